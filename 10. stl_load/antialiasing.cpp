@@ -0,0 +1,325 @@
+#include "antialiasing.h"
+#include <QOpenGLContext>
+#include <QVector2D>
+#include <QDebug>
+
+namespace {
+
+// 画面全体の三角形は頂点属性を使わないので、モデルの頂点属性(0..2)を無効にしておく
+const GLuint ModelAttributeCount = 3;
+
+}
+
+AntiAliasing::AntiAliasing(GpuResources *resources)
+{
+    m_resources = resources;
+    m_mode = Mode::Msaa4;
+    m_maxSamples = 0;
+    m_gpuBytes = 0;
+    m_sceneFramebuffer = 0;
+    m_colorBuffer = 0;
+    m_colorTexture = 0;
+    m_depthBuffer = 0;
+    m_targetMode = Mode::None;
+    m_edgesFramebuffer = 0;
+    m_edgesTexture = 0;
+    m_fxaaProgram = nullptr;
+    m_edgesProgram = nullptr;
+    m_blendProgram = nullptr;
+}
+
+AntiAliasing::~AntiAliasing()
+{
+    destroy();
+}
+
+QString AntiAliasing::name(Mode mode)
+{
+    switch (mode)
+    {
+    case Mode::None:     return QStringLiteral("None");
+    case Mode::Msaa2:    return QStringLiteral("MSAA 2x");
+    case Mode::Msaa4:    return QStringLiteral("MSAA 4x");
+    case Mode::Msaa8:    return QStringLiteral("MSAA 8x");
+    case Mode::Fxaa:     return QStringLiteral("FXAA");
+    case Mode::SmaaLite: return QStringLiteral("SMAA (lite)");
+    default:             return QString();
+    }
+}
+
+bool AntiAliasing::create()
+{
+    destroy();
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context || context->isOpenGLES())
+        return false;
+    initializeOpenGLFunctions();
+
+    m_fxaaProgram = new QOpenGLShaderProgram();
+    m_edgesProgram = new QOpenGLShaderProgram();
+    m_blendProgram = new QOpenGLShaderProgram();
+    bool linked = m_fxaaProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/screen.vert")
+            && m_fxaaProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/fxaa.frag")
+            && m_fxaaProgram->link()
+            && m_edgesProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/screen.vert")
+            && m_edgesProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/smaaedges.frag")
+            && m_edgesProgram->link()
+            && m_blendProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/screen.vert")
+            && m_blendProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/smaablend.frag")
+            && m_blendProgram->link();
+    if (!linked)
+    {
+        qWarning() << "Anti-aliasing is not available";
+        destroy();
+        return false;
+    }
+
+    // テクスチャの番号は変わらないので最初に設定する
+    m_fxaaProgram->bind();
+    m_fxaaProgram->setUniformValue("Scene", 0);
+    m_edgesProgram->bind();
+    m_edgesProgram->setUniformValue("Scene", 0);
+    m_blendProgram->bind();
+    m_blendProgram->setUniformValue("Scene", 0);
+    m_blendProgram->setUniformValue("Edges", 1);
+    m_blendProgram->release();
+
+    glGetIntegerv(GL_MAX_SAMPLES, &m_maxSamples);
+    return true;
+}
+
+void AntiAliasing::destroy()
+{
+    if (!m_fxaaProgram)
+        return;
+
+    releaseTargets();
+    delete m_fxaaProgram;
+    delete m_edgesProgram;
+    delete m_blendProgram;
+    m_fxaaProgram = nullptr;
+    m_edgesProgram = nullptr;
+    m_blendProgram = nullptr;
+}
+
+AntiAliasing::Mode AntiAliasing::mode() const
+{
+    return m_mode;
+}
+
+void AntiAliasing::setMode(Mode mode)
+{
+    // 描画先は次の begin() で作り直す
+    m_mode = mode;
+}
+
+int AntiAliasing::samples() const
+{
+    int samples = 0;
+    switch (m_mode)
+    {
+    case Mode::Msaa2: samples = 2; break;
+    case Mode::Msaa4: samples = 4; break;
+    case Mode::Msaa8: samples = 8; break;
+    default:          return 0;
+    }
+    return qMin(samples, m_maxSamples);
+}
+
+void AntiAliasing::begin(const QSize &size)
+{
+    if (!m_fxaaProgram || size.isEmpty())
+        return;
+
+    if (m_mode == Mode::None)
+    {
+        // 使っていない描画先のメモリは返す
+        if (m_sceneFramebuffer)
+            releaseTargets();
+        m_size = QSize();
+        return;
+    }
+
+    if (size != m_size || m_mode != m_targetMode)
+        resize(size);
+    if (m_sceneFramebuffer)
+        glBindFramebuffer(GL_FRAMEBUFFER, m_sceneFramebuffer);
+}
+
+void AntiAliasing::resolve(GLuint target)
+{
+    // None や描画先を作れなかった場合は target に直接描画している
+    if (!m_sceneFramebuffer)
+        return;
+
+    int width = m_size.width();
+    int height = m_size.height();
+
+    // MSAA は1サンプルにしながらコピーする(GL_MAX_SAMPLES が 0 の実装でも同じ)
+    if (m_mode != Mode::Fxaa && m_mode != Mode::SmaaLite)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_sceneFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        return;
+    }
+
+    for (GLuint location = 0; location < ModelAttributeCount; location++)
+        glDisableVertexAttribArray(location);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glViewport(0, 0, width, height);
+
+    if (m_mode == Mode::SmaaLite)
+    {
+        // 輪郭の無いところは書き込まないので 0 で消しておく
+        const GLfloat zero[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glBindFramebuffer(GL_FRAMEBUFFER, m_edgesFramebuffer);
+        glClearBufferfv(GL_COLOR, 0, zero);
+        drawScreen(m_edgesProgram, m_colorTexture);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_edgesTexture);
+        drawScreen(m_blendProgram, m_colorTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    else
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        m_fxaaProgram->bind();
+        m_fxaaProgram->setUniformValue("TexelSize", QVector2D(1.0f / width, 1.0f / height));
+        drawScreen(m_fxaaProgram, m_colorTexture);
+    }
+
+    if (blend)
+        glEnable(GL_BLEND);
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void AntiAliasing::drawScreen(QOpenGLShaderProgram *program, GLuint source)
+{
+    program->bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    program->release();
+}
+
+void AntiAliasing::resize(const QSize &size)
+{
+    releaseTargets();
+
+    // 作れなくても同じ大きさとモードでは作り直さない(直接描画する)
+    m_size = size;
+    m_targetMode = m_mode;
+
+    int width = size.width();
+    int height = size.height();
+    int samples = this->samples();
+
+    glGenFramebuffers(1, &m_sceneFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_sceneFramebuffer);
+    if (m_mode != Mode::Fxaa && m_mode != Mode::SmaaLite)
+    {
+        glGenRenderbuffers(1, &m_colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+    }
+    else
+    {
+        // 後処理では隣の画素を線形補間で読む
+        glGenTextures(1, &m_colorTexture);
+        glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTexture, 0);
+    }
+
+    // 深度は OcclusionCuller がコピーするので、ステンシルの無い形式にする
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // 色と深度は 4byte(24bit の深度も 4byte で持つ実装が多い)
+    qint64 bytes = static_cast<qint64>(width) * height * 8 * qMax(samples, 1);
+
+    if (m_mode == Mode::SmaaLite && complete)
+    {
+        glGenTextures(1, &m_edgesTexture);
+        glBindTexture(GL_TEXTURE_2D, m_edgesTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, width, height, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+        glGenFramebuffers(1, &m_edgesFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_edgesFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_edgesTexture, 0);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        bytes += static_cast<qint64>(width) * height * 2;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (!complete)
+    {
+        qWarning() << name(m_mode) << "framebuffer is incomplete. The scene is drawn without anti-aliasing";
+        releaseTargets();
+        return;
+    }
+    setGpuBytes(bytes);
+}
+
+void AntiAliasing::releaseTargets()
+{
+    if (m_edgesFramebuffer)
+        glDeleteFramebuffers(1, &m_edgesFramebuffer);
+    if (m_edgesTexture)
+        glDeleteTextures(1, &m_edgesTexture);
+    if (m_sceneFramebuffer)
+        glDeleteFramebuffers(1, &m_sceneFramebuffer);
+    if (m_colorBuffer)
+        glDeleteRenderbuffers(1, &m_colorBuffer);
+    if (m_colorTexture)
+        glDeleteTextures(1, &m_colorTexture);
+    if (m_depthBuffer)
+        glDeleteRenderbuffers(1, &m_depthBuffer);
+    m_edgesFramebuffer = 0;
+    m_edgesTexture = 0;
+    m_sceneFramebuffer = 0;
+    m_colorBuffer = 0;
+    m_colorTexture = 0;
+    m_depthBuffer = 0;
+    setGpuBytes(0);
+}
+
+qint64 AntiAliasing::gpuBytes() const
+{
+    return m_gpuBytes;
+}
+
+void AntiAliasing::setGpuBytes(qint64 bytes)
+{
+    // 描画先は大きさやモードが変わる度に作り直すので、その都度集計し直す
+    if (m_resources && m_gpuBytes > 0)
+        m_resources->remove(GpuResources::RenderTarget, m_gpuBytes);
+    if (m_resources && bytes > 0)
+        m_resources->add(GpuResources::RenderTarget, bytes);
+    m_gpuBytes = bytes;
+}
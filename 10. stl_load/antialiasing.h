@@ -0,0 +1,82 @@
+#ifndef ANTIALIASING_H
+#define ANTIALIASING_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QString>
+#include <QSize>
+#include "gpuresources.h"
+
+// シーンのアンチエイリアス
+//
+// None 以外はシーンをフレームバッファ(FBO)に描画し、resolve() で描画先に書き出す
+// - Msaa: マルチサンプルのレンダーバッファに描画し、glBlitFramebuffer で1サンプルにする
+// - Fxaa: 輝度の勾配から輪郭をぼかす後処理(1パス)
+// - SmaaLite: 輪郭を検出し(1パス)、輪郭の形(L, Z, U)からブレンドの重みを求めて隣と混ぜる(1パス)
+//   元の SMAA の面積テーブルと対角線の検出は使わず、重みはその場で計算する
+class AntiAliasing : protected QOpenGLExtraFunctions
+{
+public:
+    enum class Mode
+    {
+        None,
+        Msaa2,
+        Msaa4,
+        Msaa8,
+        Fxaa,
+        SmaaLite,
+    };
+
+    explicit AntiAliasing(GpuResources *resources = nullptr);
+    ~AntiAliasing();
+
+    static QString name(Mode mode);
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    bool create();
+    void destroy();
+
+    Mode mode() const;
+    void setMode(Mode mode);
+
+    // 実際に使うサンプル数(GL_MAX_SAMPLES で抑える)。MSAA でなければ 0
+    int samples() const;
+
+    // フレームの最初に呼ぶ。シーンの描画先を束縛する(None では何もしない)
+    void begin(const QSize &size);
+    // 描画したシーンを target(フレームバッファ)に書き出して、target を束縛する
+    void resolve(GLuint target);
+
+    qint64 gpuBytes() const;
+
+private:
+    void resize(const QSize &size);
+    void releaseTargets();
+    void setGpuBytes(qint64 bytes);
+
+    // 画面全体を覆う三角形で source を読んで描画する
+    void drawScreen(QOpenGLShaderProgram *program, GLuint source);
+
+    GpuResources *m_resources;
+    Mode m_mode;
+    int m_maxSamples;
+    qint64 m_gpuBytes;
+
+    // シーンの描画先(MSAA は色もレンダーバッファ、後処理は色をテクスチャにする)
+    GLuint m_sceneFramebuffer;
+    GLuint m_colorBuffer;
+    GLuint m_colorTexture;
+    GLuint m_depthBuffer;
+    Mode m_targetMode;      // 描画先を作った時のモード
+    QSize m_size;
+
+    // SMAA の輪郭(r: 左との輪郭, g: 下との輪郭)
+    GLuint m_edgesFramebuffer;
+    GLuint m_edgesTexture;
+
+    QOpenGLShaderProgram *m_fxaaProgram;
+    QOpenGLShaderProgram *m_edgesProgram;
+    QOpenGLShaderProgram *m_blendProgram;
+};
+
+#endif // ANTIALIASING_H
@@ -0,0 +1,116 @@
+#include "arena.h"
+#include <cstdlib>
+
+Arena::Arena(qint64 blockSize)
+{
+    m_blockSize = qMax<qint64>(blockSize, 4096);
+    m_current = -1;
+    m_offset = 0;
+    m_usedBefore = 0;
+    m_last = nullptr;
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+void *Arena::allocate(qint64 size, qint64 alignment)
+{
+    size = qMax<qint64>(size, 1);
+    m_stats.allocations++;
+
+    // 確保中のブロックに入らなければ次のブロックへ進む
+    while (true)
+    {
+        if (m_current >= 0)
+        {
+            const Block &block = m_blocks.at(m_current);
+            quintptr base = reinterpret_cast<quintptr>(block.data);
+            quintptr aligned = (base + static_cast<quintptr>(m_offset) + static_cast<quintptr>(alignment) - 1) & ~(static_cast<quintptr>(alignment) - 1);
+            qint64 offset = static_cast<qint64>(aligned - base);
+            if (offset + size <= block.size)
+            {
+                m_offset = offset + size;
+                m_stats.used = m_usedBefore + m_offset;
+                m_stats.peak = qMax(m_stats.peak, m_stats.used);
+                m_last = block.data + offset;
+                return m_last;
+            }
+            m_usedBefore += m_offset;
+        }
+
+        // reset() 後に残っているブロックが大きければ使い回す
+        if (m_current + 1 < m_blocks.size() && m_blocks.at(m_current + 1).size >= size + alignment)
+        {
+            m_current++;
+            m_offset = 0;
+            continue;
+        }
+
+        addBlock(size + alignment);
+    }
+}
+
+void *Arena::reallocate(void *ptr, qint64 oldSize, qint64 newSize, qint64 alignment)
+{
+    if (ptr && ptr == m_last)
+    {
+        // 最後の確保ならブロックの残りに収まる限りそのまま伸ばす
+        const Block &block = m_blocks.at(m_current);
+        qint64 offset = static_cast<char*>(ptr) - block.data;
+        if (offset + newSize <= block.size)
+        {
+            m_offset = offset + newSize;
+            m_stats.used = m_usedBefore + m_offset;
+            m_stats.peak = qMax(m_stats.peak, m_stats.used);
+            return ptr;
+        }
+    }
+
+    void *result = allocate(newSize, alignment);
+    if (ptr && oldSize > 0)
+        std::memcpy(result, ptr, static_cast<size_t>(qMin(oldSize, newSize)));
+    return result;
+}
+
+void Arena::reset()
+{
+    m_current = m_blocks.isEmpty() ? -1 : 0;
+    m_offset = 0;
+    m_usedBefore = 0;
+    m_last = nullptr;
+    m_stats.used = 0;
+}
+
+void Arena::release()
+{
+    for (const Block &block : m_blocks)
+        std::free(block.data);
+    m_blocks.clear();
+    m_stats.reserved = 0;
+    reset();
+}
+
+void Arena::resetStats()
+{
+    m_stats.allocations = 0;
+    m_stats.peak = m_stats.used;
+    m_stats.systemAllocations = 0;
+}
+
+void Arena::addBlock(qint64 minimumSize)
+{
+    // 大きな確保はそのサイズのブロックを作る
+    qint64 size = qMax(m_blockSize, minimumSize);
+    char *data = static_cast<char*>(std::malloc(static_cast<size_t>(size)));
+    Q_CHECK_PTR(data);
+
+    // 使い回せなかったブロックの後ろに挿入して、今のブロックの次にする
+    m_blocks.insert(m_current + 1, Block{ data, size });
+    m_current++;
+    m_offset = 0;
+
+    m_stats.reserved += size;
+    m_stats.systemAllocations++;
+}
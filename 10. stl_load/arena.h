@@ -0,0 +1,134 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// ポインタを進めるだけの確保を行うアロケータ
+// 個別の解放はせず、reset() か破棄でまとめて解放する
+// 一時的な作業領域(ローダーの中間データ、フレーム毎のリスト)用。スレッドセーフではない
+class Arena
+{
+public:
+    struct Stats
+    {
+        qint64 allocations = 0;     // allocate() の回数
+        qint64 used = 0;            // 現在使っている量(byte)
+        qint64 peak = 0;            // 最大使用量(byte)
+        qint64 reserved = 0;        // システムから確保している量(byte)
+        qint64 systemAllocations = 0; // システムからブロックを確保した回数
+    };
+
+    explicit Arena(qint64 blockSize = 1 << 20);
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(qint64 size, qint64 alignment = alignof(std::max_align_t));
+
+    // 最後に確保した領域なら、その場で大きさを変える。できなければ新しく確保してコピーする
+    void *reallocate(void *ptr, qint64 oldSize, qint64 newSize, qint64 alignment = alignof(std::max_align_t));
+
+    template <typename T>
+    T *allocateArray(qint64 count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena does not run destructors");
+        return static_cast<T*>(allocate(count * static_cast<qint64>(sizeof(T)), alignof(T)));
+    }
+
+    // 全て解放する。確保済みのブロックは次の確保で使い回す
+    void reset();
+    // ブロックもシステムに返す
+    void release();
+
+    const Stats &stats() const { return m_stats; }
+    // allocations / peak / systemAllocations の計測を今の状態から始める
+    void resetStats();
+
+private:
+    struct Block
+    {
+        char *data;
+        qint64 size;
+    };
+
+    void addBlock(qint64 minimumSize);
+
+    qint64 m_blockSize;
+    QVector<Block> m_blocks;
+    int m_current;          // 確保中のブロック
+    qint64 m_offset;        // 確保中のブロック内の位置
+    qint64 m_usedBefore;    // 確保中のブロックより前のブロックで使った量
+    void *m_last;           // 最後に確保した領域(reallocate 用)
+    Stats m_stats;
+};
+
+// Arena から確保する可変長配列
+// 要素はコピーで移動するので、トリビアルにコピーできる型だけ使える
+template <typename T>
+class ArenaVector
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ArenaVector requires trivially copyable types");
+
+public:
+    explicit ArenaVector(Arena *arena) : m_arena(arena), m_data(nullptr), m_size(0), m_capacity(0) {}
+
+    void reserve(int capacity)
+    {
+        if (capacity <= m_capacity)
+            return;
+        m_data = static_cast<T*>(m_arena->reallocate(m_data, m_capacity * static_cast<qint64>(sizeof(T)),
+                                                     capacity * static_cast<qint64>(sizeof(T)), alignof(T)));
+        m_capacity = capacity;
+    }
+
+    void resize(int size)
+    {
+        reserve(size);
+        m_size = size;
+    }
+
+    void append(const T &value)
+    {
+        if (m_size == m_capacity)
+            reserve(qMax(16, m_capacity * 2));
+        m_data[m_size++] = value;
+    }
+
+    void append(const T *values, int count)
+    {
+        reserve(m_size + count);
+        if (count > 0)
+            std::memcpy(m_data + m_size, values, static_cast<size_t>(count) * sizeof(T));
+        m_size += count;
+    }
+
+    void clear() { m_size = 0; }
+
+    Arena *arena() const { return m_arena; }
+
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    T *data() { return m_data; }
+    const T *constData() const { return m_data; }
+    T &operator[](int i) { return m_data[i]; }
+    const T &at(int i) const { return m_data[i]; }
+
+    T *begin() { return m_data; }
+    T *end() { return m_data + m_size; }
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + m_size; }
+
+private:
+    Arena *m_arena;
+    T *m_data;
+    int m_size;
+    int m_capacity;
+};
+
+#endif // ARENA_H
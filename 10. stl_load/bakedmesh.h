@@ -0,0 +1,65 @@
+#ifndef BAKEDMESH_H
+#define BAKEDMESH_H
+
+#include <QtGlobal>
+#include <QString>
+#include <cstring>
+
+// ビルド時に変換したメッシュの形式(meshbaker が書き、Model が読む)
+// ヘッダーの後に頂点(Vertex x vertexCount)と番号(quint32 x indexCount)が続く
+// 頂点は重複を除いて頂点キャッシュの順に並べてあるので、そのままGPUに転送できる
+// バイト順はビルドした環境のまま(変換と実行は同じ環境で行う)
+class BakedMesh
+{
+public:
+    // Model::VertexData と同じ並び
+    struct Vertex
+    {
+        float position[3];
+        float normal[3];
+        float texCoord[2];
+    };
+
+    struct Header
+    {
+        char magic[4];
+        quint32 version;
+        quint32 vertexStride;   // sizeof(Vertex)
+        quint32 vertexCount;
+        quint32 indexCount;
+        quint32 vertexOffset;   // ファイル先頭からの位置(byte)
+        quint32 indexOffset;
+        quint32 reserved;
+    };
+
+    static const quint32 Version = 1;
+
+    static const char *magic() { return "SLMB"; }
+
+    // 組み込みのメッシュ(":/sphere.obj")に対応するベイク済みのリソース(":/baked/sphere.obj.mesh")
+    static QString resourcePath(const QString &fileName)
+    {
+        if (!fileName.startsWith(QLatin1String(":/")))
+            return QString();
+        return QStringLiteral(":/baked/") + fileName.mid(2) + QStringLiteral(".mesh");
+    }
+
+    // data が正しい形式なら header に読み込んで true を返す
+    // リソースのデータは境界が揃っているとは限らないのでコピーして読む
+    static bool read(const uchar *data, qint64 size, Header &header)
+    {
+        if (!data || size < static_cast<qint64>(sizeof(Header)))
+            return false;
+        std::memcpy(&header, data, sizeof(Header));
+        if (std::memcmp(header.magic, magic(), 4) != 0 || header.version != Version
+                || header.vertexStride != sizeof(Vertex))
+            return false;
+
+        qint64 vertexEnd = header.vertexOffset + static_cast<qint64>(header.vertexCount) * sizeof(Vertex);
+        qint64 indexEnd = header.indexOffset + static_cast<qint64>(header.indexCount) * sizeof(quint32);
+        return header.vertexOffset >= sizeof(Header) && vertexEnd <= size && indexEnd <= size
+                && header.indexOffset >= vertexEnd && header.indexCount % 3 == 0;
+    }
+};
+
+#endif // BAKEDMESH_H
@@ -0,0 +1,135 @@
+#ifndef CHUNKREADER_H
+#define CHUNKREADER_H
+
+#include <QFile>
+#include <QByteArray>
+#include <QByteArrayMatcher>
+#include <QVector>
+#include <cstring>
+#include "loadprogress.h"
+
+// テキストファイルを行の途中で切らずに一定サイズずつ読む
+// ファイル全体をメモリに置かないので、使用量はファイルサイズに依存しない
+// 進捗は呼び出し側で進める(数える時と解析する時で2回読むため)
+class ChunkReader
+{
+public:
+    explicit ChunkReader(QFile &file, LoadProgress *progress = nullptr, int chunkSize = 4 << 20)
+        : m_file(file), m_progress(progress), m_chunkSize(chunkSize), m_size(0), m_consumed(0), m_end(false)
+    {
+        m_buffer.resize(chunkSize);
+    }
+
+    // 先頭から読み直す
+    bool rewind()
+    {
+        m_size = 0;
+        m_consumed = 0;
+        m_end = false;
+        return m_file.seek(0);
+    }
+
+    // 次の塊を [begin, end) に返す。返した範囲は次に next() を呼ぶまで有効
+    // terminator を指定すると、それを含む最後の行までで区切る(複数行にまたがる要素を切らないため)
+    // 終わりかキャンセルされたら false
+    bool next(const char *&begin, const char *&end, const char *terminator = nullptr)
+    {
+        // 前回返さなかった残りを先頭に寄せる
+        int rest = m_size - m_consumed;
+        if (rest > 0 && m_consumed > 0)
+            memmove(m_buffer.data(), m_buffer.constData() + m_consumed, static_cast<size_t>(rest));
+        m_size = rest;
+        m_consumed = 0;
+
+        while (true)
+        {
+            if (LoadProgress::canceled(m_progress))
+                return false;
+
+            if (!m_end)
+            {
+                // 区切りがバッファに収まらなければ広げる
+                if (m_size == m_buffer.size())
+                    m_buffer.resize(m_buffer.size() + m_chunkSize);
+
+                qint64 read = m_file.read(m_buffer.data() + m_size, m_buffer.size() - m_size);
+                if (read <= 0)
+                    m_end = true;
+                else
+                    m_size += static_cast<int>(read);
+            }
+
+            if (m_size == 0)
+                return false;
+
+            const char *data = m_buffer.constData();
+            const char *boundary = m_end ? data + m_size : lastBoundary(data, data + m_size, terminator);
+            if (boundary)
+            {
+                m_consumed = static_cast<int>(boundary - data);
+                begin = data;
+                end = boundary;
+                return true;
+            }
+        }
+    }
+
+    // [begin, end) を行(terminator 指定時はそれを含む行)の境界でおよそ parts 等分し、parts + 1 個の境界を返す
+    static QVector<const char*> split(const char *begin, const char *end, int parts, const char *terminator = nullptr)
+    {
+        QVector<const char*> bounds;
+        bounds.reserve(parts + 1);
+        bounds.append(begin);
+        for (int i = 1; i < parts; i++)
+        {
+            const char *pos = qMax(begin + (end - begin) * i / parts, bounds.last());
+            bounds.append(boundaryAfter(pos, end, terminator));
+        }
+        bounds.append(end);
+        return bounds;
+    }
+
+private:
+    // pos 以降で最初に見つかる区切りの直後(無ければ end)
+    static const char *boundaryAfter(const char *pos, const char *end, const char *terminator)
+    {
+        if (terminator)
+        {
+            QByteArray text = QByteArray::fromRawData(pos, static_cast<int>(end - pos));
+            int found = QByteArrayMatcher(terminator).indexIn(text);
+            if (found < 0)
+                return end;
+            pos += found;
+        }
+        const char *newline = static_cast<const char*>(memchr(pos, '\n', static_cast<size_t>(end - pos)));
+        return newline ? newline + 1 : end;
+    }
+
+    // [begin, end) の最後の区切りの直後(無ければ nullptr)
+    static const char *lastBoundary(const char *begin, const char *end, const char *terminator)
+    {
+        QByteArray text = QByteArray::fromRawData(begin, static_cast<int>(end - begin));
+        int newline = text.lastIndexOf('\n');
+        if (newline < 0)
+            return nullptr;
+        if (!terminator)
+            return begin + newline + 1;
+
+        // terminator を含む行の終わり
+        int found = text.lastIndexOf(terminator);
+        if (found < 0)
+            return nullptr;
+        int lineEnd = text.indexOf('\n', found);
+        return lineEnd < 0 ? nullptr : begin + lineEnd + 1;
+    }
+
+    QFile &m_file;
+    LoadProgress *m_progress;
+    int m_chunkSize;
+    QByteArray m_buffer;
+    int m_size;         // バッファ内の有効なバイト数
+    int m_consumed;     // 前回返した範囲
+    bool m_end;
+};
+
+#endif // CHUNKREADER_H
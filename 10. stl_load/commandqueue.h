@@ -0,0 +1,68 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <QVector>
+#include <atomic>
+
+// 複数のスレッドから push() でき、1つのスレッドがまとめて取り出す lock-free キュー
+// push() は CAS でリストの先頭に繋ぐだけなので、描画スレッドを待たせない
+template <typename T>
+class CommandQueue
+{
+public:
+    CommandQueue() : m_head(nullptr) {}
+
+    ~CommandQueue()
+    {
+        takeAll();
+    }
+
+    void push(T value)
+    {
+        Node *node = new Node{ std::move(value), m_head.load(std::memory_order_relaxed) };
+        while (!m_head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    // 投入された順に全て取り出す
+    QVector<T> takeAll()
+    {
+        Node *node = m_head.exchange(nullptr, std::memory_order_acquire);
+
+        // 後から積まれたものが先頭なので逆順にする
+        Node *reversed = nullptr;
+        while (node)
+        {
+            Node *next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+
+        QVector<T> values;
+        while (reversed)
+        {
+            Node *next = reversed->next;
+            values.append(std::move(reversed->value));
+            delete reversed;
+            reversed = next;
+        }
+        return values;
+    }
+
+    bool isEmpty() const
+    {
+        return m_head.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node
+    {
+        T value;
+        Node *next;
+    };
+
+    std::atomic<Node*> m_head;
+};
+
+#endif // COMMANDQUEUE_H
@@ -0,0 +1,6 @@
+#version 400 core
+// 色は書き込まない(深度だけ)
+
+void main(void)
+{
+}
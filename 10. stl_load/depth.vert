@@ -0,0 +1,17 @@
+#version 400 core
+// 深度だけのパス(DepthPrepass)。頂点の属性は Model::FlatFormat の位置だけが宣言される
+// 後で GL_EQUAL で比べるので、shader.vert と同じ式で gl_Position を求める
+#pragma vertex_attributes
+
+layout(std140) uniform ObjectBlock
+{
+    mat4 ModelViewMatrix;
+    mat4 MVP;
+};
+
+invariant gl_Position;
+
+void main(void)
+{
+    gl_Position = MVP * vec4(VertexPosition, 1.0f);
+}
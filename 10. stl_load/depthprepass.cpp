@@ -0,0 +1,222 @@
+#include "depthprepass.h"
+#include "model.h"
+#include <QOpenGLContext>
+#include <QDebug>
+
+namespace {
+
+// Auto で使い始める重なりと止める重なり(間を空けて切り替わり続けないようにする)
+const double EnableOverdraw = 2.0;
+const double DisableOverdraw = 1.5;
+
+}
+
+DepthPrepass::DepthPrepass()
+{
+    m_mode = Mode::Auto;
+    m_pass = Pass::None;
+    m_active = false;
+    m_enabled = false;
+    m_framesUntilProbe = 0;
+    m_overdraw = 0.0;
+    m_program = nullptr;
+    m_nextMeasure = 0;
+}
+
+DepthPrepass::~DepthPrepass()
+{
+    destroy();
+}
+
+bool DepthPrepass::create()
+{
+    destroy();
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context || context->isOpenGLES())
+        return false;
+    initializeOpenGLFunctions();
+
+    // 頂点の属性の宣言は位置だけの形式から入れる(位置の番号はどちらの形式でも同じ)
+    static_assert(Model::Format::location<VertexFormat::Position>() == Model::FlatFormat::location<VertexFormat::Position>(),
+                  "Position must have the same location in both formats");
+    m_program = new QOpenGLShaderProgram();
+    bool linked = m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, Model::FlatFormat::shaderSource(":/depth.vert"))
+            && m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/depth.frag")
+            && m_program->link();
+    if (!linked)
+    {
+        qWarning() << "Depth prepass is not available";
+        destroy();
+        return false;
+    }
+
+    GLuint block = glGetUniformBlockIndex(m_program->programId(), "ObjectBlock");
+    if (block != GL_INVALID_INDEX)
+        glUniformBlockBinding(m_program->programId(), block, Model::ObjectBlockBinding);
+
+    for (Measure &measure : m_measures)
+    {
+        glGenQueries(1, &measure.depth);
+        glGenQueries(1, &measure.shade);
+    }
+    return true;
+}
+
+void DepthPrepass::destroy()
+{
+    if (!m_program)
+        return;
+
+    for (Measure &measure : m_measures)
+    {
+        if (measure.depth)
+            glDeleteQueries(1, &measure.depth);
+        if (measure.shade)
+            glDeleteQueries(1, &measure.shade);
+        measure = Measure();
+    }
+    delete m_program;
+    m_program = nullptr;
+    m_active = false;
+}
+
+DepthPrepass::Mode DepthPrepass::mode() const
+{
+    return m_mode;
+}
+
+void DepthPrepass::setMode(Mode mode)
+{
+    m_mode = mode;
+    m_enabled = false;
+    m_framesUntilProbe = 0;
+}
+
+void DepthPrepass::beginFrame()
+{
+    if (!m_program)
+        return;
+
+    decide(resolve());
+}
+
+void DepthPrepass::decide(bool measured)
+{
+    if (m_mode == Mode::Auto && measured)
+    {
+        if (!m_enabled && m_overdraw > EnableOverdraw)
+            m_enabled = true;
+        else if (m_enabled && m_overdraw < DisableOverdraw)
+            m_enabled = false;
+    }
+
+    // 止めている間は ProbeInterval フレーム毎に1フレームだけ使って測り直す
+    bool probe = false;
+    if (m_mode == Mode::Auto && !m_enabled && --m_framesUntilProbe <= 0)
+    {
+        probe = true;
+        m_framesUntilProbe = ProbeInterval;
+    }
+    m_active = m_mode == Mode::On || (m_mode == Mode::Auto && (m_enabled || probe));
+}
+
+bool DepthPrepass::resolve()
+{
+    // 古い順に見て、結果が出ているものだけ回収する(待たない)
+    bool measured = false;
+    for (int i = 0; i < RingBuffer::Frames; i++)
+    {
+        Measure &measure = m_measures[(m_nextMeasure + i) % RingBuffer::Frames];
+        if (!measure.pending)
+            continue;
+
+        GLuint available = 0;
+        glGetQueryObjectuiv(measure.shade, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint depthSamples = 0;
+        GLuint shadeSamples = 0;
+        glGetQueryObjectuiv(measure.depth, GL_QUERY_RESULT, &depthSamples);
+        glGetQueryObjectuiv(measure.shade, GL_QUERY_RESULT, &shadeSamples);
+        measure.pending = false;
+        if (record(depthSamples, shadeSamples))
+            measured = true;
+    }
+    return measured;
+}
+
+bool DepthPrepass::record(GLuint depthSamples, GLuint shadeSamples)
+{
+    // 何も見えていなければ重なりは分からない
+    if (shadeSamples == 0)
+        return false;
+    m_overdraw = static_cast<double>(depthSamples) / shadeSamples;
+    return true;
+}
+
+bool DepthPrepass::isActive() const
+{
+    return m_active;
+}
+
+void DepthPrepass::beginDepth()
+{
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glBeginQuery(GL_SAMPLES_PASSED, m_measures[m_nextMeasure].depth);
+    m_pass = Pass::Depth;
+}
+
+void DepthPrepass::endDepth()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    m_pass = Pass::None;
+}
+
+void DepthPrepass::beginShade()
+{
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+    glBeginQuery(GL_SAMPLES_PASSED, m_measures[m_nextMeasure].shade);
+    m_pass = Pass::Shade;
+}
+
+void DepthPrepass::endShade()
+{
+    glEndQuery(GL_SAMPLES_PASSED);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    m_pass = Pass::None;
+
+    m_measures[m_nextMeasure].pending = true;
+    m_nextMeasure = (m_nextMeasure + 1) % RingBuffer::Frames;
+}
+
+DepthPrepass::Pass DepthPrepass::pass() const
+{
+    return m_pass;
+}
+
+void DepthPrepass::suspend()
+{
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+}
+
+void DepthPrepass::resume()
+{
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
+
+QOpenGLShaderProgram *DepthPrepass::program() const
+{
+    return m_program;
+}
+
+double DepthPrepass::overdraw() const
+{
+    return m_overdraw;
+}
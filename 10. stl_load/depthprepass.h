@@ -0,0 +1,95 @@
+#ifndef DEPTHPREPASS_H
+#define DEPTHPREPASS_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include "ringbuffer.h"
+
+// 不透明なものの深度だけを先に描画するパス(プリパス)
+//
+// 1. Depth: 位置だけの頂点と何も塗らないシェーダーで深度だけを書き込む
+// 2. Shade: 深度が等しい面(GL_EQUAL)だけをシェーディングする。重なった面は1回しか塗らない
+//
+// 重なり(深度テストを通ったサンプル数 / 見えたサンプル数)はオクルージョンクエリで数フレーム遅れで測る
+// Auto ではしきい値を超えたら使い始め、下回ったら止める。止めている間も時々1フレームだけ使って測り直す
+class DepthPrepass : protected QOpenGLExtraFunctions
+{
+public:
+    enum class Mode
+    {
+        Off,
+        On,
+        Auto,
+    };
+
+    // Model::draw() がどのパスで呼ばれているか
+    enum class Pass
+    {
+        None,   // プリパスを使わない通常の描画
+        Depth,
+        Shade,
+    };
+
+    // Auto で止めている時に測り直す間隔(フレーム)
+    static const int ProbeInterval = 120;
+
+    DepthPrepass();
+    ~DepthPrepass();
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    bool create();
+    void destroy();
+
+    Mode mode() const;
+    void setMode(Mode mode);
+
+    // フレームの最初に呼ぶ。終わった測定を回収して、このフレームでプリパスを使うか決める
+    void beginFrame();
+    bool isActive() const;
+
+    // 回収した測定のサンプル数から重なりを求める。何も見えていなければ求められないので false
+    // beginFrame() から呼ばれる(GLを使わないので、サンプル数を与えて切り替えを確かめる時にも使う)
+    bool record(GLuint depthSamples, GLuint shadeSamples);
+    // このフレームでプリパスを使うか決める。measured はこのフレームで新しく測れたか
+    void decide(bool measured);
+
+    void beginDepth();
+    void endDepth();
+    void beginShade();
+    void endShade();
+    Pass pass() const;
+
+    // Shade の中で深度を書き込んでいないもの(半透明)を描画する間だけ通常の深度テストに戻す
+    void suspend();
+    void resume();
+
+    // Depth で使うシェーダー(Model::FlatFormat の位置と ObjectBlock の MVP だけを使う)
+    QOpenGLShaderProgram *program() const;
+
+    // 最後に測った重なり(まだ測っていなければ 0)
+    double overdraw() const;
+
+private:
+    struct Measure
+    {
+        GLuint depth = 0;   // Depth で深度テストを通ったサンプル数
+        GLuint shade = 0;   // Shade で深度が等しかったサンプル数
+        bool pending = false;
+    };
+
+    // 新しい測定結果があれば true
+    bool resolve();
+
+    Mode m_mode;
+    Pass m_pass;
+    bool m_active;
+    bool m_enabled;         // Auto で使うと決めているか
+    int m_framesUntilProbe;
+    double m_overdraw;
+
+    QOpenGLShaderProgram *m_program;
+    Measure m_measures[RingBuffer::Frames];
+    int m_nextMeasure;
+};
+
+#endif // DEPTHPREPASS_H
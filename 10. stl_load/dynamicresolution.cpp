@@ -0,0 +1,359 @@
+#include "dynamicresolution.h"
+#include <QOpenGLContext>
+#include <QVector2D>
+#include <QDebug>
+#include <cmath>
+
+namespace {
+
+// 倍率の範囲と刻み(0.5..1 の9段階)
+const double MinScale = 0.5;
+const double ScaleStep = 1.0 / 16.0;
+const int StepCount = 8;
+
+// 目標の時間に対して残す余裕(vsync の間隔を越えないようにする)
+const double Headroom = 0.9;
+// 目標との差(割合)がこれより小さければ倍率を変えない
+const double Deadband = 0.05;
+// 時間が倍率の2乗に比例しない分を補う積分の係数(誤差は目標に対する割合、積分は倍率)と上限
+const double IntegralGain = 0.002;
+const double IntegralLimit = 0.25;
+// 刻む前の倍率が今の刻みからこれだけ(刻みの幅に対する割合)離れたら変える
+const double StepHysteresis = 0.75;
+// 倍率を変えたら、新しい解像度で測れるまでしばらく変えない
+const int MinFramesBetweenChanges = 30;
+
+// Sharpen で輪郭を強める量
+const float SharpenStrength = 0.5f;
+
+// 画面全体の三角形は頂点属性を使わないので、モデルの頂点属性(0..2)を無効にしておく
+const GLuint ModelAttributeCount = 3;
+
+}
+
+DynamicResolution::DynamicResolution(GpuResources *resources)
+{
+    m_resources = resources;
+    m_mode = Mode::Sharpen;
+    m_targetFrameTime = 1000.0 / 60.0;
+    m_integral = 0.0;
+    m_desiredScale = 1.0;
+    m_step = StepCount;
+    m_framesSinceChange = 0;
+    m_gpuTime = 0.0;
+    m_framebuffer = 0;
+    m_colorTexture = 0;
+    m_depthBuffer = 0;
+    m_gpuBytes = 0;
+    m_program = nullptr;
+    m_nextMeasure = 0;
+    m_measuring = false;
+}
+
+DynamicResolution::~DynamicResolution()
+{
+    destroy();
+}
+
+bool DynamicResolution::create()
+{
+    destroy();
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context || context->isOpenGLES())
+        return false;
+    initializeOpenGLFunctions();
+
+    m_program = new QOpenGLShaderProgram();
+    bool linked = m_program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/screen.vert")
+            && m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/upscale.frag")
+            && m_program->link();
+
+    // GPUの時間はタイムスタンプで測る(FrameProfiler の計測と入れ子にできる)
+    bool timed = linked;
+    for (Measure &measure : m_measures)
+    {
+        measure.begin = new QOpenGLTimerQuery();
+        measure.end = new QOpenGLTimerQuery();
+        timed = timed && measure.begin->create() && measure.end->create();
+    }
+    if (!timed)
+    {
+        qWarning() << "Dynamic resolution is not available";
+        destroy();
+        return false;
+    }
+
+    m_program->bind();
+    m_program->setUniformValue("Scene", 0);
+    m_program->release();
+    return true;
+}
+
+void DynamicResolution::destroy()
+{
+    if (!m_program)
+        return;
+
+    releaseTargets();
+    for (Measure &measure : m_measures)
+    {
+        delete measure.begin;
+        delete measure.end;
+        measure = Measure();
+    }
+    delete m_program;
+    m_program = nullptr;
+    m_measuring = false;
+}
+
+DynamicResolution::Mode DynamicResolution::mode() const
+{
+    return m_mode;
+}
+
+void DynamicResolution::setMode(Mode mode)
+{
+    // 止めたら元の解像度から測り直す
+    if (mode == Mode::Off)
+    {
+        m_integral = 0.0;
+        m_desiredScale = 1.0;
+        m_step = StepCount;
+    }
+    m_mode = mode;
+}
+
+double DynamicResolution::targetFrameTime() const
+{
+    return m_targetFrameTime;
+}
+
+void DynamicResolution::setTargetFrameTime(double milliseconds)
+{
+    m_targetFrameTime = milliseconds;
+}
+
+void DynamicResolution::beginFrame(const QSize &size)
+{
+    m_size = size;
+    m_renderSize = size;
+    if (!m_program || size.isEmpty())
+        return;
+
+    bool measured = resolve();
+    update(measured, m_gpuTime);
+
+    double scale = this->scale();
+    if (scale < 1.0)
+    {
+        m_renderSize = QSize(qMax(1, qRound(size.width() * scale)), qMax(1, qRound(size.height() * scale)));
+        if (m_renderSize != m_targetSize)
+            resize(m_renderSize);
+        if (!m_framebuffer)
+            m_renderSize = size;
+    }
+    else if (m_framebuffer)
+    {
+        // 使っていない描画先のメモリは返す
+        releaseTargets();
+        m_targetSize = QSize();
+    }
+
+    // GPUが遅れて前の測定が残っていれば、このフレームは測らない
+    Measure &measure = m_measures[m_nextMeasure];
+    m_measuring = !measure.pending;
+    if (m_measuring)
+    {
+        measure.begin->recordTimestamp();
+        measure.step = m_step;
+    }
+}
+
+bool DynamicResolution::resolve()
+{
+    // 古い順に見て、結果が出ているものだけ回収する(待たない)
+    bool measured = false;
+    for (int i = 0; i < RingBuffer::Frames; i++)
+    {
+        Measure &measure = m_measures[(m_nextMeasure + i) % RingBuffer::Frames];
+        if (!measure.pending)
+            continue;
+        if (!measure.end->isResultAvailable())
+            break;
+
+        GLuint64 begin = measure.begin->waitForResult();
+        GLuint64 end = measure.end->waitForResult();
+        measure.pending = false;
+
+        // 前の倍率で描画したフレームの時間は使わない
+        if (measure.step != m_step)
+            continue;
+        m_gpuTime = (end > begin ? end - begin : 0) / 1000000.0;
+        measured = true;
+    }
+    return measured;
+}
+
+void DynamicResolution::update(bool measured, double gpuTime)
+{
+    m_framesSinceChange++;
+    if (measured && m_mode != Mode::Off)
+        control(gpuTime);
+}
+
+void DynamicResolution::control(double gpuTime)
+{
+    // 誤差は目標の時間に対する余裕の割合(正なら速い)
+    double current = MinScale + m_step * ScaleStep;
+    double target = m_targetFrameTime * Headroom;
+    double error = 1.0 - gpuTime / target;
+
+    // 時間は描画する画素の数(倍率の2乗)にほぼ比例するので、目標の時間になる倍率を直接求める
+    double feedForward = gpuTime > 0.0 ? current * std::sqrt(target / gpuTime) : 1.0;
+    if (qAbs(error) < Deadband)
+    {
+        error = 0.0;
+        feedForward = current;
+    }
+
+    // 比例しない分(頂点の処理など)は積分で補う
+    // 倍率を変えてからしばらくは同じ倍率の測定が続くので積分しない(変える前に積分が振り切れないようにする)
+    // 倍率が端に着いている間も、その先へは積分しない(ワインドアップを防ぐ)
+    double output = feedForward + m_integral;
+    bool holding = m_framesSinceChange < MinFramesBetweenChanges;
+    bool saturated = (output >= 1.0 && error > 0.0) || (output <= MinScale && error < 0.0);
+    if (!holding && !saturated)
+        m_integral = qBound(-IntegralLimit, m_integral + IntegralGain * error, IntegralLimit);
+    m_desiredScale = qBound(MinScale, feedForward + m_integral, 1.0);
+
+    if (!holding && qAbs(m_desiredScale - current) > StepHysteresis * ScaleStep)
+    {
+        m_step = qBound(0, qRound((m_desiredScale - MinScale) / ScaleStep), StepCount);
+        m_framesSinceChange = 0;
+    }
+}
+
+double DynamicResolution::scale() const
+{
+    if (m_mode == Mode::Off)
+        return 1.0;
+    return MinScale + m_step * ScaleStep;
+}
+
+QSize DynamicResolution::renderSize() const
+{
+    return m_renderSize;
+}
+
+GLuint DynamicResolution::framebuffer() const
+{
+    return m_renderSize != m_size ? m_framebuffer : 0;
+}
+
+void DynamicResolution::upscale(GLuint target)
+{
+    if (framebuffer())
+    {
+        for (GLuint location = 0; location < ModelAttributeCount; location++)
+            glDisableVertexAttribArray(location);
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        glViewport(0, 0, m_size.width(), m_size.height());
+        m_program->bind();
+        m_program->setUniformValue("TexelSize", QVector2D(1.0f / m_renderSize.width(), 1.0f / m_renderSize.height()));
+        m_program->setUniformValue("Sharpness", m_mode == Mode::Sharpen ? SharpenStrength : 0.0f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_program->release();
+
+        if (blend)
+            glEnable(GL_BLEND);
+        if (depthTest)
+            glEnable(GL_DEPTH_TEST);
+    }
+
+    if (m_measuring)
+    {
+        m_measures[m_nextMeasure].end->recordTimestamp();
+        m_measures[m_nextMeasure].pending = true;
+        m_nextMeasure = (m_nextMeasure + 1) % RingBuffer::Frames;
+        m_measuring = false;
+    }
+}
+
+double DynamicResolution::gpuTime() const
+{
+    return m_gpuTime;
+}
+
+void DynamicResolution::resize(const QSize &size)
+{
+    releaseTargets();
+
+    // 作れなくても同じ大きさでは作り直さない(元の解像度で描画する)
+    m_targetSize = size;
+
+    // 拡大する時に線形補間で読む
+    glGenTextures(1, &m_colorTexture);
+    glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.width(), size.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // アンチエイリアスが None の時はここに直接描画するので深度も持つ
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.width(), size.height());
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        qWarning() << "Dynamic resolution framebuffer is incomplete. The scene is drawn at the window resolution";
+        releaseTargets();
+        return;
+    }
+    setGpuBytes(static_cast<qint64>(size.width()) * size.height() * 8);
+}
+
+void DynamicResolution::releaseTargets()
+{
+    if (m_framebuffer)
+        glDeleteFramebuffers(1, &m_framebuffer);
+    if (m_colorTexture)
+        glDeleteTextures(1, &m_colorTexture);
+    if (m_depthBuffer)
+        glDeleteRenderbuffers(1, &m_depthBuffer);
+    m_framebuffer = 0;
+    m_colorTexture = 0;
+    m_depthBuffer = 0;
+    setGpuBytes(0);
+}
+
+qint64 DynamicResolution::gpuBytes() const
+{
+    return m_gpuBytes;
+}
+
+void DynamicResolution::setGpuBytes(qint64 bytes)
+{
+    if (m_resources && m_gpuBytes > 0)
+        m_resources->remove(GpuResources::RenderTarget, m_gpuBytes);
+    if (m_resources && bytes > 0)
+        m_resources->add(GpuResources::RenderTarget, bytes);
+    m_gpuBytes = bytes;
+}
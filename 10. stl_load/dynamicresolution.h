@@ -0,0 +1,106 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTimerQuery>
+#include <QSize>
+#include "ringbuffer.h"
+#include "gpuresources.h"
+
+// GPUの時間に合わせてシーンを描画する解像度を変える
+//
+// 1. beginFrame(): 数フレーム遅れで回収したGPUの時間から倍率(0.5..1)を決める
+//    時間は倍率の2乗に比例するとして目標の時間になる倍率を求め、比例しない分を小さな積分で補う
+//    時間が目標に近ければ変えない。倍率は 1/16 刻みにし、刻みを十分に越えて、前に変えてから
+//    しばらく経った時だけ変える(描画先やオクルージョンの Hi-Z を作り直す回数を抑える)
+// 2. 倍率が1より小さければ、シーン(とアンチエイリアス)は framebuffer() に描画する
+// 3. upscale(): ウィンドウの大きさに拡大する(バイリニアか、拡大でぼけた輪郭を強める Sharpen)
+//    HUD は拡大した後にウィンドウの解像度で描画する
+class DynamicResolution : protected QOpenGLExtraFunctions
+{
+public:
+    enum class Mode
+    {
+        Off,
+        Bilinear,
+        Sharpen,
+    };
+
+    explicit DynamicResolution(GpuResources *resources = nullptr);
+    ~DynamicResolution();
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ(タイムスタンプのクエリが使えなければ false)
+    bool create();
+    void destroy();
+
+    Mode mode() const;
+    void setMode(Mode mode);
+
+    // 目標のGPU時間(ms)
+    double targetFrameTime() const;
+    void setTargetFrameTime(double milliseconds);
+
+    // フレームの最初に呼ぶ。倍率を決めて、必要なら描画先を作り直し、時間の計測を始める
+    void beginFrame(const QSize &size);
+    // 1フレーム進め、新しく測れていれば(measured)そのGPUの時間(ms)から倍率を決める
+    // beginFrame() から呼ばれる(GLを使わないので、合成した時間で制御を確かめる時にも使う)
+    void update(bool measured, double gpuTime);
+
+    double scale() const;
+    QSize renderSize() const;
+    // シーンの描画先。倍率が1なら 0(ウィンドウに直接描画する)
+    GLuint framebuffer() const;
+
+    // framebuffer() をウィンドウの大きさに拡大して target に描画し、時間の計測を終える
+    void upscale(GLuint target);
+
+    // 最後に測ったGPUの時間(ms)。まだ測っていなければ 0
+    double gpuTime() const;
+
+    qint64 gpuBytes() const;
+
+private:
+    struct Measure
+    {
+        QOpenGLTimerQuery *begin = nullptr;
+        QOpenGLTimerQuery *end = nullptr;
+        int step = 0;           // 測った時の倍率の刻み
+        bool pending = false;
+    };
+
+    // 新しい測定結果があれば true
+    bool resolve();
+    void control(double gpuTime);
+    void resize(const QSize &size);
+    void releaseTargets();
+    void setGpuBytes(qint64 bytes);
+
+    GpuResources *m_resources;
+    Mode m_mode;
+    double m_targetFrameTime;
+
+    // 倍率の制御
+    double m_integral;      // 倍率に足す補正
+    double m_desiredScale;  // 刻む前の倍率
+    int m_step;             // 今の倍率の刻み(0 が MinScale)
+    int m_framesSinceChange;
+    double m_gpuTime;
+
+    QSize m_size;           // ウィンドウの大きさ
+    QSize m_renderSize;
+
+    // 縮小したシーンの描画先
+    GLuint m_framebuffer;
+    GLuint m_colorTexture;
+    GLuint m_depthBuffer;
+    QSize m_targetSize;
+    qint64 m_gpuBytes;
+
+    QOpenGLShaderProgram *m_program;
+    Measure m_measures[RingBuffer::Frames];
+    int m_nextMeasure;
+    bool m_measuring;
+};
+
+#endif // DYNAMICRESOLUTION_H
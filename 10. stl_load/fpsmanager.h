@@ -2,7 +2,6 @@
 #define FPSMANAGER_H
 
 #include <QElapsedTimer>
-#include <QtCore/QThread>
 #include <QDebug>
 #include <QCoreApplication>
 
@@ -29,14 +28,6 @@ public:
         m_framesInSecond++;
     }
 
-    void fixedFrameRate(int fixedFps = 60)
-    {
-        // ウェイト時間
-        auto waitTime = m_framesInSecond * 1000 / fixedFps - m_fpsCountTimer.elapsed();
-        if (waitTime > 0)
-            QThread::msleep(static_cast<unsigned long>(waitTime));
-    }
-
     int getFps(){ return m_fps; }
     QElapsedTimer getFpsCountTimer() const{ return m_fpsCountTimer; }
 
@@ -0,0 +1,430 @@
+#include "frameprofiler.h"
+#include <QOpenGLContext>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QDebug>
+#include <algorithm>
+
+RollingHistogram::RollingHistogram(int capacity)
+{
+    m_samples.resize(qMax(capacity, 1));
+    m_next = 0;
+    m_count = 0;
+}
+
+void RollingHistogram::add(double value)
+{
+    m_samples[m_next] = value;
+    m_next = (m_next + 1) % m_samples.size();
+    m_count = qMin(m_count + 1, m_samples.size());
+}
+
+void RollingHistogram::clear()
+{
+    m_next = 0;
+    m_count = 0;
+}
+
+RollingHistogram::Stats RollingHistogram::stats() const
+{
+    Stats s;
+    if (m_count == 0)
+        return s;
+
+    QVector<double> sorted = samples();
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0.0;
+    for (double v : sorted)
+        sum += v;
+
+    // 最近傍順位法でパーセンタイルを求める
+    auto percentile = [&](double p){
+        int rank = static_cast<int>(p * (sorted.size() - 1) + 0.5);
+        return sorted.at(rank);
+    };
+
+    s.count = sorted.size();
+    s.mean = sum / sorted.size();
+    s.p50 = percentile(0.50);
+    s.p95 = percentile(0.95);
+    s.p99 = percentile(0.99);
+    s.max = sorted.last();
+    return s;
+}
+
+QVector<double> RollingHistogram::samples() const
+{
+    QVector<double> result;
+    result.reserve(m_count);
+    int start = (m_next - m_count + m_samples.size()) % m_samples.size();
+    for (int i = 0; i < m_count; i++)
+        result.append(m_samples.at((start + i) % m_samples.size()));
+    return result;
+}
+
+double RollingHistogram::last() const
+{
+    if (m_count == 0)
+        return 0.0;
+    return m_samples.at((m_next - 1 + m_samples.size()) % m_samples.size());
+}
+
+
+FrameProfiler::FrameProfiler(int historySize)
+    : m_frameCost(historySize)
+{
+    m_historySize = historySize;
+    m_gpuSupported = false;
+    m_droppedGpuFrames = 0;
+    m_frameCount = 0;
+    m_currentGpuFrame = nullptr;
+    m_lastFrameStart = -1;
+    m_clock.start();
+}
+
+FrameProfiler::~FrameProfiler()
+{
+    release();
+}
+
+bool FrameProfiler::initialize()
+{
+    // タイムスタンプクエリは OpenGL 3.3 か GL_ARB_timer_query が必要
+    auto context = QOpenGLContext::currentContext();
+    m_gpuSupported = context && !context->isOpenGLES()
+            && (context->format().version() >= qMakePair(3, 3)
+                || context->hasExtension("GL_ARB_timer_query"));
+
+    m_gpuFrames.clear();
+    m_gpuFrames.resize(FrameLatency);
+
+    if (!m_gpuSupported)
+        qWarning() << "GPU timer queries are not supported";
+
+    return m_gpuSupported;
+}
+
+void FrameProfiler::release()
+{
+    for (auto &frame : m_gpuFrames)
+    {
+        for (auto &query : frame.queries)
+        {
+            delete query.begin;
+            delete query.end;
+        }
+        frame.queries.clear();
+        frame.used = 0;
+        frame.pending = false;
+    }
+    m_currentGpuFrame = nullptr;
+}
+
+void FrameProfiler::beginFrame()
+{
+    m_cpuFrame.clear();
+    m_countersFrame.clear();
+
+    // 前のフレームの開始からの間隔(vsync や待ちを含む、実際のフレームの間隔)
+    qint64 now = m_clock.nsecsElapsed();
+    if (m_lastFrameStart >= 0)
+        histogram(m_cpu, QStringLiteral("frame_interval")).add((now - m_lastFrameStart) / 1000000.0);
+    m_lastFrameStart = now;
+
+    beginCpu("frame");
+
+    if (!m_gpuSupported)
+        return;
+
+    // 結果が揃ったフレームを回収する
+    resolveGpuFrames();
+
+    GpuFrame &frame = m_gpuFrames[static_cast<int>(m_frameCount % FrameLatency)];
+    if (frame.pending)
+    {
+        // 一周しても結果が返ってこない場合は待たずに捨てる
+        m_droppedGpuFrames++;
+        frame.pending = false;
+    }
+    frame.used = 0;
+    m_currentGpuFrame = &frame;
+    m_gpuOpen.clear();
+
+    beginGpu("frame");
+}
+
+void FrameProfiler::endFrame()
+{
+    GpuFrame *frame = m_currentGpuFrame;
+    if (frame)
+    {
+        endGpu("frame");
+        frame->pending = frame->used > 0;
+        m_currentGpuFrame = nullptr;
+    }
+
+    endCpu("frame");
+
+    // GPU の時間が測れないときは CPU の時間だけをフレームのコストにする
+    double cpuTime = m_cpuFrame.value(QStringLiteral("frame"));
+    if (frame && frame->pending)
+        frame->cpuTime = cpuTime;
+    else
+        m_frameCost.add(cpuTime);
+
+    // 同じ名前の区間はフレーム内で合計して1サンプルにする
+    for (auto it = m_cpuFrame.constBegin(); it != m_cpuFrame.constEnd(); ++it)
+        histogram(m_cpu, it.key()).add(it.value());
+
+    m_counters = m_countersFrame;
+    m_frameCount++;
+}
+
+void FrameProfiler::beginCpu(const QString &name)
+{
+    m_cpuOpen.insert(name, m_clock.nsecsElapsed());
+}
+
+void FrameProfiler::endCpu(const QString &name)
+{
+    auto it = m_cpuOpen.find(name);
+    if (it == m_cpuOpen.end())
+        return;
+
+    double ms = (m_clock.nsecsElapsed() - it.value()) / 1000000.0;
+    m_cpuFrame[name] += ms;
+    m_cpuOpen.erase(it);
+}
+
+void FrameProfiler::beginGpu(const QString &name)
+{
+    if (!m_currentGpuFrame)
+        return;
+
+    GpuFrame &frame = *m_currentGpuFrame;
+    if (frame.used == frame.queries.size())
+    {
+        GpuQuery query{ name, new QOpenGLTimerQuery(), new QOpenGLTimerQuery() };
+        query.begin->create();
+        query.end->create();
+        frame.queries.append(query);
+    }
+
+    GpuQuery &query = frame.queries[frame.used];
+    query.name = name;
+    query.begin->recordTimestamp();
+    m_gpuOpen.insert(name, frame.used);
+    frame.used++;
+}
+
+void FrameProfiler::endGpu(const QString &name)
+{
+    if (!m_currentGpuFrame)
+        return;
+
+    auto it = m_gpuOpen.find(name);
+    if (it == m_gpuOpen.end())
+        return;
+
+    m_currentGpuFrame->queries[it.value()].end->recordTimestamp();
+    m_gpuOpen.erase(it);
+}
+
+void FrameProfiler::removeGpu(const QString &name)
+{
+    m_gpu.remove(name);
+    m_gpuOpen.remove(name);
+
+    // 名前を空にしたクエリは回収時に読み飛ばす
+    for (auto &frame : m_gpuFrames)
+    {
+        for (int i = 0; i < frame.used; i++)
+        {
+            if (frame.queries.at(i).name == name)
+                frame.queries[i].name.clear();
+        }
+    }
+}
+
+void FrameProfiler::count(const QString &name, qint64 value)
+{
+    m_countersFrame[name] += value;
+}
+
+qint64 FrameProfiler::counter(const QString &name) const
+{
+    return m_counters.value(name, 0);
+}
+
+void FrameProfiler::resolveGpuFrames()
+{
+    // 古いフレームから順に回収する
+    for (int i = 0; i < FrameLatency; i++)
+    {
+        int index = static_cast<int>((m_frameCount + i) % FrameLatency);
+        GpuFrame &frame = m_gpuFrames[index];
+        if (frame.pending && !resolveGpuFrame(frame))
+            break;
+    }
+}
+
+bool FrameProfiler::resolveGpuFrame(GpuFrame &frame)
+{
+    // 最後のクエリが終わっていれば、それ以前のクエリも終わっている
+    if (!frame.queries.at(frame.used - 1).end->isResultAvailable()
+            || !frame.queries.at(0).end->isResultAvailable())
+        return false;
+
+    QHash<QString, double> totals;
+    for (int i = 0; i < frame.used; i++)
+    {
+        const GpuQuery &query = frame.queries.at(i);
+        if (query.name.isEmpty())
+            continue;
+        GLuint64 begin = query.begin->waitForResult();
+        GLuint64 end = query.end->waitForResult();
+        totals[query.name] += (end > begin ? end - begin : 0) / 1000000.0;
+    }
+
+    for (auto it = totals.constBegin(); it != totals.constEnd(); ++it)
+        histogram(m_gpu, it.key()).add(it.value());
+    m_frameCost.add(frame.cpuTime + totals.value(QStringLiteral("frame")));
+
+    frame.pending = false;
+    return true;
+}
+
+RollingHistogram &FrameProfiler::histogram(QMap<QString, RollingHistogram> &map, const QString &name)
+{
+    auto it = map.find(name);
+    if (it == map.end())
+        it = map.insert(name, RollingHistogram(m_historySize));
+    return it.value();
+}
+
+QStringList FrameProfiler::cpuNames() const
+{
+    return m_cpu.keys();
+}
+
+QStringList FrameProfiler::gpuNames() const
+{
+    return m_gpu.keys();
+}
+
+RollingHistogram::Stats FrameProfiler::cpuStats(const QString &name) const
+{
+    auto h = cpuHistogram(name);
+    return h ? h->stats() : RollingHistogram::Stats();
+}
+
+RollingHistogram::Stats FrameProfiler::gpuStats(const QString &name) const
+{
+    auto h = gpuHistogram(name);
+    return h ? h->stats() : RollingHistogram::Stats();
+}
+
+const RollingHistogram *FrameProfiler::cpuHistogram(const QString &name) const
+{
+    auto it = m_cpu.constFind(name);
+    return it == m_cpu.constEnd() ? nullptr : &it.value();
+}
+
+const RollingHistogram *FrameProfiler::gpuHistogram(const QString &name) const
+{
+    auto it = m_gpu.constFind(name);
+    return it == m_gpu.constEnd() ? nullptr : &it.value();
+}
+
+const RollingHistogram &FrameProfiler::frameCost() const
+{
+    return m_frameCost;
+}
+
+bool FrameProfiler::gpuTimingSupported() const
+{
+    return m_gpuSupported;
+}
+
+int FrameProfiler::droppedGpuFrames() const
+{
+    return m_droppedGpuFrames;
+}
+
+qint64 FrameProfiler::frameCount() const
+{
+    return m_frameCount;
+}
+
+QString FrameProfiler::toCsv() const
+{
+    QString csv;
+    QTextStream out(&csv);
+    out << "source,name,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+
+    auto write = [&](const QString &source, const QMap<QString, RollingHistogram> &map){
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it)
+        {
+            auto s = it.value().stats();
+            out << source << "," << it.key() << "," << s.count << ","
+                << s.mean << "," << s.p50 << "," << s.p95 << "," << s.p99 << "," << s.max << "\n";
+        }
+    };
+    write("cpu", m_cpu);
+    write("gpu", m_gpu);
+
+    return csv;
+}
+
+QByteArray FrameProfiler::toJson() const
+{
+    auto write = [](const QMap<QString, RollingHistogram> &map){
+        QJsonObject object;
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it)
+        {
+            auto s = it.value().stats();
+            QJsonObject entry;
+            entry["count"] = s.count;
+            entry["mean_ms"] = s.mean;
+            entry["p50_ms"] = s.p50;
+            entry["p95_ms"] = s.p95;
+            entry["p99_ms"] = s.p99;
+            entry["max_ms"] = s.max;
+            object[it.key()] = entry;
+        }
+        return object;
+    };
+
+    QJsonObject root;
+    root["frames"] = static_cast<double>(m_frameCount);
+    root["gpu_timing"] = m_gpuSupported;
+    root["dropped_gpu_frames"] = m_droppedGpuFrames;
+    root["cpu"] = write(m_cpu);
+    root["gpu"] = write(m_gpu);
+
+    return QJsonDocument(root).toJson();
+}
+
+bool FrameProfiler::save(const QString &filename) const
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Can't open file";
+        return false;
+    }
+
+    // 拡張子で出力形式を切り替える
+    if (QFileInfo(filename).suffix().toLower() == "json")
+        file.write(toJson());
+    else
+        file.write(toCsv().toUtf8());
+
+    file.close();
+    return true;
+}
@@ -0,0 +1,171 @@
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include <QOpenGLTimerQuery>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+// 直近 N サンプルを保持し、パーセンタイルを計算する
+class RollingHistogram
+{
+public:
+    struct Stats
+    {
+        int count = 0;
+        double mean = 0.0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    explicit RollingHistogram(int capacity = 300);
+
+    void add(double value);
+    void clear();
+    Stats stats() const;
+
+    // 古い順に並べたサンプル(グラフ表示用)
+    QVector<double> samples() const;
+    double last() const;
+
+private:
+    QVector<double> m_samples;
+    int m_next;
+    int m_count;
+};
+
+// CPUのフェーズ毎の時間と、GPUのパス・モデル毎の時間を計測する
+// GPU時間はタイムスタンプクエリをリングバッファで数フレーム遅れて回収するので、
+// 結果待ちでパイプラインを止めることはない
+class FrameProfiler
+{
+public:
+    // GPUクエリを保持するフレーム数
+    static const int FrameLatency = 4;
+
+    explicit FrameProfiler(int historySize = 300);
+    ~FrameProfiler();
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    bool initialize();
+    void release();
+
+    // beginFrame() の間隔は CPU の "frame_interval" に記録する(フレームの処理時間 "frame" とは別)
+    // 待ち時間を含まないフレームのコストは CPU と GPU の "frame" の和として frameCost() に記録する
+    void beginFrame();
+    void endFrame();
+
+    void beginCpu(const QString &name);
+    void endCpu(const QString &name);
+    void beginGpu(const QString &name);
+    void endGpu(const QString &name);
+
+    // 計測対象(モデルなど)が無くなった区間のヒストグラムを捨てる
+    // 回収待ちのフレームに残っている結果も集計しない
+    void removeGpu(const QString &name);
+
+    // ドローコール数などフレーム単位のカウンタ
+    void count(const QString &name, qint64 value = 1);
+    qint64 counter(const QString &name) const;
+
+    class CpuScope
+    {
+    public:
+        CpuScope(FrameProfiler *profiler, const QString &name) : m_profiler(profiler), m_name(name)
+        {
+            if (m_profiler) m_profiler->beginCpu(m_name);
+        }
+        ~CpuScope()
+        {
+            if (m_profiler) m_profiler->endCpu(m_name);
+        }
+    private:
+        FrameProfiler *m_profiler;
+        QString m_name;
+    };
+
+    class GpuScope
+    {
+    public:
+        GpuScope(FrameProfiler *profiler, const QString &name) : m_profiler(profiler), m_name(name)
+        {
+            if (m_profiler) m_profiler->beginGpu(m_name);
+        }
+        ~GpuScope()
+        {
+            if (m_profiler) m_profiler->endGpu(m_name);
+        }
+    private:
+        FrameProfiler *m_profiler;
+        QString m_name;
+    };
+
+    QStringList cpuNames() const;
+    QStringList gpuNames() const;
+    RollingHistogram::Stats cpuStats(const QString &name) const;
+    RollingHistogram::Stats gpuStats(const QString &name) const;
+    const RollingHistogram *cpuHistogram(const QString &name) const;
+    const RollingHistogram *gpuHistogram(const QString &name) const;
+    const RollingHistogram &frameCost() const;
+
+    bool gpuTimingSupported() const;
+    int droppedGpuFrames() const;
+    qint64 frameCount() const;
+
+    // 集計結果の出力
+    QString toCsv() const;
+    QByteArray toJson() const;
+    bool save(const QString &filename) const;
+
+private:
+    struct GpuQuery
+    {
+        QString name;
+        QOpenGLTimerQuery *begin;
+        QOpenGLTimerQuery *end;
+    };
+
+    struct GpuFrame
+    {
+        QVector<GpuQuery> queries;
+        double cpuTime = 0.0;       // 同じフレームの CPU の "frame"(ms)
+        int used = 0;
+        bool pending = false;
+    };
+
+    void resolveGpuFrames();
+    bool resolveGpuFrame(GpuFrame &frame);
+    RollingHistogram &histogram(QMap<QString, RollingHistogram> &map, const QString &name);
+
+    int m_historySize;
+    bool m_gpuSupported;
+    int m_droppedGpuFrames;
+    qint64 m_frameCount;
+
+    // CPU
+    QElapsedTimer m_clock;
+    qint64 m_lastFrameStart;    // 前の beginFrame() の時刻(ns)。まだ無ければ -1
+    QHash<QString, qint64> m_cpuOpen;
+    QHash<QString, double> m_cpuFrame;
+    QMap<QString, RollingHistogram> m_cpu;
+
+    // Counter
+    QHash<QString, qint64> m_countersFrame;
+    QHash<QString, qint64> m_counters;
+
+    // GPU
+    QVector<GpuFrame> m_gpuFrames;
+    GpuFrame *m_currentGpuFrame;
+    QHash<QString, int> m_gpuOpen;
+    QMap<QString, RollingHistogram> m_gpu;
+
+    // CPU + GPU のフレームのコスト(GPU の結果が揃ったフレームから記録する)
+    RollingHistogram m_frameCost;
+};
+
+#endif // FRAMEPROFILER_H
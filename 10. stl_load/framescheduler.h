@@ -0,0 +1,107 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// 描画要求をまとめて必要な時だけ再描画させるスケジューラ
+// GUIスレッドをスリープさせず、タイマーとvsyncでフレーム間隔を調整する
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Mode
+    {
+        OnDemand,   // シーン・カメラ・アニメーションが変化した時だけ描画
+        Continuous, // 毎フレーム描画（ベンチマーク用）
+    };
+
+    explicit FrameScheduler(QObject *parent = nullptr) : QObject(parent)
+    {
+        m_mode = Mode::OnDemand;
+        m_targetFps = 60;
+        m_animations = 0;
+        m_pending = false;
+
+        // moveToThread() で一緒に移動させる
+        m_timer.setParent(this);
+        m_timer.setSingleShot(true);
+        m_timer.setTimerType(Qt::PreciseTimer);
+        connect(&m_timer, &QTimer::timeout, this, [=](){
+            m_pending = false;
+            emit frameRequested();
+        });
+
+        m_clock.start();
+        m_lastFrame = 0;
+    }
+
+    // 再描画を要求する。次のフレームまでの要求は1回にまとめる
+    void requestUpdate()
+    {
+        if (m_pending)
+            return;
+        m_pending = true;
+
+        // 前回のフレームから目標間隔が経過するまで待つ
+        qint64 wait = 0;
+        if (m_targetFps > 0)
+        {
+            qint64 interval = 1000000000LL / m_targetFps;
+            wait = (m_lastFrame + interval - m_clock.nsecsElapsed()) / 1000000;
+        }
+        m_timer.start(static_cast<int>(qMax<qint64>(wait, 0)));
+    }
+
+    // アニメーション中は変化がなくても描画を続ける
+    void beginAnimation()
+    {
+        m_animations++;
+        requestUpdate();
+    }
+
+    void endAnimation()
+    {
+        if (m_animations > 0)
+            m_animations--;
+    }
+
+    // バッファを入れ替えた後に呼ぶ
+    void frameSwapped()
+    {
+        m_lastFrame = m_clock.nsecsElapsed();
+        if (m_mode == Mode::Continuous || m_animations > 0)
+            requestUpdate();
+    }
+
+    void setMode(Mode mode)
+    {
+        m_mode = mode;
+        requestUpdate();
+    }
+
+    // 0 を指定するとタイマーでの制限をせずvsyncのみで調整する
+    void setTargetFps(int fps)
+    {
+        m_targetFps = qMax(fps, 0);
+    }
+
+    Mode mode() const { return m_mode; }
+    int targetFps() const { return m_targetFps; }
+    bool isAnimating() const { return m_animations > 0; }
+
+signals:
+    void frameRequested();
+
+private:
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_lastFrame;
+    Mode m_mode;
+    int m_targetFps;
+    int m_animations;
+    bool m_pending;
+};
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,49 @@
+#version 400 core
+// FXAA: 周りの4画素の輝度の勾配に沿った方向に読み直して輪郭をぼかす
+// 読み直した色が周りの輝度の範囲を外れたら(輪郭を越えたら)短い方だけを使う
+
+uniform sampler2D Scene;
+uniform vec2 TexelSize;
+
+in vec2 TexCoord;
+layout(location = 0) out vec4 FragColor;
+
+const float ReduceMin = 1.0 / 128.0;
+const float ReduceMul = 1.0 / 8.0;
+const float SpanMax = 8.0;
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+void main(void)
+{
+    vec4 center = texture(Scene, TexCoord);
+    float lumaNW = luma(textureOffset(Scene, TexCoord, ivec2(-1, 1)).rgb);
+    float lumaNE = luma(textureOffset(Scene, TexCoord, ivec2(1, 1)).rgb);
+    float lumaSW = luma(textureOffset(Scene, TexCoord, ivec2(-1, -1)).rgb);
+    float lumaSE = luma(textureOffset(Scene, TexCoord, ivec2(1, -1)).rgb);
+    float lumaM = luma(center.rgb);
+
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+    // 輪郭に沿った方向(勾配と直交する方向)
+    // テクスチャ座標は y が上向き(N が +1)なので、y が下向きの元の式とは y の符号が逆になる
+    vec2 direction;
+    direction.x = -((lumaNW + lumaNE) - (lumaSW + lumaSE));
+    direction.y = (lumaNE + lumaSE) - (lumaNW + lumaSW);
+
+    float reduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25 * ReduceMul), ReduceMin);
+    float scale = 1.0 / (min(abs(direction.x), abs(direction.y)) + reduce);
+    direction = clamp(direction * scale, vec2(-SpanMax), vec2(SpanMax)) * TexelSize;
+
+    vec3 colorA = 0.5 * (texture(Scene, TexCoord + direction * (1.0 / 3.0 - 0.5)).rgb
+                       + texture(Scene, TexCoord + direction * (2.0 / 3.0 - 0.5)).rgb);
+    vec3 colorB = colorA * 0.5 + 0.25 * (texture(Scene, TexCoord - direction * 0.5).rgb
+                                       + texture(Scene, TexCoord + direction * 0.5).rgb);
+    float lumaB = luma(colorB);
+
+    FragColor = vec4((lumaB < lumaMin || lumaB > lumaMax) ? colorA : colorB, center.a);
+}
@@ -2,67 +2,127 @@
 #define GLDEBUG_H
 
 #include <QDebug>
-#include <QLabel>
 #include <QVector3D>
+#include <QSize>
+#include "perfhud.h"
 
 class GLDebug
 {
 public:
-    explicit GLDebug(QWidget *parent = nullptr)
+    struct Info
     {
-        m_fps = new QLabel("FPS: ", parent);
-        m_active = new QLabel("ActiveModel: ", parent);
-        m_translation = new QLabel("Translation: ", parent);
-        m_rotation = new QLabel("Rotation: ", parent);
-        m_scale = new QLabel("Scale: ", parent);
-        m_mouse = new QLabel("Mouse: ", parent);
-
-        m_fps->setStyleSheet("QLabel { color : white; }");
-        auto stylesheet = m_fps->styleSheet();
-        m_active->setStyleSheet(stylesheet);
-        m_translation->setStyleSheet(stylesheet);
-        m_rotation->setStyleSheet(stylesheet);
-        m_scale->setStyleSheet(stylesheet);
-        m_mouse->setStyleSheet(stylesheet);
-
-        int w = 400, h = m_fps->height();
-        int cnt = 1;
-        m_fps->setGeometry(10, h * cnt++, w, h);
-        m_active->setGeometry(10, h * cnt++, w, h);
-        m_translation->setGeometry(10, h * cnt++, w, h);
-        m_rotation->setGeometry(10, h * cnt++, w, h);
-        m_scale->setGeometry(10, h * cnt++, w, h);
-        m_mouse->setGeometry(10, h * cnt++, w, h);
+        int fps = 0;
+        double frameTime = 0.0;
+        qint64 drawCalls = 0;
+        qint64 triangles = 0;
+        qint64 culled = 0;
+        qint64 deferred = 0;            // 前のフレームの深度で隠れていて後回しにした数
+        qint64 occluded = 0;            // そのうち比べ直しでも隠れていた数(数フレーム前)
+        bool prepass = false;           // このフレームで深度だけのパスを使ったか
+        double overdraw = 0.0;          // 最後に測った重なり
+        double depthPassTime = 0.0;     // ms
+        double opaquePassTime = 0.0;    // ms
+        QString antiAliasing;           // アンチエイリアスの方法(使えなければ空)
+        double scenePassTime = 0.0;     // ms
+        double resolveTime = 0.0;       // ms
+        qint64 antiAliasingMemory = 0;  // 描画先の FBO(byte)
+        double renderScale = 1.0;       // シーンを描画した解像度の倍率
+        QSize renderSize;
+        double gpuFrameTime = 0.0;      // 解像度の制御に使ったGPUの時間(ms)
+        double targetFrameTime = 0.0;   // ms
+        qint64 gpuMemory = 0;
+        qint64 gpuBudget = 0;
+        int active = 0;
+        QVector3D translation;
+        QVector3D angle;
+        float scale = 0.0f;
+        QVector3D mouse;
+    };
+
+    // OpenGLコンテキストがカレントの状態で生成する
+    explicit GLDebug()
+    {
+        m_hud.initialize();
+        m_first = true;
+    }
+
+    // 値が変化した行だけ文字列を作り直す
+    void update(const Info &info, const QVector<double> &frameTimes)
+    {
+        if (m_first || info.fps != m_info.fps || qAbs(info.frameTime - m_info.frameTime) >= 0.01)
+            m_hud.setText(0, QString("FPS %1 (%2 ms)").arg(info.fps).arg(info.frameTime, 0, 'f', 2));
+
+        if (m_first || info.drawCalls != m_info.drawCalls || info.triangles != m_info.triangles || info.culled != m_info.culled
+                || info.deferred != m_info.deferred || info.occluded != m_info.occluded)
+            m_hud.setText(1, QString("Draw calls %1, Triangles %2, Culled %3, Deferred %4, Occluded %5")
+                                .arg(info.drawCalls).arg(info.triangles).arg(info.culled).arg(info.deferred).arg(info.occluded));
+
+        if (m_first || info.gpuMemory != m_info.gpuMemory || info.gpuBudget != m_info.gpuBudget)
+            m_hud.setText(2, QString("GPU memory %1 / %2 MB").arg(info.gpuMemory / (1024.0 * 1024.0), 0, 'f', 2)
+                                .arg(info.gpuBudget / (1024.0 * 1024.0), 0, 'f', 0));
+
+        if (m_first || info.active != m_info.active)
+            m_hud.setText(3, QString("ActiveModel: %1").arg(info.active));
+
+        if (m_first || info.translation != m_info.translation)
+            m_hud.setText(4, QString("Translation X:%1, Y:%2, Z:%3")
+                                .arg(static_cast<double>(info.translation.x()))
+                                .arg(static_cast<double>(info.translation.y()))
+                                .arg(static_cast<double>(info.translation.z())));
+
+        if (m_first || info.angle != m_info.angle)
+            m_hud.setText(5, QString("Rotation X:%1, Y:%2, Z:%3")
+                                .arg(static_cast<double>(info.angle.x()))
+                                .arg(static_cast<double>(info.angle.y()))
+                                .arg(static_cast<double>(info.angle.z())));
+
+        if (m_first || !qFuzzyCompare(info.scale, m_info.scale))
+        {
+            float dscale = (info.scale == 0.0f) ? 0.0f : info.scale * 100.0f;
+            m_hud.setText(6, QString("Scale %1%").arg(static_cast<double>(dscale)));
+        }
+
+        if (m_first || info.mouse != m_info.mouse)
+            m_hud.setText(7, QString("Camera X:%1, Y:%2, Z:%3")
+                                .arg(static_cast<double>(info.mouse.x()))
+                                .arg(static_cast<double>(info.mouse.y()))
+                                .arg(static_cast<double>(info.mouse.z())));
+
+        if (m_first || info.prepass != m_info.prepass || qAbs(info.overdraw - m_info.overdraw) >= 0.01
+                || qAbs(info.depthPassTime - m_info.depthPassTime) >= 0.01 || qAbs(info.opaquePassTime - m_info.opaquePassTime) >= 0.01)
+            m_hud.setText(8, QString("Prepass %1, Overdraw %2, Depth %3 ms, Opaque %4 ms")
+                                .arg(info.prepass ? "on" : "off").arg(info.overdraw, 0, 'f', 2)
+                                .arg(info.depthPassTime, 0, 'f', 2).arg(info.opaquePassTime, 0, 'f', 2));
+
+        if (m_first || info.antiAliasing != m_info.antiAliasing || qAbs(info.scenePassTime - m_info.scenePassTime) >= 0.01
+                || qAbs(info.resolveTime - m_info.resolveTime) >= 0.01 || info.antiAliasingMemory != m_info.antiAliasingMemory)
+            m_hud.setText(9, QString("AA %1: Scene %2 ms, Resolve %3 ms, %4 MB")
+                                .arg(info.antiAliasing.isEmpty() ? QString("n/a") : info.antiAliasing)
+                                .arg(info.scenePassTime, 0, 'f', 2).arg(info.resolveTime, 0, 'f', 2)
+                                .arg(info.antiAliasingMemory / (1024.0 * 1024.0), 0, 'f', 1));
+
+        if (m_first || !qFuzzyCompare(info.renderScale, m_info.renderScale) || info.renderSize != m_info.renderSize
+                || qAbs(info.gpuFrameTime - m_info.gpuFrameTime) >= 0.01 || qAbs(info.targetFrameTime - m_info.targetFrameTime) >= 0.01)
+            m_hud.setText(10, QString("Resolution %1% (%2x%3), GPU %4 / %5 ms")
+                                .arg(info.renderScale * 100.0, 0, 'f', 1)
+                                .arg(info.renderSize.width()).arg(info.renderSize.height())
+                                .arg(info.gpuFrameTime, 0, 'f', 2).arg(info.targetFrameTime, 0, 'f', 2));
+
+        m_hud.setGraph(frameTimes, 1000.0 / 60.0);
+
+        m_info = info;
+        m_first = false;
     }
 
-    void update(const double fps, const int active, const QVector3D translation, const QVector3D angle, const float scale, const QVector3D mouse)
+    void draw(int width, int height)
     {
-        float dscale = (scale == 0.0f) ? 0.0f : scale * 100.0f;
-
-        m_fps->setText(QString("FPS %1").arg(fps));
-        m_active->setText(QString("ActiveModel: %1").arg(active));
-        m_translation->setText(QString("Translation X:%1, Y:%2, Z:%3")
-                                    .arg(static_cast<double>(translation.x()))
-                                    .arg(static_cast<double>(translation.y()))
-                                    .arg(static_cast<double>(translation.z())));
-        m_rotation->setText(QString("Rotation X:%1, Y:%2, Z:%3")
-                                 .arg(static_cast<double>(angle.x()))
-                                 .arg(static_cast<double>(angle.y()))
-                                 .arg(static_cast<double>(angle.z())));
-        m_scale->setText(QString("Scale %1%").arg(static_cast<double>(dscale)));
-        m_mouse->setText(QString("Camera X:%1, Y:%2, Z:%3")
-                              .arg(static_cast<double>(mouse.x()))
-                              .arg(static_cast<double>(mouse.y()))
-                              .arg(static_cast<double>(mouse.z())));
+        m_hud.draw(width, height);
     }
 
 private:
-    QLabel* m_fps;
-    QLabel* m_active;
-    QLabel* m_translation;
-    QLabel* m_rotation;
-    QLabel* m_scale;
-    QLabel* m_mouse;
+    PerfHud m_hud;
+    Info m_info;
+    bool m_first;
 };
 
 #endif // GLDEBUG_H
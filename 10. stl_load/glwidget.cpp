@@ -1,74 +1,44 @@
 ﻿#include "glwidget.h"
 #include <QFileDialog>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QActionGroup>
+#include <memory>
 
-GLWidget::GLWidget(QWidget *parent) : QOpenGLWidget(parent)
+GLWidget::GLWidget(QWidget *parent) : QWidget(parent)
 {
     QSurfaceFormat format;
     format.setVersion(4,0);
     format.setDepthBufferSize(24);
-    format.setSamples(4);
+    format.setSamples(0);           // マルチサンプルは Renderer の FBO で行う(View > Anti-aliasing)
+    format.setSwapInterval(1);      // vsyncでフレーム間隔を調整
     QSurfaceFormat::setDefaultFormat(format);
 
     // eventFilterをGLWidgetに反映させる
     parent->installEventFilter(this);
 
-    m_transform.append(Transform());
-}
-
-
-void GLWidget::initializeGL()
-{
-
-    initializeOpenGLFunctions();
-
-    // enabled
-    glEnable(GL_DEPTH_TEST);        // Zバッファ
-    glEnable(GL_CULL_FACE);         // カリング
-    glEnable(GL_LINE_SMOOTH);       // アンチエイリアス(線)
-    glEnable(GL_POLYGON_SMOOTH );   // アンチエイリアス(ポリゴン)
-    glEnable(GL_BLEND);             // ブレンディング
-    glEnable(GL_MULTISAMPLE);       // マルチサンプリング
+    // 描画先のウィンドウ。描画は RenderThread が別スレッドで行う
+    m_window = new QWindow();
+    m_window->setSurfaceType(QWindow::OpenGLSurface);
+    m_window->setFormat(format);
+    m_window->create();
 
-    // background color
-    QColor c(60, 60, 60);
-    glClearColor(c.red() / 255.0f, c.green() / 255.0f, c.blue() / 255.0f, 1.0f);
+    m_render = new RenderThread(m_window, this);
+    m_window->installEventFilter(this);
 
-    // init gridline
-    m_gridline = new GridLine();
-    m_gridline->bind(":/gridline.vert", ":/gridline.frag");
-
-    // Camera
-    m_cameraAngle = QVector2D(20.0, -20.0);
-    m_cameraDistance = 2.5f;
-
-    // Model Initialize
-    m_model.clear();
-    m_model.append(new Model());
-    m_model.last()->load("C:/Users/nishioka_takuya/Desktop/untitled.stl");
-    m_model.last()->bind(":/shader.vert", ":/shader.frag");
-
-    m_model.append(new Model());
-    m_model.last()->load(":/sphere.obj");
-    m_model.last()->bind(":/shader.vert", ":/shader.frag");
-    //m_model.last()->setEnabled(false);
-    m_model.last()->setTranslation(QVector3D(0,0,-2.2f));
-    m_model[m_model.size() - 2]->addChild(m_model.last());
+    // Renderer::initialize() で作るモデルの変換
+    m_transform.append(Transform());
     m_transform.append(Transform());
     m_transform.last().translation = QVector3D(0,0,-2.2f);
-
-    m_model.append(new Model());
-    m_model.last()->load(":/cube.obj");
-    m_model.last()->bind(":/shader.vert", ":/shader.frag");
-    m_model.last()->setTranslation(QVector3D(0,0,-2.5));
-    m_model.last()->setRotation(QQuaternion::fromEulerAngles(QVector3D(0,0,0)));
-    m_model[m_model.size() - 2]->addChild(m_model.last());
     m_transform.append(Transform());
     m_transform.last().translation = QVector3D(0,0,-2.5);
 
+    // Camera
+    m_cameraAngle = QVector2D(20.0, -20.0);
+    m_cameraDistance = 2.5f;
 
     // GLWidget MenuBar
     auto menuBar = new QMenuBar(this);
-    menuBar->setFixedWidth(10000);
 
     auto file = new QMenu("File");
     menuBar->addMenu(file);
@@ -77,126 +47,197 @@ void GLWidget::initializeGL()
     file->addAction(open);
     connect(open, &QAction::triggered, this,
             [=](){
-        auto filename = QFileDialog::getOpenFileName(this, "hoge", "", "Wavefront OBJ(*.obj);;All Files(*.*)");
+        auto filenames = QFileDialog::getOpenFileNames(this, "Open", "", "3D Models(*.obj *.stl);;Wavefront OBJ(*.obj);;STL(*.stl);;All Files(*.*)");
+        openModels(filenames);
+    });
 
-        m_model.append(new Model());
-        m_model.last()->load(filename);
-        m_model.last()->bind(":/shader.vert", ":/shader.frag");
-        m_transform.append(Transform());
+    auto cancelLoading = new QAction("Cancel Loading");
+    file->addAction(cancelLoading);
+    connect(cancelLoading, &QAction::triggered, this,
+            [=](){
+        m_loader->cancelAll();
+    });
 
-        m_activeModelIndex = m_model.size()-1;
+    auto exportProfile = new QAction("Export Profile...");
+    file->addAction(exportProfile);
+    connect(exportProfile, &QAction::triggered, this,
+            [=](){
+        auto filename = QFileDialog::getSaveFileName(this, "Export Profile", "profile.csv", "CSV(*.csv);;JSON(*.json)");
+        if (!filename.isEmpty())
+            m_render->post([filename](Renderer &renderer){ renderer.profiler()->save(filename); });
     });
 
     auto exit = new QAction("Exit");
     file->addAction(exit);
     connect(exit, &QAction::triggered, this, &QApplication::exit);
 
+    auto view = new QMenu("View");
+    menuBar->addMenu(view);
+
+    // ベンチマーク用に常時描画へ切り替える
+    auto continuous = new QAction("Continuous Rendering");
+    continuous->setCheckable(true);
+    view->addAction(continuous);
+    connect(continuous, &QAction::toggled, this,
+            [=](bool checked){
+        m_render->setMode(checked ? FrameScheduler::Mode::Continuous : FrameScheduler::Mode::OnDemand);
+    });
+
+    // 深度だけを先に描画するパス(Auto は重なりを測って切り替える)
+    auto prepass = view->addMenu("Depth Prepass");
+    auto prepassModes = new QActionGroup(prepass);
+    const QPair<QString, DepthPrepass::Mode> modes[] = {
+        { "Off", DepthPrepass::Mode::Off },
+        { "On", DepthPrepass::Mode::On },
+        { "Auto", DepthPrepass::Mode::Auto },
+    };
+    for (const auto &mode : modes)
+    {
+        auto action = prepassModes->addAction(mode.first);
+        action->setCheckable(true);
+        action->setChecked(mode.second == DepthPrepass::Mode::Auto);
+        prepass->addAction(action);
+        DepthPrepass::Mode value = mode.second;
+        connect(action, &QAction::triggered, this,
+                [=](){
+            m_render->post([value](Renderer &renderer){ renderer.setDepthPrepassMode(value); });
+        });
+    }
+
+    // アンチエイリアスの方法(弱いGPUでは軽いものに切り替える。コストは HUD に表示する)
+    auto antiAliasing = view->addMenu("Anti-aliasing");
+    auto antiAliasingModes = new QActionGroup(antiAliasing);
+    const AntiAliasing::Mode aaModes[] = {
+        AntiAliasing::Mode::None,
+        AntiAliasing::Mode::Msaa2,
+        AntiAliasing::Mode::Msaa4,
+        AntiAliasing::Mode::Msaa8,
+        AntiAliasing::Mode::Fxaa,
+        AntiAliasing::Mode::SmaaLite,
+    };
+    for (AntiAliasing::Mode mode : aaModes)
+    {
+        auto action = antiAliasingModes->addAction(AntiAliasing::name(mode));
+        action->setCheckable(true);
+        action->setChecked(mode == AntiAliasing::Mode::Msaa4);
+        antiAliasing->addAction(action);
+        connect(action, &QAction::triggered, this,
+                [=](){
+            m_render->post([mode](Renderer &renderer){ renderer.setAntiAliasingMode(mode); });
+        });
+    }
+
+    // GPUの時間が 60fps に収まらなければシーンの解像度を下げる(拡大の方法を選ぶ)
+    auto dynamicResolution = view->addMenu("Dynamic Resolution");
+    auto dynamicResolutionModes = new QActionGroup(dynamicResolution);
+    const QPair<QString, DynamicResolution::Mode> resolutionModes[] = {
+        { "Off", DynamicResolution::Mode::Off },
+        { "Bilinear", DynamicResolution::Mode::Bilinear },
+        { "Sharpen", DynamicResolution::Mode::Sharpen },
+    };
+    for (const auto &mode : resolutionModes)
+    {
+        auto action = dynamicResolutionModes->addAction(mode.first);
+        action->setCheckable(true);
+        action->setChecked(mode.second == DynamicResolution::Mode::Sharpen);
+        dynamicResolution->addAction(action);
+        DynamicResolution::Mode value = mode.second;
+        connect(action, &QAction::triggered, this,
+                [=](){
+            m_render->post([value](Renderer &renderer){ renderer.setDynamicResolutionMode(value); });
+        });
+    }
+
     m_button = new QPushButton("Add Sphere" ,this);
-    m_button->setFixedWidth(m_button->width() + 20);
-    m_button->move(this->width() - m_button->width(), 30);
+    m_button->setFixedWidth(m_button->sizeHint().width() + 20);
     connect(m_button, &QPushButton::clicked, this,
             [=](){
         // 乱数のシード
         qsrand( static_cast<uint>(QTime::currentTime().msec()) );
 
-        m_sphere.append(new Model());
-        m_sphere.last()->load(":/sphere.obj");
-        m_sphere.last()->bind(":/shader.vert", ":/shader.frag");
-        m_sphere.last()->setTranslation(QVector3D(qrand() % 20 - 10, qrand() % 20 - 10, qrand() % 20 - 10));
-        m_sphere.last()->setOpacity(0.3f);
-        m_button->setText(QString("Add Sphere %1").arg(m_sphere.size()));
+        QVector3D translation(qrand() % 20 - 10, qrand() % 20 - 10, qrand() % 20 - 10);
+        m_render->post([translation](Renderer &renderer){ renderer.addSphere(translation); });
+        m_sphereCount++;
+        m_button->setText(QString("Add Sphere %1").arg(m_sphereCount));
     });
 
-    // FPS
-    m_fps = new FpsManager();
-
-    // デバッグビルド時のみデバッグ情報の初期化をする
-#ifdef QT_DEBUG
-    m_gldebug = new GLDebug(this);
+    // 非同期読み込み
+    m_loadProgress = new QProgressBar(this);
+    m_loadProgress->setRange(0, 1000);
+    m_loadProgress->setFixedWidth(240);
+    m_loadProgress->hide();
+
+    m_loader = new ModelLoader(this);
+    m_loader->setMaxConcurrentLoads(qMax(JobSystem::instance().threadCount() / 2, 1));
+    connect(m_loader, &ModelLoader::progressChanged, this,
+            [=](int pending, double progress){
+        m_loadProgress->setVisible(pending > 0);
+        m_loadProgress->setFormat(QString("Loading %1 file(s) %p%").arg(pending));
+        m_loadProgress->setValue(static_cast<int>(progress * 1000));
+    });
+    connect(m_loader, &ModelLoader::loaded, this,
+            [=](ModelLoader::Ticket, Model *model, const QString &){
+        addLoadedModel(model);
+    });
+    connect(m_loader, &ModelLoader::failed, this,
+            [=](ModelLoader::Ticket, Model *model, const QString &filename, bool canceled){
+        if (!canceled)
+            qWarning() << "Failed to load" << filename;
+        delete model;   // bind() 前なのでOpenGLのリソースは無い
+    });
 
-    // OpenGL Info
-    qDebug() << "OpenGL Ver. : " << reinterpret_cast<const char*>(glGetString(GL_VERSION));
-    qDebug() << "Shader Ver. : " << reinterpret_cast<const char*>(glGetString(GL_SHADING_LANGUAGE_VERSION));
-    qDebug() << "Vendor      : " << reinterpret_cast<const char*>(glGetString(GL_VENDOR));
-    qDebug() << "GPU         : " << reinterpret_cast<const char*>(glGetString(GL_RENDERER));
-#endif
+    // レイアウト(ネイティブウィンドウの上にはウィジェットを重ねられない)
+    auto status = new QHBoxLayout();
+    status->addWidget(m_loadProgress);
+    status->addStretch();
+    status->addWidget(m_button);
+
+    auto layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->setSpacing(0);
+    layout->setMenuBar(menuBar);
+    layout->addWidget(QWidget::createWindowContainer(m_window, this), 1);
+    layout->addLayout(status);
+
+    publish();
+    m_render->start();
 }
 
-
-void GLWidget::paintGL()
+GLWidget::~GLWidget()
 {
-    updateGL();
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // Draw Gridline
-    //m_gridline->draw(m_projectionMatrix, m_viewMatrix);
-
-
-    // Draw Model
-    m_model.first()->draw(m_projectionMatrix, m_viewMatrix);
-
-
-    for (int i = 0; i < m_sphere.size(); i++) {
-        m_sphere.at(i)->draw(m_projectionMatrix, m_viewMatrix);
-    }
+    // 読み込み中のモデルは破棄し、描画スレッドを止めてからウィンドウを破棄する
+    m_loader->cancelAll();
+    m_render->stop();
 }
 
-
-void GLWidget::resizeGL(int w, int h)
+void GLWidget::publish()
 {
-    float aspect = float(w) / float(h ? h : 1);
-    const float zNear = 0.1f, zFar = 10000, fov = 60.0;
+    Renderer::Scene scene;
+    scene.transforms = m_transform;
+    scene.active = m_activeModelIndex;
+    scene.cameraAngle = m_cameraAngle;
+    scene.cameraDistance = m_cameraDistance;
+    scene.size = m_window->size() * m_window->devicePixelRatio();
+    m_render->publish(scene);
+}
 
-    m_projectionMatrix.setToIdentity();
-    m_projectionMatrix.perspective(fov, aspect, zNear, zFar);
-    glViewport(0, 0, w, h);
+void GLWidget::openModels(const QStringList &filenames)
+{
+    // Model の生成と読み込みはOpenGLを使わないので、どのスレッドでもよい
+    for (const auto &filename : filenames)
+        m_loader->load(filename, new Model());
 }
 
-void GLWidget::updateGL()
+void GLWidget::addLoadedModel(Model *model)
 {
-    // FPS制御
-    m_fps->frameRateCalculator();
-    m_fps->fixedFrameRate(60);
-
-    //　ビューの更新処理
-    QMatrix4x4 camera;  // カメラを原点に沿って回転させる
-    camera.rotate(m_cameraAngle.x(), QVector3D(0.0f, 1.0f, 0.0f));
-    camera.rotate(m_cameraAngle.y(), QVector3D(1.0f, 0.0f, 0.0f));
-
-    auto eye = camera * QVector3D(0.0f, 0.0f, m_cameraDistance);  // 仮想3Dカメラが配置されているポイント
-    auto center = camera * QVector3D(0.0f, 0.0f, 0.0f);           // カメラが注視するポイント（シーンの中心）
-    auto up = camera * QVector3D(0.0f, 1.0f, 0.0f);               // 3Dワールドの上方向を定義
-
-    m_viewMatrix.setToIdentity();
-    m_viewMatrix.lookAt(eye, center, up);
-
-    m_gridline->update();
-    m_model.first()->update();
-
-    // モデルの更新処理
-    float pitch = m_transform[m_activeModelIndex].angle.x();
-    float yaw = m_transform[m_activeModelIndex].angle.y();
-    float roll = m_transform[m_activeModelIndex].angle.z();
-    m_model[m_activeModelIndex]->setRotation(QQuaternion::fromEulerAngles(pitch, yaw, roll));
-    m_model[m_activeModelIndex]->setTranslation(m_transform[m_activeModelIndex].translation);
-    m_model[m_activeModelIndex]->setScale(m_transform[m_activeModelIndex].scale);
-
-
-#ifdef QT_DEBUG
-    m_gldebug->update(
-                m_fps->getFps(),
-                m_activeModelIndex,
-                m_transform.at(m_activeModelIndex).translation,
-                m_transform.at(m_activeModelIndex).angle,
-                m_transform.at(m_activeModelIndex).scale,
-                QVector3D(m_cameraAngle, m_cameraDistance));
-#endif
-
-    this->update();
+    // 頂点データの転送は描画スレッドで行う
+    // 描画スレッドが受け取る前に終了した場合はコマンドと一緒に破棄される
+    auto owner = std::make_shared<std::unique_ptr<Model>>(model);
+    m_render->post([owner](Renderer &renderer){ renderer.addModel(owner->release()); });
+    m_transform.append(Transform());
+
+    m_activeModelIndex = m_transform.size()-1;
+    publish();
 }
 
 void GLWidget::mousePressEvent(QMouseEvent *event)
@@ -228,6 +269,8 @@ void GLWidget::mouseMoveEvent(QMouseEvent *event)
 
         if (m_cameraAngle.y() > 90)
             m_cameraAngle.setY(90);
+
+        publish();
     }
     m_mousePosition = event->pos();
 
@@ -247,13 +290,37 @@ void GLWidget::wheelEvent(QWheelEvent *event)
         {
             m_cameraDistance *= 0.9f;
         }
+        publish();
     }
     event->accept();
 }
 
 bool GLWidget::eventFilter(QObject *obj, QEvent *event)
 {
-    (void) obj; // 未使用引数の警告をださない
+    // 描画ウィンドウのイベント
+    if (obj == m_window)
+    {
+        switch(event->type()){
+        case QEvent::Expose:
+            m_render->setExposed(m_window->isExposed());
+            publish();
+            break;
+        case QEvent::Resize:
+            publish();
+            break;
+        case QEvent::MouseButtonPress:
+            mousePressEvent(static_cast<QMouseEvent*>(event));
+            return true;
+        case QEvent::MouseMove:
+            mouseMoveEvent(static_cast<QMouseEvent*>(event));
+            return true;
+        case QEvent::Wheel:
+            wheelEvent(static_cast<QWheelEvent*>(event));
+            return true;
+        default:
+            break;
+        }
+    }
 
     const float delta = 5.0f;  // 回転量
     const float acc = 0.1f; // 移動量
@@ -267,7 +334,7 @@ bool GLWidget::eventFilter(QObject *obj, QEvent *event)
     case QEvent::KeyPress:
         if (static_cast<QKeyEvent*>(event)->key() == Qt::Key_Tab)
         {
-            if (m_activeModelIndex >= m_model.size() - 1)
+            if (m_activeModelIndex >= m_transform.size() - 1)
             {
                 m_activeModelIndex = 0;
             }
@@ -350,6 +417,8 @@ bool GLWidget::eventFilter(QObject *obj, QEvent *event)
             scale += 0.1f;
         }
         m_transform[m_activeModelIndex].scale = scale;
+
+        publish();
         break;
 
     default:
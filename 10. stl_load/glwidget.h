@@ -1,37 +1,29 @@
 ﻿#ifndef GLWIDGET_H
 #define GLWIDGET_H
 
-#include <QOpenGLWidget>
-#include <QOpenGLFunctions>
-#include <QOpenGLShader>
-#include <QOpenGLBuffer>
-#include <QOpenGLVertexArrayObject>
-#include <QMatrix4x4>
+#include <QWidget>
+#include <QWindow>
 #include <QVector3D>
 #include <QMouseEvent>
 #include <QtMath>
-#include <QLabel>
 #include <QMenuBar>
 #include <QApplication>
 #include <QPushButton>
+#include <QProgressBar>
 #include <QtGlobal>
 #include <QTime>
 #include "model.h"
-#include "gridline.h"
-#include "fpsmanager.h"
-#include "gldebug.h"
+#include "renderer.h"
+#include "renderthread.h"
+#include "modelloader.h"
 
-class GLWidget : public QOpenGLWidget, protected QOpenGLFunctions
+// 入力とUIを扱うウィジェット。描画は RenderThread が専用のスレッドで行う
+class GLWidget : public QWidget
 {
     Q_OBJECT
 public:
     explicit GLWidget(QWidget *parent = nullptr);
-
-protected:
-    void initializeGL() override;
-    void paintGL() override;
-    void resizeGL(int w, int h) override;
-    void updateGL();
+    ~GLWidget() override;
 
 protected:
     void mousePressEvent(QMouseEvent *event) override;
@@ -40,15 +32,13 @@ protected:
     bool eventFilter(QObject *obj, QEvent *event) override;
 
 private:
-    struct Transform
-    {
-        QVector3D angle;
-        QVector3D translation;
-        float scale = 1;
-    };
+    typedef Renderer::Transform Transform;
+
+    // 現在の状態を描画スレッドへ渡す
+    void publish();
 
-    QMatrix4x4 m_projectionMatrix;
-    QMatrix4x4 m_viewMatrix;
+    void openModels(const QStringList &filenames);
+    void addLoadedModel(Model *model);
 
     /* Camera */
     QVector2D m_cameraAngle;
@@ -56,19 +46,19 @@ private:
 
     QPoint m_mousePosition;
 
-    GridLine* m_gridline;
-    QVector<Model*> m_model;
-    QVector<Model*> m_sphere;
     int m_activeModelIndex = 0;
+    int m_sphereCount = 0;
 
     QVector<Transform> m_transform;
 
-    FpsManager* m_fps;
-
-    // Debug
-    GLDebug* m_gldebug;
+    QWindow* m_window = nullptr;
+    RenderThread* m_render = nullptr;
 
     QPushButton* m_button;
+
+    // 非同期読み込み
+    ModelLoader* m_loader;
+    QProgressBar* m_loadProgress;
 };
 
 #endif // GLWIDGET_H
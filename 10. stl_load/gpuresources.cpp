@@ -0,0 +1,183 @@
+#include "gpuresources.h"
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QVector>
+#include <QDebug>
+#include <algorithm>
+
+qint64 GpuResources::s_defaultBudget = qint64(1024) << 20;
+
+GpuResources::GpuResources()
+{
+    for (int i = 0; i < CategoryCount; i++)
+    {
+        m_usage[i] = 0;
+        m_count[i] = 0;
+    }
+    m_budget = s_defaultBudget;
+    m_frame = 0;
+    m_evicted = 0;
+    m_overBudgetWarned = false;
+}
+
+GpuResources::~GpuResources()
+{
+    if (!m_pending.isEmpty())
+        qWarning() << "GpuResources destroyed with" << m_pending.size() << "pending deletions";
+}
+
+QString GpuResources::categoryName(Category category)
+{
+    switch (category)
+    {
+    case VertexBuffer:  return QStringLiteral("vertex_buffer");
+    case IndexBuffer:   return QStringLiteral("index_buffer");
+    case UniformBuffer: return QStringLiteral("uniform_buffer");
+    case ShaderProgram: return QStringLiteral("shader_program");
+    case RenderTarget:  return QStringLiteral("render_target");
+    case IndirectBuffer: return QStringLiteral("indirect_buffer");
+    case StorageBuffer: return QStringLiteral("storage_buffer");
+    case StagingBuffer: return QStringLiteral("staging_buffer");
+    default:            return QString();
+    }
+}
+
+void GpuResources::add(Category category, qint64 bytes)
+{
+    m_usage[category] += bytes;
+    m_count[category]++;
+}
+
+void GpuResources::remove(Category category, qint64 bytes)
+{
+    m_usage[category] -= bytes;
+    m_count[category]--;
+}
+
+qint64 GpuResources::usage(Category category) const
+{
+    return m_usage[category];
+}
+
+int GpuResources::count(Category category) const
+{
+    return m_count[category];
+}
+
+qint64 GpuResources::totalUsage() const
+{
+    qint64 total = 0;
+    for (int i = 0; i < CategoryCount; i++)
+        total += m_usage[i];
+    return total;
+}
+
+void GpuResources::setBudget(qint64 bytes)
+{
+    m_budget = qMax<qint64>(bytes, 0);
+    m_overBudgetWarned = false;
+}
+
+qint64 GpuResources::budget() const
+{
+    return m_budget;
+}
+
+void GpuResources::setDefaultBudget(qint64 bytes)
+{
+    s_defaultBudget = qMax<qint64>(bytes, 0);
+}
+
+qint64 GpuResources::defaultBudget()
+{
+    return s_defaultBudget;
+}
+
+void GpuResources::track(const void *owner, std::function<void()> evict)
+{
+    m_residents.insert(owner, Resident{ m_frame, std::move(evict) });
+}
+
+void GpuResources::untrack(const void *owner)
+{
+    m_residents.remove(owner);
+}
+
+void GpuResources::touch(const void *owner)
+{
+    auto it = m_residents.find(owner);
+    if (it != m_residents.end())
+        it->lastFrame = m_frame;
+}
+
+void GpuResources::deleteLater(std::function<void()> destroy)
+{
+    m_pending.append(Pending{ m_frame, std::move(destroy) });
+}
+
+void GpuResources::beginFrame()
+{
+    m_frame++;
+
+    // FramesInFlight フレーム以上前に積まれたものは GPU が使い終わっている
+    while (!m_pending.isEmpty() && m_pending.first().frame + FramesInFlight <= m_frame)
+    {
+        std::function<void()> destroy = std::move(m_pending.first().destroy);
+        m_pending.removeFirst();
+        destroy();
+    }
+
+    if (m_budget > 0 && totalUsage() > m_budget)
+        evictToBudget();
+}
+
+void GpuResources::flush()
+{
+    if (m_pending.isEmpty())
+        return;
+
+    if (QOpenGLContext::currentContext())
+        QOpenGLContext::currentContext()->functions()->glFinish();
+
+    while (!m_pending.isEmpty())
+    {
+        std::function<void()> destroy = std::move(m_pending.first().destroy);
+        m_pending.removeFirst();
+        destroy();
+    }
+}
+
+int GpuResources::evictedCount() const
+{
+    return m_evicted;
+}
+
+void GpuResources::evictToBudget()
+{
+    // 描画中のフレームで使っているものは退避しない(退避しても次のフレームで戻すことになる)
+    QVector<QPair<quint64, const void*>> candidates;
+    for (auto it = m_residents.constBegin(); it != m_residents.constEnd(); ++it)
+    {
+        if (it->lastFrame + FramesInFlight <= m_frame)
+            candidates.append(qMakePair(it->lastFrame, it.key()));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto &candidate : candidates)
+    {
+        if (totalUsage() <= m_budget)
+            break;
+
+        // evict() の中で untrack() されるので先に取り出しておく
+        Resident resident = m_residents.take(candidate.second);
+        resident.evict();
+        m_evicted++;
+    }
+
+    if (totalUsage() > m_budget && !m_overBudgetWarned)
+    {
+        qWarning() << "GPU memory" << totalUsage() / (1024 * 1024) << "MB exceeds the budget of"
+                   << m_budget / (1024 * 1024) << "MB with only visible meshes resident";
+        m_overBudgetWarned = true;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef GPURESOURCES_H
+#define GPURESOURCES_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <functional>
+#include "ringbuffer.h"
+
+// GPUリソースの使用量を種類毎に集計し、予算を超えたら長く描画されていないメッシュを退避する
+// 破棄は deleteLater() で数フレーム遅らせ、描画中のフレームが使い終わってから行う
+// GLスレッドからだけ使う
+class GpuResources
+{
+public:
+    enum Category
+    {
+        VertexBuffer,
+        IndexBuffer,
+        UniformBuffer,
+        ShaderProgram,
+        RenderTarget,
+        IndirectBuffer,
+        StorageBuffer,
+        StagingBuffer,
+        CategoryCount
+    };
+
+    // RingBuffer::beginFrame() はこのフレーム数前の描画の完了を待つので、それより古いフレームは使い終わっている
+    static const int FramesInFlight = RingBuffer::Frames;
+
+    GpuResources();
+    ~GpuResources();
+
+    static QString categoryName(Category category);
+
+    // 使用量の集計
+    void add(Category category, qint64 bytes);
+    void remove(Category category, qint64 bytes);
+    qint64 usage(Category category) const;
+    int count(Category category) const;
+    qint64 totalUsage() const;
+
+    // 予算(byte)。0 なら制限しない
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+    static void setDefaultBudget(qint64 bytes);
+    static qint64 defaultBudget();
+
+    // 退避できるリソースを登録する。退避する時は evict が呼ばれる(evict の中で remove() する)
+    void track(const void *owner, std::function<void()> evict);
+    void untrack(const void *owner);
+    // このフレームで使用した
+    void touch(const void *owner);
+
+    // 描画中のフレームが使い終わってから destroy を呼ぶ
+    void deleteLater(std::function<void()> destroy);
+
+    // RingBuffer::beginFrame() の後に呼ぶ。遅延していた破棄と、予算を超えた分の退避を行う
+    void beginFrame();
+    // 全ての遅延破棄をすぐに実行する(GPUの処理を待つ)
+    void flush();
+
+    int evictedCount() const;
+
+private:
+    void evictToBudget();
+
+    struct Resident
+    {
+        quint64 lastFrame;
+        std::function<void()> evict;
+    };
+
+    struct Pending
+    {
+        quint64 frame;
+        std::function<void()> destroy;
+    };
+
+    qint64 m_usage[CategoryCount];
+    int m_count[CategoryCount];
+    qint64 m_budget;
+
+    QHash<const void*, Resident> m_residents;
+    QList<Pending> m_pending;
+    quint64 m_frame;
+    int m_evicted;
+    bool m_overBudgetWarned;
+
+    static qint64 s_defaultBudget;
+};
+
+#endif // GPURESOURCES_H
@@ -1,81 +1,48 @@
 ﻿#include "gridline.h"
+#include "primitives.h"
 
 GridLine::GridLine()
 {
     initialize();
 
-    m_width = 500;
-    m_gap = 1.0f;
-
     setColor(GridColor::Blender);
-    gemGridLine();
+}
+
+GridLine::~GridLine()
+{
+    release();
 }
 
 void GridLine::release()
 {
+    if (m_vbo.isCreated())
+        removeGpuMemoryUsage(GpuResources::VertexBuffer, vertexBytes());
+
     m_vbo.release();
     m_vbo.destroy();
-    m_ibo.release();
-    m_ibo.destroy();
 }
 
-void GridLine::gemGridLine()
+qint64 GridLine::vertexBytes() const
 {
-    m_vertices.clear();
-
-    float start = -m_width;
-    float end = m_width;
-
-    // Axis X
-    m_vertices.append(VertexData{ QVector3D(start, 0.0f, 0.0f), m_color.axisX });
-    m_vertices.append(VertexData{ QVector3D(end, 0.0f, 0.0f), m_color.axisX });
-
-    // Axis Z
-    m_vertices.append(VertexData{ QVector3D(0.0f, 0.0f, start), m_color.axisZ });
-    m_vertices.append(VertexData{ QVector3D(0.0f, 0.0f, end), m_color.axisZ });
-
-    // X軸のライン
-    for (int i = 1; i < m_width; i++) {
-        float z = i * m_gap;
-        m_vertices.append(VertexData{ QVector3D(start, 0.0f,  z), m_color.grid });
-        m_vertices.append(VertexData{ QVector3D(  end, 0.0f,  z), m_color.grid });
-        m_vertices.append(VertexData{ QVector3D(start, 0.0f, -z), m_color.grid });
-        m_vertices.append(VertexData{ QVector3D(  end, 0.0f, -z), m_color.grid });
-    }
-
-    // Z軸のライン
-    for (int i = 1; i < m_width; i++) {
-        float x = i * m_gap;
-        m_vertices.append(VertexData{ QVector3D( x, 0.0f, start), m_color.grid });
-        m_vertices.append(VertexData{ QVector3D( x, 0.0f, end), m_color.grid });
-        m_vertices.append(VertexData{ QVector3D(-x, 0.0f, start), m_color.grid });
-        m_vertices.append(VertexData{ QVector3D(-x, 0.0f, end), m_color.grid });
-    }
+    return sizeof(Primitives::grid<HalfLines>().positions);
+}
 
-    for (int i = 0; i < m_vertices.size(); i++) {
-        m_indexes.append(static_cast<GLushort>(i));
-    }
+QByteArray GridLine::vertexShaderSource(const QString &fileName) const
+{
+    return Format::shaderSource(fileName);
 }
 
 void GridLine::bufferInit()
 {
-    // 頂点バッファを生成
+    // 頂点バッファを生成(位置はコンパイル時に作ったものをそのまま転送する)
     m_vbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
     m_vbo.create();
     m_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
     m_vbo.bind();
-    m_vbo.allocate(m_vertices.constData(), m_vertices.size() * static_cast<int>(sizeof(VertexData)));
+    m_vbo.allocate(Primitives::grid<HalfLines>().positions, static_cast<int>(vertexBytes()));
     m_vbo.release();
 
-    // インデックスバッファを生成
-    m_ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
-    m_ibo.create();
-    m_ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    m_ibo.bind();
-    m_ibo.allocate(m_indexes.constData(), m_indexes.size() * static_cast<int>(sizeof(GLushort)));
-    m_ibo.release();
-
-    m_vertices.clear();
+    addGpuMemoryUsage(GpuResources::VertexBuffer, vertexBytes());
 
     // シェーダーで使用する属性の設定
     getShaderProgram()->bind();
@@ -83,11 +50,17 @@ void GridLine::bufferInit()
     getShaderProgram()->release();
 }
 
-
-
+void GridLine::drawLines(const QVector3D &color, int first, int count)
+{
+    // 色は頂点毎に持たず、属性の定数値で渡す
+    getShaderProgram()->setAttributeValue("VertexColor", color);
+    glDrawArrays(GL_LINES, first, count);
+    if (profiler()) profiler()->count(QStringLiteral("draw_calls"));
+}
 
 void GridLine::draw(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix, const QMatrix4x4 &parentWorldMatrix)
 {
+    typedef Primitives::Grid<HalfLines> Grid;
     QMatrix4x4 modelMatrix;
 
     // set uniform
@@ -98,19 +71,15 @@ void GridLine::draw(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMa
 
     // Draw Gridline
     m_vbo.bind();
-    m_ibo.bind();
-
-    int offset = 0;
-    getShaderProgram()->enableAttributeArray("VertexPosition");
-    getShaderProgram()->setAttributeBuffer("VertexPosition", GL_FLOAT, offset, 3, sizeof(VertexData));
 
-    offset += sizeof(QVector3D);
-    getShaderProgram()->enableAttributeArray("VertexColor");
-    getShaderProgram()->setAttributeBuffer("VertexColor", GL_FLOAT, offset, 3, sizeof(VertexData));
+    Format::setAttributes(this);
+    getShaderProgram()->disableAttributeArray("VertexColor");
 
-    glDrawElements(GL_LINES, m_indexes.size(), GL_UNSIGNED_SHORT, nullptr);
+    // 軸を先に描いて、重なる格子線より手前に残す
+    drawLines(m_color.axisX, Grid::AxisXFirst, Grid::AxisVertexCount);
+    drawLines(m_color.axisZ, Grid::AxisZFirst, Grid::AxisVertexCount);
+    drawLines(m_color.grid, Grid::LineFirst, Grid::LineVertexCount);
 
-    m_ibo.release();
     m_vbo.release();
     getShaderProgram()->release();
 }
@@ -16,6 +16,7 @@ class GridLine : public Model
 {
 public:
     GridLine();
+    ~GridLine() override;
 
     void draw(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix, const QMatrix4x4 &parentWorldMatrix=QMatrix4x4()) override;
     void release() override;
@@ -23,16 +24,10 @@ public:
     void setColor(GridColor gridcolor);
 
 private:
-    struct VertexData
-    {
-        QVector3D position;
-        QVector3D color;
-    };
-    struct Axis
-    {
-        int first;
-        int count;
-    };
+    // 格子の半分の本数(Primitives::grid() で頂点位置をコンパイル時に作る)
+    static const int HalfLines = 500;
+    // 頂点は位置だけ持つ(色は属性の定数値で渡す)
+    typedef VertexFormat::Format<VertexFormat::Attribute<VertexFormat::Position, VertexFormat::Float<3>>> Format;
 
     struct Color
     {
@@ -44,20 +39,13 @@ private:
 
     // buffer
     QOpenGLBuffer m_vbo;
-    QOpenGLBuffer m_ibo;
-
-    // vertex data
-    QVector<VertexData> m_vertices;
-    QVector<GLushort> m_indexes;
 
-    float m_width;
-    float m_gap;
     Color m_color;
-    Axis m_axisX;
-    Axis m_axisZ;
 
     void bufferInit() override;
-    void gemGridLine();
+    QByteArray vertexShaderSource(const QString &fileName) const override;
+    qint64 vertexBytes() const;
+    void drawLines(const QVector3D &color, int first, int count);
 
 };
 
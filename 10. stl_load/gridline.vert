@@ -1,6 +1,7 @@
 #version 400 core
-layout(location = 0) in vec3  VertexPosition;
-layout(location = 1) in vec3  VertexColor;
+// 頂点の属性は GridLine::Format から宣言される
+#pragma vertex_attributes
+layout(location = 1) in vec3  VertexColor;  // 線毎に一定の値を渡す
 out vec3 Color;
 
 uniform mat4 MVP;
@@ -0,0 +1,30 @@
+#version 400 core
+// 1つ前の階層の 2x2 の最も奥の深度を書き込む(OcclusionCuller::reduce)
+// 前の階層の大きさが奇数なら、最後の行と列はこの階層の最後の texel に含める
+
+uniform sampler2D Source;
+uniform int SourceLevel;
+uniform ivec2 SourceSize;
+
+layout(location = 0) out float Depth;
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 size = max(SourceSize / 2, ivec2(1));
+    ivec2 last = SourceSize - 1;
+    ivec2 first = texel * 2;
+    ivec2 end = first + 1;
+    if (texel.x == size.x - 1)
+        end.x = last.x;
+    if (texel.y == size.y - 1)
+        end.y = last.y;
+
+    float depth = 0.0;
+    for (int y = first.y; y <= end.y; y++)
+    {
+        for (int x = first.x; x <= end.x; x++)
+            depth = max(depth, texelFetch(Source, min(ivec2(x, y), last), SourceLevel).r);
+    }
+    Depth = depth;
+}
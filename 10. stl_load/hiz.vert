@@ -0,0 +1,8 @@
+#version 400 core
+// 画面全体を覆う三角形(OcclusionCuller::reduce)。頂点は gl_VertexID から作る
+
+void main(void)
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
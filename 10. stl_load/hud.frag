@@ -0,0 +1,16 @@
+#version 400 core
+in vec2 TexCoord;
+in vec4 Color;
+
+uniform sampler2D Atlas;
+
+layout( location = 0 )out vec4 FragColor;
+
+void main(void)
+{
+    // テクスチャ座標が負なら単色(グラフ・背景)
+    if (TexCoord.x < 0.0)
+        FragColor = Color;
+    else
+        FragColor = vec4(Color.rgb, Color.a * texture(Atlas, TexCoord).a);
+}
@@ -0,0 +1,17 @@
+#version 400 core
+// 頂点の属性は PerfHud::Format から宣言される
+#pragma vertex_attributes
+out vec2 TexCoord;
+out vec4 Color;
+
+uniform vec2 ScreenSize;
+
+void main(void)
+{
+    TexCoord = VertexTexCoord;
+    Color = VertexColor;
+
+    // ピクセル座標(左上原点)を正規化デバイス座標へ
+    vec2 ndc = VertexPosition / ScreenSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+}
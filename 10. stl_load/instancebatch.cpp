@@ -0,0 +1,389 @@
+#include "instancebatch.h"
+#include "meshlet.h"
+#include <QOpenGLContext>
+#include <QDebug>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+#define GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT 0x90DF
+#endif
+#ifndef GL_R32UI
+#define GL_R32UI 0x8236
+#endif
+#ifndef GL_RED_INTEGER
+#define GL_RED_INTEGER 0x8D94
+#endif
+
+static_assert(sizeof(InstanceBatch::Instance) == 80, "Instance must match the std430 layout in cull.comp");
+
+InstanceBatch::InstanceBatch(GpuResources *resources)
+{
+    m_resources = resources;
+    m_vertices = nullptr;
+    m_indexes = nullptr;
+    m_vertexCount = 0;
+    m_indexCount = 0;
+    m_radius = 0.0f;
+    m_light = Model::Light();
+    m_material = Model::Material();
+    m_dirtyBegin = 0;
+    m_dirtyEnd = 0;
+    m_capacity = 0;
+    m_cullProgram = nullptr;
+    m_drawProgram = nullptr;
+    m_instanceBuffer = 0;
+    m_visibleBuffer = 0;
+    m_commandBuffer = 0;
+    m_commandStride = 0;
+    m_commandSlot = 0;
+    m_clearBufferSubData = nullptr;
+    for (qint64 &bytes : m_gpuBytes)
+        bytes = 0;
+}
+
+InstanceBatch::~InstanceBatch()
+{
+    destroy();
+}
+
+bool InstanceBatch::isSupported()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context || context->isOpenGLES())
+        return false;
+    return context->format().version() >= qMakePair(4, 3)
+            || (context->hasExtension(QByteArrayLiteral("GL_ARB_compute_shader"))
+                && context->hasExtension(QByteArrayLiteral("GL_ARB_shader_storage_buffer_object")));
+}
+
+void InstanceBatch::setMesh(const Model::VertexData *vertices, int vertexCount, const GLuint *indexes, int indexCount)
+{
+    m_vertices = vertices;
+    m_indexes = indexes;
+    m_vertexCount = vertexCount;
+    m_indexCount = indexCount;
+
+    // 境界球は AABB の中心から求める
+    float lowest = std::numeric_limits<float>::lowest();
+    float highest = std::numeric_limits<float>::max();
+    QVector3D minimum(highest, highest, highest);
+    QVector3D maximum(lowest, lowest, lowest);
+    for (int i = 0; i < vertexCount; i++)
+    {
+        const QVector3D &p = vertices[i].position;
+        minimum = QVector3D(qMin(minimum.x(), p.x()), qMin(minimum.y(), p.y()), qMin(minimum.z(), p.z()));
+        maximum = QVector3D(qMax(maximum.x(), p.x()), qMax(maximum.y(), p.y()), qMax(maximum.z(), p.z()));
+    }
+    m_center = vertexCount > 0 ? (minimum + maximum) * 0.5f : QVector3D();
+    float radius = 0.0f;
+    for (int i = 0; i < vertexCount; i++)
+        radius = qMax(radius, (vertices[i].position - m_center).lengthSquared());
+    m_radius = std::sqrt(radius);
+}
+
+void InstanceBatch::setLight(const Model::Light &light)
+{
+    m_light = light;
+}
+
+void InstanceBatch::setMaterial(const Model::Material &material)
+{
+    m_material = material;
+}
+
+bool InstanceBatch::create()
+{
+    destroy();
+    if (!isSupported())
+        return false;
+    initializeOpenGLFunctions();
+
+    m_cullProgram = new QOpenGLShaderProgram();
+    m_drawProgram = new QOpenGLShaderProgram();
+    bool linked = m_cullProgram->addShaderFromSourceFile(QOpenGLShader::Compute, ":/cull.comp")
+            && m_cullProgram->link()
+            && m_drawProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, Model::Format::shaderSource(":/instanced.vert"))
+            && m_drawProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader.frag")
+            && m_drawProgram->link();
+    if (!linked)
+    {
+        qWarning() << "InstanceBatch shaders failed to build. Instances are drawn one by one";
+        destroy();
+        return false;
+    }
+
+    m_vbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_vbo.create();
+    m_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_vbo.bind();
+    m_vbo.allocate(m_vertices, m_vertexCount * static_cast<int>(sizeof(Model::VertexData)));
+    m_vbo.release();
+
+    m_ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+    m_ibo.create();
+    m_ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_ibo.bind();
+    m_ibo.allocate(m_indexes, m_indexCount * static_cast<int>(sizeof(GLuint)));
+    m_ibo.release();
+    setGpuBytes(GpuResources::VertexBuffer, m_vertexCount * static_cast<qint64>(sizeof(Model::VertexData)));
+    setGpuBytes(GpuResources::IndexBuffer, m_indexCount * static_cast<qint64>(sizeof(GLuint)));
+
+    // instanceCount はコンピュートシェーダーが数える
+    // コマンドはフレーム毎の領域に分け、SSBO として範囲をバインドできるようにアライメントを揃える
+    GLint alignment = 1;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = qMax(alignment, 4);
+    m_commandStride = (static_cast<GLsizeiptr>(sizeof(DrawElementsIndirectCommand)) + alignment - 1) / alignment * alignment;
+    m_commandSlot = 0;
+    QByteArray commands(static_cast<int>(m_commandStride * CommandSlots), '\0');
+    DrawElementsIndirectCommand command = { static_cast<GLuint>(m_indexCount), 0, 0, 0, 0 };
+    for (int slot = 0; slot < CommandSlots; slot++)
+        std::memcpy(commands.data() + slot * m_commandStride, &command, sizeof(command));
+    glGenBuffers(1, &m_commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size(), commands.constData(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    setGpuBytes(GpuResources::IndirectBuffer, commands.size());
+
+    // 数を 0 に戻すのはGPU上で行う(GL 4.3 / ARB_clear_buffer_object)
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context->format().version() >= qMakePair(4, 3) || context->hasExtension(QByteArrayLiteral("GL_ARB_clear_buffer_object")))
+        m_clearBufferSubData = reinterpret_cast<ClearBufferSubDataFunc>(context->getProcAddress("glClearBufferSubData"));
+
+    glGenBuffers(1, &m_instanceBuffer);
+    glGenBuffers(1, &m_visibleBuffer);
+    m_capacity = 0;
+    m_dirtyBegin = 0;
+    m_dirtyEnd = m_instances.size();
+    upload();
+    return true;
+}
+
+void InstanceBatch::destroy()
+{
+    delete m_cullProgram;
+    m_cullProgram = nullptr;
+    delete m_drawProgram;
+    m_drawProgram = nullptr;
+    if (m_vbo.isCreated())
+        m_vbo.destroy();
+    if (m_ibo.isCreated())
+        m_ibo.destroy();
+    if (m_commandBuffer)
+    {
+        GLuint buffers[] = { m_instanceBuffer, m_visibleBuffer, m_commandBuffer };
+        glDeleteBuffers(3, buffers);
+    }
+    m_instanceBuffer = 0;
+    m_visibleBuffer = 0;
+    m_commandBuffer = 0;
+    m_clearBufferSubData = nullptr;
+    m_capacity = 0;
+    for (int category = 0; category < GpuResources::CategoryCount; category++)
+        setGpuBytes(static_cast<GpuResources::Category>(category), 0);
+}
+
+int InstanceBatch::add(const QMatrix4x4 &modelMatrix)
+{
+    m_instances.append(Instance());
+    setModelMatrix(m_instances.size() - 1, modelMatrix);
+    return m_instances.size() - 1;
+}
+
+void InstanceBatch::setModelMatrix(int instance, const QMatrix4x4 &modelMatrix)
+{
+    Instance &data = m_instances[instance];
+    std::memcpy(data.model, modelMatrix.constData(), sizeof(data.model));
+
+    // 拡大率は最も大きい軸で見積もる
+    QVector3D center = modelMatrix.map(m_center);
+    float scale = qMax(modelMatrix.column(0).toVector3D().length(),
+                       qMax(modelMatrix.column(1).toVector3D().length(), modelMatrix.column(2).toVector3D().length()));
+    data.sphere[0] = center.x();
+    data.sphere[1] = center.y();
+    data.sphere[2] = center.z();
+    data.sphere[3] = m_radius * scale;
+
+    if (m_dirtyBegin == m_dirtyEnd)
+    {
+        m_dirtyBegin = instance;
+        m_dirtyEnd = instance + 1;
+    }
+    else
+    {
+        m_dirtyBegin = qMin(m_dirtyBegin, instance);
+        m_dirtyEnd = qMax(m_dirtyEnd, instance + 1);
+    }
+}
+
+int InstanceBatch::size() const
+{
+    return m_instances.size();
+}
+
+void InstanceBatch::upload()
+{
+    if (!m_commandBuffer)
+        return;
+
+    if (m_instances.size() > m_capacity)
+    {
+        // 倍に広げて全て転送し直す
+        m_capacity = qMax(1024, qMax(m_instances.size(), m_capacity * 2));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instanceBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_capacity * static_cast<GLsizeiptr>(sizeof(Instance)), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibleBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_capacity * static_cast<GLsizeiptr>(sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+        m_dirtyBegin = 0;
+        m_dirtyEnd = m_instances.size();
+        setGpuBytes(GpuResources::StorageBuffer, m_capacity * static_cast<qint64>(sizeof(Instance) + sizeof(GLuint)));
+    }
+
+    if (m_dirtyBegin < m_dirtyEnd)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instanceBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, m_dirtyBegin * static_cast<GLintptr>(sizeof(Instance)),
+                        (m_dirtyEnd - m_dirtyBegin) * static_cast<GLsizeiptr>(sizeof(Instance)), m_instances.constData() + m_dirtyBegin);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    m_dirtyBegin = 0;
+    m_dirtyEnd = 0;
+}
+
+void InstanceBatch::cull(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix)
+{
+    if (!m_commandBuffer)
+        return;
+    upload();
+
+    // 次の領域の instanceCount を 0 に戻す
+    // この領域を最後に使ったのは CommandSlots フレーム前の描画なので、CPU からの書き込みでも待ちは起きない
+    // glClearBufferSubData が使えればGPUのコマンドとして書き換え、CPU からデータを送らない
+    m_commandSlot = (m_commandSlot + 1) % CommandSlots;
+    const GLintptr countOffset = commandOffset() + static_cast<GLintptr>(offsetof(DrawElementsIndirectCommand, instanceCount));
+    const GLuint zero = 0;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    if (m_clearBufferSubData)
+        m_clearBufferSubData(GL_DRAW_INDIRECT_BUFFER, GL_R32UI, countOffset, sizeof(zero), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    else
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, countOffset, sizeof(zero), &zero);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    if (m_instances.isEmpty())
+        return;
+
+    // クリップ座標の -w <= x,y,z <= w をワールド座標の平面にする
+    QMatrix4x4 viewProjection = projectionMatrix * viewMatrix;
+    QVector4D w = viewProjection.row(3);
+    QVector4D planes[6];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        planes[axis * 2 + 0] = w + viewProjection.row(axis);
+        planes[axis * 2 + 1] = w - viewProjection.row(axis);
+    }
+    for (QVector4D &plane : planes)
+    {
+        float length = plane.toVector3D().length();
+        if (length > 0.0f)
+            plane /= length;
+    }
+
+    m_cullProgram->bind();
+    m_cullProgram->setUniformValueArray("FrustumPlanes", planes, 6);
+    m_cullProgram->setUniformValue("InstanceCount", static_cast<GLuint>(m_instances.size()));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InstanceBinding, m_instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VisibleBinding, m_visibleBuffer);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CommandBinding, m_commandBuffer, commandOffset(), sizeof(DrawElementsIndirectCommand));
+    glDispatchCompute(static_cast<GLuint>((m_instances.size() + GroupSize - 1) / GroupSize), 1, 1);
+    m_cullProgram->release();
+
+    // 描画コマンドと番号の書き込みを、間接描画と頂点シェーダーから見えるようにする
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void InstanceBatch::draw(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix)
+{
+    if (!m_commandBuffer || m_instances.isEmpty())
+        return;
+
+    m_drawProgram->bind();
+    m_drawProgram->setUniformValue("ViewMatrix", viewMatrix);
+    m_drawProgram->setUniformValue("ProjectionMatrix", projectionMatrix);
+    m_drawProgram->setUniformValue("Light.Position", m_light.Position);
+    m_drawProgram->setUniformValue("Light.La", m_light.La);
+    m_drawProgram->setUniformValue("Light.Ld", m_light.Ld);
+    m_drawProgram->setUniformValue("Light.Ls", m_light.Ls);
+    m_drawProgram->setUniformValue("Material.Ka", m_material.Ka);
+    m_drawProgram->setUniformValue("Material.Kd", m_material.Kd);
+    m_drawProgram->setUniformValue("Material.Ks", m_material.Ks);
+    m_drawProgram->setUniformValue("Material.Shininess", m_material.Shininess);
+    m_drawProgram->setUniformValue("Material.Opacity", m_material.Opacity);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, InstanceBinding, m_instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VisibleBinding, m_visibleBuffer);
+    m_vbo.bind();
+    m_ibo.bind();
+    Model::Format::setAttributes(this);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(commandOffset()));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    m_ibo.release();
+    m_vbo.release();
+    m_drawProgram->release();
+}
+
+int InstanceBatch::visibleCount()
+{
+    if (!m_commandBuffer)
+        return 0;
+
+    DrawElementsIndirectCommand command;
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    void *mapped = glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, commandOffset(), sizeof(command), GL_MAP_READ_BIT);
+    if (mapped)
+    {
+        std::memcpy(&command, mapped, sizeof(command));
+        glUnmapBuffer(GL_DRAW_INDIRECT_BUFFER);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return mapped ? static_cast<int>(command.instanceCount) : 0;
+}
+
+GLintptr InstanceBatch::commandOffset() const
+{
+    return m_commandSlot * m_commandStride;
+}
+
+qint64 InstanceBatch::gpuBytes() const
+{
+    qint64 total = 0;
+    for (qint64 bytes : m_gpuBytes)
+        total += bytes;
+    return total;
+}
+
+void InstanceBatch::setGpuBytes(GpuResources::Category category, qint64 bytes)
+{
+    // インスタンスの SSBO は数に合わせて広げるので、その都度集計し直す
+    if (m_resources && m_gpuBytes[category] > 0)
+        m_resources->remove(category, m_gpuBytes[category]);
+    if (m_resources && bytes > 0)
+        m_resources->add(category, bytes);
+    m_gpuBytes[category] = bytes;
+}
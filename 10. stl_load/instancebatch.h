@@ -0,0 +1,114 @@
+#ifndef INSTANCEBATCH_H
+#define INSTANCEBATCH_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QMatrix4x4>
+#include <QVector>
+#include "model.h"
+#include "gpuresources.h"
+#include "ringbuffer.h"
+
+// 同じメッシュを多数描画するまとまり(GPUでカリングする)
+// インスタンスの変換と境界球は SSBO に置き、コンピュートシェーダーが視錐台の内側のものの番号を詰めて
+// 描画コマンドの instanceCount を数える。CPU はインスタンスの数に依らず、毎フレーム1回の dispatch と1回の間接描画だけ行う
+// コンピュートシェーダー(GL 4.3 / ARB_compute_shader)と SSBO が必要。使えなければ Model を個別に描画する
+class InstanceBatch : protected QOpenGLExtraFunctions
+{
+public:
+    // cull.comp と instanced.vert の Instance と同じ std430 のレイアウト
+    struct Instance
+    {
+        float model[16];    // モデル行列
+        float sphere[4];    // ワールド座標の境界球(中心, 半径)
+    };
+
+    explicit InstanceBatch(GpuResources *resources = nullptr);
+    ~InstanceBatch();
+
+    // カレントのコンテキストで使えるか
+    static bool isSupported();
+
+    // 読み取り専用の頂点データをコピーせずに使う(create() で転送する)
+    void setMesh(const Model::VertexData *vertices, int vertexCount, const GLuint *indexes, int indexCount);
+    template <typename Mesh>
+    void setMesh(const Mesh &mesh) { setMesh(mesh.vertices, Mesh::VertexCount, mesh.indexes, Mesh::IndexCount); }
+
+    void setLight(const Model::Light &light);
+    void setMaterial(const Model::Material &material);
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    bool create();
+    void destroy();
+
+    // インスタンスを追加して番号を返す。転送は次の cull() でまとめて行う
+    int add(const QMatrix4x4 &modelMatrix);
+    void setModelMatrix(int instance, const QMatrix4x4 &modelMatrix);
+    int size() const;
+
+    // 視錐台の内側のインスタンスを描画リストに詰める(結果はGPUに残り、読み戻さない)
+    void cull(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix);
+    // cull() で残ったインスタンスを描画する
+    void draw(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix);
+
+    // 描画コマンドを読み戻して、残ったインスタンスの数を返す(GPUを待つので計測と確認用)
+    int visibleCount();
+
+    qint64 gpuBytes() const;
+
+private:
+    // コンピュートシェーダーのワークグループの大きさ(cull.comp と同じ)
+    static const int GroupSize = 64;
+
+    // SSBO のバインディング(シェーダーと同じ)
+    static const GLuint InstanceBinding = 0;
+    static const GLuint VisibleBinding = 1;
+    static const GLuint CommandBinding = 2;
+
+    // 描画コマンドはフレーム毎に別の領域を使う(描画中のフレームのコマンドを書き換えない)
+    static const int CommandSlots = RingBuffer::Frames;
+    GLintptr commandOffset() const;
+
+    typedef void (QOPENGLF_APIENTRYP ClearBufferSubDataFunc)(GLenum target, GLenum internalformat, GLintptr offset, GLsizeiptr size,
+                                                             GLenum format, GLenum type, const void *data);
+
+    // 追加・変更したインスタンスを転送する(足りなければバッファを広げる)
+    void upload();
+    // category の使用量を bytes にして GpuResources に集計し直す
+    void setGpuBytes(GpuResources::Category category, qint64 bytes);
+
+    GpuResources *m_resources;
+
+    // mesh
+    const Model::VertexData *m_vertices;
+    const GLuint *m_indexes;
+    int m_vertexCount;
+    int m_indexCount;
+    QVector3D m_center;     // メッシュの境界球(モデル座標)
+    float m_radius;
+
+    Model::Light m_light;
+    Model::Material m_material;
+
+    // instances
+    QVector<Instance> m_instances;
+    int m_dirtyBegin;       // 転送していない範囲 [m_dirtyBegin, m_dirtyEnd)
+    int m_dirtyEnd;
+    int m_capacity;         // SSBO に確保しているインスタンスの数
+
+    // GL objects
+    QOpenGLShaderProgram *m_cullProgram;
+    QOpenGLShaderProgram *m_drawProgram;
+    QOpenGLBuffer m_vbo;
+    QOpenGLBuffer m_ibo;
+    GLuint m_instanceBuffer;
+    GLuint m_visibleBuffer; // 残ったインスタンスの番号
+    GLuint m_commandBuffer; // DrawElementsIndirectCommand を CommandSlots 個
+    GLsizeiptr m_commandStride;
+    int m_commandSlot;      // このフレームで使っている領域
+    ClearBufferSubDataFunc m_clearBufferSubData;    // 無ければ glBufferSubData で書き換える
+    qint64 m_gpuBytes[GpuResources::CategoryCount];
+};
+
+#endif // INSTANCEBATCH_H
@@ -0,0 +1,72 @@
+#version 430 core
+// InstanceBatch の描画。頂点の属性は Model::Format から宣言される
+// 行列はインスタンス毎に SSBO から読み、フラグメントシェーダーは shader.frag を使う
+#pragma vertex_attributes
+
+out vec3 LightIntensity;
+out float Opacity;
+
+struct LightInfo {
+    vec4 Position;  // 視点座標でのライトの位置
+    vec3 La;        // アンビエント ライト強度
+    vec3 Ld;        // ディフューズ ライト強度
+    vec3 Ls;        // スペキュラ ライト強度
+};
+uniform LightInfo Light;
+
+struct MaterialInfo {
+    vec3 Ka;            // アンビエント 反射率
+    vec3 Kd;            // ディフューズ 反射率
+    vec3 Ks;            // スペキュラ 反射率
+    float Shininess;    // スペキュラ 輝き係数
+    float Opacity;      //　不透明度
+};
+uniform MaterialInfo Material;
+
+uniform mat4 ViewMatrix;
+uniform mat4 ProjectionMatrix;
+
+// cull.comp と同じ
+struct Instance {
+    mat4 Model;
+    vec4 Sphere;
+};
+
+layout(std430, binding = 0) readonly buffer Instances
+{
+    Instance instances[];
+};
+
+// cull.comp で残ったインスタンスの番号
+layout(std430, binding = 1) readonly buffer Visible
+{
+    uint visible[];
+};
+
+vec3 phongModel( vec4 position, vec3 norm )
+{
+    vec3 s = normalize( vec3(Light.Position - position) );
+    vec3 v = normalize( -position.xyz );
+    vec3 r = reflect( -s, norm );
+    vec3 ambient = Light.La * Material.Ka;
+    float sDotN = max( dot(s, norm), 0.0 );
+    vec3 diffuse = Light.Ld * Material.Kd * sDotN;
+    vec3 spec = vec3(0.0);
+    if( sDotN > 0.0 )
+        spec = Light.Ls * Material.Ks * pow( max( dot(r, v), 0.0 ), Material.Shininess );
+
+    return ambient + diffuse + spec;
+}
+
+void main(void)
+{
+    mat4 modelView = ViewMatrix * instances[visible[gl_InstanceID]].Model;
+    mat3 normalMatrix = transpose( inverse( mat3(modelView) ) );
+
+    vec3 eyeNorm = normalize( normalMatrix * VertexNormal );
+    vec4 eyePosition = modelView * vec4(VertexPosition, 1.0);
+
+    LightIntensity = phongModel( eyePosition, eyeNorm );
+    Opacity = Material.Opacity;
+    gl_Position = ProjectionMatrix * eyePosition;
+}
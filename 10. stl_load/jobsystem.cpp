@@ -0,0 +1,283 @@
+#include "jobsystem.h"
+#include <QThread>
+
+thread_local int JobSystem::t_workerIndex = -1;
+
+JobSystem &JobSystem::instance()
+{
+    static JobSystem jobSystem;
+    return jobSystem;
+}
+
+JobSystem::JobSystem()
+{
+    m_pending = 0;
+    m_quit = false;
+    start(defaultThreadCount());
+}
+
+JobSystem::~JobSystem()
+{
+    stop();
+}
+
+int JobSystem::defaultThreadCount()
+{
+    // 呼び出し元のスレッドも待機中にジョブを実行するので1つ減らす
+    return qMax(QThread::idealThreadCount() - 1, 0);
+}
+
+void JobSystem::setThreadCount(int count)
+{
+    count = qMax(count, 0);
+    if (count == m_workers.size())
+        return;
+
+    stop();
+    start(count);
+}
+
+int JobSystem::threadCount() const
+{
+    return m_workers.size();
+}
+
+void JobSystem::start(int count)
+{
+    m_quit = false;
+    for (int i = 0; i < count; i++)
+        m_workers.append(new Worker());
+    for (int i = 0; i < count; i++)
+        m_workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+}
+
+void JobSystem::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+
+    for (Worker *worker : m_workers)
+    {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+
+    // 残っているジョブは呼び出し元で片付ける
+    QVector<Task> remaining;
+    for (Worker *worker : m_workers)
+    {
+        for (Task &task : worker->deque)
+            remaining.append(task);
+        delete worker;
+    }
+    m_workers.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_globalMutex);
+        for (Task &task : m_global)
+            remaining.append(task);
+        m_global.clear();
+    }
+    m_pending = 0;
+
+    for (Task &task : remaining)
+        execute(task);
+}
+
+void JobSystem::run(Job job, Counter *counter)
+{
+    if (counter)
+        counter->m_value.fetch_add(1, std::memory_order_relaxed);
+    push(Task{ std::move(job), counter });
+}
+
+void JobSystem::runAfter(Counter &dependency, Job job, Counter *counter)
+{
+    if (counter)
+        counter->m_value.fetch_add(1, std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(dependency.m_mutex);
+        if (!dependency.done())
+        {
+            dependency.m_continuations.append(Counter::Continuation{ std::move(job), counter });
+            return;
+        }
+    }
+    push(Task{ std::move(job), counter });
+}
+
+void JobSystem::push(Task task)
+{
+    // ワーカーが無ければその場で実行する
+    if (m_workers.isEmpty())
+    {
+        execute(task);
+        return;
+    }
+
+    if (t_workerIndex >= 0 && t_workerIndex < m_workers.size())
+    {
+        Worker *worker = m_workers.at(t_workerIndex);
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->deque.push_back(std::move(task));
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(m_globalMutex);
+        m_global.push_back(std::move(task));
+    }
+
+    m_pending.fetch_add(1, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+    m_wake.notify_one();
+}
+
+bool JobSystem::pop(Task &task)
+{
+    // 自分のキューは後ろから(直前に投入したジョブはキャッシュに乗っている)
+    if (t_workerIndex >= 0 && t_workerIndex < m_workers.size())
+    {
+        Worker *worker = m_workers.at(t_workerIndex);
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (!worker->deque.empty())
+        {
+            task = std::move(worker->deque.back());
+            worker->deque.pop_back();
+            m_pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_globalMutex);
+        if (!m_global.empty())
+        {
+            task = std::move(m_global.front());
+            m_global.pop_front();
+            m_pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return steal(task, t_workerIndex);
+}
+
+bool JobSystem::steal(Task &task, int thief)
+{
+    // 他のワーカーのキューから前(古い方)を盗む
+    int count = m_workers.size();
+    for (int i = 1; i <= count; i++)
+    {
+        int victim = (qMax(thief, 0) + i) % count;
+        if (victim == thief)
+            continue;
+
+        Worker *worker = m_workers.at(victim);
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (!worker->deque.empty())
+        {
+            task = std::move(worker->deque.front());
+            worker->deque.pop_front();
+            m_pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::execute(Task &task)
+{
+    if (task.job)
+        task.job();
+    if (task.counter)
+        finish(task.counter);
+}
+
+void JobSystem::finish(Counter *counter)
+{
+    QVector<Counter::Continuation> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->m_mutex);
+        if (counter->m_value.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            continuations.swap(counter->m_continuations);
+    }
+
+    for (Counter::Continuation &continuation : continuations)
+        push(Task{ std::move(continuation.job), continuation.counter });
+}
+
+void JobSystem::wait(Counter &counter)
+{
+    while (!counter.done())
+    {
+        Task task;
+        if (pop(task))
+            execute(task);
+        else
+            std::this_thread::yield();
+    }
+
+    // finish() がロックを離すまで待ってから counter を破棄できるようにする
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+void JobSystem::parallelFor(int begin, int end, int grain, const std::function<void(int, int)> &body)
+{
+    int count = end - begin;
+    if (count <= 0)
+        return;
+
+    if (grain <= 0)
+        grain = qMax(1, count / (qMax(m_workers.size(), 1) * 4));
+
+    if (m_workers.isEmpty() || count <= grain)
+    {
+        body(begin, end);
+        return;
+    }
+
+    Counter counter;
+    for (int i = begin; i < end; i += grain)
+    {
+        int chunkEnd = qMin(i + grain, end);
+        run([&body, i, chunkEnd](){ body(i, chunkEnd); }, &counter);
+    }
+    wait(counter);
+}
+
+void JobSystem::invoke(const Job &a, const Job &b)
+{
+    Counter counter;
+    run(b, &counter);
+    a();
+    wait(counter);
+}
+
+void JobSystem::workerLoop(int index)
+{
+    t_workerIndex = index;
+
+    while (true)
+    {
+        Task task;
+        if (pop(task))
+        {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this](){
+            return m_quit.load() || m_pending.load(std::memory_order_acquire) > 0;
+        });
+        if (m_quit)
+            break;
+    }
+
+    t_workerIndex = -1;
+}
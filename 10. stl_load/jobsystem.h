@@ -0,0 +1,108 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <QVector>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// 固定数のワーカーとスレッド毎の work-stealing キューでジョブを実行する
+// 待機中のスレッドも他のジョブを手伝うので、ジョブの中から更にジョブを投げて待てる
+class JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+
+    // 依存カウンタ。0 になると待機が解除され、後続のジョブが投入される
+    class Counter
+    {
+    public:
+        Counter() : m_value(0) {}
+
+        int value() const { return m_value.load(std::memory_order_acquire); }
+        bool done() const { return value() == 0; }
+
+    private:
+        friend class JobSystem;
+
+        struct Continuation
+        {
+            Job job;
+            Counter *counter;
+        };
+
+        std::atomic<int> m_value;
+        std::mutex m_mutex;
+        QVector<Continuation> m_continuations;
+    };
+
+    static JobSystem &instance();
+
+    // ワーカー数の上限(0 なら呼び出し元のスレッドで逐次実行する)
+    // ジョブを実行していない時に呼ぶこと
+    void setThreadCount(int count);
+    int threadCount() const;
+    static int defaultThreadCount();
+
+    // ジョブを投入する。counter は完了時に減らされる
+    void run(Job job, Counter *counter = nullptr);
+
+    // dependency が 0 になってから job を投入する
+    void runAfter(Counter &dependency, Job job, Counter *counter = nullptr);
+
+    // counter が 0 になるまで他のジョブを実行しながら待つ
+    void wait(Counter &counter);
+
+    // [begin, end) を grain 個ずつに分けて body(begin, end) を並列に実行する
+    // grain が 0 以下ならワーカー数から決める
+    void parallelFor(int begin, int end, int grain, const std::function<void(int, int)> &body);
+
+    // a と b を並列に実行して両方の完了を待つ
+    void invoke(const Job &a, const Job &b);
+
+private:
+    struct Task
+    {
+        Job job;
+        Counter *counter;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> deque;
+        std::thread thread;
+    };
+
+    JobSystem();
+    ~JobSystem();
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    void start(int count);
+    void stop();
+    void push(Task task);
+    bool pop(Task &task);
+    bool steal(Task &task, int thief);
+    void execute(Task &task);
+    void finish(Counter *counter);
+    void workerLoop(int index);
+
+    QVector<Worker*> m_workers;
+
+    // ワーカー以外のスレッドから投入されたジョブ
+    std::mutex m_globalMutex;
+    std::deque<Task> m_global;
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    std::atomic<int> m_pending;
+    std::atomic<bool> m_quit;
+
+    static thread_local int t_workerIndex;
+};
+
+#endif // JOBSYSTEM_H
@@ -0,0 +1,86 @@
+#ifndef LINETOKENIZER_H
+#define LINETOKENIZER_H
+
+#include <QByteArray>
+#include <cstring>
+
+// テキスト形式のローダー用に1行を空白で区切る
+// トークンは元のバッファを指すだけなので、行毎にヒープを確保しない
+class LineTokenizer
+{
+public:
+    static const int MaxTokens = 8;
+
+    LineTokenizer() : m_count(0)
+    {
+        m_number.reserve(64);
+    }
+
+    // [begin, end) を区切り、トークン数を返す(MaxTokens を超えた分は無視する)
+    int split(const char *begin, const char *end)
+    {
+        m_count = 0;
+        while (begin < end && m_count < MaxTokens)
+        {
+            while (begin < end && isSpace(*begin))
+                begin++;
+            if (begin == end)
+                break;
+
+            const char *tokenEnd = begin;
+            while (tokenEnd < end && !isSpace(*tokenEnd))
+                tokenEnd++;
+
+            m_begin[m_count] = begin;
+            m_length[m_count] = static_cast<int>(tokenEnd - begin);
+            m_count++;
+            begin = tokenEnd;
+        }
+        return m_count;
+    }
+
+    int count() const { return m_count; }
+    const char *token(int i) const { return m_begin[i]; }
+    int length(int i) const { return m_length[i]; }
+
+    bool is(int i, const char *text) const
+    {
+        int length = static_cast<int>(strlen(text));
+        return i < m_count && m_length[i] == length && memcmp(m_begin[i], text, static_cast<size_t>(length)) == 0;
+    }
+
+    // QByteArray::toFloat と同じ解釈で変換する(作業用のバッファは使い回す)
+    float toFloat(int i)
+    {
+        m_number.resize(m_length[i]);
+        memcpy(m_number.data(), m_begin[i], static_cast<size_t>(m_length[i]));
+        return m_number.toFloat();
+    }
+
+    // 10進の整数を読み、読み終えた位置を返す
+    static const char *parseInt(const char *begin, const char *end, int &value)
+    {
+        bool negative = begin < end && *begin == '-';
+        if (negative || (begin < end && *begin == '+'))
+            begin++;
+
+        int result = 0;
+        while (begin < end && *begin >= '0' && *begin <= '9')
+            result = result * 10 + (*begin++ - '0');
+        value = negative ? -result : result;
+        return begin;
+    }
+
+private:
+    static bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+    }
+
+    const char *m_begin[MaxTokens];
+    int m_length[MaxTokens];
+    int m_count;
+    QByteArray m_number;
+};
+
+#endif // LINETOKENIZER_H
@@ -0,0 +1,131 @@
+#include "allocationcounter.h"
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+
+namespace {
+    std::atomic<qint64> s_count(0);
+    std::atomic<qint64> s_current(0);
+    std::atomic<qint64> s_peak(0);
+    std::atomic<qint64> s_base(0);
+
+    void allocated(qint64 size)
+    {
+        s_count.fetch_add(1, std::memory_order_relaxed);
+        qint64 current = s_current.fetch_add(size, std::memory_order_relaxed) + size;
+        qint64 peak = s_peak.load(std::memory_order_relaxed);
+        while (current > peak && !s_peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {}
+    }
+
+    void freed(qint64 size)
+    {
+        s_current.fetch_sub(size, std::memory_order_relaxed);
+    }
+}
+
+#if defined(__GLIBC__)
+
+extern "C" {
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void *ptr);
+    size_t malloc_usable_size(void *ptr);
+
+    void *malloc(size_t size)
+    {
+        void *ptr = __libc_malloc(size);
+        if (ptr) allocated(static_cast<qint64>(malloc_usable_size(ptr)));
+        return ptr;
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        void *ptr = __libc_calloc(count, size);
+        if (ptr) allocated(static_cast<qint64>(malloc_usable_size(ptr)));
+        return ptr;
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        qint64 old = ptr ? static_cast<qint64>(malloc_usable_size(ptr)) : 0;
+        void *result = __libc_realloc(ptr, size);
+        if (result)
+        {
+            freed(old);
+            allocated(static_cast<qint64>(malloc_usable_size(result)));
+        }
+        else if (size == 0)
+        {
+            freed(old);
+        }
+        return result;
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        void *ptr = __libc_memalign(alignment, size);
+        if (ptr) allocated(static_cast<qint64>(malloc_usable_size(ptr)));
+        return ptr;
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        return memalign(alignment, size);
+    }
+
+    int posix_memalign(void **result, size_t alignment, size_t size)
+    {
+        void *ptr = memalign(alignment, size);
+        if (!ptr)
+            return ENOMEM;
+        *result = ptr;
+        return 0;
+    }
+
+    void free(void *ptr)
+    {
+        if (!ptr)
+            return;
+        freed(static_cast<qint64>(malloc_usable_size(ptr)));
+        __libc_free(ptr);
+    }
+}
+
+bool AllocationCounter::supported()
+{
+    return true;
+}
+
+#else
+
+bool AllocationCounter::supported()
+{
+    return false;
+}
+
+#endif
+
+void AllocationCounter::reset()
+{
+    qint64 current = s_current.load();
+    s_count.store(0);
+    s_base.store(current);
+    s_peak.store(current);
+}
+
+qint64 AllocationCounter::count()
+{
+    return s_count.load();
+}
+
+qint64 AllocationCounter::current()
+{
+    return s_current.load();
+}
+
+qint64 AllocationCounter::peak()
+{
+    return s_peak.load() - s_base.load();
+}
@@ -0,0 +1,20 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+// malloc/free をフックしてヒープの確保回数とピークを数える
+// glibc 以外では計測できないので supported() が false を返す
+namespace AllocationCounter
+{
+    bool supported();
+
+    // 計測開始。現在の確保量を基準にする
+    void reset();
+
+    qint64 count();     // reset() 以降の確保回数
+    qint64 current();   // 現在の確保量(byte)
+    qint64 peak();      // reset() 以降に基準から増えた最大量(byte)
+}
+
+#endif // ALLOCATIONCOUNTER_H
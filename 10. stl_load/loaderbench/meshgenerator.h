@@ -0,0 +1,224 @@
+#ifndef MESHGENERATOR_H
+#define MESHGENERATOR_H
+
+#include <QFile>
+#include <QByteArray>
+#include <QVector3D>
+#include <QString>
+#include <QtEndian>
+#include <QtMath>
+#include <QDebug>
+#include <cstring>
+
+// ベンチマーク用に指定した三角形数の波打った格子メッシュをファイルへ書き出す
+class MeshGenerator
+{
+public:
+    enum class Format
+    {
+        Obj,        // v と f のみ
+        ObjFull,    // v, vt, vn 付き
+        StlAscii,
+        StlBinary,
+    };
+
+    static QString suffix(Format format)
+    {
+        switch (format) {
+        case Format::Obj:       return "plain.obj";
+        case Format::ObjFull:   return "full.obj";
+        case Format::StlAscii:  return "ascii.stl";
+        case Format::StlBinary: return "binary.stl";
+        }
+        return QString();
+    }
+
+    static bool write(const QString &filename, Format format, int triangles)
+    {
+        QFile file(filename);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "Can't open file";
+            return false;
+        }
+
+        MeshGenerator generator(triangles);
+        switch (format) {
+        case Format::Obj:       generator.writeObj(file, false); break;
+        case Format::ObjFull:   generator.writeObj(file, true); break;
+        case Format::StlAscii:  generator.writeStlAscii(file); break;
+        case Format::StlBinary: generator.writeStlBinary(file); break;
+        }
+
+        file.close();
+        return true;
+    }
+
+private:
+    explicit MeshGenerator(int triangles)
+    {
+        m_triangles = qMax(triangles, 2);
+        m_columns = qMax(1, static_cast<int>(qCeil(qSqrt(m_triangles / 2.0))));
+        m_rows = (m_triangles / 2 + m_columns - 1) / m_columns + 1;
+    }
+
+    QVector3D position(int x, int y) const
+    {
+        float u = static_cast<float>(x) / m_columns;
+        float v = static_cast<float>(y) / m_rows;
+        return QVector3D(u, v, 0.05f * qSin(12.0f * u) * qCos(12.0f * v));
+    }
+
+    QVector3D normal(int x, int y) const
+    {
+        QVector3D dx = position(x + 1, y) - position(x, y);
+        QVector3D dy = position(x, y + 1) - position(x, y);
+        return QVector3D::crossProduct(dx, dy).normalized();
+    }
+
+    int index(int x, int y) const
+    {
+        return y * (m_columns + 1) + x;
+    }
+
+    // 三角形 i の頂点番号
+    void triangle(int i, int &a, int &b, int &c) const
+    {
+        int quad = i / 2;
+        int x = quad % m_columns;
+        int y = quad / m_columns;
+        if (i % 2 == 0)
+        {
+            a = index(x, y); b = index(x + 1, y); c = index(x + 1, y + 1);
+        }
+        else
+        {
+            a = index(x, y); b = index(x + 1, y + 1); c = index(x, y + 1);
+        }
+    }
+
+    QVector3D vertex(int i) const
+    {
+        return position(i % (m_columns + 1), i / (m_columns + 1));
+    }
+
+    // ある程度まとめてから書き込む
+    void flush(QFile &file, QByteArray &buffer, bool force = false)
+    {
+        if (force || buffer.size() > (1 << 20))
+        {
+            file.write(buffer);
+            buffer.clear();
+        }
+    }
+
+    static QByteArray number(float value)
+    {
+        return QByteArray::number(static_cast<double>(value), 'g', 7);
+    }
+
+    void writeObj(QFile &file, bool full)
+    {
+        QByteArray buffer;
+        buffer += "# generated by loaderbench\n";
+
+        for (int y = 0; y <= m_rows; y++)
+        {
+            for (int x = 0; x <= m_columns; x++)
+            {
+                QVector3D p = position(x, y);
+                buffer += "v " + number(p.x()) + " " + number(p.y()) + " " + number(p.z()) + "\n";
+                if (full)
+                {
+                    QVector3D n = normal(x, y);
+                    buffer += "vt " + number(p.x()) + " " + number(p.y()) + "\n";
+                    buffer += "vn " + number(n.x()) + " " + number(n.y()) + " " + number(n.z()) + "\n";
+                }
+                flush(file, buffer);
+            }
+        }
+
+        for (int i = 0; i < m_triangles; i++)
+        {
+            int v[3];
+            triangle(i, v[0], v[1], v[2]);
+            buffer += "f";
+            for (int k = 0; k < 3; k++)
+            {
+                QByteArray n = QByteArray::number(v[k] + 1);
+                buffer += " " + (full ? n + "/" + n + "/" + n : n);
+            }
+            buffer += "\n";
+            flush(file, buffer);
+        }
+        flush(file, buffer, true);
+    }
+
+    void writeStlAscii(QFile &file)
+    {
+        QByteArray buffer;
+        buffer += "solid loaderbench\n";
+
+        for (int i = 0; i < m_triangles; i++)
+        {
+            int v[3];
+            triangle(i, v[0], v[1], v[2]);
+            QVector3D n = QVector3D::normal(vertex(v[0]), vertex(v[1]), vertex(v[2]));
+
+            buffer += "  facet normal " + number(n.x()) + " " + number(n.y()) + " " + number(n.z()) + "\n";
+            buffer += "    outer loop\n";
+            for (int k = 0; k < 3; k++)
+            {
+                QVector3D p = vertex(v[k]);
+                buffer += "      vertex " + number(p.x()) + " " + number(p.y()) + " " + number(p.z()) + "\n";
+            }
+            buffer += "    endloop\n";
+            buffer += "  endfacet\n";
+            flush(file, buffer);
+        }
+        buffer += "endsolid loaderbench\n";
+        flush(file, buffer, true);
+    }
+
+    void writeStlBinary(QFile &file)
+    {
+        file.write(QByteArray("loaderbench").leftJustified(80, ' '));
+
+        uchar count[4];
+        qToLittleEndian<quint32>(static_cast<quint32>(m_triangles), count);
+        file.write(reinterpret_cast<const char*>(count), 4);
+
+        auto appendFloat = [](QByteArray &buffer, float value)
+        {
+            quint32 bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            uchar data[4];
+            qToLittleEndian<quint32>(bits, data);
+            buffer.append(reinterpret_cast<const char*>(data), 4);
+        };
+
+        QByteArray buffer;
+        for (int i = 0; i < m_triangles; i++)
+        {
+            int v[3];
+            triangle(i, v[0], v[1], v[2]);
+            QVector3D n = QVector3D::normal(vertex(v[0]), vertex(v[1]), vertex(v[2]));
+
+            appendFloat(buffer, n.x()); appendFloat(buffer, n.y()); appendFloat(buffer, n.z());
+            for (int k = 0; k < 3; k++)
+            {
+                QVector3D p = vertex(v[k]);
+                appendFloat(buffer, p.x()); appendFloat(buffer, p.y()); appendFloat(buffer, p.z());
+            }
+            buffer.append(2, '\0');
+            flush(file, buffer);
+        }
+        flush(file, buffer, true);
+    }
+
+    int m_triangles;
+    int m_columns;
+    int m_rows;
+};
+
+#endif // MESHGENERATOR_H
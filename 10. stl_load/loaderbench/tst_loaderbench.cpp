@@ -0,0 +1,339 @@
+#include <QtTest>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <functional>
+#include <limits>
+#include "model.h"
+#include "meshgenerator.h"
+#include "allocationcounter.h"
+
+namespace {
+    // Qt5 のコンテナは1つの確保を int のバイト数(2GB 未満)に収める
+    // 一番大きい配列は解析した三角形(Triangle3D)か、三角形ごとに3つ作る頂点なので、それに収まる数に抑える
+    // (どちらも1三角形 96 バイトで、約 2236 万三角形)
+    const qint64 BytesPerTriangle = qMax<qint64>(sizeof(Triangle3D), 3 * sizeof(Model::VertexData));
+    const int MaxTriangles = static_cast<int>((std::numeric_limits<int>::max() - 64) / BytesPerTriangle);
+}
+
+// 変換処理だけを呼び出せるようにする
+class BenchModel : public Model
+{
+public:
+    using Model::buildVertices;
+};
+
+// ローダーの各段階(パース・変換)の速度とメモリを計測する
+// 三角形数は環境変数 LOADERBENCH_SIZES で変更できる(例: 1000,100000,20000000)
+// Qt5 のコンテナに収まらない数は MaxTriangles に抑える
+// ワーカー数は LOADERBENCH_THREADS で変更できる(0 で逐次実行)
+class LoaderBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void objParser_data();
+    void objParser();
+    void stlAsciiParser_data();
+    void stlAsciiParser();
+    void stlBinaryParser_data();
+    void stlBinaryParser();
+    void objConvert_data();
+    void objConvert();
+    void stlConvert_data();
+    void stlConvert();
+    void objLoad_data();
+    void objLoad();
+    void stlLoad_data();
+    void stlLoad();
+    void stlAsciiLoad_data();
+    void stlAsciiLoad();
+
+private:
+    void sizes(bool withFormat);
+    QString file(MeshGenerator::Format format, int triangles);
+    qint64 measure(const QString &stage, qint64 bytes, int triangles, const std::function<void()> &body);
+    void load(const QString &stage, const QString &filename, int triangles);
+
+    QTemporaryDir m_dir;
+    QSet<QString> m_files;
+    QOpenGLContext* m_context = nullptr;
+    QOffscreenSurface* m_surface = nullptr;
+};
+
+void LoaderBench::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+
+    bool ok = false;
+    int threads = qEnvironmentVariableIntValue("LOADERBENCH_THREADS", &ok);
+    if (ok)
+        JobSystem::instance().setThreadCount(threads);
+    qInfo() << "Worker threads:" << JobSystem::instance().threadCount();
+
+    // Model の生成にはOpenGLコンテキストが必要
+    m_context = new QOpenGLContext();
+    if (m_context->create())
+    {
+        m_surface = new QOffscreenSurface();
+        m_surface->setFormat(m_context->format());
+        m_surface->create();
+        m_context->makeCurrent(m_surface);
+    }
+
+    if (!AllocationCounter::supported())
+        qInfo() << "Allocation counting is not supported on this platform";
+}
+
+void LoaderBench::cleanupTestCase()
+{
+    if (m_surface)
+        m_context->doneCurrent();
+    delete m_surface;
+    delete m_context;
+}
+
+void LoaderBench::sizes(bool withFormat)
+{
+    QTest::addColumn<int>("triangles");
+    if (withFormat)
+        QTest::addColumn<int>("format");
+
+    QList<QByteArray> values = qEnvironmentVariable("LOADERBENCH_SIZES", "1000,10000,100000,1000000").toUtf8().split(',');
+    for (const auto &value : values)
+    {
+        int triangles = value.trimmed().toInt();
+        if (triangles <= 0)
+            continue;
+        if (triangles > MaxTriangles)
+        {
+            qWarning() << QString("Triangles are limited to %1 by the Qt5 container size").arg(MaxTriangles);
+            triangles = MaxTriangles;
+        }
+
+        if (withFormat)
+        {
+            QTest::newRow(QString("%1 plain").arg(triangles).toUtf8()) << triangles << static_cast<int>(MeshGenerator::Format::Obj);
+            QTest::newRow(QString("%1 vt/vn").arg(triangles).toUtf8()) << triangles << static_cast<int>(MeshGenerator::Format::ObjFull);
+        }
+        else
+        {
+            QTest::newRow(QByteArray::number(triangles)) << triangles;
+        }
+    }
+}
+
+QString LoaderBench::file(MeshGenerator::Format format, int triangles)
+{
+    QString filename = m_dir.filePath(QString("%1_%2").arg(triangles).arg(MeshGenerator::suffix(format)));
+    if (!m_files.contains(filename))
+    {
+        if (!MeshGenerator::write(filename, format, triangles))
+            return QString();
+        m_files.insert(filename);
+    }
+    return filename;
+}
+
+qint64 LoaderBench::measure(const QString &stage, qint64 bytes, int triangles, const std::function<void()> &body)
+{
+    // 1回だけ実行してスループットとメモリを求める
+    AllocationCounter::reset();
+    QElapsedTimer timer;
+    timer.start();
+    body();
+    double seconds = timer.nsecsElapsed() / 1e9;
+    qint64 allocations = AllocationCounter::count();
+    qint64 peak = AllocationCounter::peak();
+
+    QString memory = AllocationCounter::supported()
+            ? QString("%1 allocs, peak %2 MB").arg(allocations).arg(peak / (1024.0 * 1024.0), 0, 'f', 1)
+            : QString("allocs n/a");
+    qInfo().noquote() << QString("%1 [%2 tris]: %3 MB/s, %4 Mtris/s, %5")
+                         .arg(stage)
+                         .arg(triangles)
+                         .arg(bytes / (1024.0 * 1024.0) / seconds, 0, 'f', 1)
+                         .arg(triangles / 1e6 / seconds, 0, 'f', 2)
+                         .arg(memory);
+
+    QBENCHMARK {
+        body();
+    }
+    return peak;
+}
+
+void LoaderBench::load(const QString &stage, const QString &filename, int triangles)
+{
+    QVERIFY(!filename.isEmpty());
+
+    // 最大使用量を、最後に残る頂点と番号の大きさ(GPUに転送する量)と比べる
+    // STL は同じ位置の頂点をまとめるので、大きさは読み込んだモデルから求める
+    qint64 finalBytes = 0;
+    qint64 peak = measure(stage, QFileInfo(filename).size(), triangles, [&](){
+        BenchModel model;
+        model.load(filename);
+        finalBytes = model.meshBytes();
+    });
+    if (!AllocationCounter::supported() || finalBytes == 0)
+        return;
+
+    double ratio = static_cast<double>(peak) / finalBytes;
+    qInfo().noquote() << QString("%1 [%2 tris]: peak %3x of the final %4 MB (target 1.2x)%5")
+                         .arg(stage)
+                         .arg(triangles)
+                         .arg(ratio, 0, 'f', 2)
+                         .arg(finalBytes / (1024.0 * 1024.0), 0, 'f', 1)
+                         .arg(ratio > 1.2 ? " over target" : "");
+}
+
+void LoaderBench::objParser_data()
+{
+    sizes(true);
+}
+
+void LoaderBench::objParser()
+{
+    QFETCH(int, triangles);
+    QFETCH(int, format);
+
+    QString filename = file(static_cast<MeshGenerator::Format>(format), triangles);
+    QVERIFY(!filename.isEmpty());
+
+    measure("WavefrontOBJ::parser", QFileInfo(filename).size(), triangles, [&](){
+        QStringList comments;
+        Arena scratch;
+        ArenaVector<Triangle3D> result(&scratch);
+        WavefrontOBJ().parser(filename, comments, result);
+    });
+}
+
+void LoaderBench::stlAsciiParser_data()
+{
+    sizes(false);
+}
+
+void LoaderBench::stlAsciiParser()
+{
+    QFETCH(int, triangles);
+
+    QString filename = file(MeshGenerator::Format::StlAscii, triangles);
+    QVERIFY(!filename.isEmpty());
+    QVERIFY(StlLoader().isAscii(filename));
+
+    measure("StlLoader::parserAscii", QFileInfo(filename).size(), triangles, [&](){
+        QString comment;
+        Arena scratch;
+        ArenaVector<StlLoader::Triangle3D> result(&scratch);
+        StlLoader().parserAscii(filename, comment, result);
+    });
+}
+
+void LoaderBench::stlBinaryParser_data()
+{
+    sizes(false);
+}
+
+void LoaderBench::stlBinaryParser()
+{
+    QFETCH(int, triangles);
+
+    QString filename = file(MeshGenerator::Format::StlBinary, triangles);
+    QVERIFY(!filename.isEmpty());
+    QVERIFY(!StlLoader().isAscii(filename));
+
+    measure("StlLoader::parserBinary", QFileInfo(filename).size(), triangles, [&](){
+        QString comment;
+        Arena scratch;
+        ArenaVector<StlLoader::Triangle3D> result(&scratch);
+        StlLoader().parserBinary(filename, comment, result);
+    });
+}
+
+void LoaderBench::objConvert_data()
+{
+    sizes(false);
+}
+
+void LoaderBench::objConvert()
+{
+    QFETCH(int, triangles);
+    if (!m_surface)
+        QSKIP("OpenGL context is not available");
+
+    QStringList comments;
+    QVector<Triangle3D> parsed;
+    QVERIFY(WavefrontOBJ().parser(file(MeshGenerator::Format::ObjFull, triangles), comments, parsed));
+    QCOMPARE(parsed.size(), triangles);
+
+    BenchModel model;
+    measure("Model::loadObj convert", parsed.size() * static_cast<qint64>(sizeof(Triangle3D)), triangles, [&](){
+        model.buildVertices(parsed);
+    });
+}
+
+void LoaderBench::stlConvert_data()
+{
+    sizes(false);
+}
+
+void LoaderBench::stlConvert()
+{
+    QFETCH(int, triangles);
+    if (!m_surface)
+        QSKIP("OpenGL context is not available");
+
+    QString comment;
+    QVector<StlLoader::Triangle3D> parsed;
+    QVERIFY(StlLoader().parserBinary(file(MeshGenerator::Format::StlBinary, triangles), comment, parsed));
+    QCOMPARE(parsed.size(), triangles);
+
+    BenchModel model;
+    measure("Model::loadStl convert", parsed.size() * static_cast<qint64>(sizeof(StlLoader::Triangle3D)), triangles, [&](){
+        model.buildVertices(parsed);
+    });
+}
+
+void LoaderBench::objLoad_data()
+{
+    sizes(false);
+}
+
+void LoaderBench::objLoad()
+{
+    QFETCH(int, triangles);
+
+    // パースから頂点の生成まで(解析した三角形は頂点配列に直接書き込まれる)
+    load("Model::load obj", file(MeshGenerator::Format::ObjFull, triangles), triangles);
+}
+
+void LoaderBench::stlLoad_data()
+{
+    sizes(false);
+}
+
+void LoaderBench::stlLoad()
+{
+    QFETCH(int, triangles);
+
+    load("Model::load stl", file(MeshGenerator::Format::StlBinary, triangles), triangles);
+}
+
+void LoaderBench::stlAsciiLoad_data()
+{
+    sizes(false);
+}
+
+void LoaderBench::stlAsciiLoad()
+{
+    QFETCH(int, triangles);
+
+    load("Model::load ascii stl", file(MeshGenerator::Format::StlAscii, triangles), triangles);
+}
+
+QTEST_MAIN(LoaderBench)
+
+#include "tst_loaderbench.moc"
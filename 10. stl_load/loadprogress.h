@@ -0,0 +1,37 @@
+#ifndef LOADPROGRESS_H
+#define LOADPROGRESS_H
+
+#include <QtGlobal>
+#include <atomic>
+
+// 読み込みスレッドとの間で進捗とキャンセル要求をやり取りする
+// 読み込み(read)と解析(parse)でそれぞれファイルサイズ分進む
+// テキスト形式は数える時の読み込みを read、解析する時の読み込みを parse とする
+class LoadProgress
+{
+public:
+    LoadProgress() : m_total(0), m_done(0), m_canceled(false) {}
+
+    void setTotal(qint64 bytes) { m_total = bytes * 2; m_done = 0; }
+    void add(qint64 bytes) { m_done.fetch_add(bytes, std::memory_order_relaxed); }
+
+    double fraction() const
+    {
+        qint64 total = m_total.load();
+        return total > 0 ? qMin(1.0, static_cast<double>(m_done.load()) / total) : 0.0;
+    }
+
+    void cancel() { m_canceled = true; }
+    bool isCanceled() const { return m_canceled.load(std::memory_order_relaxed); }
+
+    // progress が nullptr でも使えるようにする
+    static bool canceled(const LoadProgress *progress) { return progress && progress->isCanceled(); }
+    static void advance(LoadProgress *progress, qint64 bytes) { if (progress) progress->add(bytes); }
+
+private:
+    std::atomic<qint64> m_total;
+    std::atomic<qint64> m_done;
+    std::atomic<bool> m_canceled;
+};
+
+#endif // LOADPROGRESS_H
@@ -1,11 +1,28 @@
 #include "mainwindow.h"
+#include "jobsystem.h"
+#include "gpuresources.h"
 
 #include <QApplication>
 #include <QSurfaceFormat>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    // 共有マシンで他のプロセスと共存できるようにワーカー数を制限する
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption threads("threads", "Number of worker threads (0 = run jobs on the calling thread).", "count");
+    parser.addOption(threads);
+    QCommandLineOption gpuBudget("gpu-budget", "GPU memory budget in MB (0 = unlimited).", "MB");
+    parser.addOption(gpuBudget);
+    parser.process(a);
+    if (parser.isSet(threads))
+        JobSystem::instance().setThreadCount(parser.value(threads).toInt());
+    if (parser.isSet(gpuBudget))
+        GpuResources::setDefaultBudget(parser.value(gpuBudget).toLongLong() << 20);
+
     MainWindow w;
     w.show();
     return a.exec();
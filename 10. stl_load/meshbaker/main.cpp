@@ -0,0 +1,146 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDebug>
+#include <cstring>
+#include "wavefrontobj.h"
+#include "stlloader.h"
+#include "bakedmesh.h"
+#include "meshoptimizer.h"
+
+namespace {
+
+BakedMesh::Vertex vertex(const QVector3D &position, const QVector3D &normal, const QVector2D &texCoord)
+{
+    BakedMesh::Vertex v;
+    v.position[0] = position.x();
+    v.position[1] = position.y();
+    v.position[2] = position.z();
+    v.normal[0] = normal.x();
+    v.normal[1] = normal.y();
+    v.normal[2] = normal.z();
+    v.texCoord[0] = texCoord.x();
+    v.texCoord[1] = texCoord.y();
+    return v;
+}
+
+// Model::loadObj / loadStl と同じく三角形毎に3頂点を作る
+bool loadCorners(const QString &fileName, QVector<BakedMesh::Vertex> &corners)
+{
+    QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == "obj")
+    {
+        QStringList comments;
+        QVector<Triangle3D> triangles;
+        if (!WavefrontOBJ().parser(fileName, comments, triangles))
+            return false;
+
+        corners.reserve(triangles.size() * 3);
+        for (const Triangle3D &t : triangles)
+        {
+            corners.append(vertex(t.p1, t.p1Normal, t.p1TexCoord));
+            corners.append(vertex(t.p2, t.p2Normal, t.p2TexCoord));
+            corners.append(vertex(t.p3, t.p3Normal, t.p3TexCoord));
+        }
+        return true;
+    }
+    if (suffix == "stl")
+    {
+        StlLoader loader;
+        QString comment;
+        QVector<StlLoader::Triangle3D> triangles;
+        bool loaded = loader.isAscii(fileName)
+                ? loader.parserAscii(fileName, comment, triangles)
+                : loader.parserBinary(fileName, comment, triangles);
+        if (!loaded)
+            return false;
+
+        corners.reserve(triangles.size() * 3);
+        for (const StlLoader::Triangle3D &t : triangles)
+        {
+            corners.append(vertex(t.position1, t.normal, QVector2D()));
+            corners.append(vertex(t.position2, t.normal, QVector2D()));
+            corners.append(vertex(t.position3, t.normal, QVector2D()));
+        }
+        return true;
+    }
+
+    qWarning() << QString("This file is not supported(.%1)").arg(suffix);
+    return false;
+}
+
+bool write(const QString &fileName, const QVector<BakedMesh::Vertex> &vertices, const QVector<quint32> &indexes)
+{
+    BakedMesh::Header header;
+    std::memcpy(header.magic, BakedMesh::magic(), 4);
+    header.version = BakedMesh::Version;
+    header.vertexStride = sizeof(BakedMesh::Vertex);
+    header.vertexCount = static_cast<quint32>(vertices.size());
+    header.indexCount = static_cast<quint32>(indexes.size());
+    header.vertexOffset = sizeof(BakedMesh::Header);
+    header.indexOffset = header.vertexOffset + header.vertexCount * sizeof(BakedMesh::Vertex);
+    header.reserved = 0;
+
+    // 途中で失敗しても前回の出力を壊さない
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Can't open file" << fileName;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(vertices.constData()), vertices.size() * static_cast<qint64>(sizeof(BakedMesh::Vertex)));
+    file.write(reinterpret_cast<const char*>(indexes.constData()), indexes.size() * static_cast<qint64>(sizeof(quint32)));
+    return file.commit();
+}
+
+}
+
+// 組み込みのメッシュを読み込んで、重複した頂点をまとめ、頂点キャッシュの順に並べて書き出す
+// qmake の extra compiler からビルド時に呼ばれる(stl_load.pro の BAKED_MESHES)
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("meshbaker");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts .obj/.stl meshes into the pre-indexed binary format loaded by Model.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Mesh to convert (.obj or .stl).");
+    parser.addPositionalArgument("output", "Baked mesh to write.");
+    QCommandLineOption quietOption("quiet", "Do not print statistics.");
+    parser.addOption(quietOption);
+    parser.process(app);
+
+    QStringList arguments = parser.positionalArguments();
+    if (arguments.size() != 2)
+        parser.showHelp(1);
+
+    QVector<BakedMesh::Vertex> corners;
+    if (!loadCorners(arguments.at(0), corners))
+        return 1;
+
+    QVector<BakedMesh::Vertex> vertices;
+    QVector<quint32> indexes;
+    MeshOptimizer::weld(corners, vertices, indexes);
+    double before = MeshOptimizer::averageCacheMissRatio(indexes, vertices.size());
+    MeshOptimizer::optimizeVertexCache(indexes, vertices.size());
+    MeshOptimizer::optimizeVertexFetch(vertices, indexes);
+    double after = MeshOptimizer::averageCacheMissRatio(indexes, vertices.size());
+
+    if (!write(arguments.at(1), vertices, indexes))
+        return 1;
+
+    if (!parser.isSet(quietOption))
+    {
+        qInfo().noquote() << QString("%1: %2 triangles, %3 -> %4 vertices, ACMR %5 -> %6")
+                             .arg(QFileInfo(arguments.at(0)).fileName())
+                             .arg(indexes.size() / 3)
+                             .arg(corners.size())
+                             .arg(vertices.size())
+                             .arg(before, 0, 'f', 3)
+                             .arg(after, 0, 'f', 3);
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+QT       += core gui
+
+CONFIG += c++14 console
+CONFIG -= app_bundle debug_and_release
+
+TARGET = meshbaker
+
+# The following define makes your compiler emit warnings if you use
+# any Qt feature that has been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# Build the loaders from the viewer sources.
+INCLUDEPATH += ..
+
+# stl_load.pro runs the baker from this directory.
+DESTDIR = $$OUT_PWD
+
+SOURCES += \
+    ../arena.cpp \
+    ../jobsystem.cpp \
+    main.cpp \
+    meshoptimizer.cpp
+
+HEADERS += \
+    ../arena.h \
+    ../bakedmesh.h \
+    ../chunkreader.h \
+    ../jobsystem.h \
+    ../linetokenizer.h \
+    ../loadprogress.h \
+    ../stlloader.h \
+    ../wavefrontobj.h \
+    meshoptimizer.h
@@ -0,0 +1,245 @@
+#include "meshoptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+// 頂点はビット単位で比較する(-0.0 と 0.0 は別の頂点になる)
+struct VertexHash
+{
+    size_t operator()(const BakedMesh::Vertex &vertex) const
+    {
+        // FNV-1a
+        const uchar *p = reinterpret_cast<const uchar*>(&vertex);
+        quint64 hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < sizeof(BakedMesh::Vertex); i++)
+        {
+            hash ^= p[i];
+            hash *= 1099511628211ULL;
+        }
+        return static_cast<size_t>(hash);
+    }
+};
+
+struct VertexEqual
+{
+    bool operator()(const BakedMesh::Vertex &a, const BakedMesh::Vertex &b) const
+    {
+        return std::memcmp(&a, &b, sizeof(BakedMesh::Vertex)) == 0;
+    }
+};
+
+const int MaxCacheSize = 64;
+
+// キャッシュ内の位置と、まだ出力していない三角形の数から頂点の優先度を求める
+float vertexScore(int cachePosition, int remaining, int cacheSize)
+{
+    if (remaining == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // 直前の三角形の頂点は、続けて使うと同じ辺を共有しやすいので一定にする
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - static_cast<float>(cachePosition - 3) / (cacheSize - 3), 1.5f);
+    }
+
+    // 残りの三角形が少ない頂点を先に片付ける
+    score += 2.0f * std::pow(static_cast<float>(remaining), -0.5f);
+    return score;
+}
+
+}
+
+void MeshOptimizer::weld(const QVector<BakedMesh::Vertex> &corners, QVector<BakedMesh::Vertex> &vertices, QVector<quint32> &indexes)
+{
+    vertices.clear();
+    indexes.clear();
+    indexes.reserve(corners.size());
+
+    std::unordered_map<BakedMesh::Vertex, quint32, VertexHash, VertexEqual> lookup;
+    lookup.reserve(static_cast<size_t>(corners.size()));
+    for (const BakedMesh::Vertex &corner : corners)
+    {
+        auto result = lookup.emplace(corner, static_cast<quint32>(vertices.size()));
+        if (result.second)
+            vertices.append(corner);
+        indexes.append(result.first->second);
+    }
+}
+
+void MeshOptimizer::optimizeVertexCache(QVector<quint32> &indexes, int vertexCount, int cacheSize)
+{
+    int triangleCount = indexes.size() / 3;
+    if (triangleCount == 0)
+        return;
+    cacheSize = qBound(4, cacheSize, MaxCacheSize);
+
+    // 頂点毎に、まだ出力していない三角形の一覧を持つ
+    // adjacency[offsets[v] .. offsets[v] + remaining[v]) が頂点 v の未出力の三角形
+    QVector<int> offsets(vertexCount + 1, 0);
+    for (quint32 index : indexes)
+        offsets[static_cast<int>(index) + 1]++;
+    for (int v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+
+    QVector<int> adjacency(indexes.size());
+    QVector<int> remaining(vertexCount, 0);
+    for (int t = 0; t < triangleCount; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            int v = static_cast<int>(indexes.at(t * 3 + k));
+            adjacency[offsets.at(v) + remaining[v]++] = t;
+        }
+    }
+
+    QVector<int> cachePosition(vertexCount, -1);
+    QVector<float> vertexScores(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(-1, remaining.at(v), cacheSize);
+
+    auto triangleScore = [&](int t){
+        return vertexScores.at(static_cast<int>(indexes.at(t * 3)))
+                + vertexScores.at(static_cast<int>(indexes.at(t * 3 + 1)))
+                + vertexScores.at(static_cast<int>(indexes.at(t * 3 + 2)));
+    };
+
+    // 最初は全体で優先度が最も高い三角形から始める
+    QVector<bool> emitted(triangleCount, false);
+    int best = 0;
+    float bestScore = triangleScore(0);
+    for (int t = 1; t < triangleCount; t++)
+    {
+        float score = triangleScore(t);
+        if (score > bestScore)
+        {
+            best = t;
+            bestScore = score;
+        }
+    }
+
+    QVector<quint32> output;
+    output.reserve(indexes.size());
+    int cache[MaxCacheSize + 3];
+    int cacheCount = 0;
+    int cursor = 0;
+    while (output.size() < indexes.size())
+    {
+        if (best < 0)
+        {
+            // キャッシュの頂点を使う三角形が無ければ、まだ出力していない三角形から続ける
+            while (emitted.at(cursor))
+                cursor++;
+            best = cursor;
+        }
+
+        emitted[best] = true;
+        int triangle[3];
+        for (int k = 0; k < 3; k++)
+        {
+            triangle[k] = static_cast<int>(indexes.at(best * 3 + k));
+            output.append(static_cast<quint32>(triangle[k]));
+
+            // 未出力の一覧から外す
+            int v = triangle[k];
+            int *begin = adjacency.data() + offsets.at(v);
+            int *end = begin + remaining.at(v);
+            for (int *it = begin; it < end; it++)
+            {
+                if (*it == best)
+                {
+                    *it = *(end - 1);
+                    remaining[v]--;
+                    break;
+                }
+            }
+        }
+
+        // 使った頂点をキャッシュの先頭に移す。溢れた頂点はキャッシュから外れる
+        int updated[MaxCacheSize + 3];
+        int updatedCount = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if (std::find(updated, updated + updatedCount, triangle[k]) == updated + updatedCount)
+                updated[updatedCount++] = triangle[k];
+        }
+        for (int i = 0; i < cacheCount; i++)
+        {
+            if (std::find(triangle, triangle + 3, cache[i]) == triangle + 3)
+                updated[updatedCount++] = cache[i];
+        }
+
+        for (int i = 0; i < updatedCount; i++)
+        {
+            int v = updated[i];
+            cachePosition[v] = i < cacheSize ? i : -1;
+            vertexScores[v] = vertexScore(cachePosition.at(v), remaining.at(v), cacheSize);
+        }
+
+        // 優先度が変わった頂点を使う三角形から次を選ぶ
+        best = -1;
+        bestScore = -1.0f;
+        for (int i = 0; i < updatedCount; i++)
+        {
+            int v = updated[i];
+            for (int a = offsets.at(v); a < offsets.at(v) + remaining.at(v); a++)
+            {
+                int t = adjacency.at(a);
+                float score = triangleScore(t);
+                if (score > bestScore)
+                {
+                    best = t;
+                    bestScore = score;
+                }
+            }
+        }
+
+        cacheCount = qMin(updatedCount, cacheSize);
+        std::copy(updated, updated + cacheCount, cache);
+    }
+
+    indexes = output;
+}
+
+void MeshOptimizer::optimizeVertexFetch(QVector<BakedMesh::Vertex> &vertices, QVector<quint32> &indexes)
+{
+    // 参照されない頂点は捨てる
+    QVector<int> remap(vertices.size(), -1);
+    QVector<BakedMesh::Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (quint32 &index : indexes)
+    {
+        int v = static_cast<int>(index);
+        if (remap.at(v) < 0)
+        {
+            remap[v] = ordered.size();
+            ordered.append(vertices.at(v));
+        }
+        index = static_cast<quint32>(remap.at(v));
+    }
+    vertices = ordered;
+}
+
+double MeshOptimizer::averageCacheMissRatio(const QVector<quint32> &indexes, int vertexCount, int cacheSize)
+{
+    int triangleCount = indexes.size() / 3;
+    if (triangleCount == 0)
+        return 0.0;
+
+    // 読み込んだ時刻が cacheSize 回の読み込みより前ならキャッシュから外れている
+    QVector<qint64> loaded(vertexCount, -static_cast<qint64>(cacheSize) - 1);
+    qint64 time = 0;
+    for (quint32 index : indexes)
+    {
+        int v = static_cast<int>(index);
+        if (time - loaded.at(v) > cacheSize)
+            loaded[v] = time++;
+    }
+    return static_cast<double>(time) / triangleCount;
+}
@@ -0,0 +1,24 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <QVector>
+#include "bakedmesh.h"
+
+// 三角形毎の頂点列をインデックス付きのメッシュにして、GPUで読みやすい順に並べ替える
+class MeshOptimizer
+{
+public:
+    // 同じ頂点(位置・法線・UVが全て一致)をまとめて番号を振る
+    static void weld(const QVector<BakedMesh::Vertex> &corners, QVector<BakedMesh::Vertex> &vertices, QVector<quint32> &indexes);
+
+    // 頂点キャッシュに残っている頂点を使う三角形から順に並べる(Tom Forsyth の方法)
+    static void optimizeVertexCache(QVector<quint32> &indexes, int vertexCount, int cacheSize = 32);
+
+    // 頂点を番号で最初に参照される順に並べ直す
+    static void optimizeVertexFetch(QVector<BakedMesh::Vertex> &vertices, QVector<quint32> &indexes);
+
+    // 指定した大きさの FIFO キャッシュで、三角形あたり平均何頂点を読み直すか(小さいほどよい。最大は 3)
+    static double averageCacheMissRatio(const QVector<quint32> &indexes, int vertexCount, int cacheSize = 32);
+};
+
+#endif // MESHOPTIMIZER_H
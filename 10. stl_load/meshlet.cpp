@@ -0,0 +1,335 @@
+#include "meshlet.h"
+#include "jobsystem.h"
+#include <QtMath>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+QVector3D positionAt(const uchar *vertices, int stride, GLuint index)
+{
+    float position[3];
+    std::memcpy(position, vertices + static_cast<qint64>(index) * stride, sizeof(position));
+    return QVector3D(position[0], position[1], position[2]);
+}
+
+// メッシュレットの頂点の集合(開番地法)
+// 頂点は高々 MaxVertices 個なので、その倍の大きさにして毎回空にする
+class VertexSet
+{
+public:
+    static const int Capacity = MeshletBuilder::MaxVertices * 2;
+
+    void clear()
+    {
+        for (GLuint &slot : m_slots)
+            slot = Empty;
+        m_count = 0;
+    }
+
+    bool contains(GLuint index) const
+    {
+        for (int slot = hash(index); ; slot = (slot + 1) & (Capacity - 1))
+        {
+            if (m_slots[slot] == index)
+                return true;
+            if (m_slots[slot] == Empty)
+                return false;
+        }
+    }
+
+    // 新しく加えたら true
+    bool insert(GLuint index)
+    {
+        int slot = hash(index);
+        while (m_slots[slot] != Empty)
+        {
+            if (m_slots[slot] == index)
+                return false;
+            slot = (slot + 1) & (Capacity - 1);
+        }
+        m_slots[slot] = index;
+        m_count++;
+        return true;
+    }
+
+    int size() const { return m_count; }
+
+    // 三角形を加えた時に増える頂点の数(同じ番号が重なった三角形も数える)
+    int newVertexCount(const GLuint *triangle) const
+    {
+        int count = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            bool duplicate = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+            if (!duplicate && !contains(triangle[k]))
+                count++;
+        }
+        return count;
+    }
+
+private:
+    static const GLuint Empty = ~0u;
+
+    static int hash(GLuint index)
+    {
+        return static_cast<int>((index * 2654435761u) >> 24) & (Capacity - 1);
+    }
+
+    GLuint m_slots[Capacity];
+    int m_count;
+};
+
+void computeBounds(Meshlet &meshlet, const uchar *vertices, int stride, const GLuint *indexes)
+{
+    const GLuint *first = indexes + meshlet.firstIndex;
+    const GLuint *last = first + meshlet.indexCount;
+
+    // 包む球は AABB の中心から求める(最小ではないが十分に小さい)
+    float lowest = std::numeric_limits<float>::lowest();
+    float highest = std::numeric_limits<float>::max();
+    QVector3D minimum(highest, highest, highest);
+    QVector3D maximum(lowest, lowest, lowest);
+    for (const GLuint *index = first; index < last; index++)
+    {
+        QVector3D p = positionAt(vertices, stride, *index);
+        minimum = QVector3D(qMin(minimum.x(), p.x()), qMin(minimum.y(), p.y()), qMin(minimum.z(), p.z()));
+        maximum = QVector3D(qMax(maximum.x(), p.x()), qMax(maximum.y(), p.y()), qMax(maximum.z(), p.z()));
+    }
+    meshlet.center = (minimum + maximum) * 0.5f;
+    float radius = 0.0f;
+    for (const GLuint *index = first; index < last; index++)
+        radius = qMax(radius, (positionAt(vertices, stride, *index) - meshlet.center).lengthSquared());
+    meshlet.radius = std::sqrt(radius);
+
+    // 法線の錐: 軸は面の法線の平均、広がりは軸から最も離れた法線で決める
+    QVector3D axis;
+    for (const GLuint *index = first; index < last; index += 3)
+    {
+        QVector3D p1 = positionAt(vertices, stride, index[0]);
+        QVector3D p2 = positionAt(vertices, stride, index[1]);
+        QVector3D p3 = positionAt(vertices, stride, index[2]);
+        axis += QVector3D::normal(p1, p2, p3);
+    }
+
+    meshlet.coneAxis = axis.normalized();
+    meshlet.coneCutoff = 1.0f;
+    if (axis.lengthSquared() < 1e-12f)
+        return;
+
+    float minimumDot = 1.0f;
+    for (const GLuint *index = first; index < last; index += 3)
+    {
+        QVector3D p1 = positionAt(vertices, stride, index[0]);
+        QVector3D p2 = positionAt(vertices, stride, index[1]);
+        QVector3D p3 = positionAt(vertices, stride, index[2]);
+        QVector3D normal = QVector3D::normal(p1, p2, p3);
+        if (!normal.isNull())
+            minimumDot = qMin(minimumDot, QVector3D::dotProduct(normal, meshlet.coneAxis));
+    }
+
+    // 広がりが 90 度近いと外せることがほとんど無いので判定しない
+    if (minimumDot > 0.1f)
+        meshlet.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+}
+
+}
+
+QVector<Meshlet> MeshletBuilder::build(const void *vertices, int stride, int vertexCount, GLuint *indexes, int indexCount)
+{
+    QVector<Meshlet> meshlets;
+    int triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return meshlets;
+
+    // 頂点毎に、その頂点を使う三角形の一覧を持つ
+    // adjacency[offsets[v] .. offsets[v + 1]) が頂点 v を使う三角形
+    QVector<int> offsets(vertexCount + 1, 0);
+    for (int i = 0; i < triangleCount * 3; i++)
+        offsets[static_cast<int>(indexes[i]) + 1]++;
+    for (int v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+
+    QVector<int> adjacency(triangleCount * 3);
+    {
+        QVector<int> filled(offsets);
+        for (int t = 0; t < triangleCount; t++)
+        {
+            for (int k = 0; k < 3; k++)
+                adjacency[filled[static_cast<int>(indexes[t * 3 + k])]++] = t;
+        }
+    }
+
+    // 三角形を ChunkTriangles 個ずつに分けて並列に作る(分け方はワーカー数に依らないので結果は同じ)
+    // 三角形毎の配列はブロック内の要素にしか書き込まない
+    int chunkCount = (triangleCount + ChunkTriangles - 1) / ChunkTriangles;
+    QVector<QVector<Meshlet>> chunks(chunkCount);
+    QVector<GLuint> ordered(triangleCount * 3);
+    QVector<char> emitted(triangleCount, 0);
+    QVector<int> candidateOf(triangleCount, -1);    // 三角形を候補に加えたメッシュレット(重複させない)
+    JobSystem::instance().parallelFor(0, chunkCount, 1, [&](int firstChunk, int lastChunk){
+        for (int chunk = firstChunk; chunk < lastChunk; chunk++)
+        {
+            int begin = chunk * ChunkTriangles;
+            int end = qMin(begin + ChunkTriangles, triangleCount);
+            QVector<Meshlet> &output = chunks[chunk];
+            output.reserve((end - begin) / MaxTriangles + 1);
+
+            VertexSet meshletVertices;
+            QVector<int> candidates;    // 今のメッシュレットと頂点を共有する、まだ使っていない三角形
+            int written = begin * 3;
+            int cursor = begin;
+            int next = -1;
+            while (written < end * 3)
+            {
+                Meshlet meshlet;
+                meshlet.firstIndex = static_cast<GLuint>(written);
+                int id = output.size();
+                int triangleTotal = 0;
+                meshletVertices.clear();
+                candidates.clear();
+
+                while (triangleTotal < MaxTriangles)
+                {
+                    // 隣に続ける三角形が無ければ、まだ使っていない最初の三角形から始める
+                    if (next < 0)
+                    {
+                        while (cursor < end && emitted.at(cursor))
+                            cursor++;
+                        if (cursor == end)
+                            break;
+                        next = cursor;
+                    }
+
+                    const GLuint *triangle = indexes + next * 3;
+                    if (meshletVertices.size() + meshletVertices.newVertexCount(triangle) > MaxVertices)
+                        break;
+
+                    emitted[next] = 1;
+                    triangleTotal++;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        GLuint index = triangle[k];
+                        ordered[written++] = index;
+                        if (!meshletVertices.insert(index))
+                            continue;
+
+                        int v = static_cast<int>(index);
+                        for (int a = offsets.at(v); a < offsets.at(v + 1); a++)
+                        {
+                            int t = adjacency.at(a);
+                            if (t >= begin && t < end && !emitted.at(t) && candidateOf.at(t) != id)
+                            {
+                                candidateOf[t] = id;
+                                candidates.append(t);
+                            }
+                        }
+                    }
+
+                    // 増える頂点が最も少ない三角形を次にする(同じなら先に候補になったもの)
+                    // 使い終わった候補は詰めて除く
+                    int best = -1;
+                    int bestAdded = 4;
+                    int kept = 0;
+                    for (int i = 0; i < candidates.size(); i++)
+                    {
+                        int t = candidates.at(i);
+                        if (emitted.at(t))
+                            continue;
+                        candidates[kept++] = t;
+                        int count = meshletVertices.newVertexCount(indexes + t * 3);
+                        if (count < bestAdded)
+                        {
+                            best = t;
+                            bestAdded = count;
+                        }
+                    }
+                    candidates.resize(kept);
+                    next = best;
+                }
+
+                meshlet.indexCount = static_cast<GLuint>(written) - meshlet.firstIndex;
+                output.append(meshlet);
+            }
+        }
+    });
+
+    std::memcpy(indexes, ordered.constData(), static_cast<size_t>(ordered.size()) * sizeof(GLuint));
+    for (const QVector<Meshlet> &chunk : chunks)
+        meshlets += chunk;
+
+    // 包む球と法線の錐はメッシュレット毎に独立して求められる
+    const uchar *data = static_cast<const uchar*>(vertices);
+    Meshlet *output = meshlets.data();
+    JobSystem::instance().parallelFor(0, meshlets.size(), 256, [=](int begin, int end){
+        for (int i = begin; i < end; i++)
+            computeBounds(output[i], data, stride, indexes);
+    });
+    return meshlets;
+}
+
+MeshletCuller::MeshletCuller(const QMatrix4x4 &mvp, const QMatrix4x4 &modelView)
+{
+    // クリップ座標の -w <= x,y,z <= w をモデル座標の平面にする
+    QVector4D x = mvp.row(0);
+    QVector4D y = mvp.row(1);
+    QVector4D z = mvp.row(2);
+    QVector4D w = mvp.row(3);
+    m_planes[0] = w + x;
+    m_planes[1] = w - x;
+    m_planes[2] = w + y;
+    m_planes[3] = w - y;
+    m_planes[4] = w + z;
+    m_planes[5] = w - z;
+    for (QVector4D &plane : m_planes)
+    {
+        float length = plane.toVector3D().length();
+        if (length > 0.0f)
+            plane /= length;
+    }
+
+    bool invertible = false;
+    QMatrix4x4 inverse = modelView.inverted(&invertible);
+    m_eye = inverse.map(QVector3D());
+
+    // 各軸の拡大率が同じで、反転していなければ角度が保たれる
+    QVector3D axisX = modelView.column(0).toVector3D();
+    QVector3D axisY = modelView.column(1).toVector3D();
+    QVector3D axisZ = modelView.column(2).toVector3D();
+    QVector3D scale(axisX.length(), axisY.length(), axisZ.length());
+    float determinant = QVector3D::dotProduct(axisX, QVector3D::crossProduct(axisY, axisZ));
+    m_coneCulling = invertible && determinant > 0.0f
+            && qAbs(scale.x() - scale.y()) <= 1e-3f * scale.x()
+            && qAbs(scale.x() - scale.z()) <= 1e-3f * scale.x();
+}
+
+bool MeshletCuller::isVisible(const Meshlet &meshlet) const
+{
+    if (!isInside(meshlet.center, meshlet.radius))
+        return false;
+
+    // 視点から見て全ての面が裏を向いている
+    if (m_coneCulling && meshlet.coneCutoff < 1.0f)
+    {
+        QVector3D view = meshlet.center - m_eye;
+        if (QVector3D::dotProduct(view, meshlet.coneAxis) >= meshlet.coneCutoff * view.length() + meshlet.radius)
+            return false;
+    }
+    return true;
+}
+
+bool MeshletCuller::isInside(const QVector3D &center, float radius) const
+{
+    for (const QVector4D &plane : m_planes)
+    {
+        if (QVector3D::dotProduct(plane.toVector3D(), center) + plane.w() < -radius)
+            return false;
+    }
+    return true;
+}
+
+bool MeshletCuller::isConeCulling() const
+{
+    return m_coneCulling;
+}
@@ -0,0 +1,64 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <QOpenGLFunctions>
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector3D>
+#include <QVector4D>
+
+// 頂点 MaxVertices 個・三角形 MaxTriangles 個以下の三角形のまとまり
+// 大きなメッシュを細かく分けて、見えないまとまりを描画前に外す
+struct Meshlet
+{
+    QVector3D center;       // 三角形を包む球(モデル座標)
+    float radius;
+    QVector3D coneAxis;     // 面の法線がこの軸の周りの錐に収まる
+    float coneCutoff;       // 錐の広がり(sin)。1 なら向きでは外さない
+    GLuint firstIndex;      // 並べ替えたインデックス配列の範囲
+    GLuint indexCount;
+};
+
+// glMultiDrawElementsIndirect の1回分の描画
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+class MeshletBuilder
+{
+public:
+    static const int MaxVertices = 64;
+    static const int MaxTriangles = 124;
+    // この数の三角形毎に並列に分ける
+    static const int ChunkTriangles = 1 << 16;
+
+    // 隣接する三角形を順に集めてメッシュレットに分け、indexes をメッシュレット毎に連続するように並べ替える
+    // 頂点の位置は各頂点の先頭にあること(stride は頂点の大きさ)
+    static QVector<Meshlet> build(const void *vertices, int stride, int vertexCount, GLuint *indexes, int indexCount);
+};
+
+// 視錐台の外と、全ての面が裏を向いているメッシュレットを外す
+// 判定はモデル座標で行うので、メッシュレット毎に変換しなくてよい
+class MeshletCuller
+{
+public:
+    // mvp はモデル座標からクリップ座標、modelView はモデル座標から視点座標への変換
+    MeshletCuller(const QMatrix4x4 &mvp, const QMatrix4x4 &modelView);
+
+    bool isVisible(const Meshlet &meshlet) const;
+    // モデル座標の球が視錐台と重なるか
+    bool isInside(const QVector3D &center, float radius) const;
+    bool isConeCulling() const;
+
+private:
+    QVector4D m_planes[6];
+    QVector3D m_eye;        // モデル座標での視点
+    bool m_coneCulling;     // 拡大率が軸毎に違う、または反転していると錐の角度が保たれないので使わない
+};
+
+#endif // MESHLET_H
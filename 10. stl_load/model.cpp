@@ -1,4 +1,120 @@
 ﻿#include "model.h"
+#include <QOpenGLContext>
+#include <QResource>
+#include <QFile>
+#include <QTemporaryFile>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+// 形式の記述と構造体の並びがずれていたらコンパイルできないようにする
+static_assert(Model::Format::stride() == sizeof(Model::VertexData), "Model::Format must match VertexData");
+static_assert(Model::Format::offset<VertexFormat::Normal>() == offsetof(Model::VertexData, normal), "Model::Format must match VertexData");
+static_assert(Model::Format::offset<VertexFormat::TexCoord>() == offsetof(Model::VertexData, texCoord), "Model::Format must match VertexData");
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+typedef void (QOPENGLF_APIENTRYP MultiDrawElementsIndirectFunc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawCount, GLsizei stride);
+
+namespace {
+
+// 位置のハッシュ(-0.0 と 0.0 は同じ位置にする)
+quint32 positionHash(const QVector3D &position)
+{
+    float values[3] = { position.x() + 0.0f, position.y() + 0.0f, position.z() + 0.0f };
+    quint32 bits[3];
+    std::memcpy(bits, values, sizeof(bits));
+    quint32 hash = (bits[0] * 0x8da6b343u) ^ (bits[1] * 0xd8163841u) ^ (bits[2] * 0xcb1ab31fu);
+    return hash ^ (hash >> 16);
+}
+
+// 同じ位置の頂点をまとめて番号を振る。まとめた位置は positions の前に詰め、その数を返す
+// i 番目の頂点を読んでから i 番目以前にしか書き込まないので、その場で詰められる
+int weldPositions(QVector3D *positions, int count, GLuint *indexes, Arena &scratch)
+{
+    // 使用率が半分を超えたら広げる開番地法の表(値は詰めた後の番号)
+    // 表は作業用の Arena に置く(広げる前の表は読み込みが終わるとまとめて解放される)
+    int tableSize = 1024;
+    int *slots = scratch.allocateArray<int>(tableSize);
+    std::fill(slots, slots + tableSize, -1);
+    quint32 mask = static_cast<quint32>(tableSize - 1);
+    int unique = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (unique * 2 >= tableSize)
+        {
+            tableSize *= 2;
+            slots = scratch.allocateArray<int>(tableSize);
+            std::fill(slots, slots + tableSize, -1);
+            mask = static_cast<quint32>(tableSize - 1);
+            for (int u = 0; u < unique; u++)
+            {
+                quint32 slot = positionHash(positions[u]) & mask;
+                while (slots[slot] >= 0)
+                    slot = (slot + 1) & mask;
+                slots[slot] = u;
+            }
+        }
+
+        const QVector3D position = positions[i];
+        quint32 slot = positionHash(position) & mask;
+        while (slots[slot] >= 0 && positions[slots[slot]] != position)
+            slot = (slot + 1) & mask;
+
+        if (slots[slot] < 0)
+        {
+            slots[slot] = unique;
+            positions[unique] = position;
+            indexes[i] = static_cast<GLuint>(unique++);
+        }
+        else
+        {
+            indexes[i] = static_cast<GLuint>(slots[slot]);
+        }
+    }
+    return unique;
+}
+
+// 行列で移した球を包む球(拡大率は最も大きい軸のものにする)
+float maxScale(const QMatrix4x4 &matrix)
+{
+    float x = matrix.column(0).toVector3D().lengthSquared();
+    float y = matrix.column(1).toVector3D().lengthSquared();
+    float z = matrix.column(2).toVector3D().lengthSquared();
+    return std::sqrt(qMax(x, qMax(y, z)));
+}
+
+QVector4D worldSphere(const QMatrix4x4 &matrix, const QVector3D &center, float radius)
+{
+    return QVector4D(matrix.map(center), radius * maxScale(matrix));
+}
+
+// #version の次の行に定義を入れる
+QByteArray defineFlatShading(QByteArray source)
+{
+    int line = source.indexOf('\n');
+    return source.insert(line < 0 ? source.size() : line + 1, "#define FLAT_SHADING\n");
+}
+
+}
+
+FrameProfiler* Model::s_profiler = nullptr;
+RingBuffer* Model::s_uniforms = nullptr;
+bool Model::s_uniformsWarned = false;
+GpuResources* Model::s_resources = nullptr;
+Arena* Model::s_frameArena = nullptr;
+RingBuffer* Model::s_indirect = nullptr;
+OcclusionCuller* Model::s_occlusion = nullptr;
+DepthPrepass* Model::s_prepass = nullptr;
+QAtomicInt Model::s_nextId;
+static MultiDrawElementsIndirectFunc s_multiDrawElementsIndirect = nullptr;
 
 Model::Model()
 {
@@ -7,17 +123,32 @@ Model::Model()
 
 Model::~Model()
 {
+    if (m_uploadQueue)
+        m_uploadQueue->cancel(this);
+    if (m_table)
+        m_table->destroy(m_handle);
+    if (s_profiler)
+        s_profiler->removeGpu(m_profileName);
     release();
+    dropSpill();
 }
 
 void Model::initialize()
 {
-    initializeOpenGLFunctions();
+    // OpenGL関数は bind() で初期化するので、生成時はコンテキストが無くてもよい
 
     // メッシュデータの初期設定
     m_translation = QVector3D(0.0f, 0.0f, 0.0f);
     m_rotation = QQuaternion::fromEulerAngles(QVector3D(0.0f, 0.0f, 0.0f));
     m_scale = QVector3D(1.0f, 1.0f, 1.0f);
+    m_localDirty = true;
+    m_worldDirty = true;
+    m_childDirty = false;
+    m_mvpDirty = true;
+    m_parent = nullptr;
+    m_table = nullptr;
+    m_handle = -1;
+    m_tableVersion = 0;
 
     // ライティングの初期設定
     m_light.Position = QVector4D(-25.0f, 125.0f, 25.0f, 1.0f);
@@ -33,6 +164,26 @@ void Model::initialize()
 
     // ステータス
     m_visible = true;
+    m_resident = true;
+    m_uploadQueue = nullptr;
+    m_streamQueue = nullptr;
+    m_evicted = false;
+    m_vertexBytes = 0;
+    m_indexBytes = 0;
+    m_programBytes = 0;
+    m_positionBytes = 0;
+    m_staticVertices = nullptr;
+    m_staticIndexes = nullptr;
+    m_staticVertexCount = 0;
+    m_staticIndexCount = 0;
+    m_spill = nullptr;
+    m_spillMap = nullptr;
+    m_shading = Shading::Smooth;
+    m_boundsRadius = -1.0f;
+
+    // 読み込みはワーカースレッドで生成されるので番号は atomic に振る
+    m_id = s_nextId.fetchAndAddRelaxed(1);
+    m_profileName = QString("model/#%1").arg(m_id);
 
     m_shaderProgram = new QOpenGLShaderProgram();
 }
@@ -40,150 +191,628 @@ void Model::initialize()
 void Model::release()
 {
     // And now release all OpenGL resources
-    m_shaderProgram->release();
+    // bind() されていなければOpenGLのリソースは無い
+    if (m_shaderProgram->programId())
+    {
+        m_shaderProgram->release();
+        removeGpuMemoryUsage(GpuResources::ShaderProgram, m_programBytes);
+    }
     m_shaderProgram->removeAllShaders();
     delete m_shaderProgram;
     m_shaderProgram=nullptr;
 
     // VBO release
-    m_vbo.release();
-    m_vbo.destroy();
+    if (m_vbo.isCreated())
+        m_vbo.release();
+    releaseBuffers();
 }
 
-bool Model::load(const QString &filename)
+void Model::releaseBuffers()
+{
+    if (s_resources)
+        s_resources->untrack(this);
+    if (m_vbo.isCreated())
+        removeGpuMemoryUsage(GpuResources::VertexBuffer, m_vertexBytes);
+    if (m_positionVbo.isCreated())
+        removeGpuMemoryUsage(GpuResources::VertexBuffer, m_positionBytes);
+    if (m_ibo.isCreated())
+        removeGpuMemoryUsage(GpuResources::IndexBuffer, m_indexBytes);
+
+    // 描画中のフレームが使い終わってから破棄する
+    QOpenGLBuffer vbo = m_vbo;
+    QOpenGLBuffer positionVbo = m_positionVbo;
+    QOpenGLBuffer ibo = m_ibo;
+    m_vbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_positionVbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+    m_positionStream = QVector<QVector3D>();
+    m_positionBytes = 0;
+    if (s_resources)
+    {
+        s_resources->deleteLater([vbo, positionVbo, ibo]() mutable {
+            vbo.destroy();
+            positionVbo.destroy();
+            ibo.destroy();
+        });
+    }
+    else
+    {
+        vbo.destroy();
+        positionVbo.destroy();
+        ibo.destroy();
+    }
+}
+
+void Model::trackResidency()
+{
+    // 予算を超えた時に退避できるようにする(転送し直すデータがあるものだけ)
+    if (s_resources && (m_staticVertices || m_spill))
+        s_resources->track(this, [this](){ evict(); });
+}
+
+void Model::evict()
+{
+    // 転送し直すデータはベイク済みのリソースや setMesh() のデータ、または控えのファイルにある
+    // GPUから読み戻さない(glGetBufferSubData はパイプラインを止め、GLES には無い)
+    releaseBuffers();
+    m_resident = false;
+    m_evicted = true;
+}
+
+void Model::restore()
+{
+    // 控えのファイルを map して、転送が終わるまでベイク済みのメッシュと同じように直接指す
+    m_evicted = false;
+    if (m_spill && !m_spillMap)
+    {
+        m_spillMap = m_spill->map(0, m_spill->size());
+        if (!m_spillMap)
+        {
+            qWarning() << "Can't map the spilled mesh. Skipped" << m_name;
+            return;
+        }
+        m_staticVertices = m_spillMap;
+        m_staticIndexes = m_spillMap + m_vertexBytes;
+        m_staticVertexCount = static_cast<int>(m_vertexBytes / vertexStride());
+        m_staticIndexCount = drawIndexCount();
+    }
+
+    // 退避した時と同じ方法で転送し直す
+    if (m_streamQueue)
+    {
+        streamInit(m_streamQueue);
+    }
+    else
+    {
+        m_resident = true;
+        bufferInit();
+    }
+}
+
+bool Model::load(const QString &filename, LoadProgress *progress)
 {
     QFileInfo fi(filename);
     QString ext = fi.suffix();
+    setName(fi.fileName());
+
+    // 組み込みのメッシュはビルド時に変換したものを使う
+    clearMesh();
+    if (loadBaked(filename))
+        return true;
 
-    if( ext.toLower() == "obj") return loadObj(filename);
-    if( ext.toLower() == "stl") return loadStl(filename);
+    if( ext.toLower() == "obj") return loadObj(filename, progress);
+    if( ext.toLower() == "stl") return loadStl(filename, progress);
 
     qWarning() << QString("This file is not supported(.%1)").arg(ext.toLower());
     return false;
 }
 
 
-bool Model::loadObj(const QString &filename)
+bool Model::loadObj(const QString &filename, LoadProgress *progress)
 {
-    QVector<Triangle3D> triangles;
-    QStringList comments;
+    // 解析した三角形は最終的な頂点配列に直接書き込む(三角形の配列は作らない)
+    // 解析中の中間データは作業用の Arena に置き、読み込みが終わったらまとめて解放する
+    Arena scratch(ScratchBlockSize);
+    VertexData *vertices = nullptr;
+    WavefrontOBJ::Sink sink;
+    sink.reserve = [&](int count){
+        vertices = resizeTriangles(count);
+        return true;
+    };
+    sink.write = [&vertices](int first, const Triangle3D *triangles, int count){
+        convertTriangles(triangles, count, vertices + first * 3);
+    };
 
     // objファイルの読み込み
-    if (!WavefrontOBJ().parser(filename, comments, triangles))
+    QStringList comments;
+    int count = 0;
+    if (!WavefrontOBJ().parser(filename, comments, sink, count, progress, &scratch) || LoadProgress::canceled(progress))
+    {
+        clearMesh();
         return false;
+    }
 
-    m_vertices.clear();
-    m_indexes.clear();
-    m_comments.clear();
+    resizeTriangles(count);
+    buildMeshlets();
+    updateBounds();
+    m_comments = comments;
 
-    GLushort index = 0;
-    for(int i = 0; i < triangles.count(); i++)
+    return true;
+}
+
+bool Model::loadStl(const QString &filename, LoadProgress *progress)
+{
+    // STL は面の法線しか持たないので、位置だけの頂点を同じ位置でまとめる(法線はシェーダーで求める)
+    // 三角形毎の位置を最終的な配列に書き込んでから、その場で詰める
+    Arena scratch(ScratchBlockSize);
+    QVector3D *positions = nullptr;
+    StlLoader::Sink sink;
+    sink.reserve = [&](int count){
+        m_positions.reserve(count * 3);
+        m_positions.resize(count * 3);
+        positions = m_positions.data();
+        return true;
+    };
+    sink.write = [&positions](int first, const StlLoader::Triangle3D *triangles, int count){
+        QVector3D *output = positions + first * 3;
+        for (int i = 0; i < count; i++)
+        {
+            output[i * 3 + 0] = triangles[i].position1;
+            output[i * 3 + 1] = triangles[i].position2;
+            output[i * 3 + 2] = triangles[i].position3;
+        }
+    };
+
+    // stlファイルの読み込み
+    StlLoader loader;
+    QString comment;
+    int count = 0;
+    bool loaded = loader.isAscii(filename)
+            ? loader.parserAscii(filename, comment, sink, count, progress, &scratch)
+            : loader.parserBinary(filename, comment, sink, count, progress, &scratch);
+    if (!loaded || LoadProgress::canceled(progress))
     {
-        m_vertices.append(VertexData{ triangles.at(i).p1, triangles.at(i).p1Normal, triangles.at(i).p1TexCoord });
-        m_vertices.append(VertexData{ triangles.at(i).p2, triangles.at(i).p2Normal, triangles.at(i).p2TexCoord });
-        m_vertices.append(VertexData{ triangles.at(i).p3, triangles.at(i).p3Normal, triangles.at(i).p3TexCoord });
-        m_indexes.append(index++);
-        m_indexes.append(index++);
-        m_indexes.append(index++);
+        clearMesh();
+        return false;
     }
-    m_comments = comments;
+
+    int size = count * 3;
+    m_indexes.reserve(size);
+    m_indexes.resize(size);
+    m_positions.resize(weldPositions(m_positions.data(), size, m_indexes.data(), scratch));
+    m_positions.squeeze();
+    m_shading = Shading::Flat;
+    buildMeshlets();
+    updateBounds();
+    m_comments.append(comment);
 
     return true;
 }
 
-bool Model::loadStl(const QString &filename)
+bool Model::loadBaked(const QString &filename)
 {
-    QVector<StlLoader::Triangle3D> triangles;
-    QString commnet;
+    QString path = BakedMesh::resourcePath(filename);
+    if (path.isEmpty())
+        return false;
 
-    // objファイルの読み込み
-    if (!StlLoader().parserBinary(filename, commnet, triangles))
+    // 圧縮されているとデータを展開する必要があるので使わない(rcc に -no-compress を渡している)
+    QResource resource(path);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    bool compressed = resource.compressionAlgorithm() != QResource::NoCompression;
+#else
+    bool compressed = resource.isCompressed();
+#endif
+    BakedMesh::Header header;
+    if (!resource.isValid() || compressed || !BakedMesh::read(resource.data(), resource.size(), header))
         return false;
 
-    m_vertices.clear();
-    m_indexes.clear();
-    m_comments.clear();
+    static_assert(sizeof(BakedMesh::Vertex) == sizeof(VertexData), "BakedMesh::Vertex must match VertexData");
+    clearMesh();
+    m_staticVertices = resource.data() + header.vertexOffset;
+    m_staticIndexes = resource.data() + header.indexOffset;
+    m_staticVertexCount = static_cast<int>(header.vertexCount);
+    m_staticIndexCount = static_cast<int>(header.indexCount);
+    updateBounds();
+
+    return true;
+}
+
+void Model::setMesh(const VertexData *vertices, int vertexCount, const GLuint *indexes, int indexCount)
+{
+    clearMesh();
+    m_staticVertices = vertices;
+    m_staticIndexes = indexes;
+    m_staticVertexCount = vertexCount;
+    m_staticIndexCount = indexCount;
+    updateBounds();
+}
+
+const void *Model::vertexData() const
+{
+    if (m_staticVertices)
+        return m_staticVertices;
+    return m_shading == Shading::Flat ? static_cast<const void*>(m_positions.constData()) : m_vertices.constData();
+}
+
+const void *Model::indexData() const
+{
+    return m_staticIndexes ? m_staticIndexes : m_indexes.constData();
+}
+
+int Model::vertexCount() const
+{
+    if (m_staticVertices)
+        return m_staticVertexCount;
+    return m_shading == Shading::Flat ? m_positions.size() : m_vertices.size();
+}
+
+int Model::indexCount() const
+{
+    return m_staticIndexes ? m_staticIndexCount : m_indexes.size();
+}
+
+int Model::vertexStride() const
+{
+    return m_shading == Shading::Flat ? FlatFormat::stride() : Format::stride();
+}
+
+int Model::drawIndexCount() const
+{
+    return static_cast<int>(m_indexBytes / static_cast<qint64>(sizeof(GLuint)));
+}
+
+void Model::releaseMesh()
+{
+    // 控えから転送し直したのなら map を外すだけ
+    if (m_spillMap)
+    {
+        m_staticVertices = nullptr;
+        m_staticIndexes = nullptr;
+        m_spill->unmap(m_spillMap);
+        m_spillMap = nullptr;
+        return;
+    }
+
+    // 自分で持つメッシュは、退避できる(予算がある)時だけ一時ファイルに控えを書いてから捨てる
+    if (!m_staticVertices && s_resources && s_resources->budget() > 0)
+        spill();
 
-    QVector<QVector3D> v;
-    QVector<QVector3D> n;
+    m_vertices = QVector<VertexData>();
+    m_positions = QVector<QVector3D>();
+    m_indexes = QVector<GLuint>();
+    m_positionStream = QVector<QVector3D>();
+}
 
-    GLushort index = 0;
-    for(int i = 0; i < triangles.count(); i++)
+void Model::spill()
+{
+    dropSpill();
+
+    QTemporaryFile *file = new QTemporaryFile();
+    bool written = file->open()
+            && file->write(static_cast<const char*>(vertexData()), m_vertexBytes) == m_vertexBytes
+            && file->write(static_cast<const char*>(indexData()), m_indexBytes) == m_indexBytes
+            && file->flush();
+    if (!written)
     {
-        m_vertices.append(VertexData{ triangles.at(i).position1, triangles.at(i).normal, QVector2D() });
-        m_vertices.append(VertexData{ triangles.at(i).position2, triangles.at(i).normal, QVector2D() });
-        m_vertices.append(VertexData{ triangles.at(i).position3, triangles.at(i).normal, QVector2D() });
-        m_indexes.append(index++);
-        m_indexes.append(index++);
-        m_indexes.append(index++);
+        qWarning() << "Can't spill the mesh to" << file->fileName() << ". It will not be evicted" << m_name;
+        delete file;
+        return;
+    }
+    m_spill = file;
+}
+
+void Model::dropSpill()
+{
+    if (m_spillMap)
+        m_spill->unmap(m_spillMap);
+    m_spillMap = nullptr;
+    delete m_spill;
+    m_spill = nullptr;
+}
+
+void Model::clearMesh()
+{
+    dropSpill();
+    resizeTriangles(0);
+    m_positions = QVector<QVector3D>();
+    m_staticVertices = nullptr;
+    m_staticIndexes = nullptr;
+    m_shading = Shading::Smooth;
+    m_meshlets = QVector<Meshlet>();
+    m_boundsRadius = -1.0f;
+}
 
-        v << triangles.at(i).position1 << triangles.at(i).position2 << triangles.at(i).position3;
-        n << triangles.at(i).normal << triangles.at(i).normal << triangles.at(i).normal;
+void Model::buildMeshlets()
+{
+    // ベイク済みや setMesh() のデータは読み取り専用なので並べ替えられない
+    if (m_staticIndexes || m_indexes.size() / 3 < MeshletThreshold)
+        return;
+    m_meshlets = MeshletBuilder::build(vertexData(), vertexStride(), vertexCount(), m_indexes.data(), m_indexes.size());
+    m_meshlets.squeeze();
+}
 
+void Model::updateBounds()
+{
+    // 包む球は AABB の中心から求める(メッシュレットと同じ)。位置はどちらの形式でも頂点の先頭にある
+    const uchar *vertices = static_cast<const uchar*>(vertexData());
+    int stride = vertexStride();
+    int count = vertexCount();
+    m_boundsRadius = -1.0f;
+    if (count == 0)
+        return;
+
+    float lowest = std::numeric_limits<float>::lowest();
+    float highest = std::numeric_limits<float>::max();
+    QVector3D minimum(highest, highest, highest);
+    QVector3D maximum(lowest, lowest, lowest);
+    for (int i = 0; i < count; i++)
+    {
+        float p[3];
+        std::memcpy(p, vertices + static_cast<qint64>(i) * stride, sizeof(p));
+        minimum = QVector3D(qMin(minimum.x(), p[0]), qMin(minimum.y(), p[1]), qMin(minimum.z(), p[2]));
+        maximum = QVector3D(qMax(maximum.x(), p[0]), qMax(maximum.y(), p[1]), qMax(maximum.z(), p[2]));
     }
+    m_boundsCenter = (minimum + maximum) * 0.5f;
+    float radius = 0.0f;
+    for (int i = 0; i < count; i++)
+    {
+        float p[3];
+        std::memcpy(p, vertices + static_cast<qint64>(i) * stride, sizeof(p));
+        radius = qMax(radius, (QVector3D(p[0], p[1], p[2]) - m_boundsCenter).lengthSquared());
+    }
+    m_boundsRadius = std::sqrt(radius);
+}
 
-    int cnt=0;
-    for (int i = 0; i < v.size(); i++) {
-        for (int j = 0; j < v.size(); j++) {
+bool Model::needsPositionStream() const
+{
+    return isPrepassEnabled() && m_shading != Shading::Flat && vertexCount() > 0;
+}
 
-            //qDebug() << v.at(i) << n.at(i) << i;
-            //qDebug() << v.at(j) << n.at(j) << j;
-            if( v.at(i) == v.at(j) && n.at(i) == n.at(j))
-            {
-                //qDebug() << i << j;
-                if(i!=j)
-                {
-                    cnt++;
-                    qDebug() << QString("i=%1, j=%2").arg(i).arg(j);
-                }
-            }
-        }
+bool Model::isPrepassEnabled()
+{
+    return s_prepass && s_prepass->mode() != DepthPrepass::Mode::Off;
+}
+
+void Model::releasePositionStream()
+{
+    removeGpuMemoryUsage(GpuResources::VertexBuffer, m_positionBytes);
+
+    // 描画中のフレームが使い終わってから破棄する
+    QOpenGLBuffer positionVbo = m_positionVbo;
+    m_positionVbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_positionBytes = 0;
+    if (s_resources)
+        s_resources->deleteLater([positionVbo]() mutable { positionVbo.destroy(); });
+    else
+        positionVbo.destroy();
+}
+
+void Model::buildPositionStream()
+{
+    int count = vertexCount();
+    m_positionStream.resize(count);
+    m_positionBytes = count * static_cast<qint64>(sizeof(QVector3D));
+
+    const uchar *input = static_cast<const uchar*>(vertexData());
+    QVector3D *output = m_positionStream.data();
+    JobSystem::instance().parallelFor(0, count, 65536, [=](int begin, int end){
+        FlatFormat::convert<Format>(input + static_cast<qint64>(begin) * Format::stride(), output + begin, end - begin);
+    });
+}
+
+int Model::meshletCount() const
+{
+    return m_meshlets.size();
+}
+
+qint64 Model::meshBytes() const
+{
+    return vertexCount() * static_cast<qint64>(vertexStride()) + indexCount() * static_cast<qint64>(sizeof(GLuint));
+}
+
+Model::VertexData *Model::resizeTriangles(int count)
+{
+    int size = count * 3;
+    if (size < m_vertices.size())
+    {
+        // 解析中に捨てた面の分を詰める
+        m_vertices.resize(size);
+        m_vertices.squeeze();
+        m_indexes.resize(size);
+        m_indexes.squeeze();
+        return m_vertices.data();
+    }
+
+    // resize() だけだと余分に確保するので、先にちょうどの大きさを確保する
+    int first = m_indexes.size();
+    m_vertices.reserve(size);
+    m_indexes.reserve(size);
+    m_vertices.resize(size);
+    m_indexes.resize(size);
+
+    // 三角形毎に頂点を持つので番号は連番になる
+    GLuint *indexes = m_indexes.data();
+    JobSystem::instance().parallelFor(first, size, 65536, [=](int begin, int end){
+        for (int i = begin; i < end; i++)
+            indexes[i] = static_cast<GLuint>(i);
+    });
+    return m_vertices.data();
+}
+
+void Model::buildVertices(const QVector<Triangle3D> &triangles)
+{
+    buildVertices(triangles.constData(), triangles.count());
+}
+
+void Model::buildVertices(const QVector<StlLoader::Triangle3D> &triangles)
+{
+    buildVertices(triangles.constData(), triangles.count());
+}
+
+void Model::buildVertices(const Triangle3D *input, int count)
+{
+    m_comments.clear();
+
+    // 三角形毎に書き込み先が決まっているので分割して変換する
+    VertexData *vertices = resizeTriangles(count);
+    JobSystem::instance().parallelFor(0, count, 16384, [=](int begin, int end){
+        convertTriangles(input + begin, end - begin, vertices + begin * 3);
+    });
+}
+
+void Model::buildVertices(const StlLoader::Triangle3D *input, int count)
+{
+    m_comments.clear();
+
+    VertexData *vertices = resizeTriangles(count);
+    JobSystem::instance().parallelFor(0, count, 16384, [=](int begin, int end){
+        convertTriangles(input + begin, end - begin, vertices + begin * 3);
+    });
+}
+
+void Model::convertTriangles(const Triangle3D *input, int count, VertexData *output)
+{
+    for(int i = 0; i < count; i++)
+    {
+        const Triangle3D &t = input[i];
+        output[i * 3 + 0] = VertexData{ t.p1, t.p1Normal, t.p1TexCoord };
+        output[i * 3 + 1] = VertexData{ t.p2, t.p2Normal, t.p2TexCoord };
+        output[i * 3 + 2] = VertexData{ t.p3, t.p3Normal, t.p3TexCoord };
+    }
+}
+
+void Model::convertTriangles(const StlLoader::Triangle3D *input, int count, VertexData *output)
+{
+    // STLは面法線しか持たないので、三角形毎に頂点を作る
+    for(int i = 0; i < count; i++)
+    {
+        const StlLoader::Triangle3D &t = input[i];
+        output[i * 3 + 0] = VertexData{ t.position1, t.normal, QVector2D() };
+        output[i * 3 + 1] = VertexData{ t.position2, t.normal, QVector2D() };
+        output[i * 3 + 2] = VertexData{ t.position3, t.normal, QVector2D() };
     }
-    qDebug() <<  v.size();
-    qDebug() <<  cnt;
-    qDebug() <<  v.at(0) << n.at(0);
-    qDebug() <<  v.at(3) << n.at(3);
-    qDebug() <<  (v.at(0) == v.at(3));
-    qDebug() <<  (n.at(0) == n.at(3));
-    m_comments.append(commnet);
 }
 
 void Model::bind(const QString &vertexShader, const QString &fragmentShader)
 {
+    initializeOpenGLFunctions();
     shaderInit(vertexShader, fragmentShader);
     bufferInit();
 }
 
+void Model::bindStreamed(const QString &vertexShader, const QString &fragmentShader, UploadQueue *queue)
+{
+    initializeOpenGLFunctions();
+    shaderInit(vertexShader, fragmentShader);
+    m_streamQueue = queue;
+    streamInit(queue);
+}
+
+bool Model::isResident() const
+{
+    return m_resident;
+}
+
+QByteArray Model::vertexShaderSource(const QString &fileName) const
+{
+    if (m_shading == Shading::Flat)
+        return defineFlatShading(FlatFormat::shaderSource(fileName));
+    return Format::shaderSource(fileName);
+}
+
+QByteArray Model::fragmentShaderSource(const QString &fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Can't open file" << fileName;
+        return QByteArray();
+    }
+    return m_shading == Shading::Flat ? defineFlatShading(file.readAll()) : file.readAll();
+}
+
 void Model::shaderInit(const QString &vertexShaderFile, const QString &fragmentShaderFile)
 {
     // シェーダーのコンパイル
-    m_shaderProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, vertexShaderFile);
-    m_shaderProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, fragmentShaderFile);
+    m_shaderProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource(vertexShaderFile));
+    m_shaderProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource(fragmentShaderFile));
 
     // シェーダプログラムをリンク
     m_shaderProgram->link();
+
+    // オブジェクト毎のユニフォームブロックをバインディングポイントに割り当てる
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    GLuint block = f->glGetUniformBlockIndex(m_shaderProgram->programId(), "ObjectBlock");
+    if (block != GL_INVALID_INDEX)
+        f->glUniformBlockBinding(m_shaderProgram->programId(), block, ObjectBlockBinding);
+
+    // プログラムのサイズはバイナリの長さで見積もる
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    GLint length = 0;
+    if (context->format().version() >= qMakePair(4, 1) || context->hasExtension(QByteArrayLiteral("GL_ARB_get_program_binary")))
+        glGetProgramiv(m_shaderProgram->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+    m_programBytes = length;
+    addGpuMemoryUsage(GpuResources::ShaderProgram, m_programBytes);
+}
+
+bool Model::measureBuffers()
+{
+    // 頂点数 x 大きさは int を超えることがあるので 64bit で求める
+    m_vertexBytes = vertexCount() * static_cast<qint64>(vertexStride());
+    m_indexBytes = indexCount() * static_cast<qint64>(sizeof(GLuint));
+
+    // QOpenGLBuffer::allocate は大きさを int で受け取るので、それを超えるメッシュは転送しない
+    const qint64 limit = std::numeric_limits<int>::max();
+    if (m_vertexBytes <= limit && m_indexBytes <= limit)
+        return true;
+
+    qWarning() << "Mesh is too large for a buffer. Skipped" << m_name << m_vertexBytes << m_indexBytes;
+    m_vertexBytes = 0;
+    m_indexBytes = 0;
+    m_resident = false;
+    return false;
 }
 
 void Model::bufferInit()
 {
+    if (!measureBuffers())
+        return;
+
     // 頂点バッファを生成
     m_vbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
     m_vbo.create();
     m_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
     m_vbo.bind();
-    m_vbo.allocate(m_vertices.constData(), m_vertices.size() * static_cast<int>(sizeof(VertexData)));
+    m_vbo.allocate(vertexData(), static_cast<int>(m_vertexBytes));
     m_vbo.release();
 
+    if (needsPositionStream())
+    {
+        buildPositionStream();
+        m_positionVbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+        m_positionVbo.create();
+        m_positionVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        m_positionVbo.bind();
+        m_positionVbo.allocate(m_positionStream.constData(), static_cast<int>(m_positionBytes));
+        m_positionVbo.release();
+        m_positionStream = QVector<QVector3D>();
+        addGpuMemoryUsage(GpuResources::VertexBuffer, m_positionBytes);
+    }
+
     // インデックスバッファを生成
     m_ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
     m_ibo.create();
     m_ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
     m_ibo.bind();
-    m_ibo.allocate(m_indexes.constData(), m_indexes.size() * static_cast<int>(sizeof(GLushort)));
+    m_ibo.allocate(indexData(), static_cast<int>(m_indexBytes));
     m_ibo.release();
 
-    // インデックスバッファを生成したので頂点情報をクリア
-    m_vertices.clear();
+    addGpuMemoryUsage(GpuResources::VertexBuffer, m_vertexBytes);
+    addGpuMemoryUsage(GpuResources::IndexBuffer, m_indexBytes);
+
+    // 転送したので頂点と番号を捨てる
+    releaseMesh();
+    trackResidency();
 
     // シェーダーで使用する属性の設定
     m_shaderProgram->bind();
@@ -203,6 +832,57 @@ void Model::bufferInit()
 
 }
 
+void Model::streamInit(UploadQueue *queue)
+{
+    if (!measureBuffers())
+        return;
+    int vertexBytes = static_cast<int>(m_vertexBytes);
+    int indexBytes = static_cast<int>(m_indexBytes);
+
+    // 領域だけ確保して(データは送らない)、中身は UploadQueue がステージングから少しずつコピーする
+    m_vbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_vbo.create();
+    m_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_vbo.bind();
+    m_vbo.allocate(vertexBytes);
+    m_vbo.release();
+
+    if (needsPositionStream())
+    {
+        buildPositionStream();
+        m_positionVbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+        m_positionVbo.create();
+        m_positionVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        m_positionVbo.bind();
+        m_positionVbo.allocate(static_cast<int>(m_positionBytes));
+        m_positionVbo.release();
+        addGpuMemoryUsage(GpuResources::VertexBuffer, m_positionBytes);
+    }
+
+    m_ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+    m_ibo.create();
+    m_ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    m_ibo.bind();
+    m_ibo.allocate(indexBytes);
+    m_ibo.release();
+
+    addGpuMemoryUsage(GpuResources::VertexBuffer, m_vertexBytes);
+    addGpuMemoryUsage(GpuResources::IndexBuffer, m_indexBytes);
+
+    m_resident = false;
+    m_uploadQueue = queue;
+    queue->enqueue(this, m_vbo, vertexData(), vertexBytes);
+    if (m_positionVbo.isCreated())
+        queue->enqueue(this, m_positionVbo, m_positionStream.constData(), static_cast<int>(m_positionBytes));
+    queue->enqueue(this, m_ibo, indexData(), indexBytes, [this](){
+        // 転送が終わったので頂点と番号を捨てる
+        releaseMesh();
+        m_resident = true;
+        m_uploadQueue = nullptr;
+        trackResidency();
+    });
+}
+
 void Model::update()
 {
     /* Model Matrix */
@@ -213,53 +893,294 @@ void Model::update()
 
 void Model::draw(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix, const QMatrix4x4 &parentModelMatrix)
 {
-    QMatrix4x4 modelMatrix;
-    modelMatrix.translate(m_translation);
-    modelMatrix.rotate(m_rotation);
-    modelMatrix.scale(m_scale);
-    modelMatrix = parentModelMatrix * modelMatrix;
+    // 外部から親の行列が渡された場合だけ毎回掛け合わせる
+    bool external = !parentModelMatrix.isIdentity();
+    QMatrix4x4 modelMatrix = external ? parentModelMatrix * getWorldMatrix() : getWorldMatrix();
+
+    // モデル・ビュー・プロジェクションのどれかが変わった時だけ再計算
+    if (external || m_mvpDirty || viewMatrix != m_cachedViewMatrix || projectionMatrix != m_cachedProjectionMatrix)
+    {
+        m_modelViewMatrix = viewMatrix * modelMatrix;
+        m_mvpMatrix = projectionMatrix * m_modelViewMatrix;
+        m_cachedViewMatrix = viewMatrix;
+        m_cachedProjectionMatrix = projectionMatrix;
+        m_mvpDirty = external;
+    }
+
+    // 深度だけのパスでは半透明なものは描画しない(深度を書き込むと後ろのものが塗られなくなる)
+    // 同じフレームで2回呼ばれるので、カリングの数は塗るパスで数える
+    DepthPrepass::Pass pass = prepass();
+    bool opaque = m_material.Opacity >= 1.0f;
+    bool skipped = pass == DepthPrepass::Pass::Depth && !opaque;
+
+    // 包む球が視錐台の外にあれば描画しない(子は自分の球で判定する)
+    bool inFrustum = !m_visible || m_boundsRadius < 0.0f
+            || MeshletCuller(m_mvpMatrix, m_modelViewMatrix).isInside(m_boundsCenter, m_boundsRadius);
+    if ( !inFrustum && s_profiler && pass != DepthPrepass::Pass::Depth )
+        s_profiler->count(QStringLiteral("culled"));
 
     // Draw
-    if ( m_visible )
-    {
-        m_shaderProgram->bind();
-
-        m_shaderProgram->setUniformValue("Light.Position", m_light.Position);
-        m_shaderProgram->setUniformValue("Light.La", m_light.La);
-        m_shaderProgram->setUniformValue("Light.Ld", m_light.Ld);
-        m_shaderProgram->setUniformValue("Light.Ls", m_light.Ls);
-        m_shaderProgram->setUniformValue("Material.Ka", m_material.Ka);
-        m_shaderProgram->setUniformValue("Material.Kd", m_material.Kd);
-        m_shaderProgram->setUniformValue("Material.Ks", m_material.Ks);
-        m_shaderProgram->setUniformValue("Material.Shininess", m_material.Shininess);
-        m_shaderProgram->setUniformValue("Material.Opacity", m_material.Opacity);
-        m_shaderProgram->setUniformValue("ModelViewMatrix", viewMatrix * modelMatrix);
-        m_shaderProgram->setUniformValue("NormalMatrix", modelMatrix.normalMatrix());
-        m_shaderProgram->setUniformValue("MVP", projectionMatrix * viewMatrix * modelMatrix);
+    // 退避されていたら転送し直す(転送が終わるまでは描画しない)
+    if ( m_visible && inFrustum && m_evicted )
+        restore();
+
+    // プリパスを止めたら位置だけの頂点は要らない(また使う時は m_vbo から位置だけ読む)
+    if ( m_resident && m_positionVbo.isCreated() && !isPrepassEnabled() )
+        releasePositionStream();
+
+    // 行列とマテリアルはリングバッファに直接書き込む
+    RingBuffer::Allocation uniforms;
+    if ( m_visible && inFrustum && m_resident && !skipped )
+    {
+        uniforms = writeObjectUniforms(external ? modelMatrix.normalMatrix() : getNormalMatrix());
+    }
+
+    // 前のフレームの深度で隠れていたら、不透明なものを描画し終えてから比べ直す
+    if ( uniforms.isValid() && !deferOccluded(modelMatrix, uniforms) )
+    {
+        // 深度だけのパスの後は深度が等しい面だけ塗るが、半透明なものは深度が無いので普通に描画する
+        bool unprepared = pass == DepthPrepass::Pass::Shade && !opaque;
+        if (unprepared)
+            s_prepass->suspend();
+        if (pass == DepthPrepass::Pass::Depth)
+            beginDepthDraw(uniforms);
+        else
+            beginDraw(uniforms);
+
+        if (s_profiler) s_profiler->beginGpu(m_profileName);
+        int triangles = drawIndexCount() / 3;
+        if (!m_meshlets.isEmpty() && s_frameArena)
+            triangles = drawMeshlets(modelMatrix, uniforms);
+        else
+            glDrawElements(GL_TRIANGLES, drawIndexCount(), GL_UNSIGNED_INT, nullptr);
+        if (s_profiler)
+        {
+            s_profiler->endGpu(m_profileName);
+            // 深度だけのパスでも描画するが、culled と同じく数えるのは塗るパスだけにする
+            if (pass != DepthPrepass::Pass::Depth)
+            {
+                s_profiler->count(QStringLiteral("draw_calls"));
+                s_profiler->count(QStringLiteral("triangles"), triangles);
+            }
+        }
 
+        endDraw();
+        if (unprepared)
+            s_prepass->resume();
+    }
+    if ( uniforms.isValid() && s_resources )
+        s_resources->touch(this);
+
+    // 子のワールド行列は自分の変換を含んでいる
+    for (int i = 0; i < m_children.size(); ++i) {
+        m_children[i]->draw(projectionMatrix, viewMatrix, parentModelMatrix);
+    }
+}
+
+void Model::beginDraw(const RingBuffer::Allocation &uniforms)
+{
+    s_uniforms->bindRange(ObjectBlockBinding, uniforms);
+
+    m_shaderProgram->bind();
+
+    m_shaderProgram->setUniformValue("Light.Position", m_light.Position);
+    m_shaderProgram->setUniformValue("Light.La", m_light.La);
+    m_shaderProgram->setUniformValue("Light.Ld", m_light.Ld);
+    m_shaderProgram->setUniformValue("Light.Ls", m_light.Ls);
+
+    m_vbo.bind();
+    m_ibo.bind();
+
+    if (m_shading == Shading::Flat)
+    {
+        // 他のモデルが有効にした法線とUVは使わない
+        Format::disableAttributes(this);
+        FlatFormat::setAttributes(this);
+    }
+    else
+    {
+        Format::setAttributes(this);
+    }
+}
+
+void Model::beginDepthDraw(const RingBuffer::Allocation &uniforms)
+{
+    s_uniforms->bindRange(ObjectBlockBinding, uniforms);
+
+    s_prepass->program()->bind();
+
+    // 法線とUVは使わないので無効にする
+    Format::disableAttributes(this);
+    if (m_positionVbo.isCreated())
+    {
+        m_positionVbo.bind();
+        FlatFormat::setAttributes(this);
+    }
+    else if (m_shading == Shading::Flat)
+    {
         m_vbo.bind();
-        m_ibo.bind();
+        FlatFormat::setAttributes(this);
+    }
+    else
+    {
+        // 位置だけの頂点が無ければ、交互に並んだ頂点から位置だけ読む
+        const GLuint location = static_cast<GLuint>(Format::location<VertexFormat::Position>());
+        m_vbo.bind();
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, Format::stride(),
+                              reinterpret_cast<const void*>(static_cast<quintptr>(Format::offset<VertexFormat::Position>())));
+    }
 
-        int offset = 0;
-        int vertexLocation = m_shaderProgram->attributeLocation("VertexPosition");
-        m_shaderProgram->enableAttributeArray(vertexLocation);
-        m_shaderProgram->setAttributeBuffer(vertexLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
+    m_ibo.bind();
+}
 
-        offset += sizeof(QVector3D);
-        int vertexNormalLocation = m_shaderProgram->attributeLocation("VertexNormal");
-        m_shaderProgram->enableAttributeArray(vertexNormalLocation);
-        m_shaderProgram->setAttributeBuffer(vertexNormalLocation, GL_FLOAT, offset, 3, sizeof(VertexData));
+void Model::endDraw()
+{
+    m_ibo.release();
+    m_vbo.release();
+    m_shaderProgram->release();
+}
 
-        glDrawElements(GL_TRIANGLES, m_indexes.size(), GL_UNSIGNED_SHORT, nullptr);
+bool Model::isOcclusionCulled() const
+{
+    // 半透明なものは後ろが透けるので隠すものにも隠れるものにもしない
+    return s_occlusion && s_occlusion->isEnabled() && s_frameArena && m_boundsRadius >= 0.0f && m_material.Opacity >= 1.0f;
+}
 
-        m_ibo.release();
-        m_vbo.release();
-        m_shaderProgram->release();
+bool Model::deferOccluded(const QMatrix4x4 &modelMatrix, const RingBuffer::Allocation &uniforms)
+{
+    if (!isOcclusionCulled())
+        return false;
+
+    QVector4D sphere = worldSphere(modelMatrix, m_boundsCenter, m_boundsRadius);
+    if (!s_occlusion->isOccluded(sphere.toVector3D(), sphere.w()))
+        return false;
+
+    // プリパスを使う場合は深度のパスで渡したので、塗るパスでは外すだけにする
+    if (prepass() == DepthPrepass::Pass::Shade)
+        return true;
+
+    // 範囲は flush() まで残るようにフレーム用の Arena に置く
+    DrawElementsIndirectCommand *range = s_frameArena->allocateArray<DrawElementsIndirectCommand>(1);
+    *range = { static_cast<GLuint>(drawIndexCount()), 1, 0, 0, 0 };
+    s_occlusion->defer(this, uniforms, &sphere, 1, range, 1);
+    return true;
+}
+
+void Model::drawOccluded(const RingBuffer::Allocation &uniforms, const DrawElementsIndirectCommand *ranges, int count)
+{
+    beginDraw(uniforms);
+    drawRanges(ranges, count);
+    if (s_profiler)
+        s_profiler->count(QStringLiteral("draw_calls"));
+    endDraw();
+}
+
+int Model::drawMeshlets(const QMatrix4x4 &modelMatrix, const RingBuffer::Allocation &uniforms)
+{
+    // 視錐台と法線の錐、前のフレームの深度による判定はメッシュレット毎に独立しているので並列に行う
+    // 0: 外す 1: 描画する 2: 隠れていた(後で比べ直す)
+    MeshletCuller culler(m_mvpMatrix, m_modelViewMatrix);
+    const OcclusionCuller *occlusion = isOcclusionCulled() ? s_occlusion : nullptr;
+    const float scale = maxScale(modelMatrix);
+    const Meshlet *meshlets = m_meshlets.constData();
+    int count = m_meshlets.size();
+    uchar *visible = s_frameArena->allocateArray<uchar>(count);
+    JobSystem::instance().parallelFor(0, count, 1024, [=, &culler, &modelMatrix](int begin, int end){
+        for (int i = begin; i < end; i++)
+        {
+            const Meshlet &meshlet = meshlets[i];
+            if (!culler.isVisible(meshlet))
+                visible[i] = 0;
+            else if (occlusion && occlusion->isOccluded(modelMatrix.map(meshlet.center), meshlet.radius * scale))
+                visible[i] = 2;
+            else
+                visible[i] = 1;
+        }
+    });
+
+    // 続けて見えるメッシュレットはインデックスの範囲も続いているので1つのコマンドにまとめる
+    // 同じ Arena で2つの配列を交互に伸ばすと作り直しになるので、1つずつ作る
+    auto merge = [=](uchar flag, ArenaVector<DrawElementsIndirectCommand> &commands){
+        int triangles = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (visible[i] != flag)
+                continue;
+            const Meshlet &meshlet = meshlets[i];
+            triangles += static_cast<int>(meshlet.indexCount / 3);
+            if (!commands.isEmpty())
+            {
+                DrawElementsIndirectCommand &previous = commands[commands.size() - 1];
+                if (previous.firstIndex + previous.count == meshlet.firstIndex)
+                {
+                    previous.count += meshlet.indexCount;
+                    continue;
+                }
+            }
+            DrawElementsIndirectCommand command = { meshlet.indexCount, 1, meshlet.firstIndex, 0, 0 };
+            commands.append(command);
+        }
+        return triangles;
+    };
+
+    ArenaVector<DrawElementsIndirectCommand> commands(s_frameArena);
+    int triangles = merge(1, commands);
+
+    if (occlusion && prepass() != DepthPrepass::Pass::Shade)
+    {
+        ArenaVector<DrawElementsIndirectCommand> ranges(s_frameArena);
+        merge(2, ranges);
+        if (!ranges.isEmpty())
+        {
+            ArenaVector<QVector4D> spheres(s_frameArena);
+            for (int i = 0; i < count; i++)
+            {
+                if (visible[i] == 2)
+                    spheres.append(QVector4D(modelMatrix.map(meshlets[i].center), meshlets[i].radius * scale));
+            }
+            s_occlusion->defer(this, uniforms, spheres.constData(), spheres.size(), ranges.constData(), ranges.size());
+        }
     }
 
-    for (int i = 0; i < m_children.size(); ++i) {
-        m_children[i]->draw(projectionMatrix, viewMatrix, modelMatrix);
+    if (s_profiler && prepass() != DepthPrepass::Pass::Depth)
+    {
+        int culled = 0;
+        for (int i = 0; i < count; i++)
+            culled += visible[i] == 0 ? 1 : 0;
+        s_profiler->count(QStringLiteral("meshlets_culled"), culled);
     }
+    if (commands.isEmpty())
+        return 0;
+
+    drawRanges(commands.constData(), commands.size());
+    return triangles;
+}
+
+void Model::drawRanges(const DrawElementsIndirectCommand *commands, int count)
+{
+    // コマンドはリングバッファに書いて1回で描画する
+    RingBuffer::Allocation allocation;
+    if (s_indirect && s_multiDrawElementsIndirect)
+        allocation = s_indirect->allocate(count * static_cast<GLsizeiptr>(sizeof(DrawElementsIndirectCommand)), 4);
+    if (allocation.isValid())
+    {
+        std::memcpy(allocation.data, commands, static_cast<size_t>(allocation.size));
+        s_indirect->flush(allocation);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, s_indirect->bufferId());
+        s_multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(allocation.offset), count, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return;
+    }
+
+    // 使えなければ範囲毎に描画する
+    for (int i = 0; i < count; i++)
+    {
+        const quintptr offset = commands[i].firstIndex * static_cast<quintptr>(sizeof(GLuint));
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(commands[i].count), GL_UNSIGNED_INT, reinterpret_cast<const void*>(offset));
+    }
+    if (s_profiler && prepass() != DepthPrepass::Pass::Depth)
+        s_profiler->count(QStringLiteral("draw_calls"), count - 1);
 }
 
 void Model::setChild(int index, Model* child)
@@ -270,31 +1191,171 @@ void Model::setChild(int index, Model* child)
         return;
     }
     m_children[index] = child;
+    child->m_parent = this;
+    child->invalidateWorldMatrix();
+    if (m_table)
+        child->attach(m_table);
 }
 
 void Model::addChild(Model* child)
 {
     m_children.append(child);
+    child->m_parent = this;
+    child->invalidateWorldMatrix();
+    if (m_table)
+        child->attach(m_table);
 }
 
 void Model::setRotation(QQuaternion rotation)
 {
+    if (m_rotation == rotation)
+        return;
     m_rotation = rotation;
+    m_localDirty = true;
+    invalidateWorldMatrix();
+    if (m_table)
+        m_table->setRotation(m_handle, rotation);
 }
 
 void Model::setTranslation(QVector3D translation)
 {
+    if (m_translation == translation)
+        return;
     m_translation = translation;
+    m_localDirty = true;
+    invalidateWorldMatrix();
+    if (m_table)
+        m_table->setTranslation(m_handle, translation);
 }
 
 void Model::setScale(float s)
 {
-    m_scale = QVector3D(s, s, s);
+    setScale(QVector3D(s, s, s));
 }
 
 void Model::setScale(QVector3D s)
 {
+    if (m_scale == s)
+        return;
     m_scale = s;
+    m_localDirty = true;
+    invalidateWorldMatrix();
+    if (m_table)
+        m_table->setScale(m_handle, s);
+}
+
+void Model::invalidateWorldMatrix()
+{
+    // 既に無効なら子孫も無効になっている
+    if (!m_worldDirty)
+    {
+        m_worldDirty = true;
+        for (int i = 0; i < m_children.size(); ++i)
+            m_children[i]->invalidateWorldMatrix();
+    }
+
+    // 親へ更新が必要なことを伝える
+    for (Model* parent = m_parent; parent && !parent->m_childDirty; parent = parent->m_parent)
+        parent->m_childDirty = true;
+}
+
+const QMatrix4x4 &Model::getWorldMatrix()
+{
+    // SceneTable で更新された時だけ行列をコピーする
+    if (m_table)
+    {
+        quint64 version = m_table->changedAt(m_handle);
+        if (m_worldDirty || version != m_tableVersion)
+        {
+            m_worldMatrix = m_table->worldMatrix4x4(m_handle);
+            m_normalMatrix = m_worldMatrix.normalMatrix();
+            m_tableVersion = version;
+            m_worldDirty = false;
+            m_mvpDirty = true;
+        }
+        return m_worldMatrix;
+    }
+
+    if (m_worldDirty)
+    {
+        if (m_localDirty)
+        {
+            m_localMatrix.setToIdentity();
+            m_localMatrix.translate(m_translation);
+            m_localMatrix.rotate(m_rotation);
+            m_localMatrix.scale(m_scale);
+            m_localDirty = false;
+        }
+
+        m_worldMatrix = m_parent ? m_parent->getWorldMatrix() * m_localMatrix : m_localMatrix;
+        m_normalMatrix = m_worldMatrix.normalMatrix();
+        m_worldDirty = false;
+        m_mvpDirty = true;
+    }
+    return m_worldMatrix;
+}
+
+const QMatrix3x3 &Model::getNormalMatrix()
+{
+    getWorldMatrix();
+    return m_normalMatrix;
+}
+
+void Model::updateWorldMatrices()
+{
+    if (m_table)
+    {
+        m_table->update();
+        return;
+    }
+
+    if (!m_worldDirty && !m_childDirty)
+        return;
+
+    getWorldMatrix();
+    m_childDirty = false;
+    for (int i = 0; i < m_children.size(); ++i)
+        m_children[i]->updateWorldMatrices();
+}
+
+Model *Model::getParent() const
+{
+    return m_parent;
+}
+
+void Model::attach(SceneTable *table)
+{
+    SceneTable::Handle parent = m_parent && m_parent->m_table == table ? m_parent->m_handle : -1;
+
+    if (m_table != table)
+    {
+        if (m_table)
+            m_table->destroy(m_handle);
+
+        m_table = table;
+        m_handle = table->create(parent);
+        table->setTranslation(m_handle, m_translation);
+        table->setRotation(m_handle, m_rotation);
+        table->setScale(m_handle, m_scale);
+        m_worldDirty = true;
+    }
+    else
+    {
+        table->setParent(m_handle, parent);
+    }
+
+    for (int i = 0; i < m_children.size(); ++i)
+        m_children[i]->attach(table);
+}
+
+SceneTable *Model::getSceneTable() const
+{
+    return m_table;
+}
+
+SceneTable::Handle Model::getSceneHandle() const
+{
+    return m_handle;
 }
 
 void Model::setLight(QVector4D position, QVector3D La, QVector3D Ld, QVector3D Ls)
@@ -373,6 +1434,142 @@ void Model::setVisible(bool visible)
     m_visible = visible;
 }
 
+QString Model::getName() const
+{
+    return m_name;
+}
+
+Model::Shading Model::getShading() const
+{
+    return m_shading;
+}
+
+void Model::setName(const QString &name)
+{
+    m_name = name;
+    if (s_profiler)
+        s_profiler->removeGpu(m_profileName);
+    m_profileName = QString("model/%1#%2").arg(name).arg(m_id);
+}
+
+void Model::setProfiler(FrameProfiler *profiler)
+{
+    s_profiler = profiler;
+}
+
+void Model::setUniformRing(RingBuffer *ring)
+{
+    s_uniforms = ring;
+    s_uniformsWarned = false;
+}
+
+RingBuffer::Allocation Model::writeObjectUniforms(const QMatrix3x3 &normalMatrix)
+{
+    // シェーダーは ObjectBlock からしか行列を読まないので、書き込めなければ描画できない
+    // 毎フレーム全てのモデルで出さないように、警告は一度だけにする
+    if (!s_uniforms)
+    {
+        if (!s_uniformsWarned)
+            qWarning() << "No uniform ring buffer is set. Models are not drawn";
+        s_uniformsWarned = true;
+        return RingBuffer::Allocation();
+    }
+
+    // 広げられるリングバッファなら足りなくなることはない
+    RingBuffer::Allocation allocation = s_uniforms->allocate(sizeof(ObjectUniforms));
+    if (!allocation.isValid())
+    {
+        if (!s_uniformsWarned)
+            qWarning() << "Uniform ring buffer is full. Models that do not fit are not drawn";
+        s_uniformsWarned = true;
+        return allocation;
+    }
+
+    static_assert(sizeof(ObjectUniforms) == 240, "ObjectUniforms must match the std140 layout of ObjectBlock");
+    ObjectUniforms *u = static_cast<ObjectUniforms*>(allocation.data);
+    std::memcpy(u->modelView, m_modelViewMatrix.constData(), sizeof(u->modelView));
+    std::memcpy(u->mvp, m_mvpMatrix.constData(), sizeof(u->mvp));
+    // mat3 の列は vec4 に揃える
+    const float *normal = normalMatrix.constData();
+    for (int column = 0; column < 3; column++)
+    {
+        u->normal[column * 4 + 0] = normal[column * 3 + 0];
+        u->normal[column * 4 + 1] = normal[column * 3 + 1];
+        u->normal[column * 4 + 2] = normal[column * 3 + 2];
+        u->normal[column * 4 + 3] = 0.0f;
+    }
+    std::memcpy(u->Ka, &m_material.Ka, sizeof(QVector3D));
+    std::memcpy(u->Kd, &m_material.Kd, sizeof(QVector3D));
+    std::memcpy(u->Ks, &m_material.Ks, sizeof(QVector3D));
+    u->Shininess = m_material.Shininess;
+    u->Opacity = m_material.Opacity;
+
+    s_uniforms->flush(allocation);
+    return allocation;
+}
+
+FrameProfiler *Model::profiler()
+{
+    return s_profiler;
+}
+
+void Model::setResources(GpuResources *resources)
+{
+    s_resources = resources;
+}
+
+void Model::setFrameArena(Arena *arena)
+{
+    s_frameArena = arena;
+}
+
+void Model::setOcclusionCuller(OcclusionCuller *culler)
+{
+    s_occlusion = culler;
+}
+
+void Model::setDepthPrepass(DepthPrepass *prepass)
+{
+    s_prepass = prepass;
+}
+
+DepthPrepass::Pass Model::prepass()
+{
+    return s_prepass ? s_prepass->pass() : DepthPrepass::Pass::None;
+}
+
+void Model::setIndirectRing(RingBuffer *ring)
+{
+    // 関数はリングバッファを作ったコンテキストから取る
+    s_indirect = ring;
+    s_multiDrawElementsIndirect = nullptr;
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (ring && context)
+        s_multiDrawElementsIndirect = reinterpret_cast<MultiDrawElementsIndirectFunc>(context->getProcAddress("glMultiDrawElementsIndirect"));
+}
+
+GpuResources *Model::resources()
+{
+    return s_resources;
+}
+
+qint64 Model::gpuMemoryUsage()
+{
+    return s_resources ? s_resources->totalUsage() : 0;
+}
+
+void Model::addGpuMemoryUsage(GpuResources::Category category, qint64 bytes)
+{
+    if (s_resources)
+        s_resources->add(category, bytes);
+}
+
+void Model::removeGpuMemoryUsage(GpuResources::Category category, qint64 bytes)
+{
+    if (s_resources)
+        s_resources->remove(category, bytes);
+}
+
 
 QOpenGLBuffer Model::getIbo() const
 {
@@ -9,8 +9,23 @@
 #include <QVector3D>
 #include <QFileInfo>
 #include <QString>
+#include <QAtomicInt>
+#include <QTemporaryFile>
 #include "wavefrontobj.h"
 #include "stlloader.h"
+#include "frameprofiler.h"
+#include "scenetable.h"
+#include "jobsystem.h"
+#include "loadprogress.h"
+#include "uploadqueue.h"
+#include "ringbuffer.h"
+#include "gpuresources.h"
+#include "bakedmesh.h"
+#include "vertexformat.h"
+#include "meshlet.h"
+#include "arena.h"
+#include "occlusionculler.h"
+#include "depthprepass.h"
 
 class Model : protected QOpenGLFunctions
 {
@@ -20,9 +35,19 @@ public:
         QVector3D position;
         QVector3D normal;
         QVector2D texCoord;
-        int getPositionOffset(){ return 0;}
-        int getNormalOffset(){ return sizeof(QVector3D);}
-        int getTexCoordOffset(){ return sizeof(QVector3D) + sizeof(QVector2D);}
+    };
+    // VertexData の並び(属性の設定とシェーダーの宣言はここから作る)
+    typedef VertexFormat::Format<
+        VertexFormat::Attribute<VertexFormat::Position, VertexFormat::Float<3>>,
+        VertexFormat::Attribute<VertexFormat::Normal, VertexFormat::Float<3>>,
+        VertexFormat::Attribute<VertexFormat::TexCoord, VertexFormat::Float<2>>> Format;
+    // 位置だけの頂点(面の法線はフラグメントシェーダーで求める)
+    typedef VertexFormat::Format<VertexFormat::Attribute<VertexFormat::Position, VertexFormat::Float<3>>> FlatFormat;
+
+    enum class Shading
+    {
+        Smooth, // 頂点毎の法線(VertexData)
+        Flat,   // 同じ位置の頂点をまとめ、画面上の位置の変化から面の法線を求める(STL)
     };
 
     struct Light
@@ -47,8 +72,19 @@ public:
 
     virtual void initialize();
     virtual void release();
-    virtual bool load(const QString &filename);
+    // 生成と load() はOpenGLを使わないのでどのスレッドで呼んでもよい(bind 以降はGLスレッドで呼ぶ)
+    virtual bool load(const QString &filename, LoadProgress *progress = nullptr);
+    // 読み取り専用の頂点データをコピーせずに使う(データは Model より長く残っていること)
+    void setMesh(const VertexData *vertices, int vertexCount, const GLuint *indexes, int indexCount);
+    // Primitives の生成結果(primitives.h)を渡す
+    template <typename Mesh>
+    void setMesh(const Mesh &mesh) { setMesh(mesh.vertices, Mesh::VertexCount, mesh.indexes, Mesh::IndexCount); }
+    // シェーダーは読み込んだメッシュの Shading に合わせて作るので load() の後で呼ぶ
     virtual void bind(const QString &vertexShader, const QString &fragmentShader);
+
+    // 頂点データを queue で数フレームに分けて転送する(転送が終わるまで描画しない)
+    virtual void bindStreamed(const QString &vertexShader, const QString &fragmentShader, UploadQueue *queue);
+    bool isResident() const;
     virtual void update();
     virtual void draw(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix, const QMatrix4x4 &parentModelMatrix=QMatrix4x4());
     virtual void addChild(Model* child);
@@ -64,6 +100,20 @@ public:
 
     virtual QVector3D getTranslation();
 
+    // 親の変換を含めたモデル行列(変更があった時だけ再計算する)
+    const QMatrix4x4 &getWorldMatrix();
+    const QMatrix3x3 &getNormalMatrix();
+
+    // 変更のあった部分木だけワールド行列を更新する
+    void updateWorldMatrices();
+
+    Model *getParent() const;
+
+    // 変換を SceneTable で管理する(子孫も含めて登録する)
+    void attach(SceneTable *table);
+    SceneTable *getSceneTable() const;
+    SceneTable::Handle getSceneHandle() const;
+
     QVector<VertexData> getVertices() const;
     void setVertices(const QVector<VertexData> &vertices);
     Light getLight() const;
@@ -72,11 +122,64 @@ public:
     bool getVisible() const;
     void setVisible(bool visible);
 
+    QString getName() const;
+    void setName(const QString &name);
+
+    Shading getShading() const;
+    // 読み込んだ頂点と番号の大きさ(byte)。転送すると頂点は消えるので bind の前に呼ぶ
+    qint64 meshBytes() const;
+
+    // 描画時間を計測するプロファイラ(全モデル共通)
+    static void setProfiler(FrameProfiler *profiler);
+
+    // オブジェクト毎のユニフォーム(ObjectBlock)を書き込むリングバッファ(全モデル共通)
+    // 足りなくならないように setGrowable(true) にしておく
+    static void setUniformRing(RingBuffer *ring);
+    static const GLuint ObjectBlockBinding = 0;
+
+    // GPUリソースの集計と退避(全モデル共通)
+    static void setResources(GpuResources *resources);
+
+    // メッシュレットのカリング結果を置くフレーム用の Arena(全モデル共通。無ければメッシュレットを使わない)
+    static void setFrameArena(Arena *arena);
+    // 見えるメッシュレットの描画コマンドを書き込むリングバッファ(GL_DRAW_INDIRECT_BUFFER、全モデル共通)
+    // glMultiDrawElementsIndirect が使えない場合は範囲毎に glDrawElements する
+    static void setIndirectRing(RingBuffer *ring);
+
+    // 前のフレームの深度で隠れていた不透明なモデルとメッシュレットを後回しにする(全モデル共通。フレーム用の Arena も必要)
+    static void setOcclusionCuller(OcclusionCuller *culler);
+    // 深度だけを先に描画するパス(全モデル共通)。Off でない間に bind() したモデルは位置だけの頂点も転送する
+    static void setDepthPrepass(DepthPrepass *prepass);
+
+    // OcclusionCuller が後回しにした範囲を描画する(条件付き描画の中で呼ばれる)
+    void drawOccluded(const RingBuffer::Allocation &uniforms, const DrawElementsIndirectCommand *ranges, int count);
+
+    // この数以上の三角形を持つメッシュはメッシュレットに分けて、描画前に見えないものを外す
+    static const int MeshletThreshold = 4096;
+    int meshletCount() const;
+
+    // 確保しているGPUリソースの合計サイズ(byte)
+    static qint64 gpuMemoryUsage();
+
 protected:
-    virtual bool loadObj(const QString &filename);
-    virtual bool loadStl(const QString &filename);
+    virtual bool loadObj(const QString &filename, LoadProgress *progress);
+    virtual bool loadStl(const QString &filename, LoadProgress *progress);
+    void buildVertices(const QVector<Triangle3D> &triangles);
+    void buildVertices(const QVector<StlLoader::Triangle3D> &triangles);
+    void buildVertices(const Triangle3D *triangles, int count);
+    void buildVertices(const StlLoader::Triangle3D *triangles, int count);
+    // count 個の三角形分の頂点と番号を用意し、頂点の先頭を返す
+    VertexData *resizeTriangles(int count);
+    static void convertTriangles(const Triangle3D *input, int count, VertexData *output);
+    static void convertTriangles(const StlLoader::Triangle3D *input, int count, VertexData *output);
     virtual void shaderInit(const QString &vertexShaderFile, const QString &fragmentShaderFile);
+    // 頂点シェーダーに頂点の形式の宣言を入れる
+    virtual QByteArray vertexShaderSource(const QString &fileName) const;
+    virtual QByteArray fragmentShaderSource(const QString &fileName) const;
     virtual void bufferInit();
+    virtual void streamInit(UploadQueue *queue);
+    // 頂点と番号のバッファの大きさを求める。int を超えて確保できなければ false
+    bool measureBuffers();
 
     QOpenGLShaderProgram *getShaderProgram() const;
     void setShaderProgram(QOpenGLShaderProgram *shaderProgram);
@@ -87,34 +190,163 @@ protected:
     QStringList getComments() const;
     void setComments(const QStringList &comments);
 
+    static FrameProfiler *profiler();
+    static GpuResources *resources();
+    static void addGpuMemoryUsage(GpuResources::Category category, qint64 bytes);
+    static void removeGpuMemoryUsage(GpuResources::Category category, qint64 bytes);
+
 private:
+    // shader.vert の ObjectBlock と同じ std140 のレイアウト
+    struct ObjectUniforms
+    {
+        float modelView[16];
+        float mvp[16];
+        float normal[12];   // mat3 は vec4 x 3
+        float Ka[4];
+        float Kd[4];
+        float Ks[3];
+        float Shininess;
+        float Opacity;
+        float padding[3];
+    };
+    RingBuffer::Allocation writeObjectUniforms(const QMatrix3x3 &normalMatrix);
+
+    // ビルド時に変換したメッシュ(":/baked/*.mesh")があればそれを使う
+    bool loadBaked(const QString &filename);
+    // 転送する頂点データ(ベイク済みのリソースや setMesh() のデータ、それ以外は m_vertices / m_indexes)
+    const void *vertexData() const;
+    const void *indexData() const;
+    int vertexCount() const;
+    int indexCount() const;
+    int vertexStride() const;
+    // 転送した番号の数(CPU側の番号は転送すると捨てる)
+    int drawIndexCount() const;
+    // 読み込んだメッシュを捨てる
+    void clearMesh();
+    // 転送が終わった頂点と番号を捨てる(退避できるなら先に一時ファイルに控えを書く)
+    void releaseMesh();
+    void spill();
+    void dropSpill();
+    // 読み込んだメッシュをメッシュレットに分ける(m_indexes を並べ替える)
+    void buildMeshlets();
+    // 読み込んだメッシュを包む球を求める(転送すると頂点は消えるので読み込んだ時に求める)
+    void updateBounds();
+    // 前のフレームの深度で判定するか(不透明で、包む球が分かっているもの)
+    bool isOcclusionCulled() const;
+    // 隠れていれば OcclusionCuller に渡して true を返す
+    bool deferOccluded(const QMatrix4x4 &modelMatrix, const RingBuffer::Allocation &uniforms);
+    // プリパスの描画中ならそのパス
+    static DepthPrepass::Pass prepass();
+    // 深度だけのパス用に位置だけを詰めた頂点を作る(フラットシェーディングの頂点は元から位置だけ)
+    // プリパスが Off の間は作らず、Off にしたら捨てる
+    bool needsPositionStream() const;
+    static bool isPrepassEnabled();
+    void releasePositionStream();
+    void buildPositionStream();
+    // 見えるメッシュレットだけ描画し、描画した三角形の数を返す
+    int drawMeshlets(const QMatrix4x4 &modelMatrix, const RingBuffer::Allocation &uniforms);
+    // シェーダー・バッファ・頂点属性を用意して、インデックスの範囲を描画する
+    void beginDraw(const RingBuffer::Allocation &uniforms);
+    // 深度だけのパス用(位置だけを読む)
+    void beginDepthDraw(const RingBuffer::Allocation &uniforms);
+    void drawRanges(const DrawElementsIndirectCommand *commands, int count);
+    void endDraw();
+
+    // 読み込み時の作業用 Arena のブロックサイズ
+    static const qint64 ScratchBlockSize = 16 << 20;
+
+    // VBO/IBO を破棄する(描画中のフレームが使い終わってから)
+    void releaseBuffers();
+    // 予算を超えた時の退避と、次に描画される時の再転送
+    void trackResidency();
+    void evict();
+    void restore();
+
     // shader
     QOpenGLShaderProgram* m_shaderProgram;
 
     // Vertex data
     QVector<VertexData> m_vertices;
-    QVector<GLushort> m_indexes;
+    QVector<QVector3D> m_positions; // Shading::Flat の場合はこちらを使う
+    QVector<GLuint> m_indexes;
+    Shading m_shading;
     QStringList m_comments;
+    const void *m_staticVertices;   // ベイク済みのリソースや Primitives のデータを直接指す(コピーしない)
+    const void *m_staticIndexes;
+    int m_staticVertexCount;
+    int m_staticIndexCount;
+    QTemporaryFile *m_spill;        // 転送した頂点と番号の控え(退避から戻す時に map して転送する)
+    uchar *m_spillMap;              // 戻している間だけ map する(m_staticVertices が指す)
+    QVector<Meshlet> m_meshlets;    // m_indexes の範囲(自分で持つ大きなメッシュだけ)
+    QVector3D m_boundsCenter;       // メッシュを包む球(モデル座標。半径が負なら求めていない)
+    float m_boundsRadius;
 
     // buffer
     QOpenGLBuffer m_vbo;
+    QOpenGLBuffer m_positionVbo;            // 深度だけのパス用(無ければ m_vbo から位置だけ読む)
+    QVector<QVector3D> m_positionStream;    // 転送が終わるまでの位置だけの頂点
+    qint64 m_positionBytes;
     QOpenGLBuffer m_ibo;
 
+    void invalidateWorldMatrix();
+
     // transform
     QVector3D m_translation;
     QQuaternion m_rotation;
     QVector3D m_scale;
 
+    // transform cache
+    QMatrix4x4 m_localMatrix;
+    QMatrix4x4 m_worldMatrix;
+    QMatrix3x3 m_normalMatrix;
+    bool m_localDirty;
+    bool m_worldDirty;
+    bool m_childDirty;      // 子孫に更新が必要なノードがある
+
+    // draw cache
+    QMatrix4x4 m_cachedViewMatrix;
+    QMatrix4x4 m_cachedProjectionMatrix;
+    QMatrix4x4 m_modelViewMatrix;
+    QMatrix4x4 m_mvpMatrix;
+    bool m_mvpDirty;
+
     // Lighting
     Light m_light;
     Material m_material;
 
     // status
     bool m_visible;
+    bool m_resident;            // GPUへの転送が終わっている
+    UploadQueue* m_uploadQueue; // 転送中のキュー
+    UploadQueue* m_streamQueue; // bindStreamed() で指定したキュー(再転送に使う)
+    bool m_evicted;             // 予算を超えたのでGPUから退避している
+    QString m_name;
+    int m_id;                   // 同じ名前のモデルを見分ける番号(生成順)
+    QString m_profileName;      // GPU時間の計測の名前(名前と番号)
+
+    qint64 m_vertexBytes;
+    qint64 m_indexBytes;
+    qint64 m_programBytes;
+
+    static FrameProfiler* s_profiler;
+    static RingBuffer* s_uniforms;
+    static bool s_uniformsWarned;   // ユニフォームを書き込めなかった警告を出した
+    static GpuResources* s_resources;
+    static Arena* s_frameArena;
+    static RingBuffer* s_indirect;
+    static OcclusionCuller* s_occlusion;
+    static DepthPrepass* s_prepass;
+    static QAtomicInt s_nextId;
 
     // Node
+    Model* m_parent;
     QVector<Model*> m_children;
 
+    // SceneTable
+    SceneTable* m_table;
+    SceneTable::Handle m_handle;
+    quint64 m_tableVersion;     // コピー済みのワールド行列の更新番号
+
 };
 
 #endif // MODEL_H
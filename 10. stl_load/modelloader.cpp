@@ -0,0 +1,117 @@
+#include "modelloader.h"
+#include <QRunnable>
+#include <functional>
+
+namespace
+{
+    class LoadTask : public QRunnable
+    {
+    public:
+        explicit LoadTask(std::function<void()> function) : m_function(std::move(function)) {}
+        void run() override { m_function(); }
+
+    private:
+        std::function<void()> m_function;
+    };
+}
+
+ModelLoader::ModelLoader(QObject *parent) : QObject(parent)
+{
+    m_nextTicket = 1;
+
+    // ファイル単位の並列数。ファイル内の並列化は JobSystem が行う
+    setMaxConcurrentLoads(2);
+
+    // 進捗は一定間隔でまとめて通知する
+    m_progressTimer.setInterval(100);
+    connect(&m_progressTimer, &QTimer::timeout, this, [this](){
+        emit progressChanged(pendingCount(), progress());
+    });
+}
+
+ModelLoader::~ModelLoader()
+{
+    cancelAll();
+    m_pool.waitForDone();
+
+    // 受け取られなかったモデルを破棄する
+    for (auto request : m_requests)
+        delete request->model;
+    m_requests.clear();
+}
+
+ModelLoader::Ticket ModelLoader::load(const QString &filename, Model *model)
+{
+    auto request = QSharedPointer<Request>::create();
+    request->ticket = m_nextTicket++;
+    request->filename = filename;
+    request->model = model;
+    m_requests.insert(request->ticket, request);
+
+    auto task = new LoadTask([this, request](){
+        bool ok = !request->progress.isCanceled()
+                && request->model->load(request->filename, &request->progress);
+
+        // 結果は GUI スレッドで通知する
+        Ticket ticket = request->ticket;
+        QMetaObject::invokeMethod(this, [this, ticket, ok](){ finish(ticket, ok); }, Qt::QueuedConnection);
+    });
+    m_pool.start(task);
+
+    if (!m_progressTimer.isActive())
+        m_progressTimer.start();
+    emit progressChanged(pendingCount(), progress());
+
+    return request->ticket;
+}
+
+void ModelLoader::finish(Ticket ticket, bool ok)
+{
+    auto request = m_requests.take(ticket);
+    if (!request)
+        return;
+
+    if (m_requests.isEmpty())
+        m_progressTimer.stop();
+    emit progressChanged(pendingCount(), progress());
+
+    bool canceled = request->progress.isCanceled();
+    if (ok && !canceled)
+        emit loaded(ticket, request->model, request->filename);
+    else
+        emit failed(ticket, request->model, request->filename, canceled);
+}
+
+void ModelLoader::cancel(Ticket ticket)
+{
+    auto request = m_requests.value(ticket);
+    if (request)
+        request->progress.cancel();
+}
+
+void ModelLoader::cancelAll()
+{
+    for (auto request : m_requests)
+        request->progress.cancel();
+}
+
+int ModelLoader::pendingCount() const
+{
+    return m_requests.size();
+}
+
+double ModelLoader::progress() const
+{
+    if (m_requests.isEmpty())
+        return 1.0;
+
+    double sum = 0.0;
+    for (auto request : m_requests)
+        sum += request->progress.fraction();
+    return sum / m_requests.size();
+}
+
+void ModelLoader::setMaxConcurrentLoads(int count)
+{
+    m_pool.setMaxThreadCount(qMax(count, 1));
+}
@@ -0,0 +1,59 @@
+#ifndef MODELLOADER_H
+#define MODELLOADER_H
+
+#include <QObject>
+#include <QMap>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QTimer>
+#include "model.h"
+#include "loadprogress.h"
+
+// 複数のモデルファイルをバックグラウンドで並行して読み込む
+// 解析と頂点の変換はワーカースレッドで行い、完了したモデルを GUI(GL) スレッドへ渡す
+class ModelLoader : public QObject
+{
+    Q_OBJECT
+public:
+    typedef int Ticket;
+
+    explicit ModelLoader(QObject *parent = nullptr);
+    ~ModelLoader() override;
+
+    // model は GL スレッドで生成しておく(load() だけをワーカーで呼ぶ)
+    Ticket load(const QString &filename, Model *model);
+
+    void cancel(Ticket ticket);
+    void cancelAll();
+
+    int pendingCount() const;
+    double progress() const;        // 読み込み中のファイル全体の進捗(0～1)
+
+    // 同時に読み込むファイル数
+    void setMaxConcurrentLoads(int count);
+
+signals:
+    void progressChanged(int pending, double progress);
+
+    // 成功時は bind() 前のモデルを渡す。失敗・キャンセル時は model を破棄すること
+    void loaded(ModelLoader::Ticket ticket, Model *model, const QString &filename);
+    void failed(ModelLoader::Ticket ticket, Model *model, const QString &filename, bool canceled);
+
+private:
+    struct Request
+    {
+        Ticket ticket;
+        QString filename;
+        Model *model;
+        LoadProgress progress;
+    };
+
+    void finish(Ticket ticket, bool ok);
+
+    QThreadPool m_pool;
+    QMap<Ticket, QSharedPointer<Request>> m_requests;
+    QTimer m_progressTimer;
+    Ticket m_nextTicket;
+};
+
+#endif // MODELLOADER_H
@@ -0,0 +1,6 @@
+#version 400 core
+// 色も深度も書き込まず、オクルージョンクエリで見えたかだけを数える
+
+void main(void)
+{
+}
@@ -0,0 +1,25 @@
+#version 400 core
+// 後回しにしたものを包む箱(OcclusionCuller::flush)。頂点は gl_VertexID から、箱はインスタンス毎の球から作る
+
+layout(location = 3) in vec4 Sphere;    // ワールド座標の中心と半径
+
+uniform mat4 ViewProjection;
+
+// 箱の角の番号(bit 0: x, bit 1: y, bit 2: z)で 6 面 x 2 三角形
+const int Corners[36] = int[36](
+    0, 1, 3,  0, 3, 2,      // -z
+    4, 6, 7,  4, 7, 5,      // +z
+    0, 2, 6,  0, 6, 4,      // -x
+    1, 5, 7,  1, 7, 3,      // +x
+    0, 4, 5,  0, 5, 1,      // -y
+    2, 3, 7,  2, 7, 6       // +y
+);
+
+void main(void)
+{
+    int corner = Corners[gl_VertexID];
+    vec3 offset = vec3((corner & 1) != 0 ? 1.0 : -1.0,
+                       (corner & 2) != 0 ? 1.0 : -1.0,
+                       (corner & 4) != 0 ? 1.0 : -1.0);
+    gl_Position = ViewProjection * vec4(Sphere.xyz + offset * Sphere.w, 1.0);
+}
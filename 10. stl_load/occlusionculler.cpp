@@ -0,0 +1,582 @@
+#include "occlusionculler.h"
+#include "model.h"
+#include <QOpenGLContext>
+#include <QDebug>
+#include <cmath>
+#include <cstring>
+
+#ifndef GL_DEPTH_COMPONENT32
+#define GL_DEPTH_COMPONENT32 0x81A7
+#endif
+#ifndef GL_QUERY_WAIT
+#define GL_QUERY_WAIT 0x8E13
+#endif
+
+namespace {
+
+// 箱の属性の番号(モデルの頂点属性と重ならないようにする)
+const GLuint SphereLocation = 3;
+
+GLint attachmentParameter(QOpenGLExtraFunctions *gl, GLenum attachment, GLenum name)
+{
+    GLint value = 0;
+    gl->glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, attachment, name, &value);
+    return value;
+}
+
+}
+
+OcclusionCuller::OcclusionCuller()
+{
+    m_enabled = true;
+    m_supported = false;
+    m_reduceProgram = nullptr;
+    m_depthTexture = 0;
+    m_depthFramebuffer = 0;
+    m_depthFormat = 0;
+    m_source = 0;
+    m_hizTexture = 0;
+    m_nextReadback = 0;
+    m_nextQueries = 0;
+    m_occluded = 0;
+    m_depthLevel = 0;
+    m_near = 0.0f;
+    m_currentNear = 0.0f;
+    m_boxProgram = nullptr;
+    m_beginConditionalRender = nullptr;
+    m_endConditionalRender = nullptr;
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    destroy();
+}
+
+bool OcclusionCuller::create()
+{
+    destroy();
+
+    // オクルージョンクエリ(GL_ANY_SAMPLES_PASSED)と属性の divisor は 3.3 から
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context || context->isOpenGLES() || context->format().version() < qMakePair(3, 3))
+        return false;
+    initializeOpenGLFunctions();
+
+    m_beginConditionalRender = reinterpret_cast<BeginConditionalRenderFunc>(context->getProcAddress("glBeginConditionalRender"));
+    m_endConditionalRender = reinterpret_cast<EndConditionalRenderFunc>(context->getProcAddress("glEndConditionalRender"));
+
+    m_reduceProgram = new QOpenGLShaderProgram();
+    m_boxProgram = new QOpenGLShaderProgram();
+    bool linked = m_reduceProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/hiz.vert")
+            && m_reduceProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/hiz.frag")
+            && m_reduceProgram->link()
+            && m_boxProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/occlusion.vert")
+            && m_boxProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/occlusion.frag")
+            && m_boxProgram->link();
+    if (!linked || !m_beginConditionalRender || !m_endConditionalRender)
+    {
+        qWarning() << "Occlusion culling is not available";
+        destroy();
+        return false;
+    }
+
+    m_sphereBuffer = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_sphereBuffer.create();
+    m_sphereBuffer.setUsagePattern(QOpenGLBuffer::StreamDraw);
+
+    for (Readback &readback : m_readbacks)
+        glGenBuffers(1, &readback.buffer);
+
+    m_supported = true;
+    return true;
+}
+
+void OcclusionCuller::destroy()
+{
+    if (!m_reduceProgram)
+        return;
+
+    releaseTargets();
+    for (Readback &readback : m_readbacks)
+    {
+        if (readback.fence)
+            glDeleteSync(readback.fence);
+        if (readback.buffer)
+            glDeleteBuffers(1, &readback.buffer);
+        readback = Readback();
+    }
+    for (Queries &queries : m_queries)
+    {
+        if (!queries.ids.isEmpty())
+            glDeleteQueries(queries.ids.size(), queries.ids.constData());
+        queries = Queries();
+    }
+    m_occluded = 0;
+    if (m_sphereBuffer.isCreated())
+        m_sphereBuffer.destroy();
+
+    delete m_reduceProgram;
+    m_reduceProgram = nullptr;
+    delete m_boxProgram;
+    m_boxProgram = nullptr;
+
+    m_depth.clear();
+    m_supported = false;
+}
+
+void OcclusionCuller::releaseTargets()
+{
+    if (!m_hizFramebuffers.isEmpty())
+        glDeleteFramebuffers(m_hizFramebuffers.size(), m_hizFramebuffers.constData());
+    m_hizFramebuffers.clear();
+    if (m_depthFramebuffer)
+        glDeleteFramebuffers(1, &m_depthFramebuffer);
+    if (m_depthTexture)
+        glDeleteTextures(1, &m_depthTexture);
+    if (m_hizTexture)
+        glDeleteTextures(1, &m_hizTexture);
+    m_depthFramebuffer = 0;
+    m_depthTexture = 0;
+    m_hizTexture = 0;
+    m_size = QSize();
+}
+
+QSize OcclusionCuller::levelSize(const QSize &size, int level)
+{
+    int width = size.width();
+    int height = size.height();
+    for (int i = 0; i <= level; i++)
+    {
+        width = qMax(1, width / 2);
+        height = qMax(1, height / 2);
+    }
+    return QSize(width, height);
+}
+
+void OcclusionCuller::resize(const QSize &size, GLuint sourceFramebuffer)
+{
+    releaseTargets();
+
+    // 深度のコピー(glBlitFramebuffer)は形式が同じでないとできないので、描画先に合わせる
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFramebuffer);
+    GLenum depthAttachment = sourceFramebuffer ? GL_DEPTH_ATTACHMENT : GL_DEPTH;
+    GLenum stencilAttachment = sourceFramebuffer ? GL_STENCIL_ATTACHMENT : GL_STENCIL;
+    GLint depthBits = attachmentParameter(this, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE);
+    bool floating = attachmentParameter(this, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE) == GL_FLOAT;
+    GLint stencilBits = 0;
+    if (attachmentParameter(this, stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE) != GL_NONE)
+        stencilBits = attachmentParameter(this, stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE);
+
+    GLenum format = GL_DEPTH_COMPONENT;
+    GLenum type = GL_UNSIGNED_INT;
+    if (stencilBits > 0)
+    {
+        m_depthFormat = floating ? GL_DEPTH32F_STENCIL8 : GL_DEPTH24_STENCIL8;
+        format = GL_DEPTH_STENCIL;
+        type = floating ? GL_FLOAT_32_UNSIGNED_INT_24_8_REV : GL_UNSIGNED_INT_24_8;
+    }
+    else if (floating)
+    {
+        m_depthFormat = GL_DEPTH_COMPONENT32F;
+        type = GL_FLOAT;
+    }
+    else
+    {
+        m_depthFormat = depthBits >= 32 ? GL_DEPTH_COMPONENT32 : (depthBits <= 16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24);
+    }
+
+    glGenTextures(1, &m_depthTexture);
+    glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(m_depthFormat), size.width(), size.height(), 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    const GLenum none = GL_NONE;
+    glGenFramebuffers(1, &m_depthFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_depthFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, stencilBits > 0 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                           GL_TEXTURE_2D, m_depthTexture, 0);
+    glDrawBuffers(1, &none);
+    glReadBuffer(GL_NONE);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    // 1x1 になるまで 2x2 の最大値を重ねる
+    int levels = 0;
+    while (levels == 0 || levelSize(size, levels - 1) != QSize(1, 1))
+        levels++;
+
+    glGenTextures(1, &m_hizTexture);
+    glBindTexture(GL_TEXTURE_2D, m_hizTexture);
+    for (int level = 0; level < levels; level++)
+    {
+        QSize extent = levelSize(size, level);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, extent.width(), extent.height(), 0, GL_RED, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_hizFramebuffers.resize(levels);
+    glGenFramebuffers(levels, m_hizFramebuffers.data());
+    for (int level = 0; level < levels && complete; level++)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_hizFramebuffers.at(level));
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_hizTexture, level);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFramebuffer);
+
+    if (!complete)
+    {
+        qWarning() << "Hi-Z framebuffer is incomplete. Occlusion culling is disabled";
+        releaseTargets();
+        m_supported = false;
+        return;
+    }
+    m_size = size;
+    m_source = sourceFramebuffer;
+}
+
+void OcclusionCuller::beginFrame()
+{
+    m_spheres.clear();
+    m_deferred.clear();
+    if (!m_supported)
+        return;
+
+    m_nextQueries = (m_nextQueries + 1) % RingBuffer::Frames;
+    countOccluded();
+
+    // 古い順に見て、GPUが終わっているものの中で最も新しい結果を使う(待たない)
+    for (int i = 0; i < RingBuffer::Frames; i++)
+    {
+        Readback &readback = m_readbacks[(m_nextReadback + i) % RingBuffer::Frames];
+        if (!readback.fence)
+            continue;
+        GLenum result = glClientWaitSync(readback.fence, 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+            break;
+        resolve(readback);
+    }
+}
+
+void OcclusionCuller::resolve(Readback &readback)
+{
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+
+    int count = readback.size.width() * readback.size.height();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * static_cast<GLsizeiptr>(sizeof(float)), GL_MAP_READ_BIT);
+    if (mapped)
+    {
+        setDepth(static_cast<const float*>(mapped), readback.screen, readback.level, readback.projection, readback.view);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void OcclusionCuller::setDepth(const float *depth, const QSize &screen, int level, const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix)
+{
+    QSize size = levelSize(screen, level);
+    int count = size.width() * size.height();
+    m_depth.resize(count);
+    std::memcpy(m_depth.data(), depth, static_cast<size_t>(count) * sizeof(float));
+
+    m_view = viewMatrix;
+    m_projection = projectionMatrix;
+    m_depthSize = size;
+    m_depthScreen = screen;
+    m_depthLevel = level;
+    m_near = nearPlane(projectionMatrix);
+}
+
+void OcclusionCuller::countOccluded()
+{
+    // RingBuffer::beginFrame() がこのフレーム数前の描画を待っているので、結果はもう出ている
+    // 出ていなければ待たずに前の数のままにする
+    Queries &queries = m_queries[m_nextQueries];
+    int occluded = 0;
+    for (int i = 0; i < queries.sphereCounts.size(); i++)
+    {
+        GLuint available = 0;
+        glGetQueryObjectuiv(queries.ids.at(i), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            queries.sphereCounts.clear();
+            return;
+        }
+        GLuint passed = 0;
+        glGetQueryObjectuiv(queries.ids.at(i), GL_QUERY_RESULT, &passed);
+        if (!passed)
+            occluded += queries.sphereCounts.at(i);
+    }
+    queries.sphereCounts.clear();
+    m_occluded = occluded;
+}
+
+float OcclusionCuller::nearPlane(const QMatrix4x4 &projectionMatrix)
+{
+    const QMatrix4x4 &p = projectionMatrix;
+    return p(2, 3) / (p(2, 2) - 1.0f);
+}
+
+void OcclusionCuller::setCamera(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix)
+{
+    m_currentView = viewMatrix;
+    m_currentNear = nearPlane(projectionMatrix);
+}
+
+bool OcclusionCuller::isOccluded(const QVector3D &center, float radius) const
+{
+    if (!m_enabled || m_depth.isEmpty())
+        return false;
+
+    // 今の視点で、視点が球の中にある、または手前の平面に掛かる場合は見えているとする
+    QVector3D current = m_currentView.map(center);
+    if (current.lengthSquared() <= radius * radius || -current.z() - radius <= m_currentNear)
+        return false;
+
+    // 読み戻した時の視点でも同じ
+    QVector3D eye = m_view.map(center);
+    if (-eye.z() - radius <= m_near)
+        return false;
+
+    // 球を包む視点座標の箱を射影した範囲
+    float minX = 1.0f, minY = 1.0f, maxX = -1.0f, maxY = -1.0f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        QVector3D offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius, (corner & 4) ? radius : -radius);
+        QVector4D clip = m_projection * QVector4D(eye + offset, 1.0f);
+        float x = clip.x() / clip.w();
+        float y = clip.y() / clip.w();
+        minX = qMin(minX, x);
+        minY = qMin(minY, y);
+        maxX = qMax(maxX, x);
+        maxY = qMax(maxY, y);
+    }
+    if (maxX < -1.0f || maxY < -1.0f || minX > 1.0f || minY > 1.0f)
+        return false;
+
+    // 球の最も手前の点の深度(0～1)
+    QVector4D nearest = m_projection * QVector4D(eye.x(), eye.y(), eye.z() + radius, 1.0f);
+    float depth = nearest.z() / nearest.w() * 0.5f + 0.5f;
+
+    // 画面のピクセルを読み戻した階層の texel にする(端の texel は奇数の余りも含む)
+    int shift = m_depthLevel + 1;
+    auto texelX = [&](float x){
+        int pixel = qBound(0, static_cast<int>(std::floor((x * 0.5f + 0.5f) * m_depthScreen.width())), m_depthScreen.width() - 1);
+        return qMin(pixel >> shift, m_depthSize.width() - 1);
+    };
+    auto texelY = [&](float y){
+        int pixel = qBound(0, static_cast<int>(std::floor((y * 0.5f + 0.5f) * m_depthScreen.height())), m_depthScreen.height() - 1);
+        return qMin(pixel >> shift, m_depthSize.height() - 1);
+    };
+    int x0 = texelX(minX), x1 = texelX(maxX);
+    int y0 = texelY(minY), y1 = texelY(maxY);
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > MaxTestTexels)
+        return false;
+
+    // 各 texel はその範囲の最も奥の深度なので、全て球より手前なら隠れている
+    const float *row = m_depth.constData();
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            if (row[y * m_depthSize.width() + x] >= depth)
+                return false;
+        }
+    }
+    return true;
+}
+
+void OcclusionCuller::defer(Model *model, const RingBuffer::Allocation &uniforms, const QVector4D *spheres, int sphereCount,
+                            const DrawElementsIndirectCommand *ranges, int rangeCount)
+{
+    Deferred deferred;
+    deferred.model = model;
+    deferred.uniforms = uniforms;
+    deferred.firstSphere = m_spheres.size();
+    deferred.sphereCount = sphereCount;
+    deferred.ranges = ranges;
+    deferred.rangeCount = rangeCount;
+    m_deferred.append(deferred);
+    for (int i = 0; i < sphereCount; i++)
+        m_spheres.append(spheres[i]);
+}
+
+void OcclusionCuller::flush(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix)
+{
+    if (m_deferred.isEmpty())
+        return;
+
+    Queries &queries = m_queries[m_nextQueries];
+    if (queries.ids.size() < m_deferred.size())
+    {
+        int first = queries.ids.size();
+        queries.ids.resize(m_deferred.size());
+        glGenQueries(queries.ids.size() - first, queries.ids.data() + first);
+    }
+    for (const Deferred &deferred : m_deferred)
+        queries.sphereCounts.append(deferred.sphereCount);
+
+    // 包む箱を今の深度に対して描画する(色も深度も書き込まない)
+    // モデル毎に1つのクエリで、メッシュレットの箱はインスタンスとしてまとめて描画する
+    m_sphereBuffer.bind();
+    m_sphereBuffer.allocate(m_spheres.constData(), m_spheres.size() * static_cast<int>(sizeof(QVector4D)));
+    m_boxProgram->bind();
+    m_boxProgram->setUniformValue("ViewProjection", projectionMatrix * viewMatrix);
+
+    // モデルの頂点属性は使わないので無効にする(描画時に有効にし直される)
+    for (GLuint location = 0; location < SphereLocation; location++)
+        glDisableVertexAttribArray(location);
+    glEnableVertexAttribArray(SphereLocation);
+    glVertexAttribDivisor(SphereLocation, 1);
+
+    GLboolean culling = glIsEnabled(GL_CULL_FACE);
+    glDisable(GL_CULL_FACE);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    for (int i = 0; i < m_deferred.size(); i++)
+    {
+        const Deferred &deferred = m_deferred.at(i);
+        const quintptr offset = deferred.firstSphere * static_cast<quintptr>(sizeof(QVector4D));
+        glVertexAttribPointer(SphereLocation, 4, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const void*>(offset));
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries.ids.at(i));
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 36, deferred.sphereCount);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+    }
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    if (culling)
+        glEnable(GL_CULL_FACE);
+
+    glVertexAttribDivisor(SphereLocation, 0);
+    glDisableVertexAttribArray(SphereLocation);
+    m_boxProgram->release();
+    m_sphereBuffer.release();
+
+    // 見えた場合だけGPU側で描画する(CPUは結果を待たない)
+    for (int i = 0; i < m_deferred.size(); i++)
+    {
+        const Deferred &deferred = m_deferred.at(i);
+        m_beginConditionalRender(queries.ids.at(i), GL_QUERY_WAIT);
+        deferred.model->drawOccluded(deferred.uniforms, deferred.ranges, deferred.rangeCount);
+        m_endConditionalRender();
+    }
+}
+
+void OcclusionCuller::capture(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix, const QSize &size)
+{
+    if (!m_enabled || !m_supported || size.isEmpty())
+        return;
+
+    GLint source = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &source);
+    if (size != m_size || static_cast<GLuint>(source) != m_source)
+        resize(size, static_cast<GLuint>(source));
+    if (!m_supported)
+        return;
+
+    // 描画先の深度をコピーする(マルチサンプルはここで1サンプルになる)
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, static_cast<GLuint>(source));
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFramebuffer);
+    glBlitFramebuffer(0, 0, size.width(), size.height(), 0, 0, size.width(), size.height(), GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    reduce();
+
+    // 読み戻す階層を PBO にコピーし、終わったら beginFrame() で使う
+    int level = 0;
+    while (levelSize(size, level).width() > ReadbackWidth && level + 1 < m_hizFramebuffers.size())
+        level++;
+    QSize extent = levelSize(size, level);
+
+    Readback &readback = m_readbacks[m_nextReadback];
+    if (readback.fence)
+        glDeleteSync(readback.fence);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_hizFramebuffers.at(level));
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, extent.width() * extent.height() * static_cast<GLsizeiptr>(sizeof(float)), nullptr, GL_STREAM_READ);
+    glReadPixels(0, 0, extent.width(), extent.height(), GL_RED, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.projection = projectionMatrix;
+    readback.view = viewMatrix;
+    readback.size = extent;
+    readback.screen = size;
+    readback.level = level;
+    m_nextReadback = (m_nextReadback + 1) % RingBuffer::Frames;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(source));
+    glViewport(0, 0, size.width(), size.height());
+}
+
+void OcclusionCuller::reduce()
+{
+    m_reduceProgram->bind();
+    m_reduceProgram->setUniformValue("Source", 0);
+    GLint levelLocation = m_reduceProgram->uniformLocation("SourceLevel");
+    GLint sizeLocation = m_reduceProgram->uniformLocation("SourceSize");
+
+    for (GLuint location = 0; location < SphereLocation; location++)
+        glDisableVertexAttribArray(location);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glActiveTexture(GL_TEXTURE0);
+
+    int levels = m_hizFramebuffers.size();
+    for (int level = 0; level < levels; level++)
+    {
+        // 前の階層だけを参照するようにして、書き込む階層と重ならないようにする
+        QSize source = level == 0 ? m_size : levelSize(m_size, level - 1);
+        if (level == 0)
+        {
+            glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+        }
+        else
+        {
+            glBindTexture(GL_TEXTURE_2D, m_hizTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        }
+        glUniform1i(levelLocation, level == 0 ? 0 : level - 1);
+        glUniform2i(sizeLocation, source.width(), source.height());
+
+        QSize extent = levelSize(m_size, level);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_hizFramebuffers.at(level));
+        glViewport(0, 0, extent.width(), extent.height());
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    m_reduceProgram->release();
+}
+
+bool OcclusionCuller::isEnabled() const
+{
+    return m_enabled && m_supported;
+}
+
+void OcclusionCuller::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    if (!enabled)
+        m_depth.clear();
+}
+
+int OcclusionCuller::deferredCount() const
+{
+    return m_spheres.size();
+}
+
+int OcclusionCuller::occludedCount() const
+{
+    return m_occluded;
+}
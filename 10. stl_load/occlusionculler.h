@@ -0,0 +1,156 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector4D>
+#include <QSize>
+#include "ringbuffer.h"
+#include "meshlet.h"
+
+class Model;
+
+// 深度の階層(Hi-Z)による遮蔽カリング
+//
+// 1. 不透明なものを描画する時に、前のフレームの Hi-Z で隠れていたモデルやメッシュレットを描画せずに defer() する
+// 2. 不透明なものを描画し終えたら flush() で、defer() したものを包む箱を今のフレームの深度に対して描画し、
+//    1ピクセルでも見えれば(オクルージョンクエリ)条件付き描画で描画する。描画はクエリの結果を待たず、前のフレームと
+//    視点が変わっていても消えることはない。クエリの結果は数フレーム後に読み、隠れていた数として数える
+// 3. capture() で今の深度から Hi-Z を作り、小さい階層を数フレーム遅れで読み戻す(次の 1 で使う)
+class OcclusionCuller : protected QOpenGLExtraFunctions
+{
+public:
+    // 読み戻す階層の最大の幅(pixel)
+    static const int ReadbackWidth = 256;
+    // 判定する範囲の最大の大きさ(読み戻した階層の texel)。大きいものは隠れていても判定しない
+    static const int MaxTestTexels = 1024;
+
+    // 後で深度と比べ直すもの(Model::drawOccluded() で描画する)
+    struct Deferred
+    {
+        Model *model;
+        RingBuffer::Allocation uniforms;            // 描画時に書き込んだオブジェクト毎のユニフォーム
+        int firstSphere;                            // 包む球(ワールド座標)の範囲
+        int sphereCount;
+        const DrawElementsIndirectCommand *ranges;  // 描画するインデックスの範囲
+        int rangeCount;
+    };
+
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    bool create();
+    void destroy();
+
+    // フレームの最初に呼ぶ。読み戻しが終わった Hi-Z があれば使い始める
+    void beginFrame();
+    // このフレームの視点。描画を始める前に呼ぶ(flush() で箱を描画する時と同じもの)
+    void setCamera(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix);
+
+    // 前に読み戻した Hi-Z で隠れていたか(ワールド座標の球)。複数のスレッドから呼んでよい
+    // 今の視点が球の中にある、または球が今の手前の平面に掛かる場合は、箱の面が切られて
+    // 比べ直しで見えなくなるので隠れていないとする
+    bool isOccluded(const QVector3D &center, float radius) const;
+
+    // 読み戻した Hi-Z の代わりに使う(テストで作った深度を与える時にも使う)
+    // depth は screen の大きさの深度を level まで縮小した階層で、levelSize(screen, level) の texel を下の行から並べたもの
+    void setDepth(const float *depth, const QSize &screen, int level, const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix);
+    // Hi-Z の階層の大きさ。階層 0 は深度の半分の大きさで、奇数の場合は端の行と列を最後の texel に含める
+    static QSize levelSize(const QSize &size, int level);
+
+    // 隠れていたものを記録する。spheres はコピーする。ranges は flush() まで残っていること(フレーム用の Arena に置く)
+    void defer(Model *model, const RingBuffer::Allocation &uniforms, const QVector4D *spheres, int sphereCount,
+               const DrawElementsIndirectCommand *ranges, int rangeCount);
+
+    // defer() したものを今のフレームの深度と比べ直して、見えるものを描画する
+    void flush(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix);
+
+    // 描画中のフレームバッファの深度から Hi-Z を作り、読み戻しを始める
+    void capture(const QMatrix4x4 &projectionMatrix, const QMatrix4x4 &viewMatrix, const QSize &size);
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    // このフレームで defer() したモデルとメッシュレットの数
+    int deferredCount() const;
+    // そのうち比べ直しでも隠れていて描画しなかった数(数フレーム前の結果)
+    int occludedCount() const;
+
+private:
+    // 読み戻した Hi-Z(数フレーム前の深度)
+    struct Readback
+    {
+        GLuint buffer = 0;      // GL_PIXEL_PACK_BUFFER
+        GLsync fence = nullptr;
+        QMatrix4x4 projection;
+        QMatrix4x4 view;
+        QSize size;             // 読み戻した階層の大きさ
+        QSize screen;           // 元の深度の大きさ
+        int level = 0;
+    };
+
+    void resize(const QSize &size, GLuint sourceFramebuffer);
+    void releaseTargets();
+    void reduce();
+    void resolve(Readback &readback);
+    // 前に使ったクエリの結果から隠れていた数を数える
+    void countOccluded();
+
+    // 透視投影の行列から手前の平面までの距離を求める
+    static float nearPlane(const QMatrix4x4 &projectionMatrix);
+
+    bool m_enabled;
+    bool m_supported;
+
+    // Hi-Z
+    QOpenGLShaderProgram *m_reduceProgram;
+    GLuint m_depthTexture;          // 描画先の深度のコピー(マルチサンプルは解決する)
+    GLuint m_depthFramebuffer;
+    GLenum m_depthFormat;
+    GLuint m_hizTexture;            // 2x2 の最大値を重ねた階層(R32F)
+    QVector<GLuint> m_hizFramebuffers;
+    QSize m_size;
+    GLuint m_source;                // 深度をコピーする描画先(アンチエイリアスの方法で変わる)
+
+    Readback m_readbacks[RingBuffer::Frames];
+    int m_nextReadback;
+
+    // CPU 側の Hi-Z
+    QVector<float> m_depth;
+    QMatrix4x4 m_projection;
+    QMatrix4x4 m_view;
+    QSize m_depthSize;
+    QSize m_depthScreen;
+    int m_depthLevel;
+    float m_near;
+
+    // このフレームの視点
+    QMatrix4x4 m_currentView;
+    float m_currentNear;
+
+    // 比べ直し
+    QOpenGLShaderProgram *m_boxProgram;
+    QOpenGLBuffer m_sphereBuffer;
+    // クエリはフレーム毎に分け、RingBuffer が待ったフレームの結果だけを読む(待たない)
+    struct Queries
+    {
+        QVector<GLuint> ids;
+        QVector<int> sphereCounts;  // 使ったクエリ毎の球の数
+    };
+    Queries m_queries[RingBuffer::Frames];
+    int m_nextQueries;
+    int m_occluded;
+    QVector<QVector4D> m_spheres;   // 毎フレーム空にする(容量は残す)
+    QVector<Deferred> m_deferred;
+
+    typedef void (QOPENGLF_APIENTRYP BeginConditionalRenderFunc)(GLuint id, GLenum mode);
+    typedef void (QOPENGLF_APIENTRYP EndConditionalRenderFunc)();
+    BeginConditionalRenderFunc m_beginConditionalRender;
+    EndConditionalRenderFunc m_endConditionalRender;
+};
+
+#endif // OCCLUSIONCULLER_H
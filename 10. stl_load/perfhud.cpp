@@ -0,0 +1,267 @@
+#include "perfhud.h"
+#include <QImage>
+#include <QPainter>
+#include <QFont>
+#include <QFontMetrics>
+
+namespace {
+    const int FirstGlyph = 32;   // ' '
+    const int LastGlyph = 126;   // '~'
+    const int GraphWidth = 240;
+    const int GraphHeight = 60;
+    const int MaxGraphSamples = 240;
+    const float Margin = 10.0f;
+    const float Top = 30.0f;     // メニューバーの下から表示
+}
+
+PerfHud::PerfHud()
+{
+    m_shaderProgram = nullptr;
+    m_atlas = nullptr;
+    m_glyphWidth = 0;
+    m_glyphHeight = 0;
+    m_atlasColumns = 16;
+    m_atlasRows = 0;
+    m_textDirty = true;
+    m_textVertexCount = 0;
+    m_graphSamples = 0;
+    m_graphDirty = false;
+}
+
+PerfHud::~PerfHud()
+{
+    release();
+}
+
+void PerfHud::initialize()
+{
+    initializeOpenGLFunctions();
+
+    m_shaderProgram = new QOpenGLShaderProgram();
+    m_shaderProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, Format::shaderSource(":/hud.vert"));
+    m_shaderProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/hud.frag");
+    m_shaderProgram->link();
+
+    buildAtlas();
+
+    m_textVbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_textVbo.create();
+    m_textVbo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+
+    // グラフは 背景(6) + 目標ライン(2) + 折れ線 の頂点を確保しておく
+    m_graphVbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_graphVbo.create();
+    m_graphVbo.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    m_graphVbo.bind();
+    m_graphVbo.allocate((8 + MaxGraphSamples) * static_cast<int>(sizeof(VertexData)));
+    m_graphVbo.release();
+}
+
+void PerfHud::release()
+{
+    if (m_shaderProgram)
+    {
+        m_shaderProgram->removeAllShaders();
+        delete m_shaderProgram;
+        m_shaderProgram = nullptr;
+    }
+
+    delete m_atlas;
+    m_atlas = nullptr;
+
+    m_textVbo.destroy();
+    m_graphVbo.destroy();
+}
+
+void PerfHud::buildAtlas()
+{
+    QFont font("Monospace");
+    font.setStyleHint(QFont::TypeWriter);
+    font.setPixelSize(14);
+
+    QFontMetrics metrics(font);
+    m_glyphWidth = metrics.horizontalAdvance('M');
+    m_glyphHeight = metrics.height();
+
+    int glyphCount = LastGlyph - FirstGlyph + 1;
+    m_atlasRows = (glyphCount + m_atlasColumns - 1) / m_atlasColumns;
+
+    // ASCII の印字可能文字を1枚の画像に並べる
+    QImage image(m_glyphWidth * m_atlasColumns, m_glyphHeight * m_atlasRows, QImage::Format_RGBA8888);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.setFont(font);
+    painter.setPen(Qt::white);
+    for (int i = 0; i < glyphCount; i++)
+    {
+        QRect cell((i % m_atlasColumns) * m_glyphWidth, (i / m_atlasColumns) * m_glyphHeight, m_glyphWidth, m_glyphHeight);
+        painter.drawText(cell, Qt::AlignLeft | Qt::AlignVCenter, QString(QChar(FirstGlyph + i)));
+    }
+    painter.end();
+
+    m_atlas = new QOpenGLTexture(image, QOpenGLTexture::DontGenerateMipMaps);
+    m_atlas->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    m_atlas->setWrapMode(QOpenGLTexture::ClampToEdge);
+}
+
+void PerfHud::setText(int line, const QString &text)
+{
+    if (line >= m_lines.size())
+        m_lines.resize(line + 1);
+
+    if (m_lines.at(line) == text)
+        return;
+
+    m_lines[line] = text;
+    m_textDirty = true;
+}
+
+void PerfHud::setGraph(const QVector<double> &samples, double targetMs)
+{
+    int count = qMin(samples.size(), MaxGraphSamples);
+    int first = samples.size() - count;
+
+    float left = Margin;
+    float top = Top + m_lines.size() * m_glyphHeight + Margin;
+    float bottom = top + GraphHeight;
+
+    // 目標フレーム時間の2倍を上端にする
+    double range = targetMs * 2.0;
+    for (int i = first; i < samples.size(); i++)
+        range = qMax(range, samples.at(i));
+
+    QVector4D background(0.0f, 0.0f, 0.0f, 0.5f);
+    QVector4D target(1.0f, 1.0f, 1.0f, 0.4f);
+    QVector4D line(0.4f, 1.0f, 0.4f, 1.0f);
+    QVector2D solid(-1.0f, -1.0f);
+
+    m_graphVertices.clear();
+    appendQuad(m_graphVertices, QRectF(left, top, GraphWidth, GraphHeight), QRectF(-1, -1, 0, 0), background);
+
+    float targetY = bottom - static_cast<float>(targetMs / range) * GraphHeight;
+    m_graphVertices.append(VertexData{ QVector2D(left, targetY), solid, target });
+    m_graphVertices.append(VertexData{ QVector2D(left + GraphWidth, targetY), solid, target });
+
+    float step = static_cast<float>(GraphWidth) / MaxGraphSamples;
+    float x = left + (MaxGraphSamples - count) * step;
+    for (int i = first; i < samples.size(); i++)
+    {
+        float y = bottom - static_cast<float>(samples.at(i) / range) * GraphHeight;
+        m_graphVertices.append(VertexData{ QVector2D(x, y), solid, line });
+        x += step;
+    }
+
+    m_graphSamples = count;
+    m_graphDirty = true;
+}
+
+void PerfHud::appendQuad(QVector<VertexData> &vertices, QRectF rect, QRectF uv, QVector4D color)
+{
+    QVector2D p0(static_cast<float>(rect.left()), static_cast<float>(rect.top()));
+    QVector2D p1(static_cast<float>(rect.right()), static_cast<float>(rect.top()));
+    QVector2D p2(static_cast<float>(rect.right()), static_cast<float>(rect.bottom()));
+    QVector2D p3(static_cast<float>(rect.left()), static_cast<float>(rect.bottom()));
+    QVector2D t0(static_cast<float>(uv.left()), static_cast<float>(uv.top()));
+    QVector2D t1(static_cast<float>(uv.right()), static_cast<float>(uv.top()));
+    QVector2D t2(static_cast<float>(uv.right()), static_cast<float>(uv.bottom()));
+    QVector2D t3(static_cast<float>(uv.left()), static_cast<float>(uv.bottom()));
+
+    vertices << VertexData{ p0, t0, color } << VertexData{ p3, t3, color } << VertexData{ p2, t2, color };
+    vertices << VertexData{ p0, t0, color } << VertexData{ p2, t2, color } << VertexData{ p1, t1, color };
+}
+
+void PerfHud::buildText()
+{
+    QVector<VertexData> vertices;
+    QVector4D color(1.0f, 1.0f, 1.0f, 1.0f);
+
+    float atlasWidth = m_glyphWidth * m_atlasColumns;
+    float atlasHeight = m_glyphHeight * m_atlasRows;
+
+    for (int line = 0; line < m_lines.size(); line++)
+    {
+        const QString &text = m_lines.at(line);
+        float y = Top + line * m_glyphHeight;
+
+        for (int i = 0; i < text.size(); i++)
+        {
+            int c = text.at(i).unicode();
+            if (c <= FirstGlyph || c > LastGlyph)
+                continue;
+
+            int index = c - FirstGlyph;
+            QRectF rect(Margin + i * m_glyphWidth, y, m_glyphWidth, m_glyphHeight);
+            QRectF uv((index % m_atlasColumns) * m_glyphWidth / atlasWidth,
+                      (index / m_atlasColumns) * m_glyphHeight / atlasHeight,
+                      m_glyphWidth / atlasWidth,
+                      m_glyphHeight / atlasHeight);
+            appendQuad(vertices, rect, uv, color);
+        }
+    }
+
+    m_textVbo.bind();
+    m_textVbo.allocate(vertices.constData(), vertices.size() * static_cast<int>(sizeof(VertexData)));
+    m_textVbo.release();
+
+    m_textVertexCount = vertices.size();
+    m_textDirty = false;
+}
+
+void PerfHud::setAttributes()
+{
+    static_assert(Format::stride() == sizeof(VertexData), "PerfHud::Format must match VertexData");
+    Format::setAttributes(this);
+}
+
+void PerfHud::draw(int width, int height)
+{
+    if (!m_shaderProgram)
+        return;
+
+    if (m_textDirty)
+        buildText();
+
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    m_shaderProgram->bind();
+    m_shaderProgram->setUniformValue("ScreenSize", QVector2D(width, height));
+    m_shaderProgram->setUniformValue("Atlas", 0);
+
+    // グラフ
+    if (m_graphSamples > 0)
+    {
+        m_graphVbo.bind();
+        if (m_graphDirty)
+        {
+            m_graphVbo.write(0, m_graphVertices.constData(), m_graphVertices.size() * static_cast<int>(sizeof(VertexData)));
+            m_graphDirty = false;
+        }
+        setAttributes();
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glDrawArrays(GL_LINES, 6, 2);
+        glDrawArrays(GL_LINE_STRIP, 8, m_graphSamples);
+        m_graphVbo.release();
+    }
+
+    // 文字
+    if (m_textVertexCount > 0)
+    {
+        m_atlas->bind(0);
+        m_textVbo.bind();
+        setAttributes();
+        glDrawArrays(GL_TRIANGLES, 0, m_textVertexCount);
+        m_textVbo.release();
+        m_atlas->release(0);
+    }
+
+    m_shaderProgram->release();
+
+    if (depthTest) glEnable(GL_DEPTH_TEST);
+    if (cullFace) glEnable(GL_CULL_FACE);
+}
@@ -0,0 +1,74 @@
+#ifndef PERFHUD_H
+#define PERFHUD_H
+
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLBuffer>
+#include <QOpenGLTexture>
+#include <QVector2D>
+#include <QVector4D>
+#include <QVector>
+#include <QString>
+#include "vertexformat.h"
+
+// OpenGLで描画するパフォーマンス表示
+// 文字はグリフアトラスから1回のドローコールでまとめて描画し、
+// 頂点データは文字列が変化した時だけ作り直す
+class PerfHud : protected QOpenGLFunctions
+{
+public:
+    PerfHud();
+    ~PerfHud();
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    void initialize();
+    void release();
+
+    // 同じ文字列なら何もしない
+    void setText(int line, const QString &text);
+
+    // フレーム時間のグラフ(ミリ秒)
+    void setGraph(const QVector<double> &samples, double targetMs);
+
+    void draw(int width, int height);
+
+private:
+    struct VertexData
+    {
+        QVector2D position; // ピクセル座標(左上原点)
+        QVector2D texCoord; // x < 0 の場合は単色
+        QVector4D color;
+    };
+    typedef VertexFormat::Format<
+        VertexFormat::Attribute<VertexFormat::Position, VertexFormat::Float<2>>,
+        VertexFormat::Attribute<VertexFormat::TexCoord, VertexFormat::Float<2>>,
+        VertexFormat::Attribute<VertexFormat::Color, VertexFormat::Float<4>>> Format;
+
+    void buildAtlas();
+    void buildText();
+    void appendQuad(QVector<VertexData> &vertices, QRectF rect, QRectF uv, QVector4D color);
+    void setAttributes();
+
+    QOpenGLShaderProgram* m_shaderProgram;
+    QOpenGLTexture* m_atlas;
+
+    // glyph
+    int m_glyphWidth;
+    int m_glyphHeight;
+    int m_atlasColumns;
+    int m_atlasRows;
+
+    // text
+    QVector<QString> m_lines;
+    bool m_textDirty;
+    QOpenGLBuffer m_textVbo;
+    int m_textVertexCount;
+
+    // graph
+    QVector<VertexData> m_graphVertices;
+    QOpenGLBuffer m_graphVbo;
+    int m_graphSamples;
+    bool m_graphDirty;
+};
+
+#endif // PERFHUD_H
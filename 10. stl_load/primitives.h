@@ -0,0 +1,370 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include "model.h"
+
+// 基本形状の頂点データをコンパイル時に生成する
+// 生成したデータは読み取り専用の領域に置かれるので、Model::setMesh() に渡せば解析も確保もせずに使える
+//
+//   model->setMesh(Primitives::uvSphere<32, 16>());
+namespace Primitives {
+
+// インデックス付きの頂点配列(Model::VertexData と GL_TRIANGLES 用の番号)
+template <int V, int I>
+struct Mesh
+{
+    static const int VertexCount = V;
+    static const int IndexCount = I;
+    Model::VertexData vertices[V];
+    GLuint indexes[I];
+};
+
+// GL_LINES 用の頂点位置
+template <int V>
+struct Lines
+{
+    static const int VertexCount = V;
+    QVector3D positions[V];
+};
+
+// std の数学関数は constexpr ではないので級数で求める
+namespace Math {
+
+constexpr double Pi = 3.14159265358979323846;
+
+constexpr double sin(double x)
+{
+    while (x > Pi)
+        x -= 2.0 * Pi;
+    while (x < -Pi)
+        x += 2.0 * Pi;
+
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 14; n++)
+    {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double cos(double x)
+{
+    return sin(x + Pi / 2.0);
+}
+
+constexpr double sqrt(double x)
+{
+    if (x <= 0.0)
+        return 0.0;
+    double r = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64; i++)
+        r = 0.5 * (r + x / r);
+    return r;
+}
+
+constexpr QVector3D normalized(double x, double y, double z)
+{
+    double length = sqrt(x * x + y * y + z * z);
+    return QVector3D(static_cast<float>(x / length), static_cast<float>(y / length), static_cast<float>(z / length));
+}
+
+} // namespace Math
+
+// 経度 Segments 分割、緯度 Rings 分割の球(半径 1)。継ぎ目と極の頂点は UV のために重複させる
+template <int Segments, int Rings>
+using UVSphereMesh = Mesh<(Segments + 1) * (Rings + 1), 6 * Segments * (Rings - 1)>;
+
+template <int Segments, int Rings>
+constexpr UVSphereMesh<Segments, Rings> generateUVSphere()
+{
+    static_assert(Segments >= 3 && Rings >= 2, "UV sphere needs at least 3 segments and 2 rings");
+
+    UVSphereMesh<Segments, Rings> mesh{};
+    for (int r = 0; r <= Rings; r++)
+    {
+        double theta = Math::Pi * r / Rings;
+        for (int s = 0; s <= Segments; s++)
+        {
+            double phi = 2.0 * Math::Pi * s / Segments;
+            QVector3D position(static_cast<float>(Math::sin(theta) * Math::cos(phi)),
+                               static_cast<float>(Math::cos(theta)),
+                               static_cast<float>(Math::sin(theta) * Math::sin(phi)));
+            QVector2D texCoord(static_cast<float>(s) / Segments, 1.0f - static_cast<float>(r) / Rings);
+            mesh.vertices[r * (Segments + 1) + s] = Model::VertexData{ position, position, texCoord };
+        }
+    }
+
+    // 極に接する列は三角形1つ、それ以外は四角形を2つの三角形にする(外から見て反時計回り)
+    int n = 0;
+    for (int r = 0; r < Rings; r++)
+    {
+        for (int s = 0; s < Segments; s++)
+        {
+            GLuint i0 = static_cast<GLuint>(r * (Segments + 1) + s);
+            GLuint i1 = i0 + 1;
+            GLuint i2 = i0 + Segments + 1;
+            GLuint i3 = i2 + 1;
+            if (r != Rings - 1)
+            {
+                mesh.indexes[n++] = i1;
+                mesh.indexes[n++] = i3;
+                mesh.indexes[n++] = i2;
+            }
+            if (r != 0)
+            {
+                mesh.indexes[n++] = i0;
+                mesh.indexes[n++] = i1;
+                mesh.indexes[n++] = i2;
+            }
+        }
+    }
+    return mesh;
+}
+
+// 正二十面体の各面を Frequency 分割して球に投影する(半径 1)
+// 面毎に頂点を持つので辺の頂点は重複する(法線は位置と同じなので見た目は変わらない)。UV は持たない
+template <int Frequency>
+using IcoSphereMesh = Mesh<20 * (Frequency + 1) * (Frequency + 2) / 2, 20 * Frequency * Frequency * 3>;
+
+template <int Frequency>
+constexpr IcoSphereMesh<Frequency> generateIcoSphere()
+{
+    static_assert(Frequency >= 1, "Icosphere frequency must be at least 1");
+
+    const double t = (1.0 + Math::sqrt(5.0)) / 2.0;
+    const double corners[12][3] = {
+        { -1,  t,  0 }, {  1,  t,  0 }, { -1, -t,  0 }, {  1, -t,  0 },
+        {  0, -1,  t }, {  0,  1,  t }, {  0, -1, -t }, {  0,  1, -t },
+        {  t,  0, -1 }, {  t,  0,  1 }, { -t,  0, -1 }, { -t,  0,  1 },
+    };
+    const int faces[20][3] = {
+        { 0, 11,  5 }, { 0,  5,  1 }, {  0,  1,  7 }, {  0,  7, 10 }, { 0, 10, 11 },
+        { 1,  5,  9 }, { 5, 11,  4 }, { 11, 10,  2 }, { 10,  7,  6 }, { 7,  1,  8 },
+        { 3,  9,  4 }, { 3,  4,  2 }, {  3,  2,  6 }, {  3,  6,  8 }, { 3,  8,  9 },
+        { 4,  9,  5 }, { 2,  4, 11 }, {  6,  2, 10 }, {  8,  6,  7 }, { 9,  8,  1 },
+    };
+    const int faceVertices = (Frequency + 1) * (Frequency + 2) / 2;
+
+    IcoSphereMesh<Frequency> mesh{};
+    int n = 0;
+    for (int f = 0; f < 20; f++)
+    {
+        const double *a = corners[faces[f][0]];
+        const double *b = corners[faces[f][1]];
+        const double *c = corners[faces[f][2]];
+
+        // 面上の格子点 a + (b - a) * i / F + (c - a) * j / F (i + j <= F)
+        int base = f * faceVertices;
+        int v = base;
+        for (int i = 0; i <= Frequency; i++)
+        {
+            for (int j = 0; j <= Frequency - i; j++)
+            {
+                double u = static_cast<double>(i) / Frequency;
+                double w = static_cast<double>(j) / Frequency;
+                QVector3D position = Math::normalized(a[0] + (b[0] - a[0]) * u + (c[0] - a[0]) * w,
+                                                      a[1] + (b[1] - a[1]) * u + (c[1] - a[1]) * w,
+                                                      a[2] + (b[2] - a[2]) * u + (c[2] - a[2]) * w);
+                mesh.vertices[v++] = Model::VertexData{ position, position, QVector2D() };
+            }
+        }
+
+        // 行 i の先頭は i * (F + 1) - i * (i - 1) / 2
+        for (int i = 0; i < Frequency; i++)
+        {
+            int row = base + i * (Frequency + 1) - i * (i - 1) / 2;
+            int next = base + (i + 1) * (Frequency + 1) - (i + 1) * i / 2;
+            for (int j = 0; j < Frequency - i; j++)
+            {
+                mesh.indexes[n++] = static_cast<GLuint>(row + j);
+                mesh.indexes[n++] = static_cast<GLuint>(next + j);
+                mesh.indexes[n++] = static_cast<GLuint>(row + j + 1);
+                if (j < Frequency - i - 1)
+                {
+                    mesh.indexes[n++] = static_cast<GLuint>(next + j);
+                    mesh.indexes[n++] = static_cast<GLuint>(next + j + 1);
+                    mesh.indexes[n++] = static_cast<GLuint>(row + j + 1);
+                }
+            }
+        }
+    }
+    return mesh;
+}
+
+// 一辺 2 の立方体。面毎に頂点を持つので法線は面に垂直
+using CubeMesh = Mesh<24, 36>;
+
+constexpr CubeMesh generateCube()
+{
+    // 法線と、面上の2軸(外から見て u x v が法線の向き)
+    const float axes[6][3][3] = {
+        { {  1, 0, 0 }, { 0, 0, -1 }, { 0, 1, 0 } },
+        { { -1, 0, 0 }, { 0, 0,  1 }, { 0, 1, 0 } },
+        { { 0,  1, 0 }, { 1, 0,  0 }, { 0, 0, -1 } },
+        { { 0, -1, 0 }, { 1, 0,  0 }, { 0, 0,  1 } },
+        { { 0, 0,  1 }, { 1, 0,  0 }, { 0, 1, 0 } },
+        { { 0, 0, -1 }, { -1, 0, 0 }, { 0, 1, 0 } },
+    };
+    const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+    CubeMesh mesh{};
+    for (int f = 0; f < 6; f++)
+    {
+        const float *normal = axes[f][0];
+        const float *u = axes[f][1];
+        const float *v = axes[f][2];
+        for (int k = 0; k < 4; k++)
+        {
+            float cu = corners[k][0];
+            float cv = corners[k][1];
+            QVector3D position(normal[0] + u[0] * cu + v[0] * cv,
+                               normal[1] + u[1] * cu + v[1] * cv,
+                               normal[2] + u[2] * cu + v[2] * cv);
+            mesh.vertices[f * 4 + k] = Model::VertexData{ position, QVector3D(normal[0], normal[1], normal[2]),
+                                                          QVector2D((cu + 1.0f) / 2.0f, (cv + 1.0f) / 2.0f) };
+        }
+
+        GLuint base = static_cast<GLuint>(f * 4);
+        const GLuint quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int k = 0; k < 6; k++)
+            mesh.indexes[f * 6 + k] = base + quad[k];
+    }
+    return mesh;
+}
+
+// XZ 平面上の一辺 2 の正方形を Divisions x Divisions 分割した平面(法線は +Y)
+template <int Divisions>
+using PlaneMesh = Mesh<(Divisions + 1) * (Divisions + 1), 6 * Divisions * Divisions>;
+
+template <int Divisions>
+constexpr PlaneMesh<Divisions> generatePlane()
+{
+    static_assert(Divisions >= 1, "Plane needs at least 1 division");
+
+    PlaneMesh<Divisions> mesh{};
+    for (int j = 0; j <= Divisions; j++)
+    {
+        for (int i = 0; i <= Divisions; i++)
+        {
+            float u = static_cast<float>(i) / Divisions;
+            float v = static_cast<float>(j) / Divisions;
+            mesh.vertices[j * (Divisions + 1) + i] = Model::VertexData{ QVector3D(u * 2.0f - 1.0f, 0.0f, v * 2.0f - 1.0f),
+                                                                        QVector3D(0.0f, 1.0f, 0.0f), QVector2D(u, 1.0f - v) };
+        }
+    }
+
+    int n = 0;
+    for (int j = 0; j < Divisions; j++)
+    {
+        for (int i = 0; i < Divisions; i++)
+        {
+            GLuint i0 = static_cast<GLuint>(j * (Divisions + 1) + i);
+            GLuint i1 = i0 + 1;
+            GLuint i2 = i0 + Divisions + 1;
+            GLuint i3 = i2 + 1;
+            mesh.indexes[n++] = i0;
+            mesh.indexes[n++] = i2;
+            mesh.indexes[n++] = i1;
+            mesh.indexes[n++] = i1;
+            mesh.indexes[n++] = i2;
+            mesh.indexes[n++] = i3;
+        }
+    }
+    return mesh;
+}
+
+// XZ 平面上の間隔 1 の格子線(-HalfLines ～ HalfLines)
+// 先頭の4頂点が X 軸と Z 軸、続いて X 軸に平行な線、Z 軸に平行な線の順
+template <int HalfLines>
+struct Grid
+{
+    static const int AxisXFirst = 0;
+    static const int AxisZFirst = 2;
+    static const int AxisVertexCount = 2;
+    static const int LineFirst = 4;
+    static const int LineVertexCount = 8 * (HalfLines - 1);
+    typedef Lines<LineFirst + LineVertexCount> Type;
+};
+
+template <int HalfLines>
+constexpr typename Grid<HalfLines>::Type generateGrid()
+{
+    static_assert(HalfLines >= 1, "Grid needs at least 1 line");
+
+    typename Grid<HalfLines>::Type lines{};
+    float extent = static_cast<float>(HalfLines);
+    int n = 0;
+
+    // Axis X, Axis Z
+    lines.positions[n++] = QVector3D(-extent, 0.0f, 0.0f);
+    lines.positions[n++] = QVector3D( extent, 0.0f, 0.0f);
+    lines.positions[n++] = QVector3D(0.0f, 0.0f, -extent);
+    lines.positions[n++] = QVector3D(0.0f, 0.0f,  extent);
+
+    // X軸のライン
+    for (int i = 1; i < HalfLines; i++)
+    {
+        float z = static_cast<float>(i);
+        lines.positions[n++] = QVector3D(-extent, 0.0f,  z);
+        lines.positions[n++] = QVector3D( extent, 0.0f,  z);
+        lines.positions[n++] = QVector3D(-extent, 0.0f, -z);
+        lines.positions[n++] = QVector3D( extent, 0.0f, -z);
+    }
+
+    // Z軸のライン
+    for (int i = 1; i < HalfLines; i++)
+    {
+        float x = static_cast<float>(i);
+        lines.positions[n++] = QVector3D( x, 0.0f, -extent);
+        lines.positions[n++] = QVector3D( x, 0.0f,  extent);
+        lines.positions[n++] = QVector3D(-x, 0.0f, -extent);
+        lines.positions[n++] = QVector3D(-x, 0.0f,  extent);
+    }
+    return lines;
+}
+
+// 生成したデータを1つだけ持つ(テンプレートの静的メンバなのでリンク時に1つにまとまる)
+template <int Segments, int Rings>
+struct UVSphereData { static constexpr UVSphereMesh<Segments, Rings> value = generateUVSphere<Segments, Rings>(); };
+template <int Segments, int Rings>
+constexpr UVSphereMesh<Segments, Rings> UVSphereData<Segments, Rings>::value;
+
+template <int Frequency>
+struct IcoSphereData { static constexpr IcoSphereMesh<Frequency> value = generateIcoSphere<Frequency>(); };
+template <int Frequency>
+constexpr IcoSphereMesh<Frequency> IcoSphereData<Frequency>::value;
+
+template <int Divisions>
+struct PlaneData { static constexpr PlaneMesh<Divisions> value = generatePlane<Divisions>(); };
+template <int Divisions>
+constexpr PlaneMesh<Divisions> PlaneData<Divisions>::value;
+
+template <int HalfLines>
+struct GridData { static constexpr typename Grid<HalfLines>::Type value = generateGrid<HalfLines>(); };
+template <int HalfLines>
+constexpr typename Grid<HalfLines>::Type GridData<HalfLines>::value;
+
+template <int Dummy = 0>
+struct CubeData { static constexpr CubeMesh value = generateCube(); };
+template <int Dummy>
+constexpr CubeMesh CubeData<Dummy>::value;
+
+template <int Segments, int Rings>
+const UVSphereMesh<Segments, Rings> &uvSphere() { return UVSphereData<Segments, Rings>::value; }
+
+template <int Frequency>
+const IcoSphereMesh<Frequency> &icoSphere() { return IcoSphereData<Frequency>::value; }
+
+inline const CubeMesh &cube() { return CubeData<>::value; }
+
+template <int Divisions>
+const PlaneMesh<Divisions> &plane() { return PlaneData<Divisions>::value; }
+
+template <int HalfLines>
+const typename Grid<HalfLines>::Type &grid() { return GridData<HalfLines>::value; }
+
+} // namespace Primitives
+
+#endif // PRIMITIVES_H
@@ -0,0 +1,600 @@
+#include "renderer.h"
+#include "primitives.h"
+#include <QOpenGLContext>
+#include <algorithm>
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+Renderer::Renderer() : m_frameArena(64 << 10)
+{
+    m_gridline = nullptr;
+    m_sphereBatch = nullptr;
+    m_scene = nullptr;
+    m_uploads = nullptr;
+    m_uniforms = nullptr;
+    m_uniformBytes = 0;
+    m_indirect = nullptr;
+    m_resources = nullptr;
+    m_occlusion = nullptr;
+    m_prepass = nullptr;
+    m_antiAliasing = nullptr;
+    m_dynamicResolution = nullptr;
+    m_fps = nullptr;
+    m_profiler = nullptr;
+    m_gldebug = nullptr;
+}
+
+Renderer::~Renderer()
+{
+    release();
+}
+
+void Renderer::initialize()
+{
+    initializeOpenGLFunctions();
+
+    // enabled
+    glEnable(GL_DEPTH_TEST);        // Zバッファ
+    glEnable(GL_CULL_FACE);         // カリング
+    glEnable(GL_LINE_SMOOTH);       // アンチエイリアス(線)。ポリゴンは AntiAliasing で行う
+    glEnable(GL_BLEND);             // ブレンディング
+    glEnable(GL_MULTISAMPLE);       // マルチサンプリング
+
+    // background color
+    QColor c(60, 60, 60);
+    glClearColor(c.red() / 255.0f, c.green() / 255.0f, c.blue() / 255.0f, 1.0f);
+
+    // GPUリソースの集計(モデルを bind する前に設定する)
+    m_resources = new GpuResources();
+    Model::setResources(m_resources);
+
+    // 深度だけのパス(モデルを bind する前に設定すると位置だけの頂点も転送する)
+    m_prepass = new DepthPrepass();
+    if (m_prepass->create())
+    {
+        Model::setDepthPrepass(m_prepass);
+    }
+    else
+    {
+        delete m_prepass;
+        m_prepass = nullptr;
+    }
+
+    // シーンは FBO に描画し、選んだ方法でアンチエイリアスをかけてウィンドウに書き出す
+    m_antiAliasing = new AntiAliasing(m_resources);
+    if (!m_antiAliasing->create())
+    {
+        delete m_antiAliasing;
+        m_antiAliasing = nullptr;
+    }
+
+    // GPUの時間が目標を超えたらシーンを縮小して描画し、ウィンドウの大きさに拡大する
+    m_dynamicResolution = new DynamicResolution(m_resources);
+    if (!m_dynamicResolution->create())
+    {
+        delete m_dynamicResolution;
+        m_dynamicResolution = nullptr;
+    }
+
+    // init gridline
+    m_gridline = new GridLine();
+    m_gridline->bind(":/gridline.vert", ":/gridline.frag");
+
+    // Model Initialize
+    // GUI側の変換(Scene::transforms)と同じ順番で作る
+    m_model.clear();
+    m_model.append(new Model());
+    m_model.last()->load("C:/Users/nishioka_takuya/Desktop/untitled.stl");
+    m_model.last()->bind(":/shader.vert", ":/shader.frag");
+
+    m_model.append(new Model());
+    m_model.last()->load(":/sphere.obj");
+    m_model.last()->bind(":/shader.vert", ":/shader.frag");
+    m_model.last()->setTranslation(QVector3D(0,0,-2.2f));
+    m_model[m_model.size() - 2]->addChild(m_model.last());
+
+    m_model.append(new Model());
+    m_model.last()->load(":/cube.obj");
+    m_model.last()->bind(":/shader.vert", ":/shader.frag");
+    m_model.last()->setTranslation(QVector3D(0,0,-2.5));
+    m_model.last()->setRotation(QQuaternion::fromEulerAngles(QVector3D(0,0,0)));
+    m_model[m_model.size() - 2]->addChild(m_model.last());
+
+    // モデルの変換は SceneTable でまとめて更新する
+    m_scene = new SceneTable();
+    m_model.first()->attach(m_scene);
+
+    // 頂点データはステージング用のリングバッファを通して1フレームに決まった量だけ転送する
+    m_uploads = new UploadQueue();
+    m_uploads->create();
+    m_resources->add(GpuResources::StagingBuffer, m_uploads->stagingBytes());
+
+    // オブジェクト毎のユニフォームは永続マップしたリングバッファに書き込む
+    m_uniforms = new RingBuffer(GL_UNIFORM_BUFFER, UniformRingSize);
+    m_uniforms->setGrowable(true);
+    m_uniforms->create();
+    m_uniformBytes = m_uniforms->size();
+    m_resources->add(GpuResources::UniformBuffer, m_uniformBytes);
+    Model::setUniformRing(m_uniforms);
+
+    // 大きなメッシュはメッシュレット毎にカリングし、残ったものを間接描画のコマンドにする
+    Model::setFrameArena(&m_frameArena);
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context->format().version() >= qMakePair(4, 3) || context->hasExtension(QByteArrayLiteral("GL_ARB_multi_draw_indirect")))
+    {
+        m_indirect = new RingBuffer(GL_DRAW_INDIRECT_BUFFER, IndirectRingSize);
+        m_indirect->create();
+        m_resources->add(GpuResources::IndirectBuffer, m_indirect->size());
+        Model::setIndirectRing(m_indirect);
+    }
+
+    // 不透明なものは前のフレームの深度で隠れていれば後回しにし、今の深度で見えるものだけ描画する
+    m_occlusion = new OcclusionCuller();
+    if (m_occlusion->create())
+    {
+        Model::setOcclusionCuller(m_occlusion);
+    }
+    else
+    {
+        delete m_occlusion;
+        m_occlusion = nullptr;
+    }
+
+    // 追加する球は同じメッシュなので、使えれば1つのまとまりにしてGPUでカリング・描画する
+    if (InstanceBatch::isSupported())
+    {
+        Model::Material material = m_model.first()->getMaterial();
+        material.Opacity = 0.3f;
+        m_sphereBatch = new InstanceBatch(m_resources);
+        m_sphereBatch->setMesh(Primitives::uvSphere<32, 16>());
+        m_sphereBatch->setLight(m_model.first()->getLight());
+        m_sphereBatch->setMaterial(material);
+        if (!m_sphereBatch->create())
+        {
+            delete m_sphereBatch;
+            m_sphereBatch = nullptr;
+        }
+    }
+
+    // FPS
+    m_fps = new FpsManager();
+
+    // フレーム時間の計測
+    m_profiler = new FrameProfiler();
+    m_profiler->initialize();
+    Model::setProfiler(m_profiler);
+
+    // デバッグビルド時のみデバッグ情報の初期化をする
+#ifdef QT_DEBUG
+    m_gldebug = new GLDebug();
+
+    // OpenGL Info
+    qDebug() << "OpenGL Ver. : " << reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    qDebug() << "Shader Ver. : " << reinterpret_cast<const char*>(glGetString(GL_SHADING_LANGUAGE_VERSION));
+    qDebug() << "Vendor      : " << reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+    qDebug() << "GPU         : " << reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+#endif
+}
+
+void Renderer::release()
+{
+    // コンテキストがカレントの状態で後から追加したものから破棄する
+    qDeleteAll(m_sphere);
+    m_sphere.clear();
+    delete m_sphereBatch;
+    m_sphereBatch = nullptr;
+    for (int i = m_model.size() - 1; i >= 0; i--)
+        delete m_model.at(i);
+    m_model.clear();
+
+    delete m_gridline;
+    m_gridline = nullptr;
+    delete m_scene;
+    m_scene = nullptr;
+    if (m_uploads)
+    {
+        m_resources->remove(GpuResources::StagingBuffer, m_uploads->stagingBytes());
+        delete m_uploads;
+        m_uploads = nullptr;
+    }
+    if (m_uniforms)
+    {
+        Model::setUniformRing(nullptr);
+        m_resources->remove(GpuResources::UniformBuffer, m_uniformBytes);
+        m_uniformBytes = 0;
+        delete m_uniforms;
+        m_uniforms = nullptr;
+    }
+    if (m_indirect)
+    {
+        Model::setIndirectRing(nullptr);
+        m_resources->remove(GpuResources::IndirectBuffer, m_indirect->size());
+        delete m_indirect;
+        m_indirect = nullptr;
+    }
+    if (m_occlusion)
+    {
+        Model::setOcclusionCuller(nullptr);
+        delete m_occlusion;
+        m_occlusion = nullptr;
+    }
+    if (m_prepass)
+    {
+        Model::setDepthPrepass(nullptr);
+        delete m_prepass;
+        m_prepass = nullptr;
+    }
+    delete m_antiAliasing;
+    m_antiAliasing = nullptr;
+    delete m_dynamicResolution;
+    m_dynamicResolution = nullptr;
+    Model::setFrameArena(nullptr);
+    delete m_gldebug;
+    m_gldebug = nullptr;
+    delete m_fps;
+    m_fps = nullptr;
+
+    if (m_profiler)
+    {
+        Model::setProfiler(nullptr);
+        m_profiler->release();
+        delete m_profiler;
+        m_profiler = nullptr;
+    }
+
+    // 遅延していた破棄を済ませてから集計を外す
+    if (m_resources)
+    {
+        m_resources->flush();
+        Model::setResources(nullptr);
+        delete m_resources;
+        m_resources = nullptr;
+    }
+}
+
+bool Renderer::render(const Scene &scene)
+{
+    if (scene.size != m_size)
+        resize(scene.size);
+
+    m_profiler->beginFrame();
+
+    // GPUが使い終わった領域にだけ書き込む
+    m_uniforms->beginFrame();
+    if (m_indirect)
+        m_indirect->beginFrame();
+    m_resources->beginFrame();
+    if (m_occlusion)
+        m_occlusion->beginFrame();
+    if (m_prepass)
+        m_prepass->beginFrame();
+
+    {
+        FrameProfiler::CpuScope scope(m_profiler, "update");
+        update(scene);
+    }
+    if (m_occlusion)
+        m_occlusion->setCamera(m_projectionMatrix, m_viewMatrix);
+
+    // 予算内で頂点データを転送する
+    {
+        FrameProfiler::CpuScope scope(m_profiler, "upload");
+        m_uploads->process();
+    }
+
+    m_profiler->beginCpu("submission");
+    m_profiler->beginGpu("pass/scene");
+
+    // シーンは縮小した解像度で描画先に描画する(縮小しなければウィンドウ)
+    GLuint window = QOpenGLContext::currentContext()->defaultFramebufferObject();
+    GLuint output = window;
+    QSize renderSize = m_size;
+    if (m_dynamicResolution)
+    {
+        m_dynamicResolution->beginFrame(m_size);
+        renderSize = m_dynamicResolution->renderSize();
+        if (m_dynamicResolution->framebuffer())
+            output = m_dynamicResolution->framebuffer();
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, output);
+    glViewport(0, 0, renderSize.width(), renderSize.height());
+
+    if (m_antiAliasing)
+        m_antiAliasing->begin(renderSize);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // Draw Gridline
+    //m_gridline->draw(m_projectionMatrix, m_viewMatrix);
+
+
+    // Draw Model (子は親から描画される)
+    // 描画キューはフレーム用の Arena に作る(毎フレーム巻き戻すのでヒープを確保しない)
+    m_frameArena.reset();
+    m_frameArena.resetStats();
+    ArenaVector<DrawItem> queue(&m_frameArena);
+    queue.reserve(m_model.size() + m_sphere.size());
+    for (int i = 0; i < m_model.size(); i++) {
+        if (!m_model.at(i)->getParent())
+            queue.append(drawItem(m_model.at(i), queue.size()));
+    }
+    for (int i = 0; i < m_sphere.size(); i++) {
+        queue.append(drawItem(m_sphere.at(i), queue.size()));
+    }
+
+    // 不透明なものは追加した順に、半透明なものはその後に奥から描画する
+    std::sort(queue.begin(), queue.end(), [](const DrawItem &a, const DrawItem &b){
+        if (a.transparent != b.transparent)
+            return b.transparent;
+        if (a.transparent && a.depth != b.depth)
+            return a.depth < b.depth;
+        return a.order < b.order;
+    });
+
+    const DrawItem *opaqueEnd = queue.begin();
+    while (opaqueEnd != queue.end() && !opaqueEnd->transparent)
+        opaqueEnd++;
+
+    // プリパスを使う場合は不透明なものの深度だけを先に描画し、塗るのは見える面だけにする
+    bool prepass = m_prepass && m_prepass->isActive();
+    if (prepass)
+    {
+        m_profiler->beginGpu("pass/depth");
+        m_prepass->beginDepth();
+        drawItems(queue.begin(), opaqueEnd);
+        m_prepass->endDepth();
+        m_profiler->endGpu("pass/depth");
+    }
+    else
+    {
+        m_profiler->beginGpu("pass/opaque");
+        drawItems(queue.begin(), opaqueEnd);
+        m_profiler->endGpu("pass/opaque");
+    }
+
+    // 後回しにしたものを不透明なものの深度と比べ直し、その深度を次のフレームのために残す
+    // 半透明なものは深度を書き込むので、その前に行う
+    if (m_occlusion)
+    {
+        m_profiler->beginGpu("pass/occlusion");
+        m_occlusion->flush(m_projectionMatrix, m_viewMatrix);
+        m_occlusion->capture(m_projectionMatrix, m_viewMatrix, renderSize);
+        m_profiler->endGpu("pass/occlusion");
+        m_profiler->count(QStringLiteral("occlusion_deferred"), m_occlusion->deferredCount());
+        m_profiler->count(QStringLiteral("occlusion_culled"), m_occlusion->occludedCount());
+    }
+
+    if (prepass)
+    {
+        m_profiler->beginGpu("pass/opaque");
+        m_prepass->beginShade();
+        drawItems(queue.begin(), opaqueEnd);
+        m_prepass->endShade();
+        m_profiler->endGpu("pass/opaque");
+    }
+
+    drawItems(opaqueEnd, queue.end());
+
+    // まとめた球は半透明なので最後に描画する(球同士は奥から順にならない)
+    if (m_sphereBatch && m_sphereBatch->size() > 0)
+    {
+        m_profiler->beginGpu("spheres");
+        m_sphereBatch->cull(m_projectionMatrix, m_viewMatrix);
+        m_sphereBatch->draw(m_projectionMatrix, m_viewMatrix);
+        m_profiler->endGpu("spheres");
+        m_profiler->count(QStringLiteral("draw_calls"));
+        m_profiler->count(QStringLiteral("instances"), m_sphereBatch->size());
+    }
+
+    m_profiler->count(QStringLiteral("frame_arena_bytes"), m_frameArena.stats().peak);
+    m_profiler->count(QStringLiteral("frame_arena_heap_blocks"), m_frameArena.stats().systemAllocations);
+
+    m_profiler->endGpu("pass/scene");
+
+    // HUD はアンチエイリアスも拡大もせず、ウィンドウの解像度で直接描画する
+    if (m_antiAliasing)
+    {
+        m_profiler->beginGpu("pass/aa");
+        m_antiAliasing->resolve(output);
+        m_profiler->endGpu("pass/aa");
+    }
+    if (m_dynamicResolution)
+    {
+        m_profiler->beginGpu("pass/upscale");
+        m_dynamicResolution->upscale(window);
+        m_profiler->endGpu("pass/upscale");
+    }
+    m_profiler->endCpu("submission");
+
+#ifdef QT_DEBUG
+    // パフォーマンス表示(前フレームまでの計測値)
+    m_profiler->beginGpu("pass/hud");
+
+    Transform transform = scene.active < scene.transforms.size() ? scene.transforms.at(scene.active) : Transform();
+
+    // フレームの時間は間隔ではなく、測った CPU と GPU の処理時間の和
+    // (OnDemand では描画しない間の待ちが間隔に入ってしまう)
+    const RollingHistogram &frameCost = m_profiler->frameCost();
+
+    GLDebug::Info info;
+    info.fps = m_fps->getFps();
+    info.frameTime = frameCost.last();
+    info.drawCalls = m_profiler->counter("draw_calls");
+    info.triangles = m_profiler->counter("triangles");
+    info.culled = m_profiler->counter("culled");
+    info.deferred = m_profiler->counter("occlusion_deferred");
+    info.occluded = m_profiler->counter("occlusion_culled");
+    if (m_prepass)
+    {
+        const RollingHistogram *depthPass = m_profiler->gpuHistogram("pass/depth");
+        const RollingHistogram *opaquePass = m_profiler->gpuHistogram("pass/opaque");
+        info.prepass = prepass;
+        info.overdraw = m_prepass->overdraw();
+        info.depthPassTime = prepass && depthPass ? depthPass->last() : 0.0;
+        info.opaquePassTime = opaquePass ? opaquePass->last() : 0.0;
+    }
+    if (m_antiAliasing)
+    {
+        const RollingHistogram *scenePass = m_profiler->gpuHistogram("pass/scene");
+        const RollingHistogram *resolvePass = m_profiler->gpuHistogram("pass/aa");
+        info.antiAliasing = AntiAliasing::name(m_antiAliasing->mode());
+        info.scenePassTime = scenePass ? scenePass->last() : 0.0;
+        info.resolveTime = resolvePass ? resolvePass->last() : 0.0;
+        info.antiAliasingMemory = m_antiAliasing->gpuBytes();
+    }
+    if (m_dynamicResolution)
+    {
+        info.renderScale = m_dynamicResolution->scale();
+        info.renderSize = renderSize;
+        info.gpuFrameTime = m_dynamicResolution->gpuTime();
+        info.targetFrameTime = m_dynamicResolution->targetFrameTime();
+    }
+    info.gpuMemory = Model::gpuMemoryUsage();
+    info.gpuBudget = m_resources->budget();
+    info.active = scene.active;
+    info.translation = transform.translation;
+    info.angle = transform.angle;
+    info.scale = transform.scale;
+    info.mouse = QVector3D(scene.cameraAngle, scene.cameraDistance);
+
+    m_gldebug->update(info, frameCost.samples());
+    m_gldebug->draw(m_size.width(), m_size.height());
+
+    m_profiler->endGpu("pass/hud");
+#endif
+
+    m_uniforms->endFrame();
+    if (m_uniforms->size() != m_uniformBytes)
+    {
+        // オブジェクトが増えてリングバッファを広げた
+        m_resources->remove(GpuResources::UniformBuffer, m_uniformBytes);
+        m_uniformBytes = m_uniforms->size();
+        m_resources->add(GpuResources::UniformBuffer, m_uniformBytes);
+    }
+    if (m_indirect)
+        m_indirect->endFrame();
+    m_profiler->endFrame();
+
+    // 転送が残っていれば次のフレームも描画する
+    return !m_uploads->isEmpty();
+}
+
+void Renderer::resize(const QSize &size)
+{
+    m_size = size;
+
+    int w = size.width();
+    int h = size.height();
+    float aspect = float(w) / float(h ? h : 1);
+    const float zNear = 0.1f, zFar = 10000, fov = 60.0;
+
+    m_projectionMatrix.setToIdentity();
+    m_projectionMatrix.perspective(fov, aspect, zNear, zFar);
+    glViewport(0, 0, w, h);
+}
+
+void Renderer::update(const Scene &scene)
+{
+    // FPS計測
+    m_fps->frameRateCalculator();
+
+    //　ビューの更新処理
+    QMatrix4x4 camera;  // カメラを原点に沿って回転させる
+    camera.rotate(scene.cameraAngle.x(), QVector3D(0.0f, 1.0f, 0.0f));
+    camera.rotate(scene.cameraAngle.y(), QVector3D(1.0f, 0.0f, 0.0f));
+
+    auto eye = camera * QVector3D(0.0f, 0.0f, scene.cameraDistance);  // 仮想3Dカメラが配置されているポイント
+    auto center = camera * QVector3D(0.0f, 0.0f, 0.0f);           // カメラが注視するポイント（シーンの中心）
+    auto up = camera * QVector3D(0.0f, 1.0f, 0.0f);               // 3Dワールドの上方向を定義
+
+    m_viewMatrix.setToIdentity();
+    m_viewMatrix.lookAt(eye, center, up);
+
+    m_gridline->update();
+    m_model.first()->update();
+
+    // モデルの更新処理(変化の無いモデルは setter 内で何もしない)
+    int count = qMin(m_model.size(), scene.transforms.size());
+    for (int i = 0; i < count; i++)
+    {
+        const Transform &transform = scene.transforms.at(i);
+        m_model[i]->setRotation(QQuaternion::fromEulerAngles(transform.angle.x(), transform.angle.y(), transform.angle.z()));
+        m_model[i]->setTranslation(transform.translation);
+        m_model[i]->setScale(transform.scale);
+    }
+
+    // 変更のあったワールド行列を階層毎に更新
+    m_scene->update();
+}
+
+void Renderer::addModel(Model *model)
+{
+    // 頂点データは描画の合間に少しずつ転送する
+    model->bindStreamed(":/shader.vert", ":/shader.frag", m_uploads);
+    model->attach(m_scene);
+    m_model.append(model);
+}
+
+void Renderer::addSphere(const QVector3D &translation)
+{
+    if (m_sphereBatch)
+    {
+        QMatrix4x4 modelMatrix;
+        modelMatrix.translate(translation);
+        m_sphereBatch->add(modelMatrix);
+        return;
+    }
+
+    // 頂点データはコンパイル時に作ったものを共有するので、いくつ追加しても読み込みや確保は無い
+    m_sphere.append(new Model());
+    m_sphere.last()->setName("sphere");
+    m_sphere.last()->setMesh(Primitives::uvSphere<32, 16>());
+    m_sphere.last()->bind(":/shader.vert", ":/shader.frag");
+    m_sphere.last()->setTranslation(translation);
+    m_sphere.last()->setOpacity(0.3f);
+    m_sphere.last()->attach(m_scene);
+}
+
+Renderer::DrawItem Renderer::drawItem(Model *model, int order)
+{
+    // 視点座標での奥行き(奥ほど小さい)
+    QVector3D position = model->getWorldMatrix().column(3).toVector3D();
+    DrawItem item;
+    item.model = model;
+    item.depth = m_viewMatrix.map(position).z();
+    item.order = order;
+    item.transparent = model->getMaterial().Opacity < 1.0f;
+    return item;
+}
+
+FrameProfiler *Renderer::profiler() const
+{
+    return m_profiler;
+}
+
+void Renderer::setDepthPrepassMode(DepthPrepass::Mode mode)
+{
+    if (m_prepass)
+        m_prepass->setMode(mode);
+}
+
+void Renderer::setAntiAliasingMode(AntiAliasing::Mode mode)
+{
+    if (m_antiAliasing)
+        m_antiAliasing->setMode(mode);
+}
+
+void Renderer::setDynamicResolutionMode(DynamicResolution::Mode mode)
+{
+    if (m_dynamicResolution)
+        m_dynamicResolution->setMode(mode);
+}
+
+void Renderer::drawItems(const DrawItem *begin, const DrawItem *end)
+{
+    for (const DrawItem *item = begin; item != end; item++)
+        item->model->draw(m_projectionMatrix, m_viewMatrix);
+}
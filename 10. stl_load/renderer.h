@@ -0,0 +1,116 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <QOpenGLFunctions>
+#include <QMatrix4x4>
+#include <QVector2D>
+#include <QVector3D>
+#include <QSize>
+#include "model.h"
+#include "gridline.h"
+#include "instancebatch.h"
+#include "occlusionculler.h"
+#include "depthprepass.h"
+#include "antialiasing.h"
+#include "dynamicresolution.h"
+#include "fpsmanager.h"
+#include "frameprofiler.h"
+#include "scenetable.h"
+#include "uploadqueue.h"
+#include "ringbuffer.h"
+#include "gpuresources.h"
+#include "arena.h"
+#include "gldebug.h"
+
+// シーンの描画処理。OpenGLのリソースは全てこのクラスが持つ
+// 描画スレッドでコンテキストをカレントにした状態で呼ぶ
+class Renderer : protected QOpenGLFunctions
+{
+public:
+    struct Transform
+    {
+        QVector3D angle;
+        QVector3D translation;
+        float scale = 1;
+    };
+
+    // GUIスレッドから受け取るシーンの状態
+    struct Scene
+    {
+        QVector<Transform> transforms;  // m_model と同じ順番
+        int active = 0;
+        QVector2D cameraAngle;
+        float cameraDistance = 2.5f;
+        QSize size;                     // 描画サイズ(pixel)
+    };
+
+    Renderer();
+    ~Renderer();
+
+    void initialize();
+    void release();
+
+    // 1フレーム描画する。続けて描画が必要なら true を返す
+    bool render(const Scene &scene);
+
+    // 読み込み済みのモデルを追加する(転送は描画の合間に行う)
+    void addModel(Model *model);
+    void addSphere(const QVector3D &translation);
+
+    FrameProfiler *profiler() const;
+
+    // 深度だけを先に描画するパスの使い方(Auto は測った重なりで切り替える)
+    void setDepthPrepassMode(DepthPrepass::Mode mode);
+    // シーンのアンチエイリアス(None 以外は FBO に描画して書き出す)
+    void setAntiAliasingMode(AntiAliasing::Mode mode);
+    // GPUの時間に合わせてシーンの解像度を下げる(拡大の方法を選ぶ)
+    void setDynamicResolutionMode(DynamicResolution::Mode mode);
+
+private:
+    // 1フレーム分のユニフォームの初期容量(256byte x 16384 オブジェクト。足りなければ広げる)
+    static const GLsizeiptr UniformRingSize = 4 << 20;
+    // 1フレーム分のメッシュレットの描画コマンドの容量(20byte x 約5万コマンド)
+    static const GLsizeiptr IndirectRingSize = 1 << 20;
+
+    // 描画キューの要素
+    struct DrawItem
+    {
+        Model *model;
+        float depth;
+        int order;
+        bool transparent;
+    };
+
+    void resize(const QSize &size);
+    void update(const Scene &scene);
+    DrawItem drawItem(Model *model, int order);
+    void drawItems(const DrawItem *begin, const DrawItem *end);
+
+    QMatrix4x4 m_projectionMatrix;
+    QMatrix4x4 m_viewMatrix;
+    QSize m_size;
+
+    GridLine* m_gridline;
+    QVector<Model*> m_model;
+    QVector<Model*> m_sphere;
+    InstanceBatch* m_sphereBatch;   // コンピュートシェーダーが使えれば球はまとめてGPUでカリングする
+    SceneTable* m_scene;
+    UploadQueue* m_uploads;
+    RingBuffer* m_uniforms;
+    GLsizeiptr m_uniformBytes;  // GpuResources に集計したユニフォームのリングバッファの大きさ
+    RingBuffer* m_indirect; // glMultiDrawElementsIndirect が使えない場合は nullptr
+    GpuResources* m_resources;
+    OcclusionCuller* m_occlusion;   // 使えなければ nullptr
+    DepthPrepass* m_prepass;        // 使えなければ nullptr
+    AntiAliasing* m_antiAliasing;   // 使えなければ nullptr(ウィンドウに直接描画する)
+    DynamicResolution* m_dynamicResolution; // 使えなければ nullptr(ウィンドウの解像度で描画する)
+    Arena m_frameArena;     // フレーム内だけ使う一時データ(描画キュー、カリング結果)
+
+    FpsManager* m_fps;
+    FrameProfiler* m_profiler;
+
+    // Debug
+    GLDebug* m_gldebug;
+};
+
+#endif // RENDERER_H
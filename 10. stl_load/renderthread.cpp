@@ -0,0 +1,160 @@
+#include "renderthread.h"
+#include <QCoreApplication>
+
+RenderThread::RenderThread(QWindow *window, QObject *parent) : QObject(parent)
+{
+    m_window = window;
+    m_renderer = nullptr;
+    m_updatePosted = false;
+    m_exposed = false;
+    m_running = false;
+
+    m_context = new QOpenGLContext();
+    m_context->setFormat(window->requestedFormat());
+    if (!m_context->create())
+        qWarning() << "Can't create OpenGL context";
+
+    m_threaded = m_context->supportsThreadedOpenGL();
+    if (!m_threaded)
+        qWarning() << "Threaded OpenGL is not supported. Rendering on the GUI thread";
+
+    // 変化があった時だけ再描画する
+    m_scheduler = new FrameScheduler();
+    connect(m_scheduler, &FrameScheduler::frameRequested, m_scheduler, [this](){ renderFrame(); });
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+    delete m_context;
+}
+
+void RenderThread::start()
+{
+    if (m_running)
+        return;
+    m_running = true;
+
+    if (m_threaded)
+    {
+        m_context->moveToThread(&m_thread);
+        m_scheduler->moveToThread(&m_thread);
+        m_thread.setObjectName("RenderThread");
+        m_thread.start();
+    }
+    requestUpdate();
+}
+
+void RenderThread::stop()
+{
+    if (!m_running)
+        return;
+    m_running = false;
+
+    // 描画スレッドでリソースを解放してからスレッドを止める
+    QMetaObject::invokeMethod(m_scheduler, [this](){ shutdown(); },
+                              m_threaded ? Qt::BlockingQueuedConnection : Qt::DirectConnection);
+    if (m_threaded)
+    {
+        m_thread.quit();
+        m_thread.wait();
+    }
+    else
+    {
+        delete m_scheduler;
+    }
+    m_scheduler = nullptr;
+}
+
+void RenderThread::shutdown()
+{
+    if (m_context->makeCurrent(m_window))
+    {
+        // 残っているコマンドは実行してから破棄する(モデルの所有権を受け取るため)
+        for (auto &command : m_commands.takeAll())
+        {
+            if (m_renderer)
+                command(*m_renderer);
+        }
+        delete m_renderer;
+        m_renderer = nullptr;
+        m_context->doneCurrent();
+    }
+
+    if (m_threaded)
+    {
+        m_scheduler->deleteLater();
+        m_context->moveToThread(QCoreApplication::instance()->thread());
+    }
+}
+
+void RenderThread::post(Command command)
+{
+    m_commands.push(std::move(command));
+    requestUpdate();
+}
+
+void RenderThread::publish(const Renderer::Scene &scene)
+{
+    m_snapshots.publish(scene);
+    requestUpdate();
+}
+
+void RenderThread::requestUpdate()
+{
+    // 描画スレッドへの通知は1回にまとめる
+    if (!m_scheduler || m_updatePosted.exchange(true))
+        return;
+
+    FrameScheduler *scheduler = m_scheduler;
+    QMetaObject::invokeMethod(scheduler, [this, scheduler](){
+        m_updatePosted = false;
+        scheduler->requestUpdate();
+    }, Qt::QueuedConnection);
+}
+
+void RenderThread::setMode(FrameScheduler::Mode mode)
+{
+    FrameScheduler *scheduler = m_scheduler;
+    QMetaObject::invokeMethod(scheduler, [scheduler, mode](){ scheduler->setMode(mode); }, Qt::QueuedConnection);
+}
+
+void RenderThread::setExposed(bool exposed)
+{
+    m_exposed = exposed;
+    if (exposed)
+        requestUpdate();
+}
+
+bool RenderThread::isThreaded() const
+{
+    return m_threaded;
+}
+
+void RenderThread::renderFrame()
+{
+    // 描画スレッドで実行される
+    if (!m_running || !m_exposed)
+        return;
+
+    if (!m_context->makeCurrent(m_window))
+        return;
+
+    if (!m_renderer)
+    {
+        m_renderer = new Renderer();
+        m_renderer->initialize();
+    }
+
+    for (auto &command : m_commands.takeAll())
+        command(*m_renderer);
+
+    m_snapshots.update();
+    bool again = m_renderer->render(m_snapshots.front());
+
+    m_context->swapBuffers(m_window);
+    m_scheduler->frameSwapped();
+
+    if (again)
+        m_scheduler->requestUpdate();
+}
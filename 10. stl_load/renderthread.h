@@ -0,0 +1,61 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QObject>
+#include <QThread>
+#include <QWindow>
+#include <QOpenGLContext>
+#include <atomic>
+#include <functional>
+#include "renderer.h"
+#include "framescheduler.h"
+#include "commandqueue.h"
+#include "snapshotbuffer.h"
+
+// Renderer を専用のスレッドで動かし、QWindow へ描画する
+// GUIスレッドとはコマンドキューとシーンのスナップショットだけでやり取りするので
+// メニューやダイアログで GUI が止まってもフレームは落ちない
+class RenderThread : public QObject
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(Renderer&)> Command;
+
+    // window は OpenGLSurface として生成済みであること
+    explicit RenderThread(QWindow *window, QObject *parent = nullptr);
+    ~RenderThread() override;
+
+    void start();
+    void stop();
+
+    // 以下はどのスレッドから呼んでもよい
+    void post(Command command);                 // 次のフレームの前に描画スレッドで実行する
+    void publish(const Renderer::Scene &scene); // 最新のシーンの状態を渡す
+    void requestUpdate();
+    void setMode(FrameScheduler::Mode mode);
+    void setExposed(bool exposed);
+
+    // スレッドで描画できない環境では GUI スレッドで描画する
+    bool isThreaded() const;
+
+private:
+    void renderFrame();
+    void shutdown();
+
+    QWindow* m_window;
+    QOpenGLContext* m_context;
+    QThread m_thread;
+    bool m_threaded;
+
+    // 描画スレッドのオブジェクト
+    FrameScheduler* m_scheduler;
+    Renderer* m_renderer;
+
+    CommandQueue<Command> m_commands;
+    SnapshotBuffer<Renderer::Scene> m_snapshots;
+    std::atomic<bool> m_updatePosted;
+    std::atomic<bool> m_exposed;
+    std::atomic<bool> m_running;
+};
+
+#endif // RENDERTHREAD_H
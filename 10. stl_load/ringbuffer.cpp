@@ -0,0 +1,298 @@
+#include "ringbuffer.h"
+#include <QOpenGLContext>
+#include <QDebug>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+typedef void (QOPENGLF_APIENTRYP BufferStorageFunc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+RingBuffer::RingBuffer(GLenum target, GLsizeiptr size)
+{
+    m_target = target;
+    m_frameSize = size;
+    m_buffer = 0;
+    m_persistent = false;
+    m_mapped = nullptr;
+    m_frame = 0;
+    m_offset = 0;
+    m_minAlignment = 1;
+    m_stalls = 0;
+    m_growable = false;
+    for (int i = 0; i < Frames; i++)
+        m_fences[i] = nullptr;
+}
+
+RingBuffer::~RingBuffer()
+{
+    destroy();
+}
+
+bool RingBuffer::create()
+{
+    destroy();
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context)
+        return false;
+    initializeOpenGLFunctions();
+
+    if (m_target == GL_UNIFORM_BUFFER)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &m_minAlignment);
+        m_minAlignment = qMax(m_minAlignment, 1);
+    }
+
+    m_frame = 0;
+    return allocateStorage();
+}
+
+bool RingBuffer::allocateStorage()
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+
+    // 領域の境界もアライメントに揃える
+    m_frameSize = (m_frameSize + m_minAlignment - 1) / m_minAlignment * m_minAlignment;
+    GLsizeiptr total = m_frameSize * Frames;
+    m_persistent = false;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(m_target, m_buffer);
+
+    BufferStorageFunc bufferStorage = nullptr;
+    QSurfaceFormat format = context->format();
+    if (format.version() >= qMakePair(4, 4) || context->hasExtension(QByteArrayLiteral("GL_ARB_buffer_storage")))
+        bufferStorage = reinterpret_cast<BufferStorageFunc>(context->getProcAddress("glBufferStorage"));
+
+    if (bufferStorage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(m_target, total, nullptr, flags);
+        m_mapped = static_cast<char*>(glMapBufferRange(m_target, 0, total, flags));
+        m_persistent = m_mapped != nullptr;
+    }
+
+    if (!m_persistent)
+    {
+        // フォールバック: 普通のバッファに CPU 側のコピーから転送する
+        // (glBufferStorage で確保したバッファはサイズを変えられないので作り直す)
+        if (bufferStorage)
+        {
+            glBindBuffer(m_target, 0);
+            glDeleteBuffers(1, &m_buffer);
+            glGenBuffers(1, &m_buffer);
+            glBindBuffer(m_target, m_buffer);
+        }
+        qWarning() << "ARB_buffer_storage is not available. RingBuffer falls back to glBufferSubData";
+        glBufferData(m_target, total, nullptr, GL_STREAM_DRAW);
+        m_shadow.resize(static_cast<int>(total));
+        m_mapped = m_shadow.data();
+    }
+
+    glBindBuffer(m_target, 0);
+
+    m_offset = 0;
+    return true;
+}
+
+bool RingBuffer::grow(GLsizeiptr size)
+{
+    // 今のバッファはこのフレームで確保した範囲を使う描画が終わるまで残す
+    if (m_persistent)
+    {
+        glBindBuffer(m_target, m_buffer);
+        glUnmapBuffer(m_target);
+        glBindBuffer(m_target, 0);
+    }
+    m_retired.append(Retired{ m_buffer, nullptr });
+
+    // 新しいバッファはまだどの描画にも使われていないので、前の領域のフェンスは要らない
+    for (int i = 0; i < Frames; i++)
+    {
+        if (m_fences[i])
+            glDeleteSync(m_fences[i]);
+        m_fences[i] = nullptr;
+    }
+
+    GLsizeiptr previous = m_frameSize;
+    m_frameSize = qMax(m_frameSize * 2, size);
+    m_buffer = 0;
+    m_mapped = nullptr;
+    if (!allocateStorage())
+        return false;
+
+    qWarning() << "RingBuffer: grew from" << previous << "to" << m_frameSize << "bytes per frame";
+    return true;
+}
+
+void RingBuffer::releaseRetired(bool wait)
+{
+    for (int i = m_retired.size() - 1; i >= 0; i--)
+    {
+        Retired &retired = m_retired[i];
+        if (!wait)
+        {
+            // 置いたフェンスを通過したものだけ消す(待たない)
+            if (!retired.fence || glClientWaitSync(retired.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                continue;
+        }
+        if (retired.fence)
+            glDeleteSync(retired.fence);
+        glDeleteBuffers(1, &retired.buffer);
+        m_retired.removeAt(i);
+    }
+}
+
+void RingBuffer::destroy()
+{
+    if (!m_buffer)
+        return;
+
+    // 破棄する時は描画が終わっていなくても消してよい(ドライバが使い終わるまで残す)
+    releaseRetired(true);
+
+    for (int i = 0; i < Frames; i++)
+    {
+        if (m_fences[i])
+            glDeleteSync(m_fences[i]);
+        m_fences[i] = nullptr;
+    }
+
+    if (m_persistent)
+    {
+        glBindBuffer(m_target, m_buffer);
+        glUnmapBuffer(m_target);
+        glBindBuffer(m_target, 0);
+    }
+    glDeleteBuffers(1, &m_buffer);
+
+    m_buffer = 0;
+    m_persistent = false;
+    m_mapped = nullptr;
+    m_shadow.clear();
+}
+
+void RingBuffer::beginFrame()
+{
+    if (!m_buffer)
+        return;
+
+    m_frame = (m_frame + 1) % Frames;
+    m_offset = 0;
+    releaseRetired(false);
+
+    // Frames フレーム前にこの領域を使った描画が終わるまで待つ
+    GLsync fence = m_fences[m_frame];
+    if (!fence)
+        return;
+
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        m_stalls++;
+        do {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        } while (result == GL_TIMEOUT_EXPIRED);
+    }
+    if (result == GL_WAIT_FAILED)
+        qWarning() << "RingBuffer: glClientWaitSync failed";
+
+    glDeleteSync(fence);
+    m_fences[m_frame] = nullptr;
+}
+
+void RingBuffer::endFrame()
+{
+    if (!m_buffer)
+        return;
+
+    if (m_fences[m_frame])
+        glDeleteSync(m_fences[m_frame]);
+    m_fences[m_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    // このフレームで広げる前のバッファも、このフレームの描画が終わったら消せる
+    for (Retired &retired : m_retired)
+    {
+        if (!retired.fence)
+            retired.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+RingBuffer::Allocation RingBuffer::allocate(GLsizeiptr size, GLsizeiptr alignment)
+{
+    Allocation allocation;
+    if (!m_mapped || size <= 0)
+        return allocation;
+
+    alignment = qMax<GLsizeiptr>(alignment, m_minAlignment);
+    GLsizeiptr offset = (m_offset + alignment - 1) / alignment * alignment;
+    if (offset + size > m_frameSize)
+    {
+        if (!m_growable || !grow(size))
+            return allocation;
+        offset = 0;
+    }
+
+    m_offset = offset + size;
+
+    allocation.buffer = m_buffer;
+    allocation.offset = m_frame * m_frameSize + offset;
+    allocation.data = m_mapped + allocation.offset;
+    allocation.size = size;
+    return allocation;
+}
+
+void RingBuffer::flush(const Allocation &allocation)
+{
+    if (m_persistent || !allocation.isValid())
+        return;
+
+    // この領域はフェンスで GPU が使っていないことを確認済みなので同期は起きない
+    glBindBuffer(m_target, allocation.buffer);
+    glBufferSubData(m_target, allocation.offset, allocation.size, allocation.data);
+    glBindBuffer(m_target, 0);
+}
+
+void RingBuffer::bindRange(GLuint index, const Allocation &allocation)
+{
+    glBindBufferRange(m_target, index, allocation.buffer, allocation.offset, allocation.size);
+}
+
+void RingBuffer::setGrowable(bool growable)
+{
+    m_growable = growable;
+}
+
+GLuint RingBuffer::bufferId() const
+{
+    return m_buffer;
+}
+
+GLsizeiptr RingBuffer::size() const
+{
+    return m_frameSize * Frames;
+}
+
+GLenum RingBuffer::target() const
+{
+    return m_target;
+}
+
+bool RingBuffer::isPersistent() const
+{
+    return m_persistent;
+}
+
+GLsizeiptr RingBuffer::usedBytes() const
+{
+    return m_offset;
+}
+
+int RingBuffer::stallCount() const
+{
+    return m_stalls;
+}
@@ -0,0 +1,89 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <QOpenGLExtraFunctions>
+#include <QByteArray>
+#include <QVector>
+
+// 毎フレーム書き換えるデータ(ユニフォーム、インスタンスデータ、動的な頂点)用のリングバッファ
+// バッファを Frames 個の領域に分け、GPUが使い終わった(フェンスを通過した)領域にだけ書き込む
+// ARB_buffer_storage があれば永続マップしたメモリに直接書き込み、ドライバでのコピーも同期も起きない
+// 無い場合は CPU 側のコピーに書いて flush() で glBufferSubData する
+class RingBuffer : protected QOpenGLExtraFunctions
+{
+public:
+    static const int Frames = 3;
+
+    struct Allocation
+    {
+        void *data = nullptr;   // 書き込み先
+        GLuint buffer = 0;      // 確保したバッファ(広げた後も前のバッファはこのフレームが終わるまで残る)
+        GLintptr offset = 0;    // バッファ先頭からのオフセット(glBindBufferRange 用)
+        GLsizeiptr size = 0;
+
+        bool isValid() const { return data != nullptr; }
+    };
+
+    // size は1フレーム分の容量(byte)
+    explicit RingBuffer(GLenum target, GLsizeiptr size);
+    ~RingBuffer();
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    bool create();
+    void destroy();
+
+    // フレームの最初に呼ぶ。次の領域をGPUが使い終わるまで待つ
+    void beginFrame();
+    // フレームの最後に呼ぶ。この領域を使う描画の後ろにフェンスを置く
+    void endFrame();
+
+    // 今のフレームの領域から確保する。容量が足りなければ無効な Allocation を返す
+    // setGrowable(true) なら、足りない時は大きなバッファを作り直してそこから確保する
+    Allocation allocate(GLsizeiptr size, GLsizeiptr alignment = 16);
+    // ステージングのように1フレームの予算として使うものは広げない(既定は広げない)
+    void setGrowable(bool growable);
+    // 書き込んだ内容を描画で使えるようにする(永続マップでは何もしない)
+    void flush(const Allocation &allocation);
+    // 確保した範囲をインデックス付きのバインディングポイントに割り当てる(GL_UNIFORM_BUFFER など)
+    void bindRange(GLuint index, const Allocation &allocation);
+
+    GLuint bufferId() const;
+    GLsizeiptr size() const;    // 全フレーム分の容量(広げると変わる)
+    GLenum target() const;
+    bool isPersistent() const;
+
+    // 今のフレームで確保した量と、フェンス待ちで止まった回数
+    GLsizeiptr usedBytes() const;
+    int stallCount() const;
+
+private:
+    // 今の m_frameSize でバッファを作り、マップする
+    bool allocateStorage();
+    // 今のバッファを退避し、1フレーム分が size 以上の大きなバッファに作り直す
+    bool grow(GLsizeiptr size);
+    void releaseRetired(bool wait);
+
+    // 広げる前のバッファ(確保済みの範囲を使う描画が終わるまで消さない)
+    struct Retired
+    {
+        GLuint buffer;
+        GLsync fence;   // endFrame() で置く。通過したら消す
+    };
+
+    GLenum m_target;
+    GLsizeiptr m_frameSize;
+    GLuint m_buffer;
+    bool m_persistent;
+
+    char *m_mapped;         // 永続マップした先頭、またはフォールバック時の CPU 側のコピー
+    QByteArray m_shadow;
+    GLsync m_fences[Frames];
+    int m_frame;
+    GLsizeiptr m_offset;
+    GLint m_minAlignment;   // ユニフォームバッファのオフセットの最小アライメント
+    int m_stalls;
+    bool m_growable;
+    QVector<Retired> m_retired;
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,52 @@
+QT       += core gui testlib
+
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+TARGET = scenebench
+
+# The following define makes your compiler emit warnings if you use
+# any Qt feature that has been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# Build the scene graph from the viewer sources.
+INCLUDEPATH += ..
+
+SOURCES += \
+    ../arena.cpp \
+    ../depthprepass.cpp \
+    ../frameprofiler.cpp \
+    ../gpuresources.cpp \
+    ../instancebatch.cpp \
+    ../jobsystem.cpp \
+    ../meshlet.cpp \
+    ../model.cpp \
+    ../occlusionculler.cpp \
+    ../ringbuffer.cpp \
+    ../scenetable.cpp \
+    ../uploadqueue.cpp \
+    tst_scenebench.cpp
+
+HEADERS += \
+    ../arena.h \
+    ../bakedmesh.h \
+    ../depthprepass.h \
+    ../frameprofiler.h \
+    ../gpuresources.h \
+    ../instancebatch.h \
+    ../jobsystem.h \
+    ../loadprogress.h \
+    ../meshlet.h \
+    ../model.h \
+    ../occlusionculler.h \
+    ../primitives.h \
+    ../ringbuffer.h \
+    ../scenetable.h \
+    ../uploadqueue.h \
+    ../vertexformat.h
+
+# InstanceBatch reads its shaders from the viewer resources.
+RESOURCES += \
+    ../resource.qrc
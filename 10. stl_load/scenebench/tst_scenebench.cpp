@@ -0,0 +1,292 @@
+#include <QtTest>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <functional>
+#include "model.h"
+#include "scenetable.h"
+#include "instancebatch.h"
+#include "primitives.h"
+
+// 100k ノードの階層でワールド行列の更新コストを計測する
+class SceneBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void cachedUnchanged();
+    void cachedLeafMoved();
+    void cachedRootMoved();
+    void uncached();
+    void cachedMatchesUncached();
+    void tableRootMoved_data();
+    void tableRootMoved();
+    void tableLeafMoved();
+    void tableMatchesCached();
+    void gpuCulling_data();
+    void gpuCulling();
+
+private:
+    static const int NodeCount = 100000;
+    static const int Branching = 8;
+
+    QOpenGLContext* m_context = nullptr;
+    QOffscreenSurface* m_surface = nullptr;
+    QVector<Model*> m_nodes;
+    SceneTable m_table;
+    QVector<SceneTable::Handle> m_handles;
+};
+
+void SceneBench::initTestCase()
+{
+    // Model の生成にはOpenGLコンテキストが必要
+    m_context = new QOpenGLContext();
+    if (!m_context->create())
+        QSKIP("OpenGL context is not available");
+
+    m_surface = new QOffscreenSurface();
+    m_surface->setFormat(m_context->format());
+    m_surface->create();
+    QVERIFY(m_context->makeCurrent(m_surface));
+
+    // 幅優先で Branching 分木を作る
+    m_nodes.reserve(NodeCount);
+    for (int i = 0; i < NodeCount; i++)
+    {
+        auto node = new Model();
+        node->setTranslation(QVector3D(i % 7 * 0.1f, i % 5 * 0.1f, i % 3 * 0.1f));
+        node->setRotation(QQuaternion::fromEulerAngles(i % 11, i % 13, i % 17));
+        m_nodes.append(node);
+
+        if (i > 0)
+            m_nodes[(i - 1) / Branching]->addChild(node);
+    }
+    m_nodes.first()->updateWorldMatrices();
+
+    // 同じ階層を SceneTable にも作る
+    m_handles.reserve(NodeCount);
+    for (int i = 0; i < NodeCount; i++)
+    {
+        SceneTable::Handle handle = m_table.create(i > 0 ? m_handles.at((i - 1) / Branching) : -1);
+        m_table.setTranslation(handle, m_nodes.at(i)->getTranslation());
+        m_table.setRotation(handle, QQuaternion::fromEulerAngles(i % 11, i % 13, i % 17));
+        m_handles.append(handle);
+    }
+    m_table.update();
+}
+
+void SceneBench::cleanupTestCase()
+{
+    qDeleteAll(m_nodes);
+    m_nodes.clear();
+
+    if (m_surface)
+        m_context->doneCurrent();
+    delete m_surface;
+    delete m_context;
+}
+
+void SceneBench::cachedUnchanged()
+{
+    Model *root = m_nodes.first();
+    QBENCHMARK {
+        root->updateWorldMatrices();
+    }
+}
+
+void SceneBench::cachedLeafMoved()
+{
+    Model *root = m_nodes.first();
+    Model *leaf = m_nodes.last();
+    float x = 0.0f;
+    QBENCHMARK {
+        x += 0.001f;
+        leaf->setTranslation(QVector3D(x, 0.0f, 0.0f));
+        root->updateWorldMatrices();
+    }
+}
+
+void SceneBench::cachedRootMoved()
+{
+    Model *root = m_nodes.first();
+    float x = 0.0f;
+    QBENCHMARK {
+        x += 0.001f;
+        root->setTranslation(QVector3D(x, 0.0f, 0.0f));
+        root->updateWorldMatrices();
+    }
+    root->setTranslation(QVector3D());
+    root->updateWorldMatrices();
+}
+
+void SceneBench::uncached()
+{
+    // 変更前の描画処理と同じ量の行列計算(TRS, 親との積, 法線行列)
+    std::function<void(int, const QMatrix4x4 &)> traverse = [&](int index, const QMatrix4x4 &parent){
+        Model *node = m_nodes.at(index);
+        QMatrix4x4 modelMatrix;
+        modelMatrix.translate(node->getTranslation());
+        modelMatrix.rotate(QQuaternion::fromEulerAngles(index % 11, index % 13, index % 17));
+        modelMatrix.scale(QVector3D(1.0f, 1.0f, 1.0f));
+        modelMatrix = parent * modelMatrix;
+        volatile float sink = modelMatrix.normalMatrix()(0, 0);
+        Q_UNUSED(sink);
+
+        for (int child = index * Branching + 1; child <= index * Branching + Branching && child < NodeCount; child++)
+            traverse(child, modelMatrix);
+    };
+
+    QBENCHMARK {
+        traverse(0, QMatrix4x4());
+    }
+}
+
+void SceneBench::cachedMatchesUncached()
+{
+    // キャッシュしたワールド行列が親から順に掛けた結果と一致するか確認する
+    Model *leaf = m_nodes.last();
+    QMatrix4x4 expected;
+    QVector<Model*> path;
+    for (Model *node = leaf; node; node = node->getParent())
+        path.prepend(node);
+    for (Model *node : path)
+    {
+        QMatrix4x4 local;
+        local.translate(node->getTranslation());
+        int index = m_nodes.indexOf(node);
+        local.rotate(QQuaternion::fromEulerAngles(index % 11, index % 13, index % 17));
+        expected = expected * local;
+    }
+
+    const QMatrix4x4 &actual = leaf->getWorldMatrix();
+    for (int i = 0; i < 16; i++)
+        QVERIFY(qAbs(actual.constData()[i] - expected.constData()[i]) < 1e-3f);
+}
+
+void SceneBench::tableRootMoved_data()
+{
+    QTest::addColumn<int>("threshold");
+    QTest::newRow("serial") << NodeCount;
+    QTest::newRow("parallel") << 4096;
+}
+
+void SceneBench::tableRootMoved()
+{
+    QFETCH(int, threshold);
+    m_table.setParallelThreshold(threshold);
+
+    float x = 0.0f;
+    QBENCHMARK {
+        x += 0.001f;
+        m_table.setTranslation(m_handles.first(), QVector3D(x, 0.0f, 0.0f));
+        m_table.update();
+    }
+    m_table.setTranslation(m_handles.first(), QVector3D());
+    m_table.update();
+}
+
+void SceneBench::tableLeafMoved()
+{
+    float x = 0.0f;
+    QBENCHMARK {
+        x += 0.001f;
+        m_table.setTranslation(m_handles.last(), QVector3D(x, 0.0f, 0.0f));
+        m_table.update();
+    }
+    m_table.setTranslation(m_handles.last(), m_nodes.last()->getTranslation());
+    m_table.update();
+}
+
+void SceneBench::tableMatchesCached()
+{
+    // SoA で計算したワールド行列が Model の結果と一致するか確認する
+    m_nodes.last()->setTranslation(m_table.translation(m_handles.last()));
+    m_nodes.first()->setTranslation(m_table.translation(m_handles.first()));
+    m_nodes.first()->updateWorldMatrices();
+    m_table.update();
+
+    for (int i : {0, 1, Branching + 1, NodeCount / 2, NodeCount - 1})
+    {
+        QMatrix4x4 actual = m_table.worldMatrix4x4(m_handles.at(i));
+        const QMatrix4x4 &expected = m_nodes.at(i)->getWorldMatrix();
+        for (int k = 0; k < 16; k++)
+            QVERIFY(qAbs(actual.constData()[k] - expected.constData()[k]) < 1e-3f);
+    }
+    QCOMPARE(m_table.levelCount(), 7);
+}
+
+void SceneBench::gpuCulling_data()
+{
+    QTest::addColumn<int>("instances");
+    QTest::newRow("1K") << 1000;
+    QTest::newRow("100K") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+void SceneBench::gpuCulling()
+{
+    // コンピュートシェーダーには 4.3 のコアプロファイルが必要(llvmpipe でも動く)
+    QSurfaceFormat format;
+    format.setVersion(4, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    QOpenGLContext context;
+    context.setFormat(format);
+    if (!context.create() || !context.makeCurrent(m_surface))
+        QSKIP("OpenGL 4.3 context is not available");
+    if (!InstanceBatch::isSupported())
+    {
+        context.doneCurrent();
+        m_context->makeCurrent(m_surface);
+        QSKIP("Compute shaders are not available");
+    }
+
+    QFETCH(int, instances);
+    QMatrix4x4 projection;
+    projection.perspective(60.0f, 1.0f, 0.1f, 1000.0f);
+    QMatrix4x4 view;
+    view.lookAt(QVector3D(0.0f, 0.0f, 10.0f), QVector3D(), QVector3D(0.0f, 1.0f, 0.0f));
+    MeshletCuller culler(projection * view, view);
+
+    {
+        InstanceBatch batch;
+        batch.setMesh(Primitives::uvSphere<8, 4>());
+
+        // 100 x 100 の格子を奥に重ね、視錐台の内側と外側の両方に置く
+        int expected = 0;
+        for (int i = 0; i < instances; i++)
+        {
+            QMatrix4x4 model;
+            model.translate((i % 100 - 50) * 0.5f, (i / 100 % 100 - 50) * 0.5f, -(i / 10000) * 0.5f);
+            batch.add(model);
+
+            Meshlet bounds = {};
+            bounds.center = model.column(3).toVector3D();
+            bounds.radius = 1.0f;
+            bounds.coneCutoff = 1.0f;
+            if (culler.isVisible(bounds))
+                expected++;
+        }
+        QVERIFY(batch.create());
+
+        // GPU の判定が CPU と一致するか(平面の近くは丸めの違いを許す)
+        batch.cull(projection, view);
+        int visible = batch.visibleCount();
+        QVERIFY(visible > 0 && visible < instances);
+        QVERIFY(qAbs(visible - expected) <= instances / 1000);
+
+        // CPU で掛かるのは dispatch の発行だけなので、インスタンスの数に依らない
+        QBENCHMARK {
+            batch.cull(projection, view);
+        }
+        context.functions()->glFinish();
+    }
+
+    context.doneCurrent();
+    m_context->makeCurrent(m_surface);
+}
+
+QTEST_MAIN(SceneBench)
+
+#include "tst_scenebench.moc"
@@ -0,0 +1,374 @@
+#include "scenetable.h"
+#include "jobsystem.h"
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SCENETABLE_SSE
+#endif
+
+SceneTable::SceneTable()
+{
+    m_structureDirty = false;
+    m_anyDirty = false;
+    m_updateCount = 0;
+    m_parallelThreshold = 4096;
+    m_levels.append(0);
+}
+
+SceneTable::Handle SceneTable::create(Handle parent)
+{
+    Handle handle = m_indexes.size();
+    int index = m_handles.size();
+
+    // 末尾に追加して、次の update() で幅優先順に並べ直す
+    m_indexes.append(index);
+    m_parentHandle.append(parent);
+
+    m_parent.append(parent >= 0 ? m_indexes.at(parent) : -1);
+    m_translation.append(QVector3D());
+    m_rotation.append(QQuaternion());
+    m_scale.append(QVector3D(1.0f, 1.0f, 1.0f));
+    m_local.append(Matrix());
+    m_world.append(Matrix());
+    m_localDirty.append(1);
+    m_changed.append(0);
+    m_changedAt.append(0);
+    m_handles.append(handle);
+
+    m_structureDirty = true;
+    m_anyDirty = true;
+    return handle;
+}
+
+void SceneTable::destroy(Handle handle)
+{
+    if (handle < 0 || handle >= m_indexes.size() || m_indexes.at(handle) < 0)
+        return;
+
+    // 子はルートに付け替える
+    for (int h = 0; h < m_parentHandle.size(); h++)
+    {
+        if (m_parentHandle.at(h) == handle)
+            setParent(h, -1);
+    }
+
+    m_parentHandle[handle] = -1;
+    m_indexes[handle] = -1;
+    m_structureDirty = true;
+}
+
+void SceneTable::setParent(Handle handle, Handle parent)
+{
+    if (m_parentHandle.at(handle) == parent)
+        return;
+
+    m_parentHandle[handle] = parent;
+    m_localDirty[m_indexes.at(handle)] = 1;
+    m_structureDirty = true;
+    m_anyDirty = true;
+}
+
+void SceneTable::setTranslation(Handle handle, const QVector3D &translation)
+{
+    int i = m_indexes.at(handle);
+    m_translation[i] = translation;
+    m_localDirty[i] = 1;
+    m_anyDirty = true;
+}
+
+void SceneTable::setRotation(Handle handle, const QQuaternion &rotation)
+{
+    int i = m_indexes.at(handle);
+    m_rotation[i] = rotation.normalized();
+    m_localDirty[i] = 1;
+    m_anyDirty = true;
+}
+
+void SceneTable::setScale(Handle handle, const QVector3D &scale)
+{
+    int i = m_indexes.at(handle);
+    m_scale[i] = scale;
+    m_localDirty[i] = 1;
+    m_anyDirty = true;
+}
+
+QVector3D SceneTable::translation(Handle handle) const
+{
+    return m_translation.at(m_indexes.at(handle));
+}
+
+QQuaternion SceneTable::rotation(Handle handle) const
+{
+    return m_rotation.at(m_indexes.at(handle));
+}
+
+QVector3D SceneTable::scale(Handle handle) const
+{
+    return m_scale.at(m_indexes.at(handle));
+}
+
+void SceneTable::sort()
+{
+    // 各ノードの深さを求める
+    int handleCount = m_indexes.size();
+    QVector<int> depth(handleCount, -1);
+    QVector<Handle> path;
+    for (Handle h = 0; h < handleCount; h++)
+    {
+        if (m_indexes.at(h) < 0)
+            continue;
+
+        path.clear();
+        Handle node = h;
+        while (node >= 0 && depth.at(node) < 0)
+        {
+            path.append(node);
+            node = m_parentHandle.at(node);
+        }
+        int d = node >= 0 ? depth.at(node) : -1;
+        for (int i = path.size() - 1; i >= 0; i--)
+            depth[path.at(i)] = ++d;
+    }
+
+    // 深さ順(同じ深さは現在の順番)に並べる
+    QVector<Handle> order;
+    order.reserve(m_handles.size());
+    for (int i = 0; i < m_handles.size(); i++)
+    {
+        if (m_indexes.at(m_handles.at(i)) >= 0)
+            order.append(m_handles.at(i));
+    }
+    std::stable_sort(order.begin(), order.end(), [&](Handle a, Handle b){
+        return depth.at(a) < depth.at(b);
+    });
+
+    int count = order.size();
+    QVector<int> parent(count);
+    QVector<QVector3D> translation(count);
+    QVector<QQuaternion> rotation(count);
+    QVector<QVector3D> scale(count);
+    QVector<Matrix> local(count);
+    QVector<Matrix> world(count);
+    QVector<quint8> localDirty(count);
+    QVector<quint64> changedAt(count);
+
+    m_levels.clear();
+    for (int i = 0; i < count; i++)
+    {
+        Handle h = order.at(i);
+        int old = m_indexes.at(h);
+        translation[i] = m_translation.at(old);
+        rotation[i] = m_rotation.at(old);
+        scale[i] = m_scale.at(old);
+        local[i] = m_local.at(old);
+        world[i] = m_world.at(old);
+        localDirty[i] = m_localDirty.at(old);
+        changedAt[i] = m_changedAt.at(old);
+
+        if (i == 0 || depth.at(h) != depth.at(order.at(i - 1)))
+            m_levels.append(i);
+    }
+    m_levels.append(count);
+
+    for (int i = 0; i < count; i++)
+        m_indexes[order.at(i)] = i;
+    for (int i = 0; i < count; i++)
+    {
+        Handle p = m_parentHandle.at(order.at(i));
+        parent[i] = p >= 0 ? m_indexes.at(p) : -1;
+    }
+
+    m_parent = parent;
+    m_translation = translation;
+    m_rotation = rotation;
+    m_scale = scale;
+    m_local = local;
+    m_world = world;
+    m_localDirty = localDirty;
+    m_changedAt = changedAt;
+    m_changed = QVector<quint8>(count, 0);
+    m_handles = order;
+
+    m_structureDirty = false;
+}
+
+void SceneTable::update()
+{
+    if (m_structureDirty)
+        sort();
+
+    // 何も変わっていなければ行列計算は行わない
+    if (!m_anyDirty)
+        return;
+
+    m_updateCount++;
+    std::memset(m_changed.data(), 0, static_cast<size_t>(m_changed.size()));
+
+    // 親の階層から順に更新する。同じ階層のノードは互いに依存しない
+    for (int level = 0; level + 1 < m_levels.size(); level++)
+    {
+        int begin = m_levels.at(level);
+        int end = m_levels.at(level + 1);
+
+        if (end - begin < m_parallelThreshold)
+        {
+            updateRange(begin, end);
+            continue;
+        }
+
+        JobSystem &jobs = JobSystem::instance();
+        int chunkSize = qMax(m_parallelThreshold / 4, (end - begin) / (qMax(jobs.threadCount(), 1) * 4) + 1);
+        jobs.parallelFor(begin, end, chunkSize, [this](int chunkBegin, int chunkEnd){
+            updateRange(chunkBegin, chunkEnd);
+        });
+    }
+
+    m_anyDirty = false;
+}
+
+void SceneTable::updateRange(int begin, int end)
+{
+    // 複数スレッドから呼ばれるので detach しないように生のポインタを使う
+    const int *parent = m_parent.constData();
+    const QVector3D *translation = m_translation.constData();
+    const QQuaternion *rotation = m_rotation.constData();
+    const QVector3D *scale = m_scale.constData();
+    Matrix *local = const_cast<Matrix*>(m_local.constData());
+    Matrix *world = const_cast<Matrix*>(m_world.constData());
+    quint8 *localDirty = const_cast<quint8*>(m_localDirty.constData());
+    quint8 *changed = const_cast<quint8*>(m_changed.constData());
+    quint64 *changedAt = const_cast<quint64*>(m_changedAt.constData());
+
+    for (int i = begin; i < end; i++)
+    {
+        int p = parent[i];
+        bool dirty = localDirty[i] || (p >= 0 && changed[p]);
+        if (!dirty)
+            continue;
+
+        if (localDirty[i])
+        {
+            compose(translation[i], rotation[i], scale[i], local[i].m);
+            localDirty[i] = 0;
+        }
+
+        if (p >= 0)
+            multiply(world[p].m, local[i].m, world[i].m);
+        else
+            world[i] = local[i];
+
+        changed[i] = 1;
+        changedAt[i] = m_updateCount;
+    }
+}
+
+void SceneTable::compose(const QVector3D &t, const QQuaternion &r, const QVector3D &s, float *result)
+{
+    // T * R * S (列優先)
+    float x = r.x(), y = r.y(), z = r.z(), w = r.scalar();
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float xw = x * w, yw = y * w, zw = z * w;
+
+    result[0] = (1.0f - 2.0f * (yy + zz)) * s.x();
+    result[1] = 2.0f * (xy + zw) * s.x();
+    result[2] = 2.0f * (xz - yw) * s.x();
+    result[3] = 0.0f;
+
+    result[4] = 2.0f * (xy - zw) * s.y();
+    result[5] = (1.0f - 2.0f * (xx + zz)) * s.y();
+    result[6] = 2.0f * (yz + xw) * s.y();
+    result[7] = 0.0f;
+
+    result[8] = 2.0f * (xz + yw) * s.z();
+    result[9] = 2.0f * (yz - xw) * s.z();
+    result[10] = (1.0f - 2.0f * (xx + yy)) * s.z();
+    result[11] = 0.0f;
+
+    result[12] = t.x();
+    result[13] = t.y();
+    result[14] = t.z();
+    result[15] = 1.0f;
+}
+
+void SceneTable::multiply(const float *a, const float *b, float *result)
+{
+    // result = a * b (列優先)
+#ifdef SCENETABLE_SSE
+    __m128 a0 = _mm_loadu_ps(a);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+    for (int j = 0; j < 4; j++)
+    {
+        __m128 c = _mm_mul_ps(a0, _mm_set1_ps(b[j * 4 + 0]));
+        c = _mm_add_ps(c, _mm_mul_ps(a1, _mm_set1_ps(b[j * 4 + 1])));
+        c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_set1_ps(b[j * 4 + 2])));
+        c = _mm_add_ps(c, _mm_mul_ps(a3, _mm_set1_ps(b[j * 4 + 3])));
+        _mm_storeu_ps(result + j * 4, c);
+    }
+#else
+    float c[16];
+    for (int j = 0; j < 4; j++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            c[j * 4 + i] = a[0 * 4 + i] * b[j * 4 + 0]
+                         + a[1 * 4 + i] * b[j * 4 + 1]
+                         + a[2 * 4 + i] * b[j * 4 + 2]
+                         + a[3 * 4 + i] * b[j * 4 + 3];
+        }
+    }
+    std::memcpy(result, c, sizeof(c));
+#endif
+}
+
+const SceneTable::Matrix &SceneTable::worldMatrix(Handle handle) const
+{
+    return m_world.at(m_indexes.at(handle));
+}
+
+QMatrix4x4 SceneTable::worldMatrix4x4(Handle handle) const
+{
+    QMatrix4x4 matrix;
+    std::memcpy(matrix.data(), worldMatrix(handle).m, sizeof(Matrix));
+    matrix.optimize();
+    return matrix;
+}
+
+quint64 SceneTable::changedAt(Handle handle) const
+{
+    return m_changedAt.at(m_indexes.at(handle));
+}
+
+quint64 SceneTable::updateCount() const
+{
+    return m_updateCount;
+}
+
+const SceneTable::Matrix *SceneTable::worldMatrices() const
+{
+    return m_world.constData();
+}
+
+int SceneTable::index(Handle handle) const
+{
+    return m_indexes.at(handle);
+}
+
+int SceneTable::size() const
+{
+    return m_handles.size();
+}
+
+int SceneTable::levelCount() const
+{
+    return m_levels.size() - 1;
+}
+
+void SceneTable::setParallelThreshold(int nodes)
+{
+    m_parallelThreshold = qMax(nodes, 1);
+}
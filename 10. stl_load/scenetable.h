@@ -0,0 +1,87 @@
+#ifndef SCENETABLE_H
+#define SCENETABLE_H
+
+#include <QVector>
+#include <QVector3D>
+#include <QQuaternion>
+#include <QMatrix4x4>
+
+// シーンのノードを幅優先順に並べた Structure of Arrays で管理する
+// ワールド行列は階層(深さ)毎に親→子の順で更新し、同じ階層はスレッドに分割する
+class SceneTable
+{
+public:
+    typedef int Handle;
+
+    // 列優先の4x4行列(GPUへそのまま転送できる)
+    struct alignas(16) Matrix
+    {
+        float m[16];
+    };
+
+    SceneTable();
+
+    Handle create(Handle parent = -1);
+    void destroy(Handle handle);
+    void setParent(Handle handle, Handle parent);
+
+    void setTranslation(Handle handle, const QVector3D &translation);
+    void setRotation(Handle handle, const QQuaternion &rotation);
+    void setScale(Handle handle, const QVector3D &scale);
+
+    QVector3D translation(Handle handle) const;
+    QQuaternion rotation(Handle handle) const;
+    QVector3D scale(Handle handle) const;
+
+    // 変更のあったノードのワールド行列を更新する
+    void update();
+
+    const Matrix &worldMatrix(Handle handle) const;
+    QMatrix4x4 worldMatrix4x4(Handle handle) const;
+
+    // ワールド行列が最後に変化した update() の番号
+    quint64 changedAt(Handle handle) const;
+    quint64 updateCount() const;
+
+    // ワールド行列の配列(幅優先順、連続しているので1回のコピーで転送できる)。index() でハンドルから位置を得る
+    const Matrix *worldMatrices() const;
+    int index(Handle handle) const;
+    int size() const;
+    int levelCount() const;
+
+    // 1階層をスレッドに分割する最小ノード数
+    void setParallelThreshold(int nodes);
+
+    static void multiply(const float *a, const float *b, float *result);
+    static void compose(const QVector3D &t, const QQuaternion &r, const QVector3D &s, float *result);
+
+private:
+    void sort();
+    void updateRange(int begin, int end);
+
+    // SoA (幅優先順)
+    QVector<int> m_parent;          // 親の位置, ルートは -1
+    QVector<QVector3D> m_translation;
+    QVector<QQuaternion> m_rotation;
+    QVector<QVector3D> m_scale;
+    QVector<Matrix> m_local;
+    QVector<Matrix> m_world;
+    QVector<quint8> m_localDirty;
+    QVector<quint8> m_changed;      // 今回の update() でワールド行列が変化した
+    QVector<quint64> m_changedAt;
+    QVector<Handle> m_handles;      // 位置 → ハンドル
+
+    // 階層の開始位置 (末尾に size() を含む)
+    QVector<int> m_levels;
+
+    // ハンドル毎の情報
+    QVector<int> m_indexes;         // ハンドル → 位置, 破棄済みは -1
+    QVector<Handle> m_parentHandle; // 親のハンドル(並べ替えの元データ)
+
+    bool m_structureDirty;
+    bool m_anyDirty;
+    quint64 m_updateCount;
+    int m_parallelThreshold;
+};
+
+#endif // SCENETABLE_H
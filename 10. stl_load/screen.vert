@@ -0,0 +1,10 @@
+#version 400 core
+// 画面全体を覆う三角形(AntiAliasing と DynamicResolution の後処理)。頂点は gl_VertexID から作る
+out vec2 TexCoord;
+
+void main(void)
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    TexCoord = position;
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
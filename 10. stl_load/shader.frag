@@ -1,11 +1,61 @@
 #version 400 core
+#ifdef FLAT_SHADING
+in vec3 EyePosition;
+
+struct LightInfo {
+    vec4 Position;  // 視点座標でのライトの位置
+    vec3 La;        // アンビエント ライト強度
+    vec3 Ld;        // ディフューズ ライト強度
+    vec3 Ls;        // スペキュラ ライト強度
+};
+uniform LightInfo Light;
+
+struct MaterialInfo {
+    vec3 Ka;            // アンビエント 反射率
+    vec3 Kd;            // ディフューズ 反射率
+    vec3 Ks;            // スペキュラ 反射率
+    float Shininess;    // スペキュラ 輝き係数
+    float Opacity;      //　不透明度
+};
+
+// shader.vert と同じブロック
+layout(std140) uniform ObjectBlock
+{
+    mat4 ModelViewMatrix;
+    mat4 MVP;
+    mat3 NormalMatrix;
+    MaterialInfo Material;
+};
+
+vec3 phongModel( vec3 position, vec3 norm )
+{
+    vec3 s = normalize( vec3(Light.Position) - position );
+    vec3 v = normalize( -position );
+    vec3 r = reflect( -s, norm );
+    vec3 ambient = Light.La * Material.Ka;
+    float sDotN = max( dot(s, norm), 0.0 );
+    vec3 diffuse = Light.Ld * Material.Kd * sDotN;
+    vec3 spec = vec3(0.0);
+    if( sDotN > 0.0 )
+        spec = Light.Ls * Material.Ks * pow( max( dot(r, v), 0.0 ), Material.Shininess );
+
+    return ambient + diffuse + spec;
+}
+#else
 in vec3 LightIntensity;
+#endif
 in float Opacity;
 
 layout( location = 0 )out vec4 FragColor;
 
 void main(void)
 {
+#ifdef FLAT_SHADING
+    // 三角形の中では視点座標の位置が平面上にあるので、画面上の変化量の外積が面の法線になる
+    vec3 norm = normalize( cross(dFdx(EyePosition), dFdy(EyePosition)) );
+    FragColor = vec4(phongModel(EyePosition, norm), Opacity);
+#else
     FragColor = vec4(LightIntensity, Opacity);
+#endif
     //FragColor = vec4(1,1,1, 0.7f);
 }
@@ -1,10 +1,18 @@
 #version 400 core
-layout(location = 0) in vec3  VertexPosition;
-layout(location = 1) in vec3  VertexNormal;
+// 頂点の属性は Model::Format (FLAT_SHADING の場合は Model::FlatFormat) から宣言される
+#pragma vertex_attributes
 
+#ifdef FLAT_SHADING
+// 頂点は位置だけ(法線はフラグメントシェーダーで面毎に求める)
+out vec3 EyePosition;
+#else
 out vec3 LightIntensity;
+#endif
 out float Opacity;
 
+// 深度だけのパス(depth.vert)と同じ深度になるようにする
+invariant gl_Position;
+
 struct LightInfo {
     vec4 Position;  // 視点座標でのライトの位置
     vec3 La;        // アンビエント ライト強度
@@ -20,13 +28,17 @@ struct MaterialInfo {
     float Shininess;    // スペキュラ 輝き係数
     float Opacity;      //　不透明度
 };
-uniform MaterialInfo Material;
 
-uniform mat4 ModelViewMatrix;
-uniform mat3 NormalMatrix;
-uniform mat4 ProjectionMatrix;
-uniform mat4 MVP;
+// オブジェクト毎の値はリングバッファから glBindBufferRange で渡す(Model::ObjectUniforms)
+layout(std140) uniform ObjectBlock
+{
+    mat4 ModelViewMatrix;
+    mat4 MVP;
+    mat3 NormalMatrix;
+    MaterialInfo Material;
+};
 
+#ifndef FLAT_SHADING
 void getEyeSpace( out vec3 norm, out vec4 position )
 {
     norm = normalize( NormalMatrix * VertexNormal );
@@ -48,8 +60,13 @@ vec3 phongModel( vec4 position, vec3 norm )
     return ambient + diffuse + spec;
 }
 
+#endif
+
 void main(void)
 {
+#ifdef FLAT_SHADING
+    EyePosition = vec3(ModelViewMatrix * vec4(VertexPosition, 1.0));
+#else
     vec3 eyeNorm;
     vec4 eyePosition;
 
@@ -58,6 +75,7 @@ void main(void)
 
     // ライティング方程式を評価
     LightIntensity = phongModel( eyePosition, eyeNorm );
+#endif
     Opacity = Material.Opacity;
     gl_Position = MVP * vec4(VertexPosition, 1.0f);
 }
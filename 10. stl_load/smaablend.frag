@@ -0,0 +1,105 @@
+#version 400 core
+// SMAA (lite) の2パス目: 輪郭の形からブレンドの重みを求めて、輪郭の向こうの画素と混ぜる(AntiAliasing::resolve)
+//
+// 画素の上下左右の輪郭毎に、輪郭の線を両側へ MaxSearch 画素まで辿り、両端で線と交わる輪郭を調べる
+// 端で交わる輪郭が自分の側にあれば、本来の境界はその端で自分の側へ半画素入っている(+0.5)
+// 向こう側にあれば向こう側へ半画素入っている(-0.5)。両端の高さを結んだ境界が自分の側にある分だけ向こうの色を混ぜる
+// - L, Z の形: 両端の高さを直線で結ぶ
+// - U の形(両端が同じ側): 両端から線の中央へ向かって 0 になる2本の直線にする
+// 元の SMAA の面積テーブルと対角線の検出の代わりに、画素の中心での高さをそのまま面積にする
+
+uniform sampler2D Scene;
+uniform sampler2D Edges;
+
+layout(location = 0) out vec4 FragColor;
+
+const int MaxSearch = 8;
+
+vec2 edgesAt(ivec2 texel)
+{
+    ivec2 size = textureSize(Edges, 0);
+    if (any(lessThan(texel, ivec2(0))) || any(greaterThanEqual(texel, size)))
+        return vec2(0.0);
+    return texelFetch(Edges, texel, 0).rg;
+}
+
+// 線の端 texel で交わる輪郭の高さ
+// across: 線の texel 側から向こう側への向き, component: 交わる輪郭の成分, ownSide: 自分が線の texel 側にいるか
+float crossing(ivec2 texel, ivec2 across, int component, bool ownSide)
+{
+    bool texelSide = edgesAt(texel)[component] > 0.5;
+    bool acrossSide = edgesAt(texel + across)[component] > 0.5;
+    if (texelSide == acrossSide)
+        return 0.0;
+    return texelSide == ownSide ? 0.5 : -0.5;
+}
+
+// texel が持つ輪郭の線(horizontal なら下との輪郭 g, そうでなければ左との輪郭 r)に対する重み
+float blendWeight(ivec2 texel, bool horizontal, bool ownSide)
+{
+    ivec2 along = horizontal ? ivec2(1, 0) : ivec2(0, 1);
+    ivec2 across = horizontal ? ivec2(0, -1) : ivec2(-1, 0);
+    int lineComponent = horizontal ? 1 : 0;
+    int crossComponent = 1 - lineComponent;
+
+    int back = 0;
+    while (back < MaxSearch && edgesAt(texel - along * (back + 1))[lineComponent] > 0.5)
+        back++;
+    int forward = 0;
+    while (forward < MaxSearch && edgesAt(texel + along * (forward + 1))[lineComponent] > 0.5)
+        forward++;
+
+    // 始まりの texel は自分の手前の境界、終わりの次の texel は終わりの先の境界の輪郭を持つ
+    float first = crossing(texel - along * back, across, crossComponent, ownSide);
+    float last = crossing(texel + along * (forward + 1), across, crossComponent, ownSide);
+
+    // 線の上での画素の中心の位置(0..1)
+    float position = (float(back) + 0.5) / float(back + forward + 1);
+    float height;
+    if (first * last > 0.0)
+        height = position < 0.5 ? first * (1.0 - 2.0 * position) : last * (2.0 * position - 1.0);
+    else
+        height = mix(first, last, position);
+    return max(height, 0.0);
+}
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 color = texelFetch(Scene, texel, 0);
+
+    vec2 edges = edgesAt(texel);
+    float right = edgesAt(texel + ivec2(1, 0)).r;
+    float top = edgesAt(texel + ivec2(0, 1)).g;
+    if (edges.r + edges.g + right + top == 0.0)
+    {
+        FragColor = color;
+        return;
+    }
+
+    // 下と左の輪郭は自分が持ち、上と右の輪郭は隣が持つ(自分は線の向こう側)
+    float weightBottom = edges.g > 0.5 ? blendWeight(texel, true, true) : 0.0;
+    float weightTop = top > 0.5 ? blendWeight(texel + ivec2(0, 1), true, false) : 0.0;
+    float weightLeft = edges.r > 0.5 ? blendWeight(texel, false, true) : 0.0;
+    float weightRight = right > 0.5 ? blendWeight(texel + ivec2(1, 0), false, false) : 0.0;
+
+    // 上下と左右のうち、重みの大きい方だけ混ぜる
+    ivec2 neighbor;
+    float weight;
+    if (max(weightBottom, weightTop) >= max(weightLeft, weightRight))
+    {
+        weight = max(weightBottom, weightTop);
+        neighbor = weightBottom >= weightTop ? texel - ivec2(0, 1) : texel + ivec2(0, 1);
+    }
+    else
+    {
+        weight = max(weightLeft, weightRight);
+        neighbor = weightLeft >= weightRight ? texel - ivec2(1, 0) : texel + ivec2(1, 0);
+    }
+    if (weight <= 0.0)
+    {
+        FragColor = color;
+        return;
+    }
+    FragColor = mix(color, texelFetch(Scene, clamp(neighbor, ivec2(0), textureSize(Scene, 0) - 1), 0), weight);
+}
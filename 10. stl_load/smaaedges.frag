@@ -0,0 +1,25 @@
+#version 400 core
+// SMAA (lite) の1パス目: 輝度の差から左と下の画素との輪郭を検出する(AntiAliasing::resolve)
+// r: 左の画素との間の輪郭, g: 下の画素との間の輪郭。輪郭の無い画素は書き込まない
+
+uniform sampler2D Scene;
+
+layout(location = 0) out vec2 Edges;
+
+const float Threshold = 0.1;
+
+float luma(ivec2 texel)
+{
+    return dot(texelFetch(Scene, max(texel, ivec2(0)), 0).rgb, vec3(0.299, 0.587, 0.114));
+}
+
+void main(void)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float center = luma(texel);
+    vec2 delta = abs(center - vec2(luma(texel - ivec2(1, 0)), luma(texel - ivec2(0, 1))));
+    vec2 edges = step(Threshold, delta);
+    if (edges.x + edges.y == 0.0)
+        discard;
+    Edges = edges;
+}
@@ -0,0 +1,51 @@
+#ifndef SNAPSHOTBUFFER_H
+#define SNAPSHOTBUFFER_H
+
+#include <atomic>
+
+// 書き込み側と読み込み側がお互いを待たずに最新の状態を受け渡すトリプルバッファ
+// 書き込み側(GUI)は publish() を、読み込み側(描画)は update() と front() を使う
+template <typename T>
+class SnapshotBuffer
+{
+public:
+    SnapshotBuffer() : m_back(0), m_middle(1), m_front(2) {}
+
+    // 書き込み側: 状態をコピーして公開する
+    void publish(const T &value)
+    {
+        m_slots[m_back] = value;
+        int old = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel);
+        m_back = old & Index;
+    }
+
+    // 読み込み側: 新しい状態が公開されていれば front() を入れ替える
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & Fresh))
+            return false;
+
+        int old = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = old & Index;
+        return true;
+    }
+
+    const T &front() const
+    {
+        return m_slots[m_front];
+    }
+
+private:
+    enum
+    {
+        Index = 3,
+        Fresh = 4,  // 読み込み側がまだ受け取っていない
+    };
+
+    T m_slots[3];
+    int m_back;                 // 書き込み側だけが使う
+    std::atomic<int> m_middle;
+    int m_front;                // 読み込み側だけが使う
+};
+
+#endif // SNAPSHOTBUFFER_H
@@ -16,20 +16,63 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    antialiasing.cpp \
+    arena.cpp \
+    depthprepass.cpp \
+    dynamicresolution.cpp \
+    frameprofiler.cpp \
     glwidget.cpp \
+    gpuresources.cpp \
     gridline.cpp \
+    instancebatch.cpp \
+    jobsystem.cpp \
+    meshlet.cpp \
     main.cpp \
     mainwindow.cpp \
-    model.cpp
+    model.cpp \
+    modelloader.cpp \
+    occlusionculler.cpp \
+    perfhud.cpp \
+    renderer.cpp \
+    renderthread.cpp \
+    ringbuffer.cpp \
+    scenetable.cpp \
+    uploadqueue.cpp
 
 HEADERS += \
+    antialiasing.h \
+    arena.h \
+    bakedmesh.h \
+    chunkreader.h \
+    commandqueue.h \
+    depthprepass.h \
+    dynamicresolution.h \
     fpsmanager.h \
+    frameprofiler.h \
+    framescheduler.h \
     gldebug.h \
     glwidget.h \
+    gpuresources.h \
     gridline.h \
+    instancebatch.h \
+    jobsystem.h \
+    linetokenizer.h \
+    loadprogress.h \
     mainwindow.h \
+    meshlet.h \
     model.h \
+    modelloader.h \
+    occlusionculler.h \
+    perfhud.h \
+    primitives.h \
+    renderer.h \
+    renderthread.h \
+    ringbuffer.h \
+    scenetable.h \
+    snapshotbuffer.h \
     stlloader.h \
+    uploadqueue.h \
+    vertexformat.h \
     wavefrontobj.h
 
 FORMS += \
@@ -43,4 +86,66 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 RESOURCES += \
     resource.qrc
 
+# Bake the built-in meshes into the pre-indexed binary format at build time.
+# The baker is built under meshbaker/ in the build directory first. The baked
+# files are embedded uncompressed under :/baked so that Model can upload them
+# straight from the resource data (see bakedmesh.h).
+#
+# The baker runs on the build machine, so it has to be a host binary. By
+# default it is built with the same qmake as the viewer, which only works for
+# native builds. When cross-compiling, either pass a prebuilt host baker:
+#     qmake MESHBAKER=/path/to/host/meshbaker
+# or the qmake of a host Qt (with QtCore and QtGui) to build it with:
+#     qmake HOST_QMAKE=/path/to/host/qt/bin/qmake
+BAKED_MESHES = \
+    cube.obj \
+    sphere.obj
+
+isEmpty(MESHBAKER) {
+    isEmpty(HOST_QMAKE) {
+        cross_compile: error("Cross-compiling needs a host meshbaker; set MESHBAKER or HOST_QMAKE (see stl_load.pro).")
+        HOST_QMAKE = $(QMAKE)
+    }
+
+    MESHBAKER = $$OUT_PWD/meshbaker/meshbaker
+    equals(QMAKE_HOST.os, Windows): MESHBAKER = $${MESHBAKER}.exe
+
+    meshbaker.target = $$MESHBAKER
+    meshbaker.commands = $$HOST_QMAKE -o meshbaker/Makefile $$PWD/meshbaker/meshbaker.pro && cd meshbaker && $(MAKE)
+    meshbaker.depends = \
+        $$PWD/bakedmesh.h \
+        $$PWD/meshbaker/main.cpp \
+        $$PWD/meshbaker/meshoptimizer.cpp \
+        $$PWD/meshbaker/meshoptimizer.h \
+        $$PWD/stlloader.h \
+        $$PWD/wavefrontobj.h
+    QMAKE_EXTRA_TARGETS += meshbaker
+}
+
+meshbake.input = BAKED_MESHES
+meshbake.output = $$OUT_PWD/${QMAKE_FILE_IN_BASE}${QMAKE_FILE_EXT}.mesh
+meshbake.commands = $$shell_path($$MESHBAKER) --quiet ${QMAKE_FILE_IN} ${QMAKE_FILE_OUT}
+meshbake.depends = $$MESHBAKER
+meshbake.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += meshbake
+
+# The resource file for the baked meshes is generated because they only exist
+# in the build directory.
+BAKED_QRC = $$OUT_PWD/baked.qrc
+BAKED_FILES =
+baked_qrc = "<RCC>" "    <qresource prefix=\"/baked\">"
+for(mesh, BAKED_MESHES) {
+    BAKED_FILES += $$OUT_PWD/$${mesh}.mesh
+    baked_qrc += "        <file>$${mesh}.mesh</file>"
+}
+baked_qrc += "    </qresource>" "</RCC>"
+write_file($$BAKED_QRC, baked_qrc)|error("Can't write $$BAKED_QRC")
+
+bakedrcc.input = BAKED_QRC
+bakedrcc.output = $$OUT_PWD/qrc_baked.cpp
+bakedrcc.commands = $$shell_path($$[QT_HOST_BINS]/rcc) -no-compress -name baked ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT}
+bakedrcc.depends = $$BAKED_FILES
+bakedrcc.variable_out = SOURCES
+QMAKE_EXTRA_COMPILERS += bakedrcc
+
 # Suppress the output of the qDebug function in the release build.
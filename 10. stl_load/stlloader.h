@@ -7,6 +7,17 @@
 #include <QVector3D>
 #include <QString>
 #include <QDebug>
+#include <QByteArrayMatcher>
+#include <QtEndian>
+#include <cstring>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "jobsystem.h"
+#include "chunkreader.h"
+#include "loadprogress.h"
+#include "arena.h"
+#include "linetokenizer.h"
 
 class StlLoader
 {
@@ -19,15 +30,162 @@ public:
 
     StlLoader(){}
 
+    // ASCII形式かどうか判定する
+    // "solid" で始まり、バイナリとしてのサイズが合わない場合はASCIIとみなす
+    bool isAscii(const QString &fileName)
+    {
+        QFile file(fileName);
+        if( !file.open(QIODevice::ReadOnly) )
+            return false;
+
+        QByteArray header = file.read(84);
+        if (!header.startsWith("solid"))
+            return false;
+        if (header.size() < 84)
+            return true;
+
+        quint32 tri_count = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(header.constData() + 80));
+        return file.size() != 84 + static_cast<qint64>(tri_count) * 50;
+    }
+
+    // 解析した三角形の書き込み先
+    // reserve(count) は三角形数の上限が分かった時に1回呼ばれる(false を返すと中止する)
+    // write(first, triangles, count) は first 番目からの三角形を渡す。ワーカーから並列に呼ばれるが範囲は重ならない
+    struct Sink
+    {
+        std::function<bool(int count)> reserve;
+        std::function<void(int first, const Triangle3D *triangles, int count)> write;
+    };
+
     // .stlのASCIIファイルから三角形をロードする
-    bool parserAscii()
+    // progress を渡すと進捗の通知とキャンセルができる
+    bool parserAscii(const QString &fileName, QString &comment, QVector<Triangle3D> &triangles, LoadProgress *progress = nullptr)
+    {
+        return collect(triangles, [&](const Sink &sink, int &count){
+            return parserAscii(fileName, comment, sink, count, progress);
+        });
+    }
+
+    bool parserAscii(const QString &fileName, QString &comment, ArenaVector<Triangle3D> &triangles, LoadProgress *progress = nullptr)
+    {
+        return collect(triangles, [&](const Sink &sink, int &count){
+            return parserAscii(fileName, comment, sink, count, progress);
+        });
+    }
+
+    // 三角形を sink に書き込み、書き込んだ数を count に返す
+    // 1回目の読み込みで facet を数え、2回目で一定サイズずつ解析する(ファイル全体や三角形の配列は持たない)
+    // ブロックの書き込み位置は scratch に置く(無ければ内部の Arena を使う)
+    bool parserAscii(const QString &fileName, QString &comment, const Sink &sink, int &count, LoadProgress *progress = nullptr,
+                     Arena *scratch = nullptr)
     {
-        // Not implemented
+        count = 0;
+        QFile file(fileName);
+
+        // ファイルの存在確認
+        if(!file.exists())
+        {
+            qWarning() << "File does not exist";
+            return false;
+        }
+
+        // ファイルオープンの成否
+        if( !file.open(QIODevice::ReadOnly | QIODevice::Text) )
+        {
+            qWarning() << "Can't open file";
+            return false;
+        }
+
+        if (progress)
+            progress->setTotal(file.size());
+
+        // facet の数を数える
+        JobSystem &jobs = JobSystem::instance();
+        ChunkReader reader(file, progress);
+        const char *begin = nullptr;
+        const char *end = nullptr;
+        std::atomic<int> facets(0);
+        while (reader.next(begin, end))
+        {
+            QVector<const char*> bounds = ChunkReader::split(begin, end, blockCount(end - begin));
+            jobs.parallelFor(0, bounds.size() - 1, 1, [&](int first, int last){
+                for (int i = first; i < last; i++)
+                    facets += countWord(bounds.at(i), bounds.at(i + 1), "endfacet");
+            });
+            LoadProgress::advance(progress, end - begin);
+        }
+        if (LoadProgress::canceled(progress) || !reader.rewind() || !sink.reserve(facets))
+            return false;
+
+        // facet の途中で切らないように読み、各ブロックを並列に解析する
+        // ブロック毎に Arena を持つのでワーカー間で同期しない(塊毎に使い回す)
+        int maxBlocks = blockCount(INT_MAX);
+        std::unique_ptr<AsciiBlock[]> blocks(new AsciiBlock[maxBlocks]);
+        Arena local(4096);
+        int *offsets = (scratch ? scratch : &local)->allocateArray<int>(maxBlocks);
+        while (reader.next(begin, end, "endfacet"))
+        {
+            QVector<const char*> bounds = ChunkReader::split(begin, end, blockCount(end - begin), "endfacet");
+            int used = bounds.size() - 1;
+            jobs.parallelFor(0, used, 1, [&](int first, int last){
+                for (int i = first; i < last; i++)
+                {
+                    blocks[i].reset();
+                    parseAsciiBlock(bounds.at(i), bounds.at(i + 1), blocks[i], progress);
+                    LoadProgress::advance(progress, bounds.at(i + 1) - bounds.at(i));
+                }
+            });
+            if (LoadProgress::canceled(progress))
+                return false;
+
+            // 数えた数を超えることはないが、壊れたファイルに備えて確認する
+            for (int i = 0; i < used; i++)
+            {
+                offsets[i] = count;
+                count += blocks[i].triangles.size();
+                if (!blocks[i].comment.isEmpty())
+                    comment = blocks[i].comment;
+            }
+            if (count > facets)
+            {
+                qWarning() << "Facet count changed while reading";
+                return false;
+            }
+
+            jobs.parallelFor(0, used, 1, [&](int first, int last){
+                for (int i = first; i < last; i++)
+                {
+                    if (!blocks[i].triangles.isEmpty())
+                        sink.write(offsets[i], blocks[i].triangles.constData(), blocks[i].triangles.size());
+                }
+            });
+        }
+
+        file.close();
+        return !LoadProgress::canceled(progress);
     }
 
     // .stlのバイナリファイルから三角形をロードする
-    bool parserBinary(const QString &fileName, QString &comment, QVector<Triangle3D> &triangles)
+    bool parserBinary(const QString &fileName, QString &comment, QVector<Triangle3D> &triangles, LoadProgress *progress = nullptr)
+    {
+        return collect(triangles, [&](const Sink &sink, int &count){
+            return parserBinary(fileName, comment, sink, count, progress);
+        });
+    }
+
+    bool parserBinary(const QString &fileName, QString &comment, ArenaVector<Triangle3D> &triangles, LoadProgress *progress = nullptr)
     {
+        return collect(triangles, [&](const Sink &sink, int &count){
+            return parserBinary(fileName, comment, sink, count, progress);
+        });
+    }
+
+    // 三角形を sink に書き込み、書き込んだ数を count に返す
+    // 読み込んだ塊は scratch に置く(無ければ内部の Arena を使う)
+    bool parserBinary(const QString &fileName, QString &comment, const Sink &sink, int &count, LoadProgress *progress = nullptr,
+                      Arena *scratch = nullptr)
+    {
+        count = 0;
         QFile file(fileName);
 
         // ファイルの存在確認
@@ -63,41 +221,184 @@ public:
         // byte 0 ～ 79      : コメントの記述
         // byte 80 ～ 83     : 三角形の総数（N）
         // byte 84 + n × 50  : ファイルサイズ
-        if (file.size() != 84 + tri_count * 50)
+        qint64 expected = 84 + static_cast<qint64>(tri_count) * 50;
+        if (file.size() < expected)
         {
-          qWarning() << "File is NULL";
+            qWarning() << "File is too small for the triangle count";
+            return false;
         }
+        if (file.size() != expected)
+            qWarning() << "File size does not match the triangle count";
 
-        for (int i = 0; i < static_cast<int>(tri_count); i++) {
-            Triangle3D triangle;
+        if (progress)
+            progress->setTotal(expected);
 
-            // 法線位置を取得
-            float nx, ny, nz;
-            data >> nx >> ny >> nz;
-            triangle.normal = QVector3D(nx, ny, nz);
+        if (!sink.reserve(static_cast<int>(tri_count)))
+            return false;
 
-            // 頂点位置を取得
-            float x, y, z;
-            data >> x >> y >> z;
-            triangle.position1 = QVector3D(x, y, z);
+        // 一定数ずつ読み込み、ワーカーで分割して変換しながら sink に渡す
+        const int blockTriangles = 1 << 16;
+        Arena local(blockTriangles * 50);
+        char *block = (scratch ? scratch : &local)->allocateArray<char>(qMin<qint64>(blockTriangles, tri_count) * 50);
+        for (int first = 0; first < static_cast<int>(tri_count); first += blockTriangles)
+        {
+            if (LoadProgress::canceled(progress))
+                return false;
 
-            data >> x >> y >> z;
-            triangle.position2= QVector3D(x, y, z);
+            int blockSize = qMin(blockTriangles, static_cast<int>(tri_count) - first);
+            int blockBytes = blockSize * 50;
+            if (data.readRawData(block, blockBytes) != blockBytes)
+            {
+                qWarning() << "Unexpected end of file";
+                return false;
+            }
 
-            data >> x >> y >> z;
-            triangle.position3 = QVector3D(x, y, z);
+            const uchar *src = reinterpret_cast<const uchar*>(block);
+            JobSystem::instance().parallelFor(0, blockSize, 8192, [&sink, src, first](int begin, int end){
+                // 変換した三角形はスタック上に少しずつ溜めて渡す
+                Triangle3D batch[256];
+                for (int i = begin; i < end; i += 256)
+                {
+                    int n = qMin(256, end - i);
+                    for (int k = 0; k < n; k++)
+                    {
+                        // 法線・頂点位置を取得(末尾2byteは未使用)
+                        const uchar *p = src + (i + k) * 50;
+                        batch[k].normal = readVector(p);
+                        batch[k].position1 = readVector(p + 12);
+                        batch[k].position2 = readVector(p + 24);
+                        batch[k].position3 = readVector(p + 36);
+                    }
+                    sink.write(first + i, batch, n);
+                }
+            });
+            count += blockSize;
+            LoadProgress::advance(progress, blockBytes * 2);
+        }
 
-            // 未使用データをスキップ
-            quint16 unused;
-            data >> unused;
+        file.close();
+        return true;
+    }
+
+private:
+    struct AsciiBlock
+    {
+        AsciiBlock() : arena(1 << 18), triangles(&arena) {}
 
-            triangles.append(triangle);
+        // 次の塊の解析に使い回す
+        void reset()
+        {
+            arena.reset();
+            triangles = ArenaVector<Triangle3D>(&arena);
+            comment.clear();
         }
 
-        file.close();
+        Arena arena;
+        ArenaVector<Triangle3D> triangles;
+        QString comment;
+    };
+
+    // 配列に書き込む sink で解析する(ベンチマークや三角形の配列が欲しい場合用)
+    template <typename Array>
+    static bool collect(Array &triangles, const std::function<bool(const Sink &sink, int &count)> &parse)
+    {
+        triangles.clear();
+        Triangle3D *output = nullptr;
+        Sink sink;
+        sink.reserve = [&](int count){
+            triangles.resize(count);
+            output = triangles.data();
+            return true;
+        };
+        sink.write = [&output](int first, const Triangle3D *input, int count){
+            std::memcpy(output + first, input, static_cast<size_t>(count) * sizeof(Triangle3D));
+        };
+
+        int count = 0;
+        if (!parse(sink, count))
+        {
+            triangles.clear();
+            return false;
+        }
+        triangles.resize(count);
+        return true;
     }
 
+    // 大きな塊はワーカー数より多めに分けて偏りを減らす
+    static int blockCount(qint64 size)
+    {
+        return size < (1 << 20) ? 1 : qMax(JobSystem::instance().threadCount(), 1) * 4;
+    }
 
+    static int countWord(const char *begin, const char *end, const char *word)
+    {
+        QByteArray text = QByteArray::fromRawData(begin, static_cast<int>(end - begin));
+        QByteArrayMatcher matcher(word);
+        int count = 0;
+        for (int pos = matcher.indexIn(text); pos >= 0; pos = matcher.indexIn(text, pos + 1))
+            count++;
+        return count;
+    }
+
+    static QVector3D readVector(const uchar *p)
+    {
+        float v[3];
+        for (int k = 0; k < 3; k++)
+        {
+            quint32 bits = qFromLittleEndian<quint32>(p + k * 4);
+            std::memcpy(&v[k], &bits, sizeof(float));
+        }
+        return QVector3D(v[0], v[1], v[2]);
+    }
+
+    static void parseAsciiBlock(const char *begin, const char *end, AsciiBlock &block, LoadProgress *progress)
+    {
+        LineTokenizer tokens;
+        Triangle3D triangle;
+        int vertexCount = 0;
+        int lineCount = 0;
+        while (begin < end)
+        {
+            if (++lineCount % 4096 == 0 && LoadProgress::canceled(progress))
+                return;
+
+            const char *newline = static_cast<const char*>(memchr(begin, '\n', static_cast<size_t>(end - begin)));
+            const char *lineEnd = newline ? newline : end;
+            const char *lineBegin = begin;
+            begin = lineEnd + 1;
+
+            int count = tokens.split(lineBegin, lineEnd);
+            if (count == 0)
+                continue;
+
+            // solid <name>
+            if (tokens.is(0, "solid"))
+            {
+                QByteArray line = QByteArray::fromRawData(lineBegin, static_cast<int>(lineEnd - lineBegin)).simplified();
+                block.comment = QString::fromUtf8(line.mid(5)).trimmed();
+            }
+            // facet normal nx ny nz
+            else if (tokens.is(0, "facet") && count >= 5)
+            {
+                triangle.normal = QVector3D(tokens.toFloat(2), tokens.toFloat(3), tokens.toFloat(4));
+                vertexCount = 0;
+            }
+            // vertex x y z
+            else if (tokens.is(0, "vertex") && count >= 4)
+            {
+                QVector3D position(tokens.toFloat(1), tokens.toFloat(2), tokens.toFloat(3));
+                if (vertexCount == 0) triangle.position1 = position;
+                else if (vertexCount == 1) triangle.position2 = position;
+                else if (vertexCount == 2) triangle.position3 = position;
+                vertexCount++;
+            }
+            else if (tokens.is(0, "endfacet"))
+            {
+                if (vertexCount == 3)
+                    block.triangles.append(triangle);
+            }
+        }
+    }
 };
 
 #endif // STLLOADER_H
@@ -0,0 +1,202 @@
+#include <QtTest>
+#include "occlusionculler.h"
+#include "depthprepass.h"
+#include "dynamicresolution.h"
+
+// GL を使わずに、カリングや描画の制御の判定を確かめる
+class UnitTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void occlusionTest_data();
+    void occlusionTest();
+    void occlusionOddEdges();
+    void prepassThresholds();
+    void dynamicResolution_data();
+    void dynamicResolution();
+};
+
+namespace {
+
+// 視点から distance 奥の、画面上で (x, y)(-1～1)に見えるワールド座標
+QVector3D worldAt(const QMatrix4x4 &projection, const QMatrix4x4 &view, float x, float y, float distance)
+{
+    QVector3D eye(x * distance / projection(0, 0), y * distance / projection(1, 1), -distance);
+    return view.inverted().map(eye);
+}
+
+// 視点から distance 奥の深度(0～1)
+float depthAt(const QMatrix4x4 &projection, float distance)
+{
+    QVector4D clip = projection * QVector4D(0.0f, 0.0f, -distance, 1.0f);
+    return clip.z() / clip.w() * 0.5f + 0.5f;
+}
+
+}
+
+void UnitTest::occlusionTest_data()
+{
+    // 読み戻した時の視点は (0, 0, 10) で、原点の位置に画面全体を覆う壁がある
+    QTest::addColumn<QVector3D>("center");
+    QTest::addColumn<float>("radius");
+    QTest::addColumn<QVector3D>("eye");         // 今の視点(-Z を向く)
+    QTest::addColumn<bool>("occluded");
+    QTest::newRow("behind the wall") << QVector3D(0.0f, 0.0f, -5.0f) << 1.0f << QVector3D(0.0f, 0.0f, 10.0f) << true;
+    QTest::newRow("partly in front") << QVector3D(0.0f, 0.0f, 0.5f) << 1.0f << QVector3D(0.0f, 0.0f, 10.0f) << false;
+    QTest::newRow("in front") << QVector3D(0.0f, 0.0f, 5.0f) << 1.0f << QVector3D(0.0f, 0.0f, 10.0f) << false;
+    QTest::newRow("contains the current eye") << QVector3D(0.0f, 0.0f, -5.0f) << 1.0f << QVector3D(0.0f, 0.0f, -5.5f) << false;
+    QTest::newRow("crosses the current near plane") << QVector3D(0.0f, 0.0f, -5.0f) << 1.0f << QVector3D(0.0f, 0.0f, -3.95f) << false;
+}
+
+void UnitTest::occlusionTest()
+{
+    QFETCH(QVector3D, center);
+    QFETCH(float, radius);
+    QFETCH(QVector3D, eye);
+    QFETCH(bool, occluded);
+
+    QSize screen(256, 256);
+    QMatrix4x4 projection;
+    projection.perspective(60.0f, 1.0f, 0.1f, 100.0f);
+    QMatrix4x4 view;
+    view.lookAt(QVector3D(0.0f, 0.0f, 10.0f), QVector3D(), QVector3D(0.0f, 1.0f, 0.0f));
+    QMatrix4x4 current;
+    current.lookAt(eye, eye - QVector3D(0.0f, 0.0f, 1.0f), QVector3D(0.0f, 1.0f, 0.0f));
+
+    QSize size = OcclusionCuller::levelSize(screen, 0);
+    QVector<float> depth(size.width() * size.height(), depthAt(projection, 10.0f));
+    OcclusionCuller culler;
+    culler.setDepth(depth.constData(), screen, 0, projection, view);
+    culler.setCamera(projection, current);
+    QCOMPARE(culler.isOccluded(center, radius), occluded);
+}
+
+void UnitTest::occlusionOddEdges()
+{
+    // 奇数の大きさでは、端の行と列の余りのピクセルも最後の texel で判定する
+    QSize screen(257, 255);
+    QMatrix4x4 projection;
+    projection.perspective(60.0f, 257.0f / 255.0f, 0.1f, 100.0f);
+    QMatrix4x4 view;
+    view.lookAt(QVector3D(0.0f, 0.0f, 10.0f), QVector3D(), QVector3D(0.0f, 1.0f, 0.0f));
+
+    // 最後の列と行だけ何も無い(最も奥)
+    QSize size = OcclusionCuller::levelSize(screen, 0);
+    QCOMPARE(size, QSize(128, 127));
+    QVector<float> depth(size.width() * size.height(), depthAt(projection, 10.0f));
+    for (int y = 0; y < size.height(); y++)
+        depth[y * size.width() + size.width() - 1] = 1.0f;
+    for (int x = 0; x < size.width(); x++)
+        depth[(size.height() - 1) * size.width() + x] = 1.0f;
+
+    OcclusionCuller culler;
+    culler.setDepth(depth.constData(), screen, 0, projection, view);
+    culler.setCamera(projection, view);
+
+    // 壁の奥の小さな球。右端と上端の余りのピクセルに見えるものは隠れていない
+    const float radius = 0.001f;
+    QVERIFY(culler.isOccluded(worldAt(projection, view, 0.9f, 0.0f, 15.0f), radius));
+    QVERIFY(!culler.isOccluded(worldAt(projection, view, 0.997f, 0.0f, 15.0f), radius));
+    QVERIFY(!culler.isOccluded(worldAt(projection, view, 0.0f, 0.997f, 15.0f), radius));
+    QVERIFY(!culler.isOccluded(worldAt(projection, view, 0.997f, 0.997f, 15.0f), radius));
+}
+
+void UnitTest::prepassThresholds()
+{
+    // 測った重なりで Auto のプリパスが 2.0 を超えたら使い始め、1.5 を下回ったら止める
+    DepthPrepass prepass;
+    QVERIFY(prepass.mode() == DepthPrepass::Mode::Auto);
+
+    // 最初のフレームは測るために使う
+    prepass.decide(false);
+    QVERIFY(prepass.isActive());
+
+    QVERIFY(prepass.record(180, 100));
+    prepass.decide(true);
+    QVERIFY(!prepass.isActive());
+
+    QVERIFY(prepass.record(210, 100));
+    prepass.decide(true);
+    QVERIFY(prepass.isActive());
+    QCOMPARE(prepass.overdraw(), 2.1);
+
+    // 間では切り替えない
+    QVERIFY(prepass.record(160, 100));
+    prepass.decide(true);
+    QVERIFY(prepass.isActive());
+    prepass.decide(false);
+    QVERIFY(prepass.isActive());
+
+    QVERIFY(prepass.record(140, 100));
+    prepass.decide(true);
+    QVERIFY(!prepass.isActive());
+
+    // 何も見えなかった測定は使わない
+    QVERIFY(!prepass.record(500, 0));
+    QCOMPARE(prepass.overdraw(), 1.4);
+
+    // 止めている間も ProbeInterval フレーム毎に1フレームだけ使って測り直す
+    int probes = 0;
+    for (int i = 0; i < DepthPrepass::ProbeInterval * 2; i++)
+    {
+        prepass.decide(false);
+        probes += prepass.isActive() ? 1 : 0;
+    }
+    QCOMPARE(probes, 2);
+
+    // On と Off は測った値に依らない
+    prepass.setMode(DepthPrepass::Mode::On);
+    prepass.decide(false);
+    QVERIFY(prepass.isActive());
+    prepass.setMode(DepthPrepass::Mode::Off);
+    QVERIFY(prepass.record(500, 100));
+    prepass.decide(true);
+    QVERIFY(!prepass.isActive());
+}
+
+void UnitTest::dynamicResolution_data()
+{
+    // GPUの時間(ms) = fixed + perPixel * 倍率^2。目標は 60 fps
+    QTest::addColumn<double>("fixed");
+    QTest::addColumn<double>("perPixel");
+    QTest::addColumn<double>("expected");
+    QTest::newRow("proportional") << 2.0 << 20.0 << 0.8125;
+    QTest::newRow("light") << 1.0 << 4.0 << 1.0;
+    QTest::newRow("heavy") << 1.0 << 80.0 << 0.5;
+    QTest::newRow("fixed cost") << 8.0 << 12.0 << 0.75;
+}
+
+void UnitTest::dynamicResolution()
+{
+    QFETCH(double, fixed);
+    QFETCH(double, perPixel);
+    QFETCH(double, expected);
+
+    // 毎フレーム、今の倍率で描画した時間を測れたとして制御する
+    DynamicResolution resolution;
+    auto run = [&](double fixedTime, double pixelTime, int frames){
+        int changes = 0;
+        for (int i = 0; i < frames; i++)
+        {
+            double scale = resolution.scale();
+            resolution.update(true, fixedTime + pixelTime * scale * scale);
+            changes += resolution.scale() != scale ? 1 : 0;
+        }
+        return changes;
+    };
+
+    // 行ったり来たりせずに近づいて、その後は変えない
+    int changes = run(fixed, perPixel, 600);
+    QVERIFY(changes <= 8);
+    QCOMPARE(resolution.scale(), expected);
+    QCOMPARE(run(fixed, perPixel, 300), 0);
+
+    // 軽くなれば元の解像度に戻る
+    run(1.0, 1.0, 300);
+    QCOMPARE(resolution.scale(), 1.0);
+}
+
+QTEST_MAIN(UnitTest)
+
+#include "tst_unittest.moc"
@@ -0,0 +1,51 @@
+QT       += core gui testlib
+
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+TARGET = unittest
+
+# The following define makes your compiler emit warnings if you use
+# any Qt feature that has been marked deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# Test the CPU-side logic from the viewer sources. No GL context is needed.
+INCLUDEPATH += ..
+
+SOURCES += \
+    ../arena.cpp \
+    ../depthprepass.cpp \
+    ../dynamicresolution.cpp \
+    ../frameprofiler.cpp \
+    ../gpuresources.cpp \
+    ../jobsystem.cpp \
+    ../meshlet.cpp \
+    ../model.cpp \
+    ../occlusionculler.cpp \
+    ../ringbuffer.cpp \
+    ../scenetable.cpp \
+    ../uploadqueue.cpp \
+    tst_unittest.cpp
+
+HEADERS += \
+    ../arena.h \
+    ../bakedmesh.h \
+    ../chunkreader.h \
+    ../depthprepass.h \
+    ../dynamicresolution.h \
+    ../frameprofiler.h \
+    ../gpuresources.h \
+    ../jobsystem.h \
+    ../linetokenizer.h \
+    ../loadprogress.h \
+    ../meshlet.h \
+    ../model.h \
+    ../occlusionculler.h \
+    ../ringbuffer.h \
+    ../scenetable.h \
+    ../stlloader.h \
+    ../uploadqueue.h \
+    ../vertexformat.h \
+    ../wavefrontobj.h
@@ -0,0 +1,167 @@
+#include "uploadqueue.h"
+#include <QOpenGLContext>
+#include <cstring>
+
+namespace {
+
+// 分けて転送する時の最小の大きさ(これより小さく分けると呼び出しの手間の方が大きい)
+const qint64 MinChunkSize = 4096;
+
+}
+
+UploadQueue::UploadQueue()
+{
+    m_staging = nullptr;
+    setBudget(4 << 20, 2.0);
+    m_chunkSize = 1 << 20;
+    m_nanosecondsPerByte = 0.0;
+}
+
+UploadQueue::~UploadQueue()
+{
+    destroy();
+}
+
+bool UploadQueue::create()
+{
+    destroy();
+
+    if (!QOpenGLContext::currentContext())
+        return false;
+    initializeOpenGLFunctions();
+
+    // GL_COPY_READ_BUFFER にはコピー元を置くだけなので、ほかのバインドとぶつからない
+    m_staging = new RingBuffer(GL_COPY_READ_BUFFER, m_bytesPerFrame);
+    if (!m_staging->create())
+    {
+        delete m_staging;
+        m_staging = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void UploadQueue::destroy()
+{
+    delete m_staging;
+    m_staging = nullptr;
+}
+
+void UploadQueue::setBudget(qint64 bytesPerFrame, double milliseconds)
+{
+    m_bytesPerFrame = qMax<qint64>(bytesPerFrame, MinChunkSize);
+    m_nanosecondsPerFrame = static_cast<qint64>(milliseconds * 1e6);
+
+    // ステージングの大きさが変わるので作り直す(使い終わっていない領域はドライバが破棄を遅らせる)
+    if (m_staging)
+        create();
+}
+
+void UploadQueue::setChunkSize(int bytes)
+{
+    m_chunkSize = static_cast<int>(qMax<qint64>(bytes, MinChunkSize));
+}
+
+void UploadQueue::enqueue(const void *owner, const QOpenGLBuffer &buffer, const void *data, int size, std::function<void()> done)
+{
+    m_uploads.append(Upload{ owner, buffer, static_cast<const char*>(data), size, 0, std::move(done) });
+}
+
+void UploadQueue::cancel(const void *owner)
+{
+    for (int i = m_uploads.size() - 1; i >= 0; i--)
+    {
+        if (m_uploads.at(i).owner == owner)
+            m_uploads.removeAt(i);
+    }
+}
+
+qint64 UploadQueue::process()
+{
+    if (!m_staging || m_uploads.isEmpty())
+        return 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Frames 回前の process() でコピーした領域が使い終わるまで待つ
+    m_staging->beginFrame();
+
+    qint64 uploaded = 0;
+    while (!m_uploads.isEmpty() && uploaded < m_bytesPerFrame)
+    {
+        Upload &upload = m_uploads.first();
+        int count = static_cast<int>(qMin<qint64>(qMin(m_chunkSize, upload.size - upload.offset), m_bytesPerFrame - uploaded));
+
+        // 時間の予算に残っている分だけ転送する。最初の転送も大きければ分ける
+        // 毎フレーム少しは進むように、最初の転送は MinChunkSize まで許す
+        // 転送速度がまだ分からなければ、MinChunkSize だけ転送して測る
+        if (m_nanosecondsPerByte <= 0.0)
+        {
+            count = static_cast<int>(qMin<qint64>(count, MinChunkSize));
+        }
+        else
+        {
+            qint64 remaining = qMax<qint64>(m_nanosecondsPerFrame - timer.nsecsElapsed(), 0);
+            qint64 affordable = static_cast<qint64>(remaining / m_nanosecondsPerByte);
+            if (uploaded == 0)
+                affordable = qMax(affordable, MinChunkSize);
+            if (affordable < qMin<qint64>(count, MinChunkSize))
+                break;
+            count = static_cast<int>(qMin<qint64>(count, affordable));
+        }
+
+        // 1フレーム分のステージングを使い切ったら次のフレームに回す
+        RingBuffer::Allocation staging = m_staging->allocate(count, 4);
+        if (!staging.isValid())
+            break;
+
+        qint64 start = timer.nsecsElapsed();
+        std::memcpy(staging.data, upload.data + upload.offset, static_cast<size_t>(count));
+        m_staging->flush(staging);
+        glBindBuffer(GL_COPY_READ_BUFFER, m_staging->bufferId());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, upload.buffer.bufferId());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staging.offset, upload.offset, count);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        qint64 spent = timer.nsecsElapsed() - start;
+
+        // 転送速度を移動平均で推定する
+        double rate = static_cast<double>(spent) / qMax(count, 1);
+        m_nanosecondsPerByte = m_nanosecondsPerByte > 0.0 ? m_nanosecondsPerByte * 0.8 + rate * 0.2 : rate;
+
+        upload.offset += count;
+        uploaded += count;
+
+        if (upload.offset >= upload.size)
+        {
+            auto done = std::move(upload.done);
+            m_uploads.removeFirst();
+            if (done)
+                done();
+        }
+    }
+
+    // コピーの後ろにフェンスを置き、Frames 回後の process() まで領域を書き換えない
+    m_staging->endFrame();
+
+    return uploaded;
+}
+
+bool UploadQueue::isEmpty() const
+{
+    return m_uploads.isEmpty();
+}
+
+qint64 UploadQueue::stagingBytes() const
+{
+    return m_staging ? m_staging->size() : 0;
+}
+
+qint64 UploadQueue::pendingBytes() const
+{
+    qint64 bytes = 0;
+    for (const Upload &upload : m_uploads)
+        bytes += upload.size - upload.offset;
+    return bytes;
+}
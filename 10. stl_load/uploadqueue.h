@@ -0,0 +1,66 @@
+#ifndef UPLOADQUEUE_H
+#define UPLOADQUEUE_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLBuffer>
+#include <QElapsedTimer>
+#include <QList>
+#include <functional>
+#include "ringbuffer.h"
+
+// 大きなバッファの転送を小さく分けて、1フレームあたりの量と時間を制限して行う
+// データは永続マップしたステージング用のリングバッファ(1フレーム分 = 予算のバイト数)に書き、
+// glCopyBufferSubData で転送先にコピーする。リングの領域はフェンスで守られているので転送先との同期は起きない
+// GLスレッドから毎フレーム process() を呼ぶ
+// 時間はステージングへの書き込みとコピーの発行にかかったCPUの時間で測る(GPUでのコピーは含まない)
+class UploadQueue : protected QOpenGLExtraFunctions
+{
+public:
+    UploadQueue();
+    ~UploadQueue();
+
+    // OpenGLコンテキストがカレントの状態で呼ぶ
+    bool create();
+    void destroy();
+
+    // 1フレームで転送する最大バイト数(ステージングの1フレーム分の大きさ)と最大時間(ms)
+    void setBudget(qint64 bytesPerFrame, double milliseconds);
+    void setChunkSize(int bytes);
+
+    // data は転送が終わるか cancel() されるまで owner が保持する
+    // buffer は size 以上の領域を確保しておく(中身はここで転送する)
+    // 全て転送し終わると done が呼ばれる
+    void enqueue(const void *owner, const QOpenGLBuffer &buffer, const void *data, int size,
+                 std::function<void()> done = std::function<void()>());
+    void cancel(const void *owner);
+
+    // 予算内で転送し、転送したバイト数を返す
+    qint64 process();
+
+    bool isEmpty() const;
+    qint64 pendingBytes() const;
+    // ステージング用のリングバッファの大きさ(全フレーム分)
+    qint64 stagingBytes() const;
+
+private:
+    struct Upload
+    {
+        const void *owner;
+        QOpenGLBuffer buffer;
+        const char *data;
+        int size;
+        int offset;
+        std::function<void()> done;
+    };
+
+    QList<Upload> m_uploads;
+    qint64 m_bytesPerFrame;
+    qint64 m_nanosecondsPerFrame;
+    int m_chunkSize;
+    RingBuffer *m_staging;
+
+    // 転送速度の推定値(ns/byte)。まだ測っていなければ 0
+    double m_nanosecondsPerByte;
+};
+
+#endif // UPLOADQUEUE_H
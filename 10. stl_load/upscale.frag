@@ -0,0 +1,31 @@
+#version 400 core
+// 縮小して描画したシーンをウィンドウの大きさに拡大する(DynamicResolution::upscale)
+// Sharpness が 0 ならバイリニア。0 より大きければ周りの4点との差で輪郭を強める
+// 強めた色は周りの色の範囲に収めて、輪郭の周りに縞が出ないようにする
+
+uniform sampler2D Scene;
+uniform vec2 TexelSize;     // 縮小したシーンの1 texel
+uniform float Sharpness;
+
+in vec2 TexCoord;
+layout(location = 0) out vec4 FragColor;
+
+void main(void)
+{
+    vec4 center = texture(Scene, TexCoord);
+    if (Sharpness <= 0.0)
+    {
+        FragColor = center;
+        return;
+    }
+
+    vec3 left = texture(Scene, TexCoord - vec2(TexelSize.x, 0.0)).rgb;
+    vec3 right = texture(Scene, TexCoord + vec2(TexelSize.x, 0.0)).rgb;
+    vec3 bottom = texture(Scene, TexCoord - vec2(0.0, TexelSize.y)).rgb;
+    vec3 top = texture(Scene, TexCoord + vec2(0.0, TexelSize.y)).rgb;
+
+    vec3 minimum = min(center.rgb, min(min(left, right), min(bottom, top)));
+    vec3 maximum = max(center.rgb, max(max(left, right), max(bottom, top)));
+    vec3 sharpened = center.rgb + Sharpness * (center.rgb - 0.25 * (left + right + bottom + top));
+    FragColor = vec4(clamp(sharpened, minimum, maximum), center.a);
+}
@@ -0,0 +1,315 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <QOpenGLFunctions>
+#include <QVector2D>
+#include <QVector3D>
+#include <QVector4D>
+#include <QByteArray>
+#include <QFile>
+#include <QDebug>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+
+// 頂点の並びを型で記述する
+// オフセットとストライドはコンパイル時に決まり、属性の設定・量子化した値の読み書き・GLSL の宣言は同じ記述から作る
+//
+//   typedef VertexFormat::Format<
+//       VertexFormat::Attribute<VertexFormat::Position, VertexFormat::Float<3>>,
+//       VertexFormat::Attribute<VertexFormat::Normal, VertexFormat::Snorm16<3>>> Compact;
+//
+//   Compact::pack<VertexFormat::Normal>(vertex, normal);
+//   Compact::setAttributes(gl);
+//
+// シェーダーには "#pragma vertex_attributes" の行を置いておくと、そこに宣言が入る
+// 属性の番号(layout(location))は並べた順になる
+namespace VertexFormat {
+
+// 属性の意味(GLSL の変数名)
+struct Position { static constexpr const char *name() { return "VertexPosition"; } };
+struct Normal   { static constexpr const char *name() { return "VertexNormal"; } };
+struct TexCoord { static constexpr const char *name() { return "VertexTexCoord"; } };
+struct Color    { static constexpr const char *name() { return "VertexColor"; } };
+
+// 成分の格納方法
+// Normalized の場合は整数を -1～1 (符号なしは 0～1) に割り当てる
+template <typename T, GLenum GLType, bool IsNormalized, int N>
+struct Storage
+{
+    static_assert(N >= 1 && N <= 4, "Attribute needs 1 to 4 components");
+    static_assert(IsNormalized || std::is_floating_point<T>::value, "Integer components must be normalized");
+
+    typedef T Component;
+    static const GLenum Type = GLType;
+    static const bool Normalized = IsNormalized;
+    static const int Count = N;
+    // 属性の先頭は4バイト境界に揃える
+    static const int Size = (static_cast<int>(sizeof(T)) * N + 3) / 4 * 4;
+
+    static void pack(const float *values, void *out)
+    {
+        T components[N];
+        for (int i = 0; i < N; i++)
+            components[i] = quantize(values[i], std::integral_constant<bool, IsNormalized>());
+        std::memcpy(out, components, sizeof(components));
+    }
+
+    static void unpack(const void *in, float *values)
+    {
+        T components[N];
+        std::memcpy(components, in, sizeof(components));
+        for (int i = 0; i < N; i++)
+            values[i] = dequantize(components[i], std::integral_constant<bool, IsNormalized>());
+    }
+
+private:
+    static T quantize(float value, std::false_type) { return value; }
+    static float dequantize(T value, std::false_type) { return value; }
+
+    static T quantize(float value, std::true_type)
+    {
+        const float low = std::is_signed<T>::value ? -1.0f : 0.0f;
+        const float scale = static_cast<float>(std::numeric_limits<T>::max());
+        float clamped = value < low ? low : (value > 1.0f ? 1.0f : value);
+        return static_cast<T>(std::lround(clamped * scale));
+    }
+
+    static float dequantize(T value, std::true_type)
+    {
+        // GL と同じく符号付きの最小値は -1 にする
+        float result = static_cast<float>(value) / static_cast<float>(std::numeric_limits<T>::max());
+        return result < -1.0f ? -1.0f : result;
+    }
+};
+
+template <int N> using Float = Storage<float, GL_FLOAT, false, N>;
+template <int N> using Snorm16 = Storage<qint16, GL_SHORT, true, N>;
+template <int N> using Unorm16 = Storage<quint16, GL_UNSIGNED_SHORT, true, N>;
+template <int N> using Snorm8 = Storage<qint8, GL_BYTE, true, N>;
+template <int N> using Unorm8 = Storage<quint8, GL_UNSIGNED_BYTE, true, N>;
+
+template <typename SemanticT, typename StorageT>
+struct Attribute
+{
+    typedef SemanticT Semantic;
+    typedef StorageT Storage;
+};
+
+// QVector2D/3D/4D と float の配列の変換
+inline void toFloats(float value, float *out) { out[0] = value; }
+inline void toFloats(const QVector2D &value, float *out) { out[0] = value.x(); out[1] = value.y(); }
+inline void toFloats(const QVector3D &value, float *out) { out[0] = value.x(); out[1] = value.y(); out[2] = value.z(); }
+inline void toFloats(const QVector4D &value, float *out) { out[0] = value.x(); out[1] = value.y(); out[2] = value.z(); out[3] = value.w(); }
+
+template <typename Value> Value fromFloats(const float *in);
+template <> inline float fromFloats<float>(const float *in) { return in[0]; }
+template <> inline QVector2D fromFloats<QVector2D>(const float *in) { return QVector2D(in[0], in[1]); }
+template <> inline QVector3D fromFloats<QVector3D>(const float *in) { return QVector3D(in[0], in[1], in[2]); }
+template <> inline QVector4D fromFloats<QVector4D>(const float *in) { return QVector4D(in[0], in[1], in[2], in[3]); }
+
+// シェーダーの "#pragma vertex_attributes" の行を宣言に置き換える
+inline QByteArray insertDeclarations(QByteArray source, const QByteArray &declarations)
+{
+    static const QByteArray marker("#pragma vertex_attributes");
+    int index = source.indexOf(marker);
+    if (index < 0)
+        return source;
+    return source.replace(index, marker.size(), declarations);
+}
+
+// 同じ意味の属性が重複していないか
+template <typename... Semantics>
+struct SemanticList
+{
+    template <typename Semantic>
+    static constexpr int occurrences()
+    {
+        const bool matches[] = { std::is_same<Semantic, Semantics>::value... };
+        int count = 0;
+        for (bool match : matches)
+            count += match ? 1 : 0;
+        return count;
+    }
+
+    static constexpr bool isUnique()
+    {
+        const int counts[] = { occurrences<Semantics>()... };
+        for (int count : counts)
+        {
+            if (count != 1)
+                return false;
+        }
+        return true;
+    }
+};
+
+template <typename... Attributes>
+struct Format
+{
+    static_assert(sizeof...(Attributes) > 0, "Format needs at least 1 attribute");
+    static_assert(SemanticList<typename Attributes::Semantic...>::isUnique(), "Each attribute may appear only once in a format");
+
+    static const int Count = sizeof...(Attributes);
+
+    // 属性の番号(並べた順)。含まない場合は -1
+    template <typename Semantic>
+    static constexpr int location()
+    {
+        const bool matches[] = { std::is_same<Semantic, typename Attributes::Semantic>::value... };
+        for (int i = 0; i < Count; i++)
+        {
+            if (matches[i])
+                return i;
+        }
+        return -1;
+    }
+
+    template <typename Semantic>
+    static constexpr bool contains() { return location<Semantic>() >= 0; }
+
+    static constexpr int offset(int index)
+    {
+        const int sizes[] = { Attributes::Storage::Size... };
+        int result = 0;
+        for (int i = 0; i < index; i++)
+            result += sizes[i];
+        return result;
+    }
+
+    template <typename Semantic>
+    static constexpr int offset()
+    {
+        static_assert(contains<Semantic>(), "Format does not contain the attribute");
+        return offset(location<Semantic>());
+    }
+
+    static constexpr int stride() { return offset(Count); }
+
+    // 頂点バッファを束縛した状態で呼ぶ(VAO を束縛していればそこに記録される)
+    // baseOffset はバッファ内の頂点データの先頭
+    static void setAttributes(QOpenGLFunctions *gl, int baseOffset = 0)
+    {
+        int expand[] = { (setAttribute<Attributes>(gl, baseOffset), 0)... };
+        Q_UNUSED(expand);
+    }
+
+    static void disableAttributes(QOpenGLFunctions *gl)
+    {
+        int expand[] = { (gl->glDisableVertexAttribArray(static_cast<GLuint>(location<typename Attributes::Semantic>())), 0)... };
+        Q_UNUSED(expand);
+    }
+
+    // "layout(location = 0) in vec3 VertexPosition;" を属性の数だけ並べる
+    static QByteArray declarations()
+    {
+        QByteArray source;
+        int expand[] = { (source += declaration<Attributes>(), 0)... };
+        Q_UNUSED(expand);
+        return source;
+    }
+
+    // シェーダーのファイルを読んで属性の宣言を入れる
+    static QByteArray shaderSource(const QString &fileName)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            qWarning() << "Can't open file" << fileName;
+            return QByteArray();
+        }
+        return insertDeclarations(file.readAll(), declarations());
+    }
+
+    // vertex は頂点の先頭
+    template <typename Semantic, typename Value>
+    static void pack(void *vertex, const Value &value)
+    {
+        typedef typename AttributeOf<Semantic>::Storage Storage;
+        static_assert(sizeof(Value) == sizeof(float) * Storage::Count, "Value does not match the component count");
+        float values[Storage::Count];
+        toFloats(value, values);
+        Storage::pack(values, static_cast<uchar*>(vertex) + offset<Semantic>());
+    }
+
+    template <typename Semantic, typename Value>
+    static Value unpack(const void *vertex)
+    {
+        typedef typename AttributeOf<Semantic>::Storage Storage;
+        static_assert(sizeof(Value) == sizeof(float) * Storage::Count, "Value does not match the component count");
+        float values[Storage::Count];
+        Storage::unpack(static_cast<const uchar*>(vertex) + offset<Semantic>(), values);
+        return fromFloats<Value>(values);
+    }
+
+    // Source の形式の頂点を詰め替える
+    // 同じ意味の属性を変換し、Source に無い属性や足りない成分は 0 にする
+    template <typename Source>
+    static void convert(const void *source, void *output, int count)
+    {
+        const uchar *in = static_cast<const uchar*>(source);
+        uchar *out = static_cast<uchar*>(output);
+        for (int i = 0; i < count; i++)
+        {
+            int expand[] = { (convertAttribute<Source, Attributes>(in, out, std::integral_constant<bool, Source::template contains<typename Attributes::Semantic>()>()), 0)... };
+            Q_UNUSED(expand);
+            in += Source::stride();
+            out += stride();
+        }
+    }
+
+    // 他の形式から属性の値を float で読む(convert() から使う)
+    template <typename Semantic>
+    static void unpackFloats(const void *vertex, float *values)
+    {
+        AttributeOf<Semantic>::Storage::unpack(static_cast<const uchar*>(vertex) + offset<Semantic>(), values);
+    }
+
+    template <typename Semantic>
+    struct AttributeOf
+    {
+        static_assert(contains<Semantic>(), "Format does not contain the attribute");
+        typedef typename std::tuple_element<location<Semantic>(), std::tuple<Attributes...>>::type Type;
+        typedef typename Type::Storage Storage;
+    };
+
+private:
+    template <typename A>
+    static void setAttribute(QOpenGLFunctions *gl, int baseOffset)
+    {
+        const GLuint index = static_cast<GLuint>(location<typename A::Semantic>());
+        const quintptr pointer = static_cast<quintptr>(baseOffset + offset<typename A::Semantic>());
+        gl->glEnableVertexAttribArray(index);
+        gl->glVertexAttribPointer(index, A::Storage::Count, A::Storage::Type, A::Storage::Normalized ? GL_TRUE : GL_FALSE,
+                                  stride(), reinterpret_cast<const void*>(pointer));
+    }
+
+    template <typename A>
+    static QByteArray declaration()
+    {
+        QByteArray type = A::Storage::Count == 1 ? QByteArray("float") : "vec" + QByteArray::number(A::Storage::Count);
+        return "layout(location = " + QByteArray::number(location<typename A::Semantic>()) + ") in "
+                + type + " " + A::Semantic::name() + ";\n";
+    }
+
+    template <typename Source, typename A>
+    static void convertAttribute(const uchar *in, uchar *out, std::true_type)
+    {
+        float values[4] = {};
+        Source::template unpackFloats<typename A::Semantic>(in, values);
+        A::Storage::pack(values, out + offset<typename A::Semantic>());
+    }
+
+    template <typename Source, typename A>
+    static void convertAttribute(const uchar *, uchar *out, std::false_type)
+    {
+        const float values[4] = {};
+        A::Storage::pack(values, out + offset<typename A::Semantic>());
+    }
+};
+
+} // namespace VertexFormat
+
+#endif // VERTEXFORMAT_H
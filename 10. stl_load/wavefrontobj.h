@@ -6,8 +6,16 @@
 #include <QVector3D>
 #include <QString>
 #include <QFile>
-#include <QRegularExpression>
 #include <QtDebug>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include "jobsystem.h"
+#include "chunkreader.h"
+#include "loadprogress.h"
+#include "arena.h"
+#include "linetokenizer.h"
 
 struct Triangle3D
 {
@@ -21,10 +29,39 @@ class WavefrontOBJ
 public:
     WavefrontOBJ(){}
 
-    bool parser(const QString &fileName, QStringList &comments, QVector<Triangle3D> &triangles)
+    // 解析した三角形の書き込み先
+    // reserve(count) は三角形数の上限が分かった時に1回呼ばれる(false を返すと中止する)
+    // write(first, triangles, count) は first 番目からの三角形を渡す。ワーカーから並列に呼ばれるが範囲は重ならない
+    struct Sink
+    {
+        std::function<bool(int count)> reserve;
+        std::function<void(int first, const Triangle3D *triangles, int count)> write;
+    };
+
+    // progress を渡すと進捗の通知とキャンセルができる
+    bool parser(const QString &fileName, QStringList &comments, QVector<Triangle3D> &triangles, LoadProgress *progress = nullptr)
+    {
+        return collect(triangles, [&](const Sink &sink, int &count){
+            return parser(fileName, comments, sink, count, progress);
+        });
+    }
+
+    bool parser(const QString &fileName, QStringList &comments, ArenaVector<Triangle3D> &triangles, LoadProgress *progress = nullptr)
+    {
+        return collect(triangles, [&](const Sink &sink, int &count){
+            return parser(fileName, comments, sink, count, progress);
+        });
+    }
+
+    // 三角形を sink に書き込み、書き込んだ数を count に返す
+    // 1回目の読み込みで行の種類を数えて頂点の配列を確保し、2回目で一定サイズずつ解析する
+    // 手元に残るのは v/vt/vn だけで、ファイル全体や三角形の配列は持たない
+    // v/vt/vn は scratch に置く(無ければ内部の Arena を使う)
+    bool parser(const QString &fileName, QStringList &comments, const Sink &sink, int &count, LoadProgress *progress = nullptr,
+                Arena *scratch = nullptr)
     {
         comments.clear();
-        triangles.clear();
+        count = 0;
 
         QFile file(fileName);
         if(!file.exists())
@@ -33,85 +70,392 @@ public:
             return false;
         }
 
-        QVector<QVector3D> v, vn;
-        QVector<QVector2D> vt;
-
         if (!file.open(QFile::ReadOnly | QFile::Text))
         {
             qWarning() << "Can't open file";
             return false;
         }
 
-        while(!file.atEnd())
+        if (progress)
+            progress->setTotal(file.size());
+
+        // 行の種類を数える
+        JobSystem &jobs = JobSystem::instance();
+        ChunkReader reader(file, progress);
+        const char *begin = nullptr;
+        const char *end = nullptr;
+        int maxBlocks = blockCount(INT_MAX);
+        std::unique_ptr<LineCounts[]> counts(new LineCounts[maxBlocks]);
+        LineCounts total;
+        while (reader.next(begin, end))
         {
-            QString line = file.readLine().trimmed();
-            QStringList lineParts = line.split(QRegularExpression("\\s+"));
-            if(lineParts.count() > 0)
-            {
+            QVector<const char*> bounds = ChunkReader::split(begin, end, blockCount(end - begin));
+            jobs.parallelFor(0, bounds.size() - 1, 1, [&](int first, int last){
+                for (int i = first; i < last; i++)
+                    counts[i] = countLines(bounds.at(i), bounds.at(i + 1));
+            });
+            for (int i = 0; i < bounds.size() - 1; i++)
+                total += counts[i];
+            LoadProgress::advance(progress, end - begin);
+        }
+        if (LoadProgress::canceled(progress) || !reader.rewind() || !sink.reserve(total.f))
+            return false;
 
-                // コメントなら
-                if(lineParts.at(0).compare("#", Qt::CaseInsensitive) == 0)
-                {
-                    comments.append(line.remove(0, 1).trimmed());
-                }
-                // 頂点位置の場合(v)
-                else if(lineParts.at(0).compare("v", Qt::CaseInsensitive) == 0)
+        // 頂点データは面から参照されるので最後まで持つ(数えた分だけ確保する)
+        Arena local(4 << 20);
+        Arena &arena = scratch ? *scratch : local;
+        ArenaVector<QVector3D> v(&arena), vn(&arena);
+        ArenaVector<QVector2D> vt(&arena);
+        v.reserve(total.v);
+        vt.reserve(total.vt);
+        vn.reserve(total.vn);
+        ArenaVector<Deferred> deferred(&arena);
+
+        // 行の途中で切らないように読み、各ブロックを並列に解析する
+        // ブロック毎に Arena を持つのでワーカー間で同期しない(塊毎に使い回す)
+        std::unique_ptr<Block[]> blocks(new Block[maxBlocks]);
+        QVector<int> faceOffsets(maxBlocks);
+        std::atomic<bool> missing(false);
+        while (reader.next(begin, end))
+        {
+            QVector<const char*> bounds = ChunkReader::split(begin, end, blockCount(end - begin));
+            int used = bounds.size() - 1;
+            jobs.parallelFor(0, used, 1, [&](int first, int last){
+                for (int i = first; i < last; i++)
                 {
-                    v.append(QVector3D(lineParts.at(1).toFloat(),
-                                       lineParts.at(2).toFloat(),
-                                       lineParts.at(3).toFloat()));
+                    blocks[i].reset();
+                    parseBlock(bounds.at(i), bounds.at(i + 1), blocks[i], progress);
                 }
-                // UV座標の場合(vt)
-                else if(lineParts.at(0).compare("vt", Qt::CaseInsensitive) == 0)
+            });
+            if (LoadProgress::canceled(progress))
+                return false;
+
+            // 頂点データを元の順番で連結する
+            for (int i = 0; i < used; i++)
+            {
+                const Block &block = blocks[i];
+                v.append(block.v.constData(), block.v.size());
+                vt.append(block.vt.constData(), block.vt.size());
+                vn.append(block.vn.constData(), block.vn.size());
+                comments += block.comments;
+                faceOffsets[i] = count;
+                count += block.faces.size();
+            }
+            if (count > total.f)
+            {
+                qWarning() << "Face count changed while reading";
+                return false;
+            }
+
+            // 面データを三角形に変換して sink に渡す
+            // まだ読んでいない頂点を参照する面は最後に変換する
+            jobs.parallelFor(0, used, 1, [&](int first, int last){
+                for (int i = first; i < last; i++)
                 {
-                    vt.append(QVector2D(lineParts.at(1).toFloat(),
-                                        lineParts.at(2).toFloat()));
+                    Block &block = blocks[i];
+                    if (!writeFaces(block, faceOffsets.at(i), v, vt, vn, sink))
+                        missing = true;
                 }
-                // 法線位置の場合(vn)
-                else if(lineParts.at(0).compare("vn", Qt::CaseInsensitive) == 0)
+            });
+            for (int i = 0; i < used; i++)
+                deferred.append(blocks[i].deferred.constData(), blocks[i].deferred.size());
+        }
+        if (LoadProgress::canceled(progress))
+            return false;
+
+        for (const Deferred &face : deferred)
+        {
+            Triangle3D triangle;
+            if (!buildTriangle(face.face, v, vt, vn, triangle))
+                missing = true;
+            sink.write(face.index, &triangle, 1);
+        }
+
+        if (missing)
+            qWarning() << "Face refers to a missing vertex";
+
+        file.close();
+        return true;
+    }
+
+    QString errorMessage(){
+        return m_errorMsg;
+    }
+
+private:
+    // 面の頂点番号(0始まり, 無い場合は -1)
+    struct Face
+    {
+        int v[3];
+        int vt[3];
+        int vn[3];
+    };
+
+    // 後の行で定義される頂点を参照する面と、その出力先
+    struct Deferred
+    {
+        Face face;
+        int index;
+    };
+
+    struct Block
+    {
+        Block() : arena(1 << 18), v(&arena), vn(&arena), vt(&arena), faces(&arena), deferred(&arena) {}
+
+        // 次の塊の解析に使い回す
+        void reset()
+        {
+            arena.reset();
+            v = ArenaVector<QVector3D>(&arena);
+            vn = ArenaVector<QVector3D>(&arena);
+            vt = ArenaVector<QVector2D>(&arena);
+            faces = ArenaVector<Face>(&arena);
+            deferred = ArenaVector<Deferred>(&arena);
+            comments.clear();
+        }
+
+        Arena arena;
+        ArenaVector<QVector3D> v, vn;
+        ArenaVector<QVector2D> vt;
+        ArenaVector<Face> faces;
+        ArenaVector<Deferred> deferred;
+        QStringList comments;
+    };
+
+    struct LineCounts
+    {
+        int v = 0, vt = 0, vn = 0, f = 0;
+
+        LineCounts &operator+=(const LineCounts &other)
+        {
+            v += other.v;
+            vt += other.vt;
+            vn += other.vn;
+            f += other.f;
+            return *this;
+        }
+    };
+
+    // 配列に書き込む sink で解析する(ベンチマークや三角形の配列が欲しい場合用)
+    template <typename Array>
+    static bool collect(Array &triangles, const std::function<bool(const Sink &sink, int &count)> &parse)
+    {
+        triangles.clear();
+        Triangle3D *output = nullptr;
+        Sink sink;
+        sink.reserve = [&](int count){
+            triangles.resize(count);
+            output = triangles.data();
+            return true;
+        };
+        sink.write = [&output](int first, const Triangle3D *input, int count){
+            std::memcpy(output + first, input, static_cast<size_t>(count) * sizeof(Triangle3D));
+        };
+
+        int count = 0;
+        if (!parse(sink, count))
+        {
+            triangles.clear();
+            return false;
+        }
+        triangles.resize(count);
+        return true;
+    }
+
+    // 大きな塊はワーカー数より多めに分けて偏りを減らす
+    static int blockCount(qint64 size)
+    {
+        return size < (1 << 20) ? 1 : qMax(JobSystem::instance().threadCount(), 1) * 4;
+    }
+
+    // 行頭のキーワードだけを見て数える(解析時に捨てる行も数えるので上限になる)
+    static LineCounts countLines(const char *begin, const char *end)
+    {
+        LineCounts counts;
+        while (begin < end)
+        {
+            while (begin < end && (*begin == ' ' || *begin == '\t'))
+                begin++;
+
+            if (end - begin >= 2)
+            {
+                char c0 = begin[0];
+                char c1 = begin[1];
+                bool space1 = c1 == ' ' || c1 == '\t';
+                if (c0 == 'v' && space1)
+                    counts.v++;
+                else if (c0 == 'f' && space1)
+                    counts.f++;
+                else if (c0 == 'v' && end - begin >= 3 && (begin[2] == ' ' || begin[2] == '\t'))
                 {
-                    vn.append(QVector3D(lineParts.at(1).toFloat(),
-                                        lineParts.at(2).toFloat(),
-                                        lineParts.at(3).toFloat()));
+                    if (c1 == 't')
+                        counts.vt++;
+                    else if (c1 == 'n')
+                        counts.vn++;
                 }
-                // 面データの場合。すべて三角形であるとする。
-                else if(lineParts.at(0).compare("f", Qt::CaseInsensitive) == 0)
-                {
-                    Triangle3D triangle;
+            }
+
+            const char *newline = static_cast<const char*>(memchr(begin, '\n', static_cast<size_t>(end - begin)));
+            begin = newline ? newline + 1 : end;
+        }
+        return counts;
+    }
+
+    static void parseBlock(const char *begin, const char *end, Block &block, LoadProgress *progress)
+    {
+        LineTokenizer tokens;
+        const char *reported = begin;
+        int lineCount = 0;
+        while (begin < end)
+        {
+            // ときどき進捗を通知してキャンセルを確認する
+            if (++lineCount % 4096 == 0)
+            {
+                LoadProgress::advance(progress, begin - reported);
+                reported = begin;
+                if (LoadProgress::canceled(progress))
+                    return;
+            }
 
+            const char *newline = static_cast<const char*>(memchr(begin, '\n', static_cast<size_t>(end - begin)));
+            const char *lineEnd = newline ? newline : end;
+            const char *lineBegin = begin;
+            begin = lineEnd + 1;
 
-                    // 頂点座標を取得
-                    triangle.p1 = v.at(lineParts.at(1).split("/").at(0).toInt() - 1);
-                    triangle.p2 = v.at(lineParts.at(2).split("/").at(0).toInt() - 1);
-                    triangle.p3 = v.at(lineParts.at(3).split("/").at(0).toInt() - 1);
+            int count = tokens.split(lineBegin, lineEnd);
+            if (count == 0)
+                continue;
 
-                    if(vt.count() > 0) // UV座標があるか確認
+            // コメントなら
+            if(tokens.token(0)[0] == '#')
+            {
+                QByteArray line = QByteArray::fromRawData(lineBegin, static_cast<int>(lineEnd - lineBegin)).simplified();
+                block.comments.append(QString::fromUtf8(line.mid(1)).trimmed());
+            }
+            // 頂点位置の場合(v)
+            else if(tokens.is(0, "v") && count >= 4)
+            {
+                block.v.append(QVector3D(tokens.toFloat(1), tokens.toFloat(2), tokens.toFloat(3)));
+            }
+            // UV座標の場合(vt)
+            else if(tokens.is(0, "vt") && count >= 3)
+            {
+                block.vt.append(QVector2D(tokens.toFloat(1), tokens.toFloat(2)));
+            }
+            // 法線位置の場合(vn)
+            else if(tokens.is(0, "vn") && count >= 4)
+            {
+                block.vn.append(QVector3D(tokens.toFloat(1), tokens.toFloat(2), tokens.toFloat(3)));
+            }
+            // 面データの場合。すべて三角形であるとする。
+            else if(tokens.is(0, "f") && count >= 4)
+            {
+                // 頂点座標・UV座標・法線の番号を取得(v, v/vt, v//vn, v/vt/vn)
+                Face face;
+                for (int k = 0; k < 3; k++)
+                {
+                    const char *p = tokens.token(k + 1);
+                    const char *tokenEnd = p + tokens.length(k + 1);
+                    int *indexes[3] = { &face.v[k], &face.vt[k], &face.vn[k] };
+                    for (int n = 0; n < 3; n++)
                     {
-                        triangle.p1TexCoord = vt.at(lineParts.at(1).split("/").at(1).toInt() - 1);
-                        triangle.p2TexCoord = vt.at(lineParts.at(2).split("/").at(1).toInt() - 1);
-                        triangle.p3TexCoord = vt.at(lineParts.at(3).split("/").at(1).toInt() - 1);
+                        // 空の番号は -1
+                        int value = 0;
+                        const char *next = LineTokenizer::parseInt(p, tokenEnd, value);
+                        *indexes[n] = next > p ? value - 1 : -1;
+                        p = next < tokenEnd && *next == '/' ? next + 1 : tokenEnd;
                     }
+                }
+                block.faces.append(face);
+            }
+        }
+        LoadProgress::advance(progress, end - reported);
+    }
 
-                    // 法線位置を取得
-                    triangle.p1Normal = vn.at(lineParts.at(1).split("/").at(2).toInt() - 1);
-                    triangle.p2Normal = vn.at(lineParts.at(2).split("/").at(2).toInt() - 1);
-                    triangle.p3Normal = vn.at(lineParts.at(3).split("/").at(2).toInt() - 1);
+    // 読み込み済みの頂点だけで作れる面を三角形にして sink に渡す。作れない面は block.deferred に回す
+    static bool writeFaces(Block &block, int offset, const ArenaVector<QVector3D> &v, const ArenaVector<QVector2D> &vt,
+                           const ArenaVector<QVector3D> &vn, const Sink &sink)
+    {
+        // 変換した三角形はスタック上に少しずつ溜めて、連続した範囲毎に渡す
+        const int batchSize = 64;
+        Triangle3D batch[batchSize];
+        int batchCount = 0;
+        int batchFirst = offset;
+        bool valid = true;
 
-                    triangles.append(triangle);
-                }
+        const ArenaVector<Face> &faces = block.faces;
+        for (int f = 0; f < faces.size(); f++)
+        {
+            const Face &face = faces.at(f);
+            if (!isResolved(face, v.size(), vt.size(), vn.size()))
+            {
+                if (batchCount > 0)
+                    sink.write(batchFirst, batch, batchCount);
+                block.deferred.append(Deferred{ face, offset + f });
+                batchCount = 0;
+                batchFirst = offset + f + 1;
+                continue;
+            }
 
+            if (!buildTriangle(face, v, vt, vn, batch[batchCount]))
+                valid = false;
+            if (++batchCount == batchSize)
+            {
+                sink.write(batchFirst, batch, batchCount);
+                batchFirst += batchCount;
+                batchCount = 0;
             }
         }
-        file.close();
+        if (batchCount > 0)
+            sink.write(batchFirst, batch, batchCount);
+        return valid;
+    }
 
+    // 番号が全て読み込み済みの範囲にあるか(負の番号は変換時に無効として扱う)
+    static bool isResolved(const Face &face, int vSize, int vtSize, int vnSize)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            if (face.v[k] >= vSize || face.vt[k] >= vtSize || face.vn[k] >= vnSize)
+                return false;
+        }
         return true;
     }
 
-    QString errorMessage(){
-        return m_errorMsg;
+    static bool buildTriangle(const Face &face, const ArenaVector<QVector3D> &v, const ArenaVector<QVector2D> &vt,
+                              const ArenaVector<QVector3D> &vn, Triangle3D &triangle)
+    {
+        QVector3D *positions[3] = { &triangle.p1, &triangle.p2, &triangle.p3 };
+        QVector2D *texCoords[3] = { &triangle.p1TexCoord, &triangle.p2TexCoord, &triangle.p3TexCoord };
+        QVector3D *normals[3] = { &triangle.p1Normal, &triangle.p2Normal, &triangle.p3Normal };
+
+        bool valid = true;
+        bool hasNormal = true;
+        for (int k = 0; k < 3; k++)
+        {
+            if (face.v[k] >= 0 && face.v[k] < v.size())
+                *positions[k] = v.at(face.v[k]);
+            else
+                valid = false;
+
+            if (face.vt[k] >= 0 && face.vt[k] < vt.size())
+                *texCoords[k] = vt.at(face.vt[k]);
+
+            if (face.vn[k] >= 0 && face.vn[k] < vn.size())
+                *normals[k] = vn.at(face.vn[k]);
+            else
+                hasNormal = false;
+        }
+
+        // 法線が無い場合は面法線を使う
+        if(!hasNormal)
+        {
+            QVector3D normal = QVector3D::normal(triangle.p1, triangle.p2, triangle.p3);
+            triangle.p1Normal = triangle.p2Normal = triangle.p3Normal = normal;
+        }
+        return valid;
     }
 
-private:
     QString m_errorMsg="";
 };
 
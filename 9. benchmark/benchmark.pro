@@ -16,6 +16,7 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    benchmarkrunner.cpp \
     glwidget.cpp \
     gridline.cpp \
     main.cpp \
@@ -23,6 +24,7 @@ SOURCES += \
     model.cpp
 
 HEADERS += \
+    benchmarkrunner.h \
     fpsmanager.h \
     gldebug.h \
     glwidget.h \
@@ -42,4 +44,7 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 RESOURCES += \
     resource.qrc
 
+# Peak working set for the benchmark result.
+win32: LIBS += -lpsapi
+
 # Suppress the output of the qDebug function in the release build.
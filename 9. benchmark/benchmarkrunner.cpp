@@ -0,0 +1,431 @@
+#include "benchmarkrunner.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+namespace {
+    // Model はインデックスを GLushort で持ち、面ごとに3頂点を作るので1モデルの頂点数に上限がある
+    // UV球の分割数 d では 3 * (2 * d * d) 頂点になる(d = 104 で 64896)
+    const int MaxVerticesPerModel = 65535;
+    const int MaxDivision = 104;
+    static_assert(3 * 2 * MaxDivision * MaxDivision <= MaxVerticesPerModel, "sphere exceeds GLushort indices");
+    const float InstanceGap = 2.5f;
+}
+
+BenchmarkRunner::BenchmarkRunner(const Config &config)
+{
+    m_config = config;
+    m_context = nullptr;
+    m_surface = nullptr;
+    m_fbo = nullptr;
+    m_vao = nullptr;
+    m_sceneRadius = 1.0f;
+    m_triangles = 0;
+}
+
+BenchmarkRunner::~BenchmarkRunner()
+{
+    release();
+}
+
+bool BenchmarkRunner::initializeContext()
+{
+    QSurfaceFormat format;
+    format.setVersion(4,0);
+    format.setDepthBufferSize(24);
+
+    m_context = new QOpenGLContext();
+    m_context->setFormat(format);
+    if (!m_context->create())
+    {
+        qWarning() << "Can't create OpenGL context";
+        return false;
+    }
+
+    m_surface = new QOffscreenSurface();
+    m_surface->setFormat(m_context->format());
+    m_surface->create();
+
+    if (!m_context->makeCurrent(m_surface))
+    {
+        qWarning() << "Can't make OpenGL context current";
+        return false;
+    }
+    initializeOpenGLFunctions();
+
+    // 描画先のFBO
+    QOpenGLFramebufferObjectFormat fboFormat;
+    fboFormat.setAttachment(QOpenGLFramebufferObject::Depth);
+    fboFormat.setSamples(m_config.samples);
+    m_fbo = new QOpenGLFramebufferObject(m_config.width, m_config.height, fboFormat);
+    if (!m_fbo->isValid())
+    {
+        qWarning() << "Can't create framebuffer object";
+        return false;
+    }
+
+    // コアプロファイルでも描画できるようにVAOをバインドしておく
+    m_vao = new QOpenGLVertexArrayObject();
+    m_vao->create();
+    m_vao->bind();
+
+    // GLWidget と同じ描画設定
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glEnable(GL_MULTISAMPLE);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(60 / 255.0f, 60 / 255.0f, 60 / 255.0f, 1.0f);
+
+    float aspect = float(m_config.width) / float(m_config.height);
+    m_projectionMatrix.setToIdentity();
+    m_projectionMatrix.perspective(60.0f, aspect, 0.1f, 1000.0f);
+
+    return true;
+}
+
+void BenchmarkRunner::release()
+{
+    if (!m_context)
+        return;
+
+    m_context->makeCurrent(m_surface);
+
+    qDeleteAll(m_models);
+    m_models.clear();
+
+    delete m_vao;
+    m_vao = nullptr;
+    delete m_fbo;
+    m_fbo = nullptr;
+
+    m_context->doneCurrent();
+    delete m_surface;
+    m_surface = nullptr;
+    delete m_context;
+    m_context = nullptr;
+}
+
+QString BenchmarkRunner::writeSphereObj(int index, int division)
+{
+    // UV球: 三角形数 = 2 * slices * stacks
+    int stacks = division;
+    int slices = division;
+
+    QString filename = m_dir.filePath(QString("model%1.obj").arg(index));
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qWarning() << "Can't open file";
+        return QString();
+    }
+
+    QTextStream out(&file);
+    out << "# generated by benchmark\n";
+
+    for (int i = 0; i <= stacks; i++)
+    {
+        float theta = static_cast<float>(M_PI) * i / stacks;
+        for (int j = 0; j <= slices; j++)
+        {
+            float phi = 2.0f * static_cast<float>(M_PI) * j / slices;
+            float x = qSin(theta) * qCos(phi);
+            float y = qCos(theta);
+            float z = qSin(theta) * qSin(phi);
+            out << "v " << x << " " << y << " " << z << "\n";
+            out << "vn " << x << " " << y << " " << z << "\n";
+        }
+    }
+
+    // 外側から見て反時計回りになるように並べる
+    for (int i = 0; i < stacks; i++)
+    {
+        for (int j = 0; j < slices; j++)
+        {
+            int a = i * (slices + 1) + j + 1;
+            int b = a + slices + 1;
+            int c = b + 1;
+            int d = a + 1;
+            out << "f " << a << "//" << a << " " << c << "//" << c << " " << b << "//" << b << "\n";
+            out << "f " << a << "//" << a << " " << d << "//" << d << " " << c << "//" << c << "\n";
+        }
+    }
+
+    file.close();
+    return filename;
+}
+
+bool BenchmarkRunner::generateScene(double &loadTime)
+{
+    int division = qMax(3, static_cast<int>(qCeil(qSqrt(m_config.triangles / 2.0))));
+    if (division > MaxDivision)
+    {
+        qWarning() << QString("Triangles per model is limited to %1").arg(MaxVerticesPerModel / 3);
+        division = MaxDivision;
+    }
+    // 分割数で切り上げるので、要求した数より多くなることがある
+    m_triangles = 2 * division * division;
+
+    QStringList files;
+    for (int i = 0; i < m_config.models; i++)
+    {
+        files.append(writeSphereObj(i, division));
+        if (files.last().isEmpty())
+            return false;
+    }
+
+    // 読み込みからGPU転送までをロード時間とする
+    QElapsedTimer timer;
+    timer.start();
+    for (const QString &filename : files)
+    {
+        auto model = new Model();
+        if (!model->load(filename))
+        {
+            delete model;
+            return false;
+        }
+        model->bind(":/shader.vert", ":/shader.frag");
+        m_models.append(model);
+    }
+    glFinish();
+    loadTime = timer.nsecsElapsed() / 1000000.0;
+
+    // インスタンスは XZ 平面上の格子に並べる
+    int total = m_config.models * m_config.instances;
+    int columns = qMax(1, static_cast<int>(qCeil(qSqrt(total))));
+    float offset = (columns - 1) * InstanceGap * 0.5f;
+    for (int i = 0; i < total; i++)
+        m_instances.append(QVector3D((i % columns) * InstanceGap - offset, 0.0f, (i / columns) * InstanceGap - offset));
+
+    m_sceneRadius = qMax(offset * 1.5f, 3.0f);
+    return true;
+}
+
+void BenchmarkRunner::renderFrame(int frame)
+{
+    // カメラはシーンの周りを一周しながら上下する
+    float t = static_cast<float>(frame) / m_config.frames;
+    QMatrix4x4 camera;
+    camera.rotate(360.0f * t, QVector3D(0.0f, 1.0f, 0.0f));
+    camera.rotate(-20.0f - 15.0f * qSin(2.0f * static_cast<float>(M_PI) * t), QVector3D(1.0f, 0.0f, 0.0f));
+
+    auto eye = camera * QVector3D(0.0f, 0.0f, m_sceneRadius * 1.5f);
+    auto up = camera * QVector3D(0.0f, 1.0f, 0.0f);
+    m_viewMatrix.setToIdentity();
+    m_viewMatrix.lookAt(eye, QVector3D(0.0f, 0.0f, 0.0f), up);
+
+    glViewport(0, 0, m_config.width, m_config.height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    for (int i = 0; i < m_models.size(); i++)
+    {
+        for (int k = 0; k < m_config.instances; k++)
+        {
+            m_models[i]->setTranslation(m_instances.at(i * m_config.instances + k));
+            m_models[i]->draw(m_projectionMatrix, m_viewMatrix);
+        }
+    }
+}
+
+QJsonObject BenchmarkRunner::run()
+{
+    if (!m_dir.isValid() || !initializeContext())
+        return QJsonObject();
+
+    double loadTime = 0.0;
+    if (!generateScene(loadTime))
+        return QJsonObject();
+
+    m_fbo->bind();
+
+    for (int i = 0; i < m_config.warmup; i++)
+        renderFrame(i);
+    glFinish();
+
+    // GPUの完了まで含めた1フレームの時間を計測する
+    QVector<double> frameTimes;
+    frameTimes.reserve(m_config.frames);
+    QElapsedTimer timer;
+    for (int i = 0; i < m_config.frames; i++)
+    {
+        timer.start();
+        renderFrame(i);
+        glFinish();
+        frameTimes.append(timer.nsecsElapsed() / 1000000.0);
+    }
+
+    m_fbo->release();
+
+    Summary s = summarize(frameTimes);
+
+    QJsonObject config;
+    config["models"] = m_config.models;
+    config["triangles"] = m_triangles;
+    config["requested_triangles"] = m_config.triangles;
+    config["instances"] = m_config.instances;
+    config["frames"] = m_config.frames;
+    config["warmup"] = m_config.warmup;
+    config["width"] = m_config.width;
+    config["height"] = m_config.height;
+    config["samples"] = m_config.samples;
+
+    QJsonObject frameTime;
+    frameTime["mean"] = s.mean;
+    frameTime["p50"] = s.p50;
+    frameTime["p95"] = s.p95;
+    frameTime["p99"] = s.p99;
+    frameTime["max"] = s.max;
+
+    QJsonArray samples;
+    for (double v : frameTimes)
+        samples.append(v);
+
+    QJsonObject result;
+    result["renderer"] = QString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    result["version"] = QString(reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+    result["config"] = config;
+    result["load_time_ms"] = loadTime;
+    result["peak_rss_kb"] = static_cast<double>(peakRss() / 1024);
+    result["frame_time_ms"] = frameTime;
+    result["frame_times_ms"] = samples;
+
+    return result;
+}
+
+BenchmarkRunner::Summary BenchmarkRunner::summarize(QVector<double> samples)
+{
+    Summary s;
+    if (samples.isEmpty())
+        return s;
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (double v : samples)
+        sum += v;
+
+    auto percentile = [&](double p){
+        return samples.at(static_cast<int>(p * (samples.size() - 1) + 0.5));
+    };
+
+    s.mean = sum / samples.size();
+    s.p50 = percentile(0.50);
+    s.p95 = percentile(0.95);
+    s.p99 = percentile(0.99);
+    s.max = samples.last();
+    return s;
+}
+
+qint64 BenchmarkRunner::peakRss()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return static_cast<qint64>(counters.PeakWorkingSetSize);
+    return 0;
+#elif defined(Q_OS_MACOS)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<qint64>(usage.ru_maxrss);
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#else
+    return 0;
+#endif
+}
+
+int BenchmarkRunner::compare(const QString &baseFile, const QString &newFile, double threshold, double alpha)
+{
+    auto load = [](const QString &filename, QVector<double> &samples, QJsonObject &root){
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            qWarning() << "Can't open file" << filename;
+            return false;
+        }
+        root = QJsonDocument::fromJson(file.readAll()).object();
+        for (const auto &v : root["frame_times_ms"].toArray())
+            samples.append(v.toDouble());
+        return !samples.isEmpty();
+    };
+
+    QVector<double> base, current;
+    QJsonObject baseRoot, currentRoot;
+    if (!load(baseFile, base, baseRoot) || !load(newFile, current, currentRoot))
+        return 2;
+
+    // Mann-Whitney の U 検定(正規近似)で new が base より遅いかを片側検定する
+    struct Sample { double value; int group; };
+    QVector<Sample> all;
+    for (double v : base) all.append(Sample{ v, 0 });
+    for (double v : current) all.append(Sample{ v, 1 });
+    std::sort(all.begin(), all.end(), [](const Sample &a, const Sample &b){ return a.value < b.value; });
+
+    double rankSum = 0.0;
+    for (int i = 0; i < all.size();)
+    {
+        // 同順位は平均順位を使う
+        int j = i;
+        while (j < all.size() && all.at(j).value == all.at(i).value)
+            j++;
+        double rank = (i + 1 + j) / 2.0;
+        for (int k = i; k < j; k++)
+            if (all.at(k).group == 1)
+                rankSum += rank;
+        i = j;
+    }
+
+    double n1 = current.size();
+    double n2 = base.size();
+    double u = rankSum - n1 * (n1 + 1) / 2.0;
+    double mu = n1 * n2 / 2.0;
+    double sigma = std::sqrt(n1 * n2 * (n1 + n2 + 1) / 12.0);
+    double z = sigma > 0.0 ? (u - mu) / sigma : 0.0;
+    double p = 0.5 * std::erfc(z / std::sqrt(2.0));
+
+    Summary b = summarize(base);
+    Summary c = summarize(current);
+
+    QTextStream out(stdout);
+    auto row = [&](const QString &name, double before, double after){
+        double change = before > 0.0 ? (after - before) / before * 100.0 : 0.0;
+        out << QString("%1 %2 ms -> %3 ms (%4%5%)\n")
+               .arg(name, -6)
+               .arg(before, 9, 'f', 3)
+               .arg(after, 9, 'f', 3)
+               .arg(change >= 0.0 ? "+" : "")
+               .arg(change, 0, 'f', 1);
+    };
+    row("mean", b.mean, c.mean);
+    row("p50", b.p50, c.p50);
+    row("p95", b.p95, c.p95);
+    row("p99", b.p99, c.p99);
+    row("load", baseRoot["load_time_ms"].toDouble(), currentRoot["load_time_ms"].toDouble());
+    out << QString("peak RSS %1 KB -> %2 KB\n")
+           .arg(baseRoot["peak_rss_kb"].toDouble(), 0, 'f', 0)
+           .arg(currentRoot["peak_rss_kb"].toDouble(), 0, 'f', 0);
+    out << QString("Mann-Whitney U: z=%1, p=%2\n").arg(z, 0, 'f', 3).arg(p, 0, 'g', 3);
+
+    // 統計的に有意で、かつ中央値の悪化がしきい値を超えたものを劣化とする
+    bool regression = p < alpha && c.p50 > b.p50 * (1.0 + threshold);
+    out << (regression ? "REGRESSION\n" : "OK\n");
+    out.flush();
+
+    return regression ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#ifndef BENCHMARKRUNNER_H
+#define BENCHMARKRUNNER_H
+
+#include <QOpenGLFunctions>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLVertexArrayObject>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QMatrix4x4>
+#include <QVector>
+#include <QString>
+#include "model.h"
+
+// ウィンドウを使わずにFBOへ描画して、決まったカメラパスでフレーム時間を計測する
+class BenchmarkRunner : protected QOpenGLFunctions
+{
+public:
+    struct Config
+    {
+        int models = 4;         // モデル数(N)
+        int triangles = 10000;  // モデル1つあたりの三角形数(M)
+        int instances = 16;     // モデル1つあたりのインスタンス数(K)
+        int frames = 600;       // 計測フレーム数
+        int warmup = 30;        // 計測前に捨てるフレーム数
+        int width = 1280;
+        int height = 720;
+        int samples = 4;
+    };
+
+    struct Summary
+    {
+        double mean = 0.0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    explicit BenchmarkRunner(const Config &config);
+    ~BenchmarkRunner();
+
+    // 計測を行い結果をJSONで返す。失敗した場合は空のオブジェクト
+    QJsonObject run();
+
+    // 2つの結果ファイルを比較する
+    // 戻り値 0: 劣化なし, 1: 有意な劣化あり, 2: 読み込み失敗
+    static int compare(const QString &baseFile, const QString &newFile, double threshold, double alpha);
+
+    static Summary summarize(QVector<double> samples);
+    static qint64 peakRss();
+
+private:
+    bool initializeContext();
+    bool generateScene(double &loadTime);
+    QString writeSphereObj(int index, int division);
+    void renderFrame(int frame);
+    void release();
+
+    Config m_config;
+
+    QOpenGLContext* m_context;
+    QOffscreenSurface* m_surface;
+    QOpenGLFramebufferObject* m_fbo;
+    QOpenGLVertexArrayObject* m_vao;
+
+    QTemporaryDir m_dir;
+    QVector<Model*> m_models;
+    QVector<QVector3D> m_instances;
+    float m_sceneRadius;
+    int m_triangles;        // 実際に生成したモデル1つあたりの三角形数
+
+    QMatrix4x4 m_projectionMatrix;
+    QMatrix4x4 m_viewMatrix;
+};
+
+#endif // BENCHMARKRUNNER_H
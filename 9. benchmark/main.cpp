@@ -1,12 +1,93 @@
 #include "mainwindow.h"
+#include "benchmarkrunner.h"
 
 #include <QApplication>
 #include <QSurfaceFormat>
+#include <QCommandLineParser>
+#include <QJsonDocument>
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
-    return a.exec();
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless rendering benchmark.\n"
+                                     "Use \"-platform offscreen\" (or xvfb-run) on machines without a display.");
+    parser.addHelpOption();
+
+    QCommandLineOption models("models", "Number of models (N).", "N", "4");
+    QCommandLineOption triangles("triangles", "Triangles per model (M).", "M", "10000");
+    QCommandLineOption instances("instances", "Instances per model (K).", "K", "16");
+    QCommandLineOption frames("frames", "Number of measured frames.", "frames", "600");
+    QCommandLineOption warmup("warmup", "Number of warm-up frames.", "frames", "30");
+    QCommandLineOption size("size", "Framebuffer size.", "WxH", "1280x720");
+    QCommandLineOption samples("samples", "MSAA samples.", "samples", "4");
+    QCommandLineOption output("output", "Write the result JSON to file.", "file");
+    QCommandLineOption compare("compare", "Compare two result files <base> <new>.");
+    QCommandLineOption threshold("threshold", "Median slowdown treated as a regression.", "ratio", "0.05");
+    QCommandLineOption alpha("alpha", "Significance level of the comparison.", "alpha", "0.01");
+    QCommandLineOption interactive("interactive", "Open the interactive viewer instead.");
+    parser.addOptions({ models, triangles, instances, frames, warmup, size, samples,
+                        output, compare, threshold, alpha, interactive });
+    parser.addPositionalArgument("files", "Result files for --compare.", "[base new]");
+    parser.process(a);
+
+    // 従来のビューア
+    if (parser.isSet(interactive))
+    {
+        MainWindow w;
+        w.show();
+        return a.exec();
+    }
+
+    // 2つの結果の比較
+    if (parser.isSet(compare))
+    {
+        auto files = parser.positionalArguments();
+        if (files.size() != 2)
+            parser.showHelp(2);
+        return BenchmarkRunner::compare(files.at(0), files.at(1),
+                                        parser.value(threshold).toDouble(),
+                                        parser.value(alpha).toDouble());
+    }
+
+    BenchmarkRunner::Config config;
+    config.models = parser.value(models).toInt();
+    config.triangles = parser.value(triangles).toInt();
+    config.instances = parser.value(instances).toInt();
+    config.frames = qMax(1, parser.value(frames).toInt());
+    config.warmup = parser.value(warmup).toInt();
+    config.samples = parser.value(samples).toInt();
+    auto wh = parser.value(size).split('x');
+    if (wh.size() == 2)
+    {
+        config.width = wh.at(0).toInt();
+        config.height = wh.at(1).toInt();
+    }
+
+    auto result = BenchmarkRunner(config).run();
+    if (result.isEmpty())
+        return 2;
+
+    auto json = QJsonDocument(result).toJson();
+    if (parser.isSet(output))
+    {
+        QFile file(parser.value(output));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "Can't open file";
+            return 2;
+        }
+        file.write(json);
+        file.close();
+    }
+    else
+    {
+        QTextStream(stdout) << json;
+    }
+
+    return 0;
 }